@@ -4,15 +4,22 @@
 
 #include "driver/gpio.h"
 #include "driver/ledc.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
 #include "freertos/task.h"
 #include "esp_log.h"
-#include "oled_ssd1306.h"
+#include "button_gesture.h"
+#include "oled_display.h"
 
 #define BUTTON_GPIO GPIO_NUM_1
 #define BUZZER_GPIO GPIO_NUM_2
 #define DEBOUNCE_MS 30
 #define LONG_PRESS_MS 500
+#define DOUBLE_PRESS_MS 300
+#define BUTTON_QUEUE_LEN 8
+#define BUTTON_BIT_RECORDING BIT0
 #define BUZZER_PULSE_MS 50
 #define BUZZER_FREQ_HZ 2000
 #define BUZZER_DUTY_RES LEDC_TIMER_10_BIT
@@ -22,8 +29,21 @@ static const char *TAG = "button";
 static volatile bool s_paused = false;
 static volatile bool s_recording = false;
 static volatile TickType_t s_record_start_tick = 0;
+static volatile int64_t s_record_press_us = 0;
 static char s_status_line[64] = "Ready";
 
+// Input path: GPIO ISR -> debounce timer -> gesture recognizer (esp_timer task) -> s_events -> button task
+static esp_timer_handle_t s_debounce_timer;
+static esp_timer_handle_t s_long_timer;
+static volatile int64_t s_edge_us;          // First edge of the burst being debounced
+static bool s_pressed;                      // Debounced level, owned by the esp_timer task
+static button_gesture_t s_gesture;          // Owned by the esp_timer task
+static QueueHandle_t s_events;
+static EventGroupHandle_t s_state;          // BUTTON_BIT_RECORDING mirrors s_recording for blocking waiters
+static volatile int64_t s_state_us;         // When the button task last changed the recording state
+static TaskHandle_t s_oled_task_handle;
+static button_stats_t s_stats;
+
 // Logs button state changes to the console.
 static void s_log_info(const char *text)
 {
@@ -40,72 +60,138 @@ static void s_buzzer_pulse(void)
     ledc_update_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0);
 }
 
-// Updates the OLED with timer/status once per second.
+// Updates the OLED with timer/status once per second, and right away when the state changes.
 static void s_oled_task(void *arg)
 {
     (void)arg;
-    char buffer[64];
     while (true) {
         if (s_recording) {
             TickType_t elapsed_ticks = xTaskGetTickCount() - s_record_start_tick;
-            uint32_t elapsed_seconds = (uint32_t)(elapsed_ticks / configTICK_RATE_HZ);
-            uint32_t hours = elapsed_seconds / 3600;
-            uint32_t minutes = (elapsed_seconds % 3600) / 60;
-            uint32_t seconds = elapsed_seconds % 60;
-            const char *line2 = s_paused ? "Paused" : "Recording";
-            snprintf(buffer, sizeof(buffer), "%02lu:%02lu:%02lu\n%s",
-                     (unsigned long)hours,
-                     (unsigned long)minutes,
-                     (unsigned long)seconds,
-                     line2);
-            oled_ssd1306_display_text(buffer);
+            oled_display_post_recording((uint32_t)(elapsed_ticks / configTICK_RATE_HZ), s_paused);
+        } else {
+            oled_display_post(s_status_line);
+        }
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+    }
+}
+
+// Returns whether the button is down; it pulls the pin low.
+static bool s_read_pressed(void)
+{
+    return gpio_get_level(BUTTON_GPIO) == 0;
+}
+
+// Raises a stored maximum.
+static void s_update_max(uint32_t *max, int64_t value)
+{
+    if (value > (int64_t)*max) {
+        *max = (value > UINT32_MAX) ? UINT32_MAX : (uint32_t)value;
+    }
+}
+
+// Hands a recognized gesture to the button task.
+static void s_send(const button_event_t *evt)
+{
+    if (xQueueSend(s_events, evt, 0) != pdTRUE) {
+        s_stats.dropped++;
+    }
+}
+
+// GPIO edge: masks the pin for the debounce window and timestamps the first edge of the burst.
+static void s_button_isr(void *arg)
+{
+    (void)arg;
+    gpio_intr_disable(BUTTON_GPIO);
+    s_edge_us = esp_timer_get_time();
+    esp_timer_start_once(s_debounce_timer, DEBOUNCE_MS * 1000);
+}
+
+// Debounce timer: the pin has had DEBOUNCE_MS to settle since the first edge, so its level now is the new state.
+static void s_debounce_cb(void *arg)
+{
+    (void)arg;
+    const bool pressed = s_read_pressed();
+    if (pressed == s_pressed) {
+        s_stats.glitches++;
+    } else {
+        s_pressed = pressed;
+        if (pressed) {
+            // The long press is reported while the button is still held
+            const int64_t remaining_us = s_edge_us + LONG_PRESS_MS * 1000LL - esp_timer_get_time();
+            esp_timer_start_once(s_long_timer, (remaining_us > 0) ? (uint64_t)remaining_us : 1);
         } else {
-            oled_ssd1306_display_text(s_status_line);
+            esp_timer_stop(s_long_timer);
         }
-        vTaskDelay(pdMS_TO_TICKS(1000));
+        button_event_t evt;
+        if (button_gesture_edge(&s_gesture, pressed, s_edge_us, &evt)) {
+            s_send(&evt);
+        }
+    }
+    gpio_intr_enable(BUTTON_GPIO);
+    // An edge between the read above and the enable raised no interrupt
+    if (s_read_pressed() != s_pressed) {
+        s_button_isr(NULL);
     }
 }
 
-// Handles debounced button presses and toggles recording state.
+// Long-press timer: the button has been held for LONG_PRESS_MS.
+static void s_long_cb(void *arg)
+{
+    (void)arg;
+    button_event_t evt;
+    if (button_gesture_poll(&s_gesture, esp_timer_get_time(), &evt)) {
+        s_send(&evt);
+    }
+}
+
+// Publishes a recording state change to blocked waiters and the OLED task.
+static void s_publish_state(void)
+{
+    s_state_us = esp_timer_get_time();
+    if (s_recording) {
+        xEventGroupSetBits(s_state, BUTTON_BIT_RECORDING);
+    } else {
+        xEventGroupClearBits(s_state, BUTTON_BIT_RECORDING);
+    }
+    xTaskNotifyGive(s_oled_task_handle);
+}
+
+// Applies button events to the recording state: long press starts or stops, short and double presses pause.
 static void s_button_task(void *arg)
 {
     (void)arg;
-    bool last_level = true;
-    TickType_t press_tick = 0;
+    button_event_t evt;
 
     while (true) {
-        bool level = gpio_get_level(BUTTON_GPIO);
-        if (level != last_level) {
-            vTaskDelay(pdMS_TO_TICKS(DEBOUNCE_MS));
-            level = gpio_get_level(BUTTON_GPIO);
-            if (level != last_level) {
-                last_level = level;
-                if (!level) {
-                    press_tick = xTaskGetTickCount();
-                } else {
-                    TickType_t held = xTaskGetTickCount() - press_tick;
-                    if (held >= pdMS_TO_TICKS(LONG_PRESS_MS)) {
-                        if (s_recording) {
-                            s_recording = false;
-                            s_paused = false;
-                            s_log_info("Recording stopped");
-                        } else {
-                            s_recording = true;
-                            s_paused = false;
-                            s_record_start_tick = xTaskGetTickCount();
-                            s_log_info("Recording started");
-                        }
-                    } else {
-                        if (s_recording) {
-                            s_paused = !s_paused;
-                            s_log_info(s_paused ? "Paused" : "Recording");
-                        }
-                    }
-                    s_buzzer_pulse();
-                }
+        xQueueReceive(s_events, &evt, portMAX_DELAY);
+        if (evt.type == BUTTON_EVENT_LONG) {
+            s_stats.longs++;
+            if (s_recording) {
+                s_recording = false;
+                s_paused = false;
+                s_log_info("Recording stopped");
+            } else {
+                s_record_press_us = evt.press_us;
+                s_recording = true;
+                s_paused = false;
+                s_record_start_tick = xTaskGetTickCount();
+                s_log_info("Recording started");
+            }
+        } else {
+            // The first press of a double already toggled, so the second one toggles back as before
+            if (evt.type == BUTTON_EVENT_DOUBLE) {
+                s_stats.doubles++;
+            } else {
+                s_stats.shorts++;
+            }
+            if (s_recording) {
+                s_paused = !s_paused;
+                s_log_info(s_paused ? "Paused" : "Recording");
             }
         }
-        vTaskDelay(pdMS_TO_TICKS(10));
+        s_publish_state();
+        s_update_max(&s_stats.action_max_us, esp_timer_get_time() - evt.at_us);
+        s_buzzer_pulse();
     }
 }
 
@@ -117,7 +203,7 @@ void button_init(void)
         .mode = GPIO_MODE_INPUT,
         .pull_up_en = GPIO_PULLUP_ENABLE,
         .pull_down_en = GPIO_PULLDOWN_DISABLE,
-        .intr_type = GPIO_INTR_DISABLE,
+        .intr_type = GPIO_INTR_ANYEDGE,
     };
     gpio_config(&cfg);
 
@@ -141,8 +227,35 @@ void button_init(void)
     };
     ledc_channel_config(&buzzer_channel);
 
+    s_events = xQueueCreate(BUTTON_QUEUE_LEN, sizeof(button_event_t));
+    s_state = xEventGroupCreate();
+    const esp_timer_create_args_t debounce_args = {
+        .callback = s_debounce_cb,
+        .name = "button_debounce",
+    };
+    const esp_timer_create_args_t long_args = {
+        .callback = s_long_cb,
+        .name = "button_long",
+    };
+    if (s_events == NULL || s_state == NULL || esp_timer_create(&debounce_args, &s_debounce_timer) != ESP_OK ||
+            esp_timer_create(&long_args, &s_long_timer) != ESP_OK) {
+        ESP_LOGE(TAG, "Button init failed");
+        return;
+    }
+    button_gesture_init(&s_gesture, LONG_PRESS_MS, DOUBLE_PRESS_MS);
+    s_pressed = s_read_pressed();
+
     xTaskCreate(s_button_task, "button_task", 2048, NULL, 10, NULL);
-    xTaskCreate(s_oled_task, "oled_task", 2048, NULL, 5, NULL);
+    xTaskCreate(s_oled_task, "oled_task", 2048, NULL, 5, &s_oled_task_handle);
+
+    // The ISR service may already be installed by another component
+    esp_err_t ret = gpio_install_isr_service(0);
+    if (ret == ESP_OK || ret == ESP_ERR_INVALID_STATE) {
+        ret = gpio_isr_handler_add(BUTTON_GPIO, s_button_isr, NULL);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Button interrupt setup failed (%s)", esp_err_to_name(ret));
+    }
 }
 
 // Sets the idle OLED display lines shown when not recording.
@@ -168,3 +281,29 @@ bool button_is_recording(void)
 {
     return s_recording;
 }
+
+// Returns the esp_timer time of the press that started the current recording, 0 before the first one.
+int64_t button_get_record_press_us(void)
+{
+    return s_record_press_us;
+}
+
+// Blocks until a recording is active or the timeout passes. Returns whether recording.
+bool button_wait_recording(TickType_t timeout)
+{
+    if (xEventGroupGetBits(s_state) & BUTTON_BIT_RECORDING) {
+        return true;
+    }
+    const EventBits_t bits = xEventGroupWaitBits(s_state, BUTTON_BIT_RECORDING, pdFALSE, pdTRUE, timeout);
+    if ((bits & BUTTON_BIT_RECORDING) == 0) {
+        return false;
+    }
+    s_update_max(&s_stats.wake_max_us, esp_timer_get_time() - s_state_us);
+    return true;
+}
+
+// Copies the input counters since boot.
+void button_get_stats(button_stats_t *out)
+{
+    *out = s_stats;
+}
@@ -1,8 +1,27 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+
+// Button input counters since boot. action_max_us runs from the moment a press became a gesture to the recording
+// state change: from the release edge for short and double presses, so it includes the debounce window, and from
+// the long-press threshold for long presses. wake_max_us runs from the state change to a blocked
+// button_wait_recording() caller running again.
+typedef struct {
+    uint32_t shorts;
+    uint32_t longs;
+    uint32_t doubles;
+    uint32_t glitches;           // Edges that settled back to the level they started from
+    uint32_t dropped;            // Events lost to a full queue
+    uint32_t action_max_us;
+    uint32_t wake_max_us;
+} button_stats_t;
 
 void button_init(void);
 bool button_is_paused(void);
 bool button_is_recording(void);
+int64_t button_get_record_press_us(void);
+bool button_wait_recording(TickType_t timeout);
+void button_get_stats(button_stats_t *out);
 void button_set_idle_display(const char *line1, const char *line2);
@@ -0,0 +1,59 @@
+#include "button_gesture.h"
+
+#include <string.h>
+
+// Resets the recognizer with the button released.
+void button_gesture_init(button_gesture_t *gesture, uint32_t long_ms, uint32_t double_ms)
+{
+    memset(gesture, 0, sizeof(*gesture));
+    gesture->long_us = (int64_t)long_ms * 1000;
+    gesture->double_us = (int64_t)double_ms * 1000;
+}
+
+// Feeds one debounced edge. Returns true and fills out when it completes a short or double press.
+bool button_gesture_edge(button_gesture_t *gesture, bool pressed, int64_t edge_us, button_event_t *out)
+{
+    if (pressed) {
+        gesture->down = true;
+        gesture->long_sent = false;
+        gesture->press_us = edge_us;
+        return false;
+    }
+    // A release without a press, e.g. the button was held at boot
+    if (!gesture->down) {
+        return false;
+    }
+    gesture->down = false;
+    if (gesture->long_sent) {
+        return false;
+    }
+    // Held past the threshold but released before button_gesture_poll() saw it
+    if (edge_us - gesture->press_us >= gesture->long_us) {
+        gesture->click_pending = false;
+        out->type = BUTTON_EVENT_LONG;
+        out->press_us = gesture->press_us;
+        out->at_us = gesture->press_us + gesture->long_us;
+        return true;
+    }
+    const bool second = gesture->click_pending && gesture->press_us - gesture->release_us <= gesture->double_us;
+    gesture->click_pending = !second;
+    gesture->release_us = edge_us;
+    out->type = second ? BUTTON_EVENT_DOUBLE : BUTTON_EVENT_SHORT;
+    out->press_us = gesture->press_us;
+    out->at_us = edge_us;
+    return true;
+}
+
+// Checks the held button against the long-press threshold. Returns true and fills out once per long press.
+bool button_gesture_poll(button_gesture_t *gesture, int64_t now_us, button_event_t *out)
+{
+    if (!gesture->down || gesture->long_sent || now_us - gesture->press_us < gesture->long_us) {
+        return false;
+    }
+    gesture->long_sent = true;
+    gesture->click_pending = false;
+    out->type = BUTTON_EVENT_LONG;
+    out->press_us = gesture->press_us;
+    out->at_us = gesture->press_us + gesture->long_us;
+    return true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Turns debounced press/release edges into short, long and double presses. A long press is reported while the
+// button is still held, as soon as it has been down for long_us; a short press on release; a second short press
+// that starts within double_us of the previous release is reported as a double press instead.
+// Depends only on the C library so it can be tested on a host.
+
+typedef enum {
+    BUTTON_EVENT_NONE = 0,
+    BUTTON_EVENT_SHORT,
+    BUTTON_EVENT_LONG,
+    BUTTON_EVENT_DOUBLE,
+} button_event_type_t;
+
+typedef struct {
+    button_event_type_t type;
+    int64_t press_us;            // Capture time of the press edge
+    int64_t at_us;               // When the press became a gesture: the release edge, or the long-press threshold
+} button_event_t;
+
+typedef struct {
+    int64_t long_us;
+    int64_t double_us;
+    bool down;
+    bool long_sent;              // The current press was already reported as long
+    bool click_pending;          // The previous press was short and may become a double
+    int64_t press_us;
+    int64_t release_us;
+} button_gesture_t;
+
+void button_gesture_init(button_gesture_t *gesture, uint32_t long_ms, uint32_t double_ms);
+bool button_gesture_edge(button_gesture_t *gesture, bool pressed, int64_t edge_us, button_event_t *out);
+bool button_gesture_poll(button_gesture_t *gesture, int64_t now_us, button_event_t *out);
@@ -0,0 +1,124 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "button_gesture.h"
+#include "host_test.h"
+
+// button_gesture fed edge and poll times the way the debounce and long-press timers in button.c feed it, with the
+// thresholds button.c uses. Checks which gesture each sequence makes, the edges of each threshold, and the times
+// an event carries, which the action latency in button_get_stats() counts from.
+
+#define LONG_MS   500
+#define DOUBLE_MS 300
+#define MS        1000LL
+
+static button_gesture_t s_g;
+
+// Feeds an edge; returns the event type it completed, BUTTON_EVENT_NONE for none.
+static button_event_type_t s_edge(bool pressed, int64_t at_us, button_event_t *evt)
+{
+    button_event_t tmp;
+    if (evt == NULL) {
+        evt = &tmp;
+    }
+    return button_gesture_edge(&s_g, pressed, at_us, evt) ? evt->type : BUTTON_EVENT_NONE;
+}
+
+// A press and release; returns the event the release completed.
+static button_event_type_t s_click(int64_t press_us, int64_t release_us, button_event_t *evt)
+{
+    TEST_CHECK(s_edge(true, press_us, NULL) == BUTTON_EVENT_NONE);
+    return s_edge(false, release_us, evt);
+}
+
+// A release completes a short press, stamped with both edges.
+static void s_test_short(void)
+{
+    button_gesture_init(&s_g, LONG_MS, DOUBLE_MS);
+    button_event_t evt;
+    TEST_CHECK(s_click(1000 * MS, 1100 * MS, &evt) == BUTTON_EVENT_SHORT);
+    TEST_CHECK(evt.press_us == 1000 * MS && evt.at_us == 1100 * MS);
+}
+
+// The long press comes from the poll while the button is held, once, at the threshold; the release adds nothing.
+static void s_test_long_held(void)
+{
+    button_gesture_init(&s_g, LONG_MS, DOUBLE_MS);
+    button_event_t evt;
+    TEST_CHECK(s_edge(true, 1000 * MS, NULL) == BUTTON_EVENT_NONE);
+    TEST_CHECK(!button_gesture_poll(&s_g, 1000 * MS + LONG_MS * MS - 1, &evt));
+    TEST_CHECK(button_gesture_poll(&s_g, 1000 * MS + LONG_MS * MS + 40, &evt));
+    TEST_CHECK(evt.type == BUTTON_EVENT_LONG && evt.press_us == 1000 * MS && evt.at_us == 1000 * MS + LONG_MS * MS);
+    TEST_CHECK(!button_gesture_poll(&s_g, 2000 * MS, &evt));
+    TEST_CHECK(s_edge(false, 2500 * MS, NULL) == BUTTON_EVENT_NONE);
+    TEST_CHECK(!button_gesture_poll(&s_g, 3000 * MS, &evt));
+}
+
+// A release at or past the threshold before any poll is still a long press, dated at the threshold; one just
+// under it is short.
+static void s_test_long_released(void)
+{
+    button_gesture_init(&s_g, LONG_MS, DOUBLE_MS);
+    button_event_t evt;
+    TEST_CHECK(s_click(1000 * MS, 1000 * MS + LONG_MS * MS, &evt) == BUTTON_EVENT_LONG);
+    TEST_CHECK(evt.press_us == 1000 * MS && evt.at_us == 1000 * MS + LONG_MS * MS);
+    TEST_CHECK(s_click(5000 * MS, 5000 * MS + LONG_MS * MS - 1, &evt) == BUTTON_EVENT_SHORT);
+    TEST_CHECK(evt.at_us == 5000 * MS + LONG_MS * MS - 1);
+}
+
+// A second press that starts within DOUBLE_MS of the previous release makes a double, a later one another short.
+// The double consumes the pair, so a third quick press is short again.
+static void s_test_double(void)
+{
+    button_gesture_init(&s_g, LONG_MS, DOUBLE_MS);
+    button_event_t evt;
+    TEST_CHECK(s_click(1000 * MS, 1080 * MS, NULL) == BUTTON_EVENT_SHORT);
+    TEST_CHECK(s_click(1080 * MS + DOUBLE_MS * MS, 1500 * MS, &evt) == BUTTON_EVENT_DOUBLE);
+    TEST_CHECK(evt.press_us == 1080 * MS + DOUBLE_MS * MS && evt.at_us == 1500 * MS);
+    TEST_CHECK(s_click(1600 * MS, 1650 * MS, NULL) == BUTTON_EVENT_SHORT);
+
+    TEST_CHECK(s_click(3000 * MS, 3080 * MS, NULL) == BUTTON_EVENT_SHORT);
+    TEST_CHECK(s_click(3080 * MS + DOUBLE_MS * MS + 1, 3500 * MS, NULL) == BUTTON_EVENT_SHORT);
+    // The press above still counts as the first of a pair
+    TEST_CHECK(s_click(3600 * MS, 3650 * MS, NULL) == BUTTON_EVENT_DOUBLE);
+}
+
+// A long press in between cancels a pending double, whether the poll or the release reported it.
+static void s_test_long_cancels_double(void)
+{
+    button_gesture_init(&s_g, LONG_MS, DOUBLE_MS);
+    button_event_t evt;
+    TEST_CHECK(s_click(1000 * MS, 1050 * MS, NULL) == BUTTON_EVENT_SHORT);
+    TEST_CHECK(s_edge(true, 1100 * MS, NULL) == BUTTON_EVENT_NONE);
+    TEST_CHECK(button_gesture_poll(&s_g, 1100 * MS + LONG_MS * MS, &evt) && evt.type == BUTTON_EVENT_LONG);
+    TEST_CHECK(s_edge(false, 1700 * MS, NULL) == BUTTON_EVENT_NONE);
+    TEST_CHECK(s_click(1750 * MS, 1800 * MS, NULL) == BUTTON_EVENT_SHORT);
+
+    TEST_CHECK(s_click(3000 * MS, 3050 * MS, NULL) == BUTTON_EVENT_SHORT);
+    TEST_CHECK(s_click(3100 * MS, 3700 * MS, NULL) == BUTTON_EVENT_LONG);
+    TEST_CHECK(s_click(3750 * MS, 3800 * MS, NULL) == BUTTON_EVENT_SHORT);
+}
+
+// A release with no press before it, e.g. the button held at boot, and a poll with the button up report nothing.
+static void s_test_stray(void)
+{
+    button_gesture_init(&s_g, LONG_MS, DOUBLE_MS);
+    button_event_t evt;
+    TEST_CHECK(!button_gesture_poll(&s_g, 10000 * MS, &evt));
+    TEST_CHECK(s_edge(false, 10000 * MS, NULL) == BUTTON_EVENT_NONE);
+    TEST_CHECK(s_click(11000 * MS, 11100 * MS, NULL) == BUTTON_EVENT_SHORT);
+    TEST_CHECK(s_edge(false, 11200 * MS, NULL) == BUTTON_EVENT_NONE);
+    TEST_CHECK(!button_gesture_poll(&s_g, 20000 * MS, &evt));
+}
+
+int main(void)
+{
+    s_test_short();
+    s_test_long_held();
+    s_test_long_released();
+    s_test_double();
+    s_test_long_cancels_double();
+    s_test_stray();
+    printf("button gesture: all checks passed\n");
+    return 0;
+}
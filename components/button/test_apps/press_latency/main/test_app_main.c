@@ -0,0 +1,27 @@
+#include <stdio.h>
+#include "unity.h"
+#include "unity_test_runner.h"
+#include "unity_test_utils_memory.h"
+
+#include "button.h"
+
+/* setUp runs before every test */
+void setUp(void)
+{
+    unity_utils_record_free_mem();
+}
+
+/* tearDown runs after every test */
+void tearDown(void)
+{
+    unity_utils_evaluate_leaks();
+}
+
+void app_main(void)
+{
+    printf("button: press latency with the pin driven by the test\n");
+    // Its tasks, queue and timers live for the whole run, so they are created before the leak checks start
+    button_init();
+    unity_utils_setup_heap_record(80);
+    unity_run_menu();
+}
@@ -0,0 +1,227 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "driver/gpio.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "unity.h"
+
+#include "button.h"
+
+// The button path on the chip, from the pin to the recording state: the test drives the button pin as
+// INPUT_OUTPUT, so the GPIO interrupt, the debounce and long-press timers and the button task all run as they do
+// for a real press. Each case prints one [perf] line, min/avg/max over its presses.
+
+// Same as button.c
+#define TEST_BUTTON_GPIO   GPIO_NUM_1
+#define TEST_DEBOUNCE_MS   30
+#define TEST_LONG_MS       500
+#define TEST_DOUBLE_MS     300
+
+#define TEST_ROUNDS        10
+#define TEST_SHORT_HOLD_MS 100
+// Between presses: past the double-press window and the 50 ms beep the button task plays after each event
+#define TEST_GAP_MS        (TEST_DOUBLE_MS + 100)
+#define TEST_TIMEOUT_US    (1000 * 1000LL)
+
+typedef struct {
+    int64_t min_us;
+    int64_t max_us;
+    int64_t sum_us;
+    uint32_t count;
+} latency_t;
+
+static bool s_driving;
+
+// Adds one measurement.
+static void s_latency_add(latency_t *t, int64_t us)
+{
+    if (t->count == 0 || us < t->min_us) {
+        t->min_us = us;
+    }
+    if (t->count == 0 || us > t->max_us) {
+        t->max_us = us;
+    }
+    t->sum_us += us;
+    t->count++;
+}
+
+static void s_latency_print(const char *what, const latency_t *t)
+{
+    TEST_ASSERT_GREATER_THAN(0, t->count);
+    printf("[perf] button, %s: min %lld us, avg %lld us, max %lld us over %lu\n", what, (long long)t->min_us,
+           (long long)(t->sum_us / t->count), (long long)t->max_us, (unsigned long)t->count);
+}
+
+// Takes over the button pin once: released level first, then output on top of the input button.c reads.
+static void s_drive_begin(void)
+{
+    if (s_driving) {
+        return;
+    }
+    TEST_ESP_OK(gpio_set_level(TEST_BUTTON_GPIO, 1));
+    TEST_ESP_OK(gpio_set_direction(TEST_BUTTON_GPIO, GPIO_MODE_INPUT_OUTPUT));
+    s_driving = true;
+    vTaskDelay(pdMS_TO_TICKS(TEST_GAP_MS));
+}
+
+// Drives the pin to pressed (low) or released; returns the time of the edge.
+static int64_t s_set_pressed(bool pressed)
+{
+    const int64_t now_us = esp_timer_get_time();
+    TEST_ESP_OK(gpio_set_level(TEST_BUTTON_GPIO, pressed ? 0 : 1));
+    return now_us;
+}
+
+// Spins until the recording state reads want; returns when it did, or -1 after TEST_TIMEOUT_US. The test task
+// is below the button task, so spinning does not hold it up.
+static int64_t s_wait_recording(bool want)
+{
+    const int64_t deadline_us = esp_timer_get_time() + TEST_TIMEOUT_US;
+    while (esp_timer_get_time() < deadline_us) {
+        if (button_is_recording() == want) {
+            return esp_timer_get_time();
+        }
+    }
+    return -1;
+}
+
+// The same for the pause state.
+static int64_t s_wait_paused(bool want)
+{
+    const int64_t deadline_us = esp_timer_get_time() + TEST_TIMEOUT_US;
+    while (esp_timer_get_time() < deadline_us) {
+        if (button_is_paused() == want) {
+            return esp_timer_get_time();
+        }
+    }
+    return -1;
+}
+
+// Stops a recording left running by an earlier case, with one long press.
+static void s_ensure_stopped(void)
+{
+    if (!button_is_recording()) {
+        return;
+    }
+    s_set_pressed(true);
+    TEST_ASSERT_TRUE(s_wait_recording(false) > 0);
+    s_set_pressed(false);
+    vTaskDelay(pdMS_TO_TICKS(TEST_GAP_MS));
+}
+
+TEST_CASE("Long press starts and stops recording while held", "[button]")
+{
+    s_drive_begin();
+    s_ensure_stopped();
+    button_stats_t before;
+    button_get_stats(&before);
+    latency_t start = {0};
+    latency_t stop = {0};
+    for (int round = 0; round < TEST_ROUNDS; round++) {
+        // Start: button_wait_recording() returns in this task, as it does in app_main; timed from the threshold
+        int64_t press_us = s_set_pressed(true);
+        TEST_ASSERT_TRUE(button_wait_recording(pdMS_TO_TICKS(TEST_LONG_MS + 500)));
+        const int64_t started_us = esp_timer_get_time();
+        // The press that started it is the edge the ISR stamped, a few microseconds after this task drove it
+        const int64_t stamped_us = button_get_record_press_us();
+        TEST_ASSERT_TRUE(stamped_us >= press_us);
+        TEST_ASSERT_TRUE(stamped_us < press_us + 1000);
+        TEST_ASSERT_TRUE(started_us >= press_us + TEST_LONG_MS * 1000LL);
+        s_latency_add(&start, started_us - (press_us + TEST_LONG_MS * 1000LL));
+        vTaskDelay(pdMS_TO_TICKS(TEST_LONG_MS / 2));
+        s_set_pressed(false);
+        vTaskDelay(pdMS_TO_TICKS(TEST_GAP_MS));
+        TEST_ASSERT_TRUE(button_is_recording());
+
+        // Stop: the state flips while the button is still down
+        press_us = s_set_pressed(true);
+        const int64_t stopped_us = s_wait_recording(false);
+        TEST_ASSERT_TRUE(stopped_us >= press_us + TEST_LONG_MS * 1000LL);
+        s_latency_add(&stop, stopped_us - (press_us + TEST_LONG_MS * 1000LL));
+        s_set_pressed(false);
+        vTaskDelay(pdMS_TO_TICKS(TEST_GAP_MS));
+        TEST_ASSERT_FALSE(button_is_recording());
+    }
+    button_stats_t after;
+    button_get_stats(&after);
+    TEST_ASSERT_EQUAL_UINT32(before.longs + 2 * TEST_ROUNDS, after.longs);
+    TEST_ASSERT_EQUAL_UINT32(before.shorts, after.shorts);
+    TEST_ASSERT_EQUAL_UINT32(before.glitches, after.glitches);
+    TEST_ASSERT_EQUAL_UINT32(before.dropped, after.dropped);
+    s_latency_print("long press threshold to app wake, start", &start);
+    s_latency_print("long press threshold to state change, stop", &stop);
+    printf("[perf] button, stats: event to action max %lu us, app wake max %lu us\n",
+           (unsigned long)after.action_max_us, (unsigned long)after.wake_max_us);
+}
+
+TEST_CASE("Short press pauses and resumes on release", "[button]")
+{
+    s_drive_begin();
+    s_ensure_stopped();
+    // Start a recording to pause
+    s_set_pressed(true);
+    TEST_ASSERT_TRUE(button_wait_recording(pdMS_TO_TICKS(TEST_LONG_MS + 500)));
+    s_set_pressed(false);
+    vTaskDelay(pdMS_TO_TICKS(TEST_GAP_MS));
+    TEST_ASSERT_FALSE(button_is_paused());
+
+    button_stats_t before;
+    button_get_stats(&before);
+    latency_t pause = {0};
+    for (int round = 0; round < 2 * TEST_ROUNDS; round++) {
+        const bool paused = button_is_paused();
+        s_set_pressed(true);
+        vTaskDelay(pdMS_TO_TICKS(TEST_SHORT_HOLD_MS));
+        // Nothing happens until the release
+        TEST_ASSERT_EQUAL(paused, button_is_paused());
+        const int64_t release_us = s_set_pressed(false);
+        const int64_t toggled_us = s_wait_paused(!paused);
+        TEST_ASSERT_TRUE(toggled_us > 0);
+        // The release is only read once the debounce window has passed
+        TEST_ASSERT_TRUE(toggled_us >= release_us + TEST_DEBOUNCE_MS * 1000LL);
+        s_latency_add(&pause, toggled_us - release_us);
+        vTaskDelay(pdMS_TO_TICKS(TEST_GAP_MS));
+    }
+    button_stats_t after;
+    button_get_stats(&after);
+    TEST_ASSERT_EQUAL_UINT32(before.shorts + 2 * TEST_ROUNDS, after.shorts);
+    TEST_ASSERT_EQUAL_UINT32(before.doubles, after.doubles);
+    TEST_ASSERT_EQUAL_UINT32(before.glitches, after.glitches);
+    TEST_ASSERT_FALSE(button_is_paused());
+    s_latency_print("short press release to pause toggle, 30 ms debounce included", &pause);
+    s_ensure_stopped();
+}
+
+TEST_CASE("Second press within the double window toggles pause back", "[button]")
+{
+    s_drive_begin();
+    s_ensure_stopped();
+    s_set_pressed(true);
+    TEST_ASSERT_TRUE(button_wait_recording(pdMS_TO_TICKS(TEST_LONG_MS + 500)));
+    s_set_pressed(false);
+    vTaskDelay(pdMS_TO_TICKS(TEST_GAP_MS));
+
+    button_stats_t before;
+    button_get_stats(&before);
+    for (int round = 0; round < TEST_ROUNDS; round++) {
+        s_set_pressed(true);
+        vTaskDelay(pdMS_TO_TICKS(TEST_SHORT_HOLD_MS));
+        s_set_pressed(false);
+        TEST_ASSERT_TRUE(s_wait_paused(true) > 0);
+        // Second press well inside the window, after the first release has been debounced
+        vTaskDelay(pdMS_TO_TICKS(TEST_DEBOUNCE_MS + 50));
+        s_set_pressed(true);
+        vTaskDelay(pdMS_TO_TICKS(TEST_SHORT_HOLD_MS));
+        s_set_pressed(false);
+        TEST_ASSERT_TRUE(s_wait_paused(false) > 0);
+        vTaskDelay(pdMS_TO_TICKS(TEST_GAP_MS));
+    }
+    button_stats_t after;
+    button_get_stats(&after);
+    TEST_ASSERT_EQUAL_UINT32(before.shorts + TEST_ROUNDS, after.shorts);
+    TEST_ASSERT_EQUAL_UINT32(before.doubles + TEST_ROUNDS, after.doubles);
+    s_ensure_stopped();
+}
@@ -0,0 +1,6 @@
+import pytest
+from pytest_embedded_idf.dut import IdfDut
+
+@pytest.mark.esp32s3
+def test_button_press_latency(dut: IdfDut) -> None:
+    dut.run_all_single_board_cases(group=['button']) # Run all test cases in the 'button' group
@@ -0,0 +1,792 @@
+#include "rec_catalog.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CATALOG_RECORD_BYTES   64
+#define CATALOG_BATCH          8            // Records per read, one 512-byte sector
+#define CATALOG_RECORD_MAGIC   0x32455243u  // "CRE2"
+#define CATALOG_SNAP_MAGIC     0x32534e43u  // "CNS2"
+#define CATALOG_CRC_OFFSET     (CATALOG_RECORD_BYTES - 4)
+
+// Stores a 16-bit little-endian value.
+static void s_put_le16(uint8_t *p, uint16_t value)
+{
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+}
+
+// Stores a 32-bit little-endian value.
+static void s_put_le32(uint8_t *p, uint32_t value)
+{
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = (value >> 24) & 0xff;
+}
+
+// Stores a 64-bit little-endian value.
+static void s_put_le64(uint8_t *p, uint64_t value)
+{
+    s_put_le32(p, (uint32_t)value);
+    s_put_le32(p + 4, (uint32_t)(value >> 32));
+}
+
+// Loads a 16-bit little-endian value.
+static uint16_t s_get_le16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+// Loads a 32-bit little-endian value.
+static uint32_t s_get_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Loads a 64-bit little-endian value.
+static uint64_t s_get_le64(const uint8_t *p)
+{
+    return (uint64_t)s_get_le32(p) | ((uint64_t)s_get_le32(p + 4) << 32);
+}
+
+// CRC-32 (IEEE, reflected), bit by bit; records are only 60 bytes.
+static uint32_t s_crc32(const uint8_t *data, size_t len)
+{
+    uint32_t crc = 0xffffffffu;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xedb88320u & (0u - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+// Seals a record with its CRC.
+static void s_seal(uint8_t *r)
+{
+    s_put_le32(r + CATALOG_CRC_OFFSET, s_crc32(r, CATALOG_CRC_OFFSET));
+}
+
+// True if the record is intact and of the expected kind; torn writes fail here.
+static bool s_valid(const uint8_t *r, uint32_t magic)
+{
+    return s_get_le32(r) == magic && s_get_le32(r + CATALOG_CRC_OFFSET) == s_crc32(r, CATALOG_CRC_OFFSET);
+}
+
+// File extension of a container.
+static const char *s_ext(uint8_t container)
+{
+    switch (container) {
+    case REC_CATALOG_WAV:
+        return ".wav";
+    case REC_CATALOG_FLAC:
+        return ".flac";
+    case REC_CATALOG_OPUS:
+        return ".opus";
+    default:
+        return ".raw";
+    }
+}
+
+// Maps a file extension to its container.
+static rec_catalog_container_t s_container(const char *ext)
+{
+    if (strcasecmp(ext, ".flac") == 0) {
+        return REC_CATALOG_FLAC;
+    }
+    if (strcasecmp(ext, ".opus") == 0) {
+        return REC_CATALOG_OPUS;
+    }
+    if (strcasecmp(ext, ".wav") == 0) {
+        return REC_CATALOG_WAV;
+    }
+    return REC_CATALOG_RAW;
+}
+
+// Fills in the file name, which follows from the index and container.
+static void s_name(rec_catalog_entry_t *e)
+{
+    snprintf(e->name, sizeof(e->name), REC_CATALOG_PREFIX "%04lu%s", (unsigned long)e->index, s_ext(e->container));
+}
+
+// Serializes an entry as one record.
+static void s_encode(uint8_t *r, uint32_t seq, const rec_catalog_entry_t *e)
+{
+    memset(r, 0, CATALOG_RECORD_BYTES);
+    s_put_le32(r, CATALOG_RECORD_MAGIC);
+    s_put_le32(r + 4, seq);
+    s_put_le32(r + 8, e->index);
+    r[12] = e->state;
+    r[13] = e->container;
+    s_put_le16(r + 14, e->segments);
+    s_put_le32(r + 16, e->sample_rate_hz);
+    s_put_le32(r + 20, e->seconds);
+    s_put_le64(r + 24, e->bytes);
+    s_put_le64(r + 32, (uint64_t)e->start_time);
+    s_put_le16(r + 40, e->slot);
+    memcpy(r + 42, e->dir, REC_CATALOG_DIR_MAX - 1);
+    s_seal(r);
+}
+
+// Parses a record that passed s_valid(); returns its sequence number.
+static uint32_t s_decode(const uint8_t *r, rec_catalog_entry_t *e)
+{
+    memset(e, 0, sizeof(*e));
+    e->index = s_get_le32(r + 8);
+    e->state = r[12];
+    e->container = r[13];
+    e->segments = s_get_le16(r + 14);
+    e->sample_rate_hz = s_get_le32(r + 16);
+    e->seconds = s_get_le32(r + 20);
+    e->bytes = s_get_le64(r + 24);
+    e->start_time = (int64_t)s_get_le64(r + 32);
+    e->slot = s_get_le16(r + 40);
+    memcpy(e->dir, r + 42, REC_CATALOG_DIR_MAX - 1);
+    s_name(e);
+    return s_get_le32(r + 4);
+}
+
+// Writes all of buf; returns 0 on success, -1 on error.
+static int s_write_all(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Returns the log copy of a recording, or NULL if the log does not mention it.
+static rec_catalog_entry_t *s_tail_find(const rec_catalog_t *cat, uint32_t index)
+{
+    for (size_t i = 0; i < cat->tail_count; i++) {
+        if (cat->tail[i].index == index) {
+            return (rec_catalog_entry_t *)&cat->tail[i];
+        }
+    }
+    return NULL;
+}
+
+// Folds a log record into the in-memory tail; later records for a recording replace earlier ones.
+static int s_tail_apply(rec_catalog_t *cat, const rec_catalog_entry_t *e)
+{
+    rec_catalog_entry_t *slot = s_tail_find(cat, e->index);
+    if (slot == NULL) {
+        if (cat->tail_count == REC_CATALOG_LOG_MAX) {
+            return -1;
+        }
+        slot = &cat->tail[cat->tail_count++];
+    }
+    *slot = *e;
+    if (e->index + 1 >= cat->next_index) {
+        cat->next_index = e->index + 1;
+        memcpy(cat->cur_dir, e->dir, sizeof(cat->cur_dir));
+        cat->cur_slot = e->slot;
+    }
+    return 0;
+}
+
+// Reads snapshot record i (0 is the first recording); returns 0 if it is intact.
+static int s_read_record(int fd, uint32_t i, rec_catalog_entry_t *e)
+{
+    uint8_t r[CATALOG_RECORD_BYTES];
+    const off_t off = (off_t)(i + 1) * CATALOG_RECORD_BYTES;
+    if (lseek(fd, off, SEEK_SET) != off || read(fd, r, sizeof(r)) != (ssize_t)sizeof(r) ||
+            !s_valid(r, CATALOG_RECORD_MAGIC)) {
+        return -1;
+    }
+    s_decode(r, e);
+    return 0;
+}
+
+// Reads the snapshot header and its newest recording; returns 0 if the header is intact.
+static int s_load_snapshot(rec_catalog_t *cat, const char *path)
+{
+    uint8_t h[CATALOG_RECORD_BYTES];
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    if (read(fd, h, sizeof(h)) != (ssize_t)sizeof(h) || !s_valid(h, CATALOG_SNAP_MAGIC)) {
+        close(fd);
+        return -1;
+    }
+    cat->snap_count = s_get_le32(h + 8);
+    cat->next_index = s_get_le32(h + 12);
+    cat->snap_seq = s_get_le32(h + 16);
+    cat->snap_next_index = s_get_le32(h + 20);
+    cat->seq = cat->snap_seq;
+    // Records are sorted by index, so the last one says which directory is being filled.
+    rec_catalog_entry_t last;
+    if (cat->snap_count > 0 && s_read_record(fd, cat->snap_count - 1, &last) == 0) {
+        memcpy(cat->cur_dir, last.dir, sizeof(cat->cur_dir));
+        cat->cur_slot = last.slot;
+    }
+    close(fd);
+    return 0;
+}
+
+// Opens the temporary snapshot and reserves its header record; returns the descriptor or -1.
+static int s_snapshot_begin(const rec_catalog_t *cat)
+{
+    const uint8_t zero[CATALOG_RECORD_BYTES] = {0};
+    int fd = open(cat->tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd >= 0 && s_write_all(fd, zero, sizeof(zero)) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+// Seals the temporary snapshot, swaps it in and, if the log was folded into it, empties the log.
+// A crash before the rename leaves the old snapshot; after it, log records are skipped by sequence number.
+// covered is one past the highest index written to it; a name handed out but not logged yet lies beyond.
+static int s_snapshot_finish(rec_catalog_t *cat, int fd, uint32_t count, uint32_t covered, bool fold_log)
+{
+    uint8_t h[CATALOG_RECORD_BYTES] = {0};
+    s_put_le32(h, CATALOG_SNAP_MAGIC);
+    s_put_le32(h + 8, count);
+    s_put_le32(h + 12, cat->next_index);
+    s_put_le32(h + 16, cat->seq);
+    s_put_le32(h + 20, covered);
+    s_seal(h);
+    int ret = (lseek(fd, 0, SEEK_SET) == 0) ? s_write_all(fd, h, sizeof(h)) : -1;
+    if (ret == 0 && fsync(fd) != 0) {
+        ret = -1;
+    }
+    close(fd);
+    if (ret != 0) {
+        unlink(cat->tmp_path);
+        return -1;
+    }
+    // FAT cannot rename over an existing file; the loader falls back to the temporary name.
+    unlink(cat->snap_path);
+    if (rename(cat->tmp_path, cat->snap_path) != 0) {
+        return -1;
+    }
+    cat->snap_count = count;
+    cat->snap_next_index = covered;
+    cat->snap_seq = cat->seq;
+    if (fold_log) {
+        fd = open(cat->log_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd >= 0) {
+            fsync(fd);
+            close(fd);
+        }
+        cat->tail_count = 0;
+        cat->log_records = 0;
+    }
+    return 0;
+}
+
+// Rewrites the snapshot with the log folded in.
+static int s_compact(rec_catalog_t *cat)
+{
+    int out = s_snapshot_begin(cat);
+    if (out < 0) {
+        return -1;
+    }
+    uint8_t batch[CATALOG_BATCH * CATALOG_RECORD_BYTES];
+    uint8_t r[CATALOG_RECORD_BYTES];
+    uint32_t count = 0;
+    uint32_t covered = cat->snap_next_index;
+    int ret = 0;
+
+    int in = open(cat->snap_path, O_RDONLY);
+    if (in >= 0 && lseek(in, CATALOG_RECORD_BYTES, SEEK_SET) == CATALOG_RECORD_BYTES) {
+        ssize_t n;
+        while (ret == 0 && (n = read(in, batch, sizeof(batch))) >= CATALOG_RECORD_BYTES) {
+            for (ssize_t off = 0; off + CATALOG_RECORD_BYTES <= n && ret == 0; off += CATALOG_RECORD_BYTES) {
+                if (!s_valid(batch + off, CATALOG_RECORD_MAGIC)) {
+                    continue;
+                }
+                rec_catalog_entry_t e;
+                s_decode(batch + off, &e);
+                const rec_catalog_entry_t *newer = s_tail_find(cat, e.index);
+                s_encode(r, 0, (newer != NULL) ? newer : &e);
+                ret = s_write_all(out, r, sizeof(r));
+                count++;
+            }
+        }
+    }
+    if (in >= 0) {
+        close(in);
+    }
+    for (size_t i = 0; i < cat->tail_count && ret == 0; i++) {
+        if (cat->tail[i].index >= cat->snap_next_index) {
+            s_encode(r, 0, &cat->tail[i]);
+            ret = s_write_all(out, r, sizeof(r));
+            count++;
+            if (cat->tail[i].index >= covered) {
+                covered = cat->tail[i].index + 1;
+            }
+        }
+    }
+    if (ret != 0) {
+        close(out);
+        unlink(cat->tmp_path);
+        return -1;
+    }
+    return s_snapshot_finish(cat, out, count, covered, true);
+}
+
+// Orders entries by index.
+static int s_compare_index(const void *a, const void *b)
+{
+    const uint32_t ia = ((const rec_catalog_entry_t *)a)->index;
+    const uint32_t ib = ((const rec_catalog_entry_t *)b)->index;
+    return (ia > ib) - (ia < ib);
+}
+
+// Adds the recordings found in one directory to a growing array; returns -1 if out of memory.
+static int s_scan_dir(rec_catalog_t *cat, const char *sub, rec_catalog_entry_t **entries, size_t *count,
+                      size_t *capacity)
+{
+    const size_t prefix_len = strlen(REC_CATALOG_PREFIX);
+    const char *sep = (sub[0] != '\0') ? "/" : "";
+    char path[REC_CATALOG_PATH_MAX + REC_CATALOG_DIR_MAX + REC_CATALOG_NAME_MAX];
+    snprintf(path, sizeof(path), "%s%s%s", cat->dir, sep, sub);
+    DIR *d = opendir(path);
+    if (d == NULL) {
+        return 0;
+    }
+    int ret = 0;
+    struct dirent *entry;
+    while (ret == 0 && (entry = readdir(d)) != NULL) {
+        const char *name = entry->d_name;
+        if (entry->d_type == DT_DIR) {
+            if (sub[0] != '\0' || name[0] == '.' || strlen(name) >= REC_CATALOG_DIR_MAX) {
+                continue;
+            }
+            // One level of shard directories below the root.
+            ret = s_scan_dir(cat, name, entries, count, capacity);
+            continue;
+        }
+        if (strncasecmp(name, REC_CATALOG_PREFIX, prefix_len) != 0) {
+            continue;
+        }
+        char *end = NULL;
+        const unsigned long index = strtoul(name + prefix_len, &end, 10);
+        if (end == name + prefix_len) {
+            continue;
+        }
+        if (index >= cat->next_index) {
+            cat->next_index = (uint32_t)index + 1;
+        }
+        // Later segments (mic_0001_002.wav) only move the next index; the first file stands for the recording.
+        if (*end != '.') {
+            continue;
+        }
+        if (*count == *capacity) {
+            const size_t grown = (*capacity > 0) ? *capacity * 2 : 256;
+            rec_catalog_entry_t *more = realloc(*entries, grown * sizeof(**entries));
+            if (more == NULL) {
+                ret = -1;
+                break;
+            }
+            *entries = more;
+            *capacity = grown;
+        }
+        // Sizes are left unknown: a stat() per file would make the scan quadratic in a large directory.
+        rec_catalog_entry_t *e = &(*entries)[*count];
+        memset(e, 0, sizeof(*e));
+        e->index = (uint32_t)index;
+        e->state = REC_CATALOG_DONE;
+        e->container = (uint8_t)s_container(end);
+        e->segments = 1;
+        snprintf(e->dir, sizeof(e->dir), "%s", sub);
+        s_name(e);
+        if (strcasecmp(e->name, name) == 0) {
+            (*count)++;
+        }
+    }
+    closedir(d);
+    return ret;
+}
+
+// Builds a snapshot from the recordings already on the card, in the root and one level of directories below.
+// Only runs when no snapshot exists, e.g. on the first boot with a card written before the catalog existed.
+// Runs before the log replay and leaves the log alone.
+static int s_rebuild(rec_catalog_t *cat)
+{
+    rec_catalog_entry_t *entries = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    int ret = s_scan_dir(cat, "", &entries, &count, &capacity);
+    int out = (ret == 0) ? s_snapshot_begin(cat) : -1;
+    if (out < 0) {
+        free(entries);
+        return -1;
+    }
+    if (count > 1) {
+        qsort(entries, count, sizeof(*entries), s_compare_index);
+    }
+    uint8_t r[CATALOG_RECORD_BYTES];
+    for (size_t i = 0; i < count && ret == 0; i++) {
+        rec_catalog_entry_t *e = &entries[i];
+        const bool same_dir = (i > 0) && strcmp(e->dir, entries[i - 1].dir) == 0;
+        e->slot = same_dir ? entries[i - 1].slot + 1 : 1;
+        s_encode(r, 0, e);
+        ret = s_write_all(out, r, sizeof(r));
+    }
+    if (count > 0) {
+        memcpy(cat->cur_dir, entries[count - 1].dir, sizeof(cat->cur_dir));
+        cat->cur_slot = entries[count - 1].slot;
+    }
+    free(entries);
+    if (ret != 0) {
+        close(out);
+        unlink(cat->tmp_path);
+        return -1;
+    }
+    return s_snapshot_finish(cat, out, (uint32_t)count, cat->next_index, false);
+}
+
+// Replays the log on top of the snapshot and cuts off a torn record at its end.
+static void s_replay_log(rec_catalog_t *cat)
+{
+    int fd = open(cat->log_path, O_RDWR);
+    if (fd < 0) {
+        return;
+    }
+    uint8_t r[CATALOG_RECORD_BYTES];
+    off_t good = 0;
+    while (read(fd, r, sizeof(r)) == (ssize_t)sizeof(r) && s_valid(r, CATALOG_RECORD_MAGIC)) {
+        rec_catalog_entry_t e;
+        const uint32_t seq = s_decode(r, &e);
+        good += CATALOG_RECORD_BYTES;
+        cat->log_records++;
+        // Records already folded into the snapshot survive a crash between the rename and the log truncation.
+        if (seq <= cat->snap_seq) {
+            continue;
+        }
+        if (s_tail_apply(cat, &e) != 0) {
+            break;
+        }
+        if (seq > cat->seq) {
+            cat->seq = seq;
+        }
+    }
+    if (lseek(fd, 0, SEEK_END) != good) {
+        ftruncate(fd, good);
+    }
+    close(fd);
+}
+
+// Appends a record to the log, compacting first if it is full. The in-memory state is updated even if
+// the card write fails, so names keep moving forward.
+static int s_append(rec_catalog_t *cat, const rec_catalog_entry_t *e)
+{
+    if (cat->log_records >= REC_CATALOG_LOG_MAX) {
+        s_compact(cat);
+    }
+    if (s_tail_apply(cat, e) != 0) {
+        return -1;
+    }
+    uint8_t r[CATALOG_RECORD_BYTES];
+    s_encode(r, ++cat->seq, e);
+    int fd = open(cat->log_path, O_WRONLY | O_CREAT | O_APPEND, 0666);
+    if (fd < 0) {
+        return -1;
+    }
+    int ret = s_write_all(fd, r, sizeof(r));
+    if (ret == 0 && fsync(fd) != 0) {
+        ret = -1;
+    }
+    close(fd);
+    cat->log_records++;
+    return ret;
+}
+
+// Loads the catalog in dir, building it from the directory on first use. Returns 0 on success, -1 if the
+// catalog could not be read or created (names are still handed out from memory).
+int rec_catalog_open(rec_catalog_t *cat, const char *dir)
+{
+    memset(cat, 0, sizeof(*cat));
+    cat->next_index = 1;
+    snprintf(cat->dir, sizeof(cat->dir), "%s", dir);
+    snprintf(cat->snap_path, sizeof(cat->snap_path), "%s/CATALOG.SNP", dir);
+    snprintf(cat->tmp_path, sizeof(cat->tmp_path), "%s/CATALOG.TMP", dir);
+    snprintf(cat->log_path, sizeof(cat->log_path), "%s/CATALOG.LOG", dir);
+
+    int ret = 0;
+    if (s_load_snapshot(cat, cat->snap_path) == 0) {
+        unlink(cat->tmp_path);
+    } else if (s_load_snapshot(cat, cat->tmp_path) == 0) {
+        // Power was lost between removing the old snapshot and renaming the new one.
+        ret = rename(cat->tmp_path, cat->snap_path);
+    } else {
+        ret = s_rebuild(cat);
+    }
+    s_replay_log(cat);
+
+    // Recordings still open in the log were cut short by a reset.
+    for (size_t i = 0; i < cat->tail_count; i++) {
+        rec_catalog_entry_t e = cat->tail[i];
+        if (e.state != REC_CATALOG_OPEN) {
+            continue;
+        }
+        // The file may still be waiting for its repair, so its size is left unknown.
+        e.state = REC_CATALOG_INTERRUPTED;
+        if (s_append(cat, &e) != 0) {
+            ret = -1;
+        }
+    }
+    return (ret == 0) ? 0 : -1;
+}
+
+// Reloads the catalog after the card was away, e.g. exposed over USB, staying in the current boot session.
+int rec_catalog_reload(rec_catalog_t *cat)
+{
+    char dir[REC_CATALOG_PATH_MAX];
+    memcpy(dir, cat->dir, sizeof(dir));
+    const bool started = cat->session_started;
+    const int ret = rec_catalog_open(cat, dir);
+    cat->session_started = started;
+    return ret;
+}
+
+// True for a day directory ("20261016" or "20261016_2"), false for the root and boot-session directories.
+static bool s_is_day_dir(const char *dir)
+{
+    return dir[0] >= '0' && dir[0] <= '9';
+}
+
+// Finds the newest recording filed under day (YYYYMMDD) in any of its directories. Day directories only
+// grow with the index while the clock moves forward, so the snapshot is binary searched on the day, stepping
+// left past recordings made without a clock; the log tail is then checked for anything newer.
+// Returns 0 if found, -1 if the day has no recordings.
+static int s_find_day(const rec_catalog_t *cat, const char *day, rec_catalog_entry_t *out)
+{
+    const size_t len = strlen(day);
+    int ret = -1;
+    int fd = open(cat->snap_path, O_RDONLY);
+    if (fd >= 0) {
+        uint32_t lo = 0;
+        uint32_t hi = cat->snap_count;
+        rec_catalog_entry_t e;
+        while (lo < hi) {
+            const uint32_t mid = lo + (hi - lo) / 2;
+            uint32_t probe = mid + 1;
+            bool dated = false;
+            while (probe > lo && !dated) {
+                probe--;
+                if (s_read_record(fd, probe, &e) != 0) {
+                    break;
+                }
+                dated = s_is_day_dir(e.dir);
+            }
+            if (!dated) {
+                lo = mid + 1;
+            } else if (strncmp(e.dir, day, len) <= 0) {
+                if (strncmp(e.dir, day, len) == 0) {
+                    *out = e;
+                    ret = 0;
+                }
+                lo = mid + 1;
+            } else {
+                hi = probe;
+            }
+        }
+        close(fd);
+    }
+    for (size_t i = 0; i < cat->tail_count; i++) {
+        const rec_catalog_entry_t *t = &cat->tail[i];
+        if (s_is_day_dir(t->dir) && strncmp(t->dir, day, len) == 0 && (ret != 0 || t->index > out->index)) {
+            *out = *t;
+            ret = 0;
+        }
+    }
+    return ret;
+}
+
+// Moves on to a new directory when needed: one per day while the clock is set, one per boot otherwise,
+// and a new one whenever the current one holds REC_CATALOG_DIR_FILES recordings.
+static void s_pick_dir(rec_catalog_t *cat, int64_t start_time, uint32_t index)
+{
+    char day[REC_CATALOG_DIR_MAX] = "";
+    if (start_time >= REC_CATALOG_CLOCK_VALID) {
+        const time_t t = (time_t)start_time;
+        struct tm tm;
+        localtime_r(&t, &tm);
+        strftime(day, sizeof(day), "%Y%m%d", &tm);
+    }
+    if (day[0] != '\0') {
+        if (strncmp(cat->cur_dir, day, strlen(day)) != 0) {
+            // Back on a day that already has recordings, e.g. after a boot without a clock: carry on where
+            // that day left off instead of refilling its first directory.
+            rec_catalog_entry_t newest = {0};
+            if (s_find_day(cat, day, &newest) == 0) {
+                memcpy(cat->cur_dir, newest.dir, sizeof(cat->cur_dir));
+                cat->cur_slot = newest.slot;
+            } else {
+                snprintf(cat->cur_dir, sizeof(cat->cur_dir), "%s", day);
+                cat->cur_slot = 0;
+            }
+        }
+        if (cat->cur_slot < REC_CATALOG_DIR_FILES) {
+            return;
+        }
+        const char *suffix = strchr(cat->cur_dir, '_');
+        const unsigned next = (suffix != NULL) ? (unsigned)atoi(suffix + 1) + 1 : 2;
+        snprintf(cat->cur_dir, sizeof(cat->cur_dir), "%.8s_%u", day, next);
+    } else {
+        if (cat->session_started && cat->cur_dir[0] != '\0' && cat->cur_slot < REC_CATALOG_DIR_FILES) {
+            return;
+        }
+        snprintf(cat->cur_dir, sizeof(cat->cur_dir), "S%07lu", (unsigned long)index);
+    }
+    cat->cur_slot = 0;
+}
+
+// Hands out the next name and logs the recording as open, before any audio is written.
+int rec_catalog_begin(rec_catalog_t *cat, rec_catalog_container_t container, uint32_t sample_rate_hz,
+                      int64_t start_time, rec_catalog_entry_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->container = (uint8_t)container;
+    s_pick_dir(cat, start_time, cat->next_index);
+    memcpy(out->dir, cat->cur_dir, sizeof(out->dir));
+
+    char path[REC_CATALOG_PATH_MAX + REC_CATALOG_DIR_MAX + REC_CATALOG_NAME_MAX];
+    snprintf(path, sizeof(path), "%s/%s", cat->dir, out->dir);
+    mkdir(path, 0777);
+    struct stat st;
+    // One lookup per recording guards against files copied onto the card under a catalog name.
+    do {
+        out->index = cat->next_index++;
+        s_name(out);
+        rec_catalog_path(cat, out, path, sizeof(path));
+    } while (stat(path, &st) == 0);
+    out->state = REC_CATALOG_OPEN;
+    out->slot = ++cat->cur_slot;
+    out->sample_rate_hz = sample_rate_hz;
+    out->start_time = start_time;
+    cat->session_started = true;
+    return s_append(cat, out);
+}
+
+// Logs the final state, length and size of a recording.
+int rec_catalog_finish(rec_catalog_t *cat, const rec_catalog_entry_t *entry)
+{
+    return s_append(cat, entry);
+}
+
+// Looks a recording up by index: the log first, then a binary search of the sorted snapshot.
+// Returns 0 if found, -1 otherwise.
+int rec_catalog_find(const rec_catalog_t *cat, uint32_t index, rec_catalog_entry_t *out)
+{
+    const rec_catalog_entry_t *newer = s_tail_find(cat, index);
+    if (newer != NULL) {
+        *out = *newer;
+        return 0;
+    }
+    int fd = open(cat->snap_path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    int ret = -1;
+    uint32_t lo = 0;
+    uint32_t hi = cat->snap_count;
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if (s_read_record(fd, mid, out) != 0) {
+            break;
+        }
+        if (out->index == index) {
+            ret = 0;
+            break;
+        }
+        if (out->index < index) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    close(fd);
+    return ret;
+}
+
+// Builds the full path of a recording's first file.
+void rec_catalog_path(const rec_catalog_t *cat, const rec_catalog_entry_t *entry, char *out, size_t out_size)
+{
+    if (entry->dir[0] != '\0') {
+        snprintf(out, out_size, "%s/%s/%s", cat->dir, entry->dir, entry->name);
+    } else {
+        snprintf(out, out_size, "%s/%s", cat->dir, entry->name);
+    }
+}
+
+// Builds the file name of one segment the way mic_capture does: the first keeps the name, later ones add _002, ...
+void rec_catalog_segment_name(const rec_catalog_entry_t *entry, uint16_t segment, char *out, size_t out_size)
+{
+    if (segment == 0) {
+        snprintf(out, out_size, "%s", entry->name);
+        return;
+    }
+    const char *dot = strrchr(entry->name, '.');
+    if (dot != NULL) {
+        snprintf(out, out_size, "%.*s_%03u%s", (int)(dot - entry->name), entry->name, (unsigned)segment + 1, dot);
+    } else {
+        snprintf(out, out_size, "%s_%03u", entry->name, (unsigned)segment + 1);
+    }
+}
+
+// Returns the number of recordings in the catalog.
+size_t rec_catalog_count(const rec_catalog_t *cat)
+{
+    size_t count = cat->snap_count;
+    for (size_t i = 0; i < cat->tail_count; i++) {
+        if (cat->tail[i].index >= cat->snap_next_index) {
+            count++;
+        }
+    }
+    return count;
+}
+
+// Calls visit for every recording, oldest first, until it returns false. Reads the snapshot a sector at a time.
+int rec_catalog_list(const rec_catalog_t *cat, rec_catalog_visit_t visit, void *arg)
+{
+    uint8_t batch[CATALOG_BATCH * CATALOG_RECORD_BYTES];
+    int fd = open(cat->snap_path, O_RDONLY);
+    if (fd >= 0 && lseek(fd, CATALOG_RECORD_BYTES, SEEK_SET) == CATALOG_RECORD_BYTES) {
+        ssize_t n;
+        while ((n = read(fd, batch, sizeof(batch))) >= CATALOG_RECORD_BYTES) {
+            for (ssize_t off = 0; off + CATALOG_RECORD_BYTES <= n; off += CATALOG_RECORD_BYTES) {
+                if (!s_valid(batch + off, CATALOG_RECORD_MAGIC)) {
+                    continue;
+                }
+                rec_catalog_entry_t e;
+                s_decode(batch + off, &e);
+                const rec_catalog_entry_t *newer = s_tail_find(cat, e.index);
+                if (!visit((newer != NULL) ? newer : &e, arg)) {
+                    close(fd);
+                    return 0;
+                }
+            }
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    for (size_t i = 0; i < cat->tail_count; i++) {
+        if (cat->tail[i].index >= cat->snap_next_index && !visit(&cat->tail[i], arg)) {
+            break;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// On-card catalog of recordings: a compact snapshot (CATALOG.SNP) plus an append-only log (CATALOG.LOG) of
+// fixed-size, CRC-protected records. The snapshot header carries the next free index, so allocating a name
+// at boot never scans the directory; the log is folded into the snapshot when it fills up.
+// Recordings are sharded into one directory per day (per boot while the clock is unset) holding at most
+// REC_CATALOG_DIR_FILES recordings; the snapshot is sorted by index, so a lookup is a binary search.
+// Uses only POSIX file I/O so it can be built and tested on a host.
+
+#define REC_CATALOG_NAME_MAX     20     // "mic_0001.flac" plus room for larger indices
+#define REC_CATALOG_SEGMENT_MAX  (REC_CATALOG_NAME_MAX + 4)  // Room for the _NNN segment suffix
+#define REC_CATALOG_DIR_MAX      16     // "20261016_2" or "S0000153"
+#define REC_CATALOG_PATH_MAX     64
+#define REC_CATALOG_DIR_FILES    100    // Recordings per directory before a new one is started
+#define REC_CATALOG_CLOCK_VALID  1700000000  // Start times before this mean the clock was never set
+#define REC_CATALOG_LOG_MAX      64     // Log records kept before compaction
+#define REC_CATALOG_PREFIX       "mic_"
+
+typedef enum {
+    REC_CATALOG_OPEN = 1,        // Name handed out, recording in progress
+    REC_CATALOG_DONE,
+    REC_CATALOG_FAILED,          // Recording stopped on an error
+    REC_CATALOG_INTERRUPTED,     // Still open at the next boot, e.g. after a power loss
+} rec_catalog_state_t;
+
+typedef enum {
+    REC_CATALOG_WAV,
+    REC_CATALOG_FLAC,
+    REC_CATALOG_OPUS,
+    REC_CATALOG_RAW,
+} rec_catalog_container_t;
+
+typedef struct {
+    uint32_t index;              // NNNN in mic_NNNN
+    uint8_t state;               // rec_catalog_state_t
+    uint8_t container;           // rec_catalog_container_t
+    uint16_t segments;
+    uint32_t sample_rate_hz;
+    uint32_t seconds;
+    uint64_t bytes;              // Audio written, all segments together
+    int64_t start_time;          // Unix time; small values mean the clock had not been set
+    uint16_t slot;               // Position in its directory, from 1
+    char dir[REC_CATALOG_DIR_MAX];   // Directory under the catalog root, empty for the root itself
+    char name[REC_CATALOG_NAME_MAX]; // Derived from index and container
+} rec_catalog_entry_t;
+
+typedef struct {
+    char snap_path[REC_CATALOG_PATH_MAX];
+    char tmp_path[REC_CATALOG_PATH_MAX];
+    char log_path[REC_CATALOG_PATH_MAX];
+    char dir[REC_CATALOG_PATH_MAX];
+    uint32_t next_index;
+    uint32_t seq;                // Sequence number of the last record written
+    uint32_t snap_seq;           // Last sequence number folded into the snapshot
+    uint32_t snap_count;
+    uint32_t snap_next_index;    // Recordings from here on are only in the log
+    uint32_t log_records;        // Records in the log file, superseded ones included
+    char cur_dir[REC_CATALOG_DIR_MAX]; // Directory of the newest recording
+    uint16_t cur_slot;
+    bool session_started;        // A recording was made since boot; without a clock each boot gets a directory
+    size_t tail_count;
+    rec_catalog_entry_t tail[REC_CATALOG_LOG_MAX]; // Latest state of every recording in the log
+} rec_catalog_t;
+
+typedef bool (*rec_catalog_visit_t)(const rec_catalog_entry_t *entry, void *arg);
+
+int rec_catalog_open(rec_catalog_t *cat, const char *dir);
+int rec_catalog_reload(rec_catalog_t *cat);
+int rec_catalog_begin(rec_catalog_t *cat, rec_catalog_container_t container, uint32_t sample_rate_hz,
+                      int64_t start_time, rec_catalog_entry_t *out);
+int rec_catalog_finish(rec_catalog_t *cat, const rec_catalog_entry_t *entry);
+int rec_catalog_find(const rec_catalog_t *cat, uint32_t index, rec_catalog_entry_t *out);
+void rec_catalog_path(const rec_catalog_t *cat, const rec_catalog_entry_t *entry, char *out, size_t out_size);
+void rec_catalog_segment_name(const rec_catalog_entry_t *entry, uint16_t segment, char *out, size_t out_size);
+size_t rec_catalog_count(const rec_catalog_t *cat);
+int rec_catalog_list(const rec_catalog_t *cat, rec_catalog_visit_t visit, void *arg);
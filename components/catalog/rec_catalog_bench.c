@@ -0,0 +1,98 @@
+#include "rec_catalog_bench.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rec_catalog.h"
+
+#define BENCH_PATH_MAX   96
+
+static const uint32_t s_points[REC_CATALOG_BENCH_POINTS] = {100, 1000, 10000};
+
+// Monotonic time in microseconds.
+static int64_t s_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Names file i of a layout; sharded files go REC_CATALOG_DIR_FILES to a directory, as recordings do.
+static void s_bench_path(const char *root, bool sharded, uint32_t i, char *out, size_t out_size)
+{
+    if (sharded) {
+        snprintf(out, out_size, "%s/S%07lu/" REC_CATALOG_PREFIX "%05lu.wav", root,
+                 (unsigned long)(i / REC_CATALOG_DIR_FILES), (unsigned long)i);
+    } else {
+        snprintf(out, out_size, "%s/" REC_CATALOG_PREFIX "%05lu.wav", root, (unsigned long)i);
+    }
+}
+
+// Creates the files of one layout, recording the mean create latency at each point; then removes them.
+static int s_run(const char *root, bool sharded, rec_catalog_bench_t *out)
+{
+    const uint32_t total = s_points[REC_CATALOG_BENCH_POINTS - 1];
+    char path[BENCH_PATH_MAX];
+    int64_t window_us = 0;
+    int point = 0;
+    int ret = 0;
+
+    mkdir(root, 0777);
+    for (uint32_t i = 0; i < total && ret == 0; i++) {
+        if (sharded && i % REC_CATALOG_DIR_FILES == 0) {
+            snprintf(path, sizeof(path), "%s/S%07lu", root, (unsigned long)(i / REC_CATALOG_DIR_FILES));
+            mkdir(path, 0777);
+        }
+        s_bench_path(root, sharded, i, path, sizeof(path));
+        const int64_t start_us = s_now_us();
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0) {
+            ret = -1;
+            break;
+        }
+        close(fd);
+        const uint32_t n = i + 1;
+        const uint32_t window = s_points[point] / 10;
+        if (n > s_points[point] - window) {
+            window_us += s_now_us() - start_us;
+        }
+        if (n == s_points[point]) {
+            out[point].files = n;
+            if (sharded) {
+                out[point].sharded_us = (uint32_t)(window_us / window);
+            } else {
+                out[point].flat_us = (uint32_t)(window_us / window);
+            }
+            window_us = 0;
+            point++;
+        }
+    }
+
+    for (uint32_t i = 0; i < total; i++) {
+        s_bench_path(root, sharded, i, path, sizeof(path));
+        unlink(path);
+        if (sharded && (i + 1) % REC_CATALOG_DIR_FILES == 0) {
+            snprintf(path, sizeof(path), "%s/S%07lu", root, (unsigned long)(i / REC_CATALOG_DIR_FILES));
+            rmdir(path);
+        }
+    }
+    rmdir(root);
+    return ret;
+}
+
+// Measures both layouts under dir, leaving nothing behind. Needs room for 10,000 empty files and takes minutes
+// on an SD card. Returns 0 on success, -1 if a file could not be created.
+int rec_catalog_bench(const char *dir, rec_catalog_bench_t out[REC_CATALOG_BENCH_POINTS])
+{
+    char root[BENCH_PATH_MAX];
+    snprintf(root, sizeof(root), "%s/BENCH_F", dir);
+    if (s_run(root, false, out) != 0) {
+        return -1;
+    }
+    snprintf(root, sizeof(root), "%s/BENCH_S", dir);
+    return s_run(root, true, out);
+}
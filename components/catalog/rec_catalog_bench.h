@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// File-create latency in one flat directory against the sharded layout used by rec_catalog.
+// Each point is the mean over the last tenth of the files created before it.
+
+#define REC_CATALOG_BENCH_POINTS 3   // 100, 1,000 and 10,000 files
+
+typedef struct {
+    uint32_t files;
+    uint32_t flat_us;
+    uint32_t sharded_us;
+} rec_catalog_bench_t;
+
+int rec_catalog_bench(const char *dir, rec_catalog_bench_t out[REC_CATALOG_BENCH_POINTS]);
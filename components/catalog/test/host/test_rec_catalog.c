@@ -0,0 +1,362 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "host_test.h"
+#include "rec_catalog.h"
+
+// rec_catalog on a scratch directory standing in for the card: 150 recordings through several compactions,
+// a reboot, a torn log tail, the two crash windows of a compaction, returning to a day after recordings made
+// without a clock, and the first-boot rebuild from files.
+
+#define RECORDINGS   150
+#define DAY_START    1760572800     // 2025-10-16 00:00 UTC
+#define RECORD_BYTES 64
+
+static const char *s_day = "20251016";
+
+// Bytes and seconds derived from the index, so every entry can be checked after the fact.
+static void s_finish(rec_catalog_t *cat, rec_catalog_entry_t *e)
+{
+    e->state = (e->index % 10 == 0) ? REC_CATALOG_FAILED : REC_CATALOG_DONE;
+    e->seconds = e->index * 3;
+    e->bytes = (uint64_t)e->index * 96000;
+    e->segments = 1 + (e->index % 3);
+    TEST_CHECK(rec_catalog_finish(cat, e) == 0);
+}
+
+// Checks what the catalog holds for recording i (1-based) after s_finish().
+static void s_check_entry(const rec_catalog_t *cat, uint32_t i)
+{
+    rec_catalog_entry_t e;
+    TEST_CHECK(rec_catalog_find(cat, i, &e) == 0);
+    TEST_CHECK(e.index == i);
+    TEST_CHECK(e.state == ((i % 10 == 0) ? REC_CATALOG_FAILED : REC_CATALOG_DONE));
+    TEST_CHECK(e.seconds == i * 3 && e.bytes == (uint64_t)i * 96000 && e.segments == 1 + (i % 3));
+    TEST_CHECK(e.container == REC_CATALOG_WAV && e.sample_rate_hz == 16000);
+    char want[32];
+    snprintf(want, sizeof(want), "mic_%04u.wav", (unsigned)i);
+    TEST_CHECK(strcmp(e.name, want) == 0);
+    // The first REC_CATALOG_DIR_FILES go to the day's directory, the rest to its _2 overflow
+    if (i <= REC_CATALOG_DIR_FILES) {
+        TEST_CHECK(strcmp(e.dir, s_day) == 0 && e.slot == i);
+    } else {
+        char dir[REC_CATALOG_DIR_MAX];
+        snprintf(dir, sizeof(dir), "%s_2", s_day);
+        TEST_CHECK(strcmp(e.dir, dir) == 0 && e.slot == i - REC_CATALOG_DIR_FILES);
+    }
+}
+
+typedef struct {
+    uint32_t count;
+    uint32_t last_index;
+} s_list_t;
+
+static bool s_visit(const rec_catalog_entry_t *e, void *arg)
+{
+    s_list_t *l = arg;
+    TEST_CHECK(e->index > l->last_index);
+    l->last_index = e->index;
+    l->count++;
+    return true;
+}
+
+// Lists the catalog and checks it is complete and in index order.
+static void s_check_list(const rec_catalog_t *cat, uint32_t expect)
+{
+    s_list_t l = {0};
+    TEST_CHECK(rec_catalog_list(cat, s_visit, &l) == 0);
+    TEST_CHECK(l.count == expect && rec_catalog_count(cat) == expect);
+}
+
+static off_t s_file_size(const char *path)
+{
+    struct stat st;
+    return (stat(path, &st) == 0) ? st.st_size : -1;
+}
+
+// Reads a whole file into a malloc'd buffer.
+static uint8_t *s_read_file(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    TEST_CHECK(f != NULL);
+    fseek(f, 0, SEEK_END);
+    *len = (size_t)ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *buf = malloc(*len + 1);
+    TEST_CHECK(buf != NULL);
+    TEST_CHECK(fread(buf, 1, *len, f) == *len);
+    fclose(f);
+    return buf;
+}
+
+static void s_write_file(const char *path, const void *data, size_t len, const char *mode)
+{
+    FILE *f = fopen(path, mode);
+    TEST_CHECK(f != NULL);
+    TEST_CHECK(fwrite(data, 1, len, f) == len);
+    fclose(f);
+}
+
+// Creates an empty file, e.g. a recording the catalog should pick up on its first boot.
+static void s_touch(const char *dir, const char *name)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    s_write_file(path, "", 0, "wb");
+}
+
+// Removes the scratch directory and everything in it.
+static void s_remove_tree(const char *dir)
+{
+    char cmd[300];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", dir);
+    TEST_CHECK(system(cmd) == 0);
+}
+
+static void s_test_many(const char *root)
+{
+    static rec_catalog_t cat;
+    TEST_CHECK(rec_catalog_open(&cat, root) == 0);
+    TEST_CHECK(cat.next_index == 1 && rec_catalog_count(&cat) == 0);
+
+    uint32_t compactions = 0;
+    for (uint32_t i = 1; i <= RECORDINGS; i++) {
+        const uint32_t snap_seq = cat.snap_seq;
+        rec_catalog_entry_t e;
+        TEST_CHECK(rec_catalog_begin(&cat, REC_CATALOG_WAV, 16000, DAY_START + 60 * i, &e) == 0);
+        TEST_CHECK(e.index == i && e.state == REC_CATALOG_OPEN);
+        // Recordings are not written in this test; the names just have to be free
+        s_finish(&cat, &e);
+        compactions += (cat.snap_seq != snap_seq);
+        // The log never outgrows its bound, so boot never reads more than that
+        TEST_CHECK(s_file_size(cat.log_path) <= REC_CATALOG_LOG_MAX * RECORD_BYTES);
+    }
+    TEST_CHECK(compactions >= (2 * RECORDINGS) / REC_CATALOG_LOG_MAX - 1);
+    for (uint32_t i = 1; i <= RECORDINGS; i++) {
+        s_check_entry(&cat, i);
+    }
+    s_check_list(&cat, RECORDINGS);
+
+    // Reboot: everything comes back from the snapshot header and the log, and names carry on
+    static rec_catalog_t again;
+    TEST_CHECK(rec_catalog_open(&again, root) == 0);
+    TEST_CHECK(again.next_index == RECORDINGS + 1);
+    for (uint32_t i = 1; i <= RECORDINGS; i++) {
+        s_check_entry(&again, i);
+    }
+    s_check_list(&again, RECORDINGS);
+    rec_catalog_entry_t missing;
+    TEST_CHECK(rec_catalog_find(&again, RECORDINGS + 1, &missing) != 0);
+    TEST_CHECK(rec_catalog_find(&again, 0, &missing) != 0);
+    printf("%u recordings, %u compactions, log %ld bytes\n", (unsigned)RECORDINGS, (unsigned)compactions,
+           (long)s_file_size(again.log_path));
+}
+
+static void s_test_torn_tail(const char *root)
+{
+    static rec_catalog_t cat;
+    TEST_CHECK(rec_catalog_open(&cat, root) == 0);
+    const uint32_t next = cat.next_index;
+    rec_catalog_entry_t e;
+    TEST_CHECK(rec_catalog_begin(&cat, REC_CATALOG_FLAC, 48000, DAY_START + 86400 / 2, &e) == 0);
+    TEST_CHECK(e.index == next);
+
+    // Power fails halfway through the next log append, and a second record is garbage
+    uint8_t torn[RECORD_BYTES];
+    memset(torn, 0xa5, sizeof(torn));
+    s_write_file(cat.log_path, torn, RECORD_BYTES / 2, "ab");
+    const off_t before = s_file_size(cat.log_path);
+    TEST_CHECK(before % RECORD_BYTES == RECORD_BYTES / 2);
+
+    static rec_catalog_t boot;
+    TEST_CHECK(rec_catalog_open(&boot, root) == 0);
+    // The torn half record is cut off and the open recording is marked interrupted in a fresh record
+    TEST_CHECK(s_file_size(boot.log_path) == before - RECORD_BYTES / 2 + RECORD_BYTES);
+    rec_catalog_entry_t got;
+    TEST_CHECK(rec_catalog_find(&boot, e.index, &got) == 0);
+    TEST_CHECK(got.state == REC_CATALOG_INTERRUPTED && got.container == REC_CATALOG_FLAC);
+    TEST_CHECK(boot.next_index == next + 1);
+
+    // A whole record with a bad CRC is dropped the same way
+    s_write_file(boot.log_path, torn, sizeof(torn), "ab");
+    static rec_catalog_t boot2;
+    TEST_CHECK(rec_catalog_open(&boot2, root) == 0);
+    TEST_CHECK(s_file_size(boot2.log_path) % RECORD_BYTES == 0);
+    TEST_CHECK(rec_catalog_find(&boot2, e.index, &got) == 0 && got.state == REC_CATALOG_INTERRUPTED);
+    TEST_CHECK(boot2.next_index == next + 1);
+    s_check_list(&boot2, RECORDINGS + 1);
+}
+
+static void s_test_compaction_crash(const char *root)
+{
+    static rec_catalog_t cat;
+    TEST_CHECK(rec_catalog_open(&cat, root) == 0);
+    const size_t count = rec_catalog_count(&cat);
+
+    // Run up to the append that compacts, keeping the log as it was just before
+    size_t old_len = 0;
+    uint8_t *old_log = NULL;
+    uint32_t added = 0;
+    const uint32_t snap_seq = cat.snap_seq;
+    while (cat.snap_seq == snap_seq) {
+        free(old_log);
+        old_log = s_read_file(cat.log_path, &old_len);
+        rec_catalog_entry_t e;
+        TEST_CHECK(rec_catalog_begin(&cat, REC_CATALOG_WAV, 16000, DAY_START + 86400 + added, &e) == 0);
+        added++;
+        s_finish(&cat, &e);
+    }
+    const uint32_t next = cat.next_index;
+
+    const uint32_t last = next - 1;
+
+    // Crash after the rename but before the log was emptied: the folded records must not apply twice. The
+    // compaction ran inside the last begin, so that recording's name was never handed out, but the
+    // snapshot already skips it and it is not reused.
+    s_write_file(cat.log_path, old_log, old_len, "wb");
+    static rec_catalog_t boot;
+    TEST_CHECK(rec_catalog_open(&boot, root) == 0);
+    TEST_CHECK(boot.next_index == next);
+    rec_catalog_entry_t e;
+    TEST_CHECK(rec_catalog_find(&boot, last, &e) != 0);
+    TEST_CHECK(rec_catalog_find(&boot, last - 1, &e) == 0 && e.state != REC_CATALOG_OPEN);
+    s_check_list(&boot, (uint32_t)(count + added - 1));
+
+    // Crash between removing the old snapshot and renaming the new one into place
+    size_t snap_len = 0;
+    uint8_t *snap = s_read_file(boot.snap_path, &snap_len);
+    s_write_file(boot.tmp_path, snap, snap_len, "wb");
+    TEST_CHECK(unlink(boot.snap_path) == 0);
+    static rec_catalog_t boot2;
+    TEST_CHECK(rec_catalog_open(&boot2, root) == 0);
+    TEST_CHECK(s_file_size(boot2.snap_path) == (off_t)snap_len && s_file_size(boot2.tmp_path) < 0);
+    TEST_CHECK(boot2.next_index == next);
+    s_check_list(&boot2, (uint32_t)(count + added - 1));
+    for (uint32_t i = 1; i <= RECORDINGS; i++) {
+        s_check_entry(&boot2, i);
+    }
+    free(snap);
+    free(old_log);
+}
+
+static void s_test_rebuild(const char *root)
+{
+    // A card written before the catalog existed, with a stray file and an orphaned later segment
+    char sub[256];
+    snprintf(sub, sizeof(sub), "%s/S0000009", root);
+    TEST_CHECK(mkdir(sub, 0777) == 0);
+    s_touch(root, "mic_0003.wav");
+    s_touch(root, "mic_0004.WAV");
+    s_touch(root, "mic_0007_002.wav");
+    s_touch(root, "notes.txt");
+    s_touch(sub, "mic_0009.flac");
+
+    static rec_catalog_t cat;
+    TEST_CHECK(rec_catalog_open(&cat, root) == 0);
+    TEST_CHECK(cat.next_index == 10);
+    // FAT names are case-insensitive, so mic_0004.WAV counts; the second segment only moves the index
+    s_check_list(&cat, 3);
+    rec_catalog_entry_t e;
+    TEST_CHECK(rec_catalog_find(&cat, 3, &e) == 0 && e.dir[0] == '\0' && e.slot == 1);
+    TEST_CHECK(rec_catalog_find(&cat, 4, &e) == 0 && e.slot == 2);
+    TEST_CHECK(rec_catalog_find(&cat, 7, &e) != 0);
+    TEST_CHECK(rec_catalog_find(&cat, 9, &e) == 0 && e.container == REC_CATALOG_FLAC);
+    TEST_CHECK(strcmp(e.dir, "S0000009") == 0 && e.slot == 1);
+    TEST_CHECK(strcmp(cat.cur_dir, "S0000009") == 0);
+
+    // A name copied onto the card ahead of the catalog is skipped rather than overwritten
+    char day[256];
+    snprintf(day, sizeof(day), "%s/%s", root, s_day);
+    TEST_CHECK(mkdir(day, 0777) == 0);
+    s_touch(day, "mic_0010.wav");
+    TEST_CHECK(rec_catalog_begin(&cat, REC_CATALOG_WAV, 16000, DAY_START, &e) == 0);
+    TEST_CHECK(e.index == 11 && strcmp(e.dir, s_day) == 0);
+}
+
+// Begins and finishes one recording, returning its entry.
+static rec_catalog_entry_t s_record(rec_catalog_t *cat, int64_t start_time)
+{
+    rec_catalog_entry_t e;
+    TEST_CHECK(rec_catalog_begin(cat, REC_CATALOG_WAV, 16000, start_time, &e) == 0);
+    s_finish(cat, &e);
+    return e;
+}
+
+static void s_test_back_to_day(const char *root)
+{
+    static rec_catalog_t cat;
+    TEST_CHECK(rec_catalog_open(&cat, root) == 0);
+    rec_catalog_entry_t e;
+    for (uint32_t i = 0; i < REC_CATALOG_DIR_FILES + 30; i++) {
+        e = s_record(&cat, DAY_START + i);
+    }
+    char day_2[REC_CATALOG_DIR_MAX];
+    snprintf(day_2, sizeof(day_2), "%s_2", s_day);
+    TEST_CHECK(strcmp(e.dir, day_2) == 0 && e.slot == 30);
+
+    // Boots without a clock get their own directories
+    static rec_catalog_t boot;
+    TEST_CHECK(rec_catalog_open(&boot, root) == 0);
+    e = s_record(&boot, 7);
+    TEST_CHECK(e.dir[0] == 'S' && e.slot == 1);
+    e = s_record(&boot, 8);
+    TEST_CHECK(e.dir[0] == 'S' && e.slot == 2);
+
+    // Once the clock is back the day carries on in its newest directory, from the log tail and after a
+    // compaction from the snapshot
+    e = s_record(&boot, DAY_START + 3600);
+    TEST_CHECK(strcmp(e.dir, day_2) == 0 && e.slot == 31);
+    static rec_catalog_t boot1;
+    TEST_CHECK(rec_catalog_open(&boot1, root) == 0);
+    for (uint32_t i = 0; i < REC_CATALOG_LOG_MAX; i++) {
+        e = s_record(&boot1, 9);
+        TEST_CHECK(e.dir[0] == 'S');
+    }
+    TEST_CHECK(boot1.tail_count < REC_CATALOG_LOG_MAX);
+    static rec_catalog_t boot2;
+    TEST_CHECK(rec_catalog_open(&boot2, root) == 0);
+    e = s_record(&boot2, DAY_START + 7200);
+    TEST_CHECK(strcmp(e.dir, day_2) == 0 && e.slot == 32);
+    for (uint32_t i = 33; i <= REC_CATALOG_DIR_FILES; i++) {
+        e = s_record(&boot2, DAY_START + 7200 + i);
+    }
+    TEST_CHECK(strcmp(e.dir, day_2) == 0 && e.slot == REC_CATALOG_DIR_FILES);
+    e = s_record(&boot2, DAY_START + 8000);
+    char day_3[REC_CATALOG_DIR_MAX];
+    snprintf(day_3, sizeof(day_3), "%s_3", s_day);
+    TEST_CHECK(strcmp(e.dir, day_3) == 0 && e.slot == 1);
+
+    // A new day starts fresh, and a reboot without a clock in between does not change that
+    e = s_record(&boot2, 6);
+    static rec_catalog_t boot3;
+    TEST_CHECK(rec_catalog_open(&boot3, root) == 0);
+    e = s_record(&boot3, DAY_START + 86400);
+    TEST_CHECK(strcmp(e.dir, "20251017") == 0 && e.slot == 1);
+}
+
+int main(void)
+{
+    // Day directories follow local time; pin it so the names are known
+    setenv("TZ", "UTC0", 1);
+    tzset();
+
+    char root[128];
+    host_test_tmpdir(root, sizeof(root), "catalog");
+    s_test_many(root);
+    s_test_torn_tail(root);
+    s_test_compaction_crash(root);
+    s_remove_tree(root);
+
+    host_test_tmpdir(root, sizeof(root), "catalog_day");
+    s_test_back_to_day(root);
+    s_remove_tree(root);
+
+    host_test_tmpdir(root, sizeof(root), "catalog_rebuild");
+    s_test_rebuild(root);
+    s_remove_tree(root);
+    printf("rec_catalog: ok\n");
+    return 0;
+}
@@ -7,6 +7,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "esp_err.h"
 #include "soc/soc_caps.h"
 #include "tusb.h"
@@ -173,6 +174,20 @@ esp_err_t tinyusb_driver_install(const tinyusb_config_t *config);
  */
 esp_err_t tinyusb_driver_uninstall(void);
 
+/**
+ * @brief Throughput of a transfer in KB/s, with 1 KB = 1024 bytes as in the byte totals logged next to it
+ *
+ * For the counters of tinyusb_msc_get_io_stats() and tinyusb_mtp_get_stats(), which give bytes and microseconds.
+ *
+ * @param bytes Bytes transferred
+ * @param us Time the transfer took, in microseconds
+ * @return Throughput in KB/s, 0 when no time was measured
+ */
+static inline uint32_t tinyusb_rate_kbps(uint64_t bytes, uint64_t us)
+{
+    return us ? (uint32_t)(bytes * 1000000 / 1024 / us) : 0;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -11,6 +11,7 @@ extern "C" {
 #endif
 
 #include <stddef.h>
+#include <stdint.h>
 #include "soc/soc_caps.h"
 #include "esp_err.h"
 #include "wear_levelling.h"
@@ -84,6 +85,67 @@ typedef struct {
                                             */
 } tinyusb_msc_fatfs_config_t;
 
+/**
+ * @brief Write-back cache statistics
+ *
+ * Host writes are held in RAM and written to the medium as one multi-sector write per sequential run.
+ * Counters accumulate from storage creation.
+ */
+typedef struct {
+    uint64_t write_sectors;                 /*!< Sectors written by the USB host */
+    uint64_t write_hits;                    /*!< Sectors rewritten while still in the cache, written to the medium once */
+    uint64_t read_sectors;                  /*!< Sectors read by the USB host */
+    uint64_t read_hits;                     /*!< Sectors returned from the cache instead of the medium */
+    uint64_t medium_sectors;                /*!< Sectors written to the medium */
+    uint32_t medium_writes;                 /*!< Write calls issued to the medium; medium_sectors / medium_writes is the coalescing ratio */
+    uint32_t longest_write;                 /*!< Largest single medium write, in sectors */
+    uint32_t flush_sync;                    /*!< Flushes on SCSI SYNCHRONIZE CACHE or when the host allows medium removal */
+    uint32_t flush_idle;                    /*!< Flushes after CONFIG_TINYUSB_MSC_CACHE_IDLE_MS without host writes */
+    uint32_t flush_full;                    /*!< Flushes because the cache filled up */
+    uint32_t flush_seek;                    /*!< Flushes because a write did not continue the cached run, or an access could not use the cache */
+    uint32_t flush_unmount;                 /*!< Flushes when the storage was handed back to the application */
+    uint32_t errors;                        /*!< Medium writes that failed; their sectors are dropped */
+} tinyusb_msc_cache_stats_t;
+
+/**
+ * @brief Read-ahead statistics
+ *
+ * Sequential host reads are detected per LUN and the following sectors are read from the medium
+ * by a background task, so later reads are served from memory. hit_sectors / read_sectors is the hit rate.
+ * Counters accumulate from storage creation.
+ */
+typedef struct {
+    uint64_t read_sectors;                  /*!< Sectors read by the USB host */
+    uint64_t hit_sectors;                   /*!< Sectors served from a read-ahead window */
+    uint64_t wait_sectors;                  /*!< Hits that had to wait for the read-ahead in flight; included in hit_sectors */
+    uint64_t miss_sectors;                  /*!< Sectors read from the medium on demand */
+    uint64_t prefetch_sectors;              /*!< Sectors read ahead */
+    uint32_t prefetches;                    /*!< Read-ahead medium reads */
+    uint32_t streams;                       /*!< Sequential streams detected */
+    uint32_t invalidations;                 /*!< Read-ahead windows dropped because the medium was written or taken by the application */
+    uint32_t errors;                        /*!< Read-ahead medium reads that failed; the host then reads on demand */
+} tinyusb_msc_readahead_stats_t;
+
+/**
+ * @brief Host I/O statistics of the MSC driver, for all LUNs
+ *
+ * Measured at the TinyUSB READ10/WRITE10 callbacks the same way with and without CONFIG_TINYUSB_MSC_ASYNC,
+ * so both paths can be compared on the same card. Only time the host was actually transferring counts:
+ * a gap of more than 50 ms between two callbacks ends a burst. tinyusb_rate_kbps() turns read_bytes and
+ * read_active_us into the read throughput.
+ * Counters accumulate from driver installation.
+ */
+typedef struct {
+    uint64_t read_bytes;                    /*!< Bytes sent to the USB host */
+    uint64_t write_bytes;                   /*!< Bytes received from the USB host */
+    uint64_t read_active_us;                /*!< Time spent in read bursts */
+    uint64_t write_active_us;               /*!< Time spent in write bursts */
+    uint64_t worker_busy_us;                /*!< Time the storage worker spent on the medium; 0 without CONFIG_TINYUSB_MSC_ASYNC */
+    uint32_t write_stalls;                  /*!< Write packets that found every write buffer in use and held the endpoint */
+    uint32_t max_queued;                    /*!< Deepest storage worker queue seen */
+    uint32_t errors;                        /*!< Worker medium accesses that failed */
+} tinyusb_msc_io_stats_t;
+
 /**
  * @brief MSC event callback function type
  *
@@ -115,6 +177,30 @@ typedef struct {
                                              */
 } tinyusb_msc_storage_config_t;
 
+/**
+ * @brief Read callback of a virtual storage medium
+ *
+ * Called from the TinyUSB task, or from the storage worker with CONFIG_TINYUSB_MSC_ASYNC.
+ *
+ * @param[in] lba First sector to read.
+ * @param[in] count Number of sectors to read.
+ * @param[out] dest Buffer for count sectors.
+ * @param[in] arg Argument from tinyusb_msc_virtual_config_t.
+ *
+ * @return ESP_OK, or an error reported to the host as a failed read
+ */
+typedef esp_err_t (*tinyusb_msc_virtual_read_cb_t)(uint32_t lba, uint32_t count, void *dest, void *arg);
+
+/**
+ * @brief Configuration of a read-only virtual storage medium
+ */
+typedef struct {
+    uint32_t sector_count;                  /*!< Size of the medium in sectors, as reported to the host. */
+    uint32_t sector_size;                   /*!< Sector size in bytes, must divide CONFIG_TINYUSB_MSC_BUFSIZE. */
+    tinyusb_msc_virtual_read_cb_t read;     /*!< Produces the sectors the host reads. */
+    void *arg;                              /*!< Argument passed to the read callback. */
+} tinyusb_msc_virtual_config_t;
+
 typedef struct {
     union {
         struct {
@@ -199,6 +285,30 @@ esp_err_t tinyusb_msc_new_storage_spiflash(const tinyusb_msc_storage_config_t *c
 esp_err_t tinyusb_msc_new_storage_sdmmc(const tinyusb_msc_storage_config_t *config, tinyusb_msc_storage_handle_t *handle);
 #endif // SOC_SDMMC_HOST_SUPPORTED
 
+/**
+ * @brief Initialize TinyUSB MSC with a read-only virtual storage
+ *
+ * Adds a LUN whose sectors are produced by the application's read callback, e.g. a filesystem view synthesized
+ * from data on another medium. The host sees it write protected. The virtual storage has no filesystem for the
+ * application: TINYUSB_MSC_STORAGE_MOUNT_APP only hides the medium from the host (MEDIUM NOT PRESENT) while the
+ * application changes what the callback returns, and TINYUSB_MSC_STORAGE_MOUNT_USB publishes it again with a
+ * UNIT ATTENTION, so the host rereads it. The storage starts hidden and is not switched by the automatic
+ * mount on USB connection.
+ *
+ * @note Create the storage before the TinyUSB driver is installed; the host reads the number of LUNs once.
+ *
+ * @param[in] config Pointer to the virtual medium configuration.
+ * @param[out] handle Pointer to the storage handle
+ *
+ * @return
+ *    - ESP_OK: Initialization successful
+ *    - ESP_ERR_INVALID_ARG: Invalid input argument
+ *    - ESP_ERR_INVALID_STATE: A virtual storage already exists
+ *    - ESP_ERR_NO_MEM: Not enough memory to initialize storage
+ *    - ESP_FAIL: Failed to map storage to LUN
+ */
+esp_err_t tinyusb_msc_new_storage_virtual(const tinyusb_msc_virtual_config_t *config, tinyusb_msc_storage_handle_t *handle);
+
 /**
  * @brief Delete TinyUSB MSC Storage
  *
@@ -268,6 +378,8 @@ esp_err_t tinyusb_msc_config_storage_fat_fs(tinyusb_msc_storage_handle_t handle,
  * @brief Set the mount point for the storage media
  *
  * This function sets the mount point for the storage media, which determines whether the storage is exposed to the USB host or used by the application.
+ * The device stays enumerated: while the application owns the medium, the host gets MEDIUM NOT PRESENT, and
+ * a UNIT ATTENTION (medium may have changed) on its first TEST UNIT READY once the medium is back.
  *
  * @param[in] handle Storage handle, obtained during storage creation.
  * @param[in] mount_point The mount point to set, either TINYUSB_MSC_STORAGE_MOUNT_USB or TINYUSB_MSC_STORAGE_MOUNT_APP.
@@ -275,6 +387,7 @@ esp_err_t tinyusb_msc_config_storage_fat_fs(tinyusb_msc_storage_handle_t handle,
  * @return
  *   - ESP_OK: Mount point set successfully
  *   - ESP_ERR_INVALID_STATE: Driver is not installed or storage wasn't created
+ *   - Other: Mounting or unmounting the filesystem failed; the mount point is unchanged
  */
 esp_err_t tinyusb_msc_set_storage_mount_point(tinyusb_msc_storage_handle_t handle,
                                               tinyusb_msc_mount_point_t mount_point);
@@ -321,6 +434,44 @@ esp_err_t tinyusb_msc_get_storage_sector_size(tinyusb_msc_storage_handle_t handl
 esp_err_t tinyusb_msc_get_storage_mount_point(tinyusb_msc_storage_handle_t handle,
                                               tinyusb_msc_mount_point_t *mount_point);
 
+/**
+ * @brief Get write-back cache statistics
+ *
+ * @param[in] handle Storage handle, obtained during storage creation.
+ * @param[out] stats Pointer to store the cache statistics. All zero when the cache is disabled.
+ *
+ * @return
+ *    - ESP_OK: Statistics retrieved successfully
+ *    - ESP_ERR_INVALID_ARG: Invalid input argument, stats pointer is NULL
+ *    - ESP_ERR_INVALID_STATE: MSC driver is not installed or storage is not initialized
+ */
+esp_err_t tinyusb_msc_get_cache_stats(tinyusb_msc_storage_handle_t handle, tinyusb_msc_cache_stats_t *stats);
+
+/**
+ * @brief Get read-ahead statistics
+ *
+ * @param[in] handle Storage handle, obtained during storage creation.
+ * @param[out] stats Pointer to store the read-ahead statistics. Only read_sectors and miss_sectors count when read-ahead is disabled.
+ *
+ * @return
+ *    - ESP_OK: Statistics retrieved successfully
+ *    - ESP_ERR_INVALID_ARG: Invalid input argument, stats pointer is NULL
+ *    - ESP_ERR_INVALID_STATE: MSC driver is not installed or storage is not initialized
+ */
+esp_err_t tinyusb_msc_get_readahead_stats(tinyusb_msc_storage_handle_t handle, tinyusb_msc_readahead_stats_t *stats);
+
+/**
+ * @brief Get host I/O statistics
+ *
+ * @param[out] stats Pointer to store the I/O statistics.
+ *
+ * @return
+ *    - ESP_OK: Statistics retrieved successfully
+ *    - ESP_ERR_INVALID_ARG: Invalid input argument, stats pointer is NULL
+ *    - ESP_ERR_INVALID_STATE: MSC driver is not installed
+ */
+esp_err_t tinyusb_msc_get_io_stats(tinyusb_msc_io_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,137 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define TINYUSB_MTP_NAME_MAX         64          /*!< Longest object name, terminating zero included */
+#define TINYUSB_MTP_STORAGE_ID       0x00010001  /*!< The only storage, first physical store */
+
+/**
+ * @brief Object listed by the storage backend
+ *
+ * Objects are files in the root of a single read-only storage. The object handle the host sees is the
+ * backend index plus one, so an index must keep naming the same file for as long as the device is connected.
+ */
+typedef struct {
+    char name[TINYUSB_MTP_NAME_MAX];        /*!< File name shown to the host */
+    uint64_t size;                          /*!< Size in bytes; objects of 4 GB or more are not listed */
+    uint16_t format;                        /*!< MTP object format code, e.g. 0x3008 for WAV or 0xB906 for FLAC */
+    int64_t mtime;                          /*!< Unix time of the file, 0 when unknown */
+} tinyusb_mtp_object_t;
+
+/**
+ * @brief Storage backend of the MTP responder
+ *
+ * count and get are called from the TinyUSB task. open and close are called from the TinyUSB task, read
+ * from the MTP stream worker; the responder never calls open, read and close concurrently and keeps at most
+ * one object open.
+ */
+typedef struct {
+    uint32_t (*count)(void *arg);                                   /*!< Number of objects */
+    esp_err_t (*get)(uint32_t index, tinyusb_mtp_object_t *object, void *arg); /*!< Describe object index */
+    esp_err_t (*open)(uint32_t index, void *arg);                   /*!< Open object index for reading */
+    esp_err_t (*read)(uint64_t offset, void *dest, size_t size, size_t *read_size, void *arg); /*!< Read from the open object.
+                                                                     *   offset is a multiple of 512 and dest is 64-byte aligned,
+                                                                     *   so a filesystem can read whole sectors straight into it. */
+    void (*close)(void *arg);                                       /*!< Close the open object */
+    esp_err_t (*capacity)(uint64_t *total_bytes, uint64_t *free_bytes, void *arg); /*!< Optional: size of the medium */
+} tinyusb_mtp_storage_ops_t;
+
+/**
+ * @brief Configuration of the MTP responder
+ */
+typedef struct {
+    tinyusb_mtp_storage_ops_t ops;          /*!< Storage backend */
+    void *arg;                              /*!< Passed to every backend callback */
+    const char *description;                /*!< Storage description shown by the host, NULL for "Storage" */
+    const char *manufacturer;               /*!< DeviceInfo strings, NULL for defaults */
+    const char *model;
+    const char *version;
+    const char *serial;
+} tinyusb_mtp_config_t;
+
+/**
+ * @brief Object transfer statistics of the MTP responder
+ *
+ * Measured from the GetObject or GetPartialObject command to the end of its data phase, so
+ * tinyusb_rate_kbps() of sent_bytes and active_us is the throughput the host saw, comparable with
+ * tinyusb_msc_io_stats_t. Counters accumulate from tinyusb_mtp_init().
+ */
+typedef struct {
+    uint64_t sent_bytes;                    /*!< Object data sent to the USB host */
+    uint64_t active_us;                     /*!< Time spent in object transfers */
+    uint64_t read_us;                       /*!< Time the stream worker spent in the backend read */
+    uint32_t objects;                       /*!< GetObject transfers */
+    uint32_t partial_objects;               /*!< GetPartialObject transfers */
+    uint32_t waits;                         /*!< Packets that waited for the stream worker */
+    uint32_t errors;                        /*!< Transfers ended by a backend error, a cancel or a reset */
+} tinyusb_mtp_stats_t;
+
+/**
+ * @brief Start the MTP responder
+ *
+ * Allocates the stream buffers (2 x CONFIG_TINYUSB_MTP_CHUNK_SIZE, PSRAM when available) and starts the
+ * stream worker. The configuration descriptor passed to tinyusb_driver_install() must carry an MTP interface,
+ * e.g. TUD_MTP_DESCRIPTOR(). Can be called before or after the driver is installed.
+ *
+ * @param[in] config Responder configuration; the strings must stay valid until tinyusb_mtp_deinit().
+ *
+ * @return
+ *    - ESP_OK: Responder started
+ *    - ESP_ERR_INVALID_ARG: Missing backend callback
+ *    - ESP_ERR_INVALID_STATE: Already started
+ *    - ESP_ERR_NO_MEM: No memory for the stream buffers or the worker
+ */
+esp_err_t tinyusb_mtp_init(const tinyusb_mtp_config_t *config);
+
+/**
+ * @brief Stop the MTP responder and free its buffers
+ *
+ * Uninstall the TinyUSB driver first; an object transfer in progress is abandoned.
+ *
+ * @return
+ *    - ESP_OK: Responder stopped
+ *    - ESP_ERR_INVALID_STATE: Not started
+ */
+esp_err_t tinyusb_mtp_deinit(void);
+
+/**
+ * @brief Tell the host that the backend lists a new object
+ *
+ * Sends an ObjectAdded event for the object with the given index, when a session is open.
+ *
+ * @param[in] index Backend index of the new object.
+ *
+ * @return
+ *    - ESP_OK: Event sent, or no session open
+ *    - ESP_ERR_INVALID_STATE: Not started
+ *    - ESP_FAIL: The event endpoint is busy
+ */
+esp_err_t tinyusb_mtp_object_added(uint32_t index);
+
+/**
+ * @brief Get object transfer statistics
+ *
+ * @param[out] stats Pointer to store the statistics.
+ *
+ * @return
+ *    - ESP_OK: Statistics retrieved successfully
+ *    - ESP_ERR_INVALID_ARG: Invalid input argument, stats pointer is NULL
+ *    - ESP_ERR_INVALID_STATE: Not started
+ */
+esp_err_t tinyusb_mtp_get_stats(tinyusb_mtp_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -47,6 +47,10 @@ extern "C" {
 #   define CONFIG_TINYUSB_MSC_ENABLED 0
 #endif
 
+#ifndef CONFIG_TINYUSB_MTP_ENABLED
+#   define CONFIG_TINYUSB_MTP_ENABLED 0
+#endif
+
 #ifndef CONFIG_TINYUSB_HID_COUNT
 #   define CONFIG_TINYUSB_HID_COUNT 0
 #endif
@@ -149,6 +153,38 @@ extern "C" {
 // MSC Buffer size of Device Mass storage
 #define CFG_TUD_MSC_BUFSIZE         CONFIG_TINYUSB_MSC_BUFSIZE
 
+// MTP endpoint buffer: one bulk transfer of a data phase
+#define CFG_TUD_MTP_EP_BUFSIZE          CONFIG_TINYUSB_MTP_EP_BUFSIZE
+#define CFG_TUD_MTP_EP_CONTROL_BUFSIZE  16
+
+// MTP device info of the read-only responder in tinyusb_mtp.c
+#define CFG_TUD_MTP_DEVICEINFO_EXTENSIONS   "microsoft.com: 1.0; "
+#define CFG_TUD_MTP_DEVICEINFO_SUPPORTED_OPERATIONS \
+    MTP_OP_GET_DEVICE_INFO, \
+    MTP_OP_OPEN_SESSION, \
+    MTP_OP_CLOSE_SESSION, \
+    MTP_OP_GET_STORAGE_IDS, \
+    MTP_OP_GET_STORAGE_INFO, \
+    MTP_OP_GET_NUM_OBJECTS, \
+    MTP_OP_GET_OBJECT_HANDLES, \
+    MTP_OP_GET_OBJECT_INFO, \
+    MTP_OP_GET_OBJECT, \
+    MTP_OP_GET_PARTIAL_OBJECT, \
+    MTP_OP_GET_DEVICE_PROP_DESC, \
+    MTP_OP_GET_DEVICE_PROP_VALUE
+#define CFG_TUD_MTP_DEVICEINFO_SUPPORTED_EVENTS \
+    MTP_EVENT_OBJECT_ADDED
+#define CFG_TUD_MTP_DEVICEINFO_SUPPORTED_DEVICE_PROPERTIES \
+    MTP_DEV_PROP_DEVICE_FRIENDLY_NAME
+#define CFG_TUD_MTP_DEVICEINFO_CAPTURE_FORMATS \
+    MTP_OBJ_FORMAT_UNDEFINED
+#define CFG_TUD_MTP_DEVICEINFO_PLAYBACK_FORMATS \
+    MTP_OBJ_FORMAT_UNDEFINED, \
+    MTP_OBJ_FORMAT_WAV, \
+    MTP_OBJ_FORMAT_FLAC, \
+    MTP_OBJ_FORMAT_OGG, \
+    MTP_OBJ_FORMAT_UNDEFINED_AUDIO
+
 // MIDI macros
 #define CFG_TUD_MIDI_EP_BUFSIZE     64
 #define CFG_TUD_MIDI_EPSIZE         CFG_TUD_MIDI_EP_BUFSIZE
@@ -168,6 +204,7 @@ extern "C" {
 // Enabled device class driver
 #define CFG_TUD_CDC                 CONFIG_TINYUSB_CDC_COUNT
 #define CFG_TUD_MSC                 CONFIG_TINYUSB_MSC_ENABLED
+#define CFG_TUD_MTP                 CONFIG_TINYUSB_MTP_ENABLED
 #define CFG_TUD_HID                 CONFIG_TINYUSB_HID_COUNT
 #define CFG_TUD_MIDI                CONFIG_TINYUSB_MIDI_COUNT
 #define CFG_TUD_VENDOR              CONFIG_TINYUSB_VENDOR_COUNT
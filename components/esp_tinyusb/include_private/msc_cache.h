@@ -0,0 +1,108 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include "stdint.h"
+#include "esp_err.h"
+#include "msc_storage.h"
+#include "tinyusb_msc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Reason a cached run is written to the medium, for the statistics.
+ */
+typedef enum {
+    MSC_CACHE_FLUSH_SYNC = 0,       /*!< SCSI SYNCHRONIZE CACHE, or the host allowed medium removal */
+    MSC_CACHE_FLUSH_IDLE,           /*!< No host writes for the idle timeout */
+    MSC_CACHE_FLUSH_FULL,           /*!< The cache filled up */
+    MSC_CACHE_FLUSH_SEEK,           /*!< A write did not continue the cached run */
+    MSC_CACHE_FLUSH_UNMOUNT,        /*!< Storage handed back to the application */
+    MSC_CACHE_FLUSH_BYPASS,         /*!< An access the cache cannot serve, e.g. not sector aligned */
+} msc_cache_flush_reason_t;
+
+/**
+ * @brief Write-back cache holding one run of consecutive sectors.
+ *
+ * Hosts copy files as long sequential WRITE10 commands which arrive here one USB packet at a time.
+ * The cache appends each packet to the run and writes the whole run to the medium in one call,
+ * so SD cards see multi-block writes instead of a single-block write per packet.
+ * Only dirty data is held: once flushed the cache is empty, so the application never sees stale sectors.
+ *
+ * @note The caller serialises all calls, in tinyusb_msc.c with the storage mutex.
+ */
+typedef struct {
+    uint8_t *buf;                           /*!< capacity sectors; NULL when the cache is disabled */
+    uint32_t capacity;                      /*!< Size of buf in sectors */
+    uint32_t sector_size;                   /*!< Medium sector size in bytes */
+    uint32_t lba;                           /*!< First sector of the run */
+    uint32_t count;                         /*!< Sectors in the run, 0 when clean */
+    int64_t last_write_us;                  /*!< esp_timer time of the last host write */
+    tinyusb_msc_cache_stats_t stats;        /*!< Counters reported by tinyusb_msc_get_cache_stats() */
+} msc_cache_t;
+
+/**
+ * @brief Allocate the cache buffer, from PSRAM when available.
+ *
+ * @param[out] cache Cache to initialise.
+ * @param[in] capacity Cache size in sectors, 0 leaves the cache disabled.
+ * @param[in] sector_size Medium sector size in bytes.
+ *
+ * @return
+ *    - ESP_OK: Cache allocated, or disabled by a zero capacity
+ *    - ESP_ERR_NO_MEM: No memory for the buffer; the cache is left disabled
+ */
+esp_err_t msc_cache_init(msc_cache_t *cache, uint32_t capacity, uint32_t sector_size);
+
+/**
+ * @brief Free the cache buffer. Unflushed sectors are lost, flush first.
+ */
+void msc_cache_deinit(msc_cache_t *cache);
+
+/**
+ * @brief Check whether an access can go through the cache.
+ *
+ * The cache works in whole sectors; anything else must flush and go straight to the medium.
+ */
+bool msc_cache_accepts(const msc_cache_t *cache, uint32_t offset, size_t size);
+
+/**
+ * @brief Store host data in the cache, writing out the previous run if this one does not continue it.
+ *
+ * @return
+ *    - ESP_OK: Data cached, or written through when larger than the cache
+ *    - Other: Error of the medium write; the sectors of the failed run are dropped
+ */
+esp_err_t msc_cache_write(msc_cache_t *cache, const storage_medium_t *medium, uint32_t lba, size_t size, const void *src);
+
+/**
+ * @brief Check whether every sector of a read is in the cache, so the medium need not be read.
+ */
+bool msc_cache_covers(const msc_cache_t *cache, uint32_t lba, size_t size);
+
+/**
+ * @brief Copy the sectors of a read that are still in the cache over the data read from the medium.
+ *
+ * Cached sectors are newer than the medium, and than any read-ahead taken from it.
+ */
+void msc_cache_overlay(msc_cache_t *cache, uint32_t lba, size_t size, void *dest);
+
+/**
+ * @brief Write the cached run to the medium in one call and empty the cache.
+ *
+ * @return
+ *    - ESP_OK: Cache was clean or has been written
+ *    - Other: Error of the medium write; the sectors are dropped so a failing card does not block the cache
+ */
+esp_err_t msc_cache_flush(msc_cache_t *cache, const storage_medium_t *medium, msc_cache_flush_reason_t reason);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,113 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include "stdint.h"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "msc_storage.h"
+#include "tinyusb_msc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Read-ahead window: a run of sectors read from the medium ahead of the host.
+ */
+typedef struct {
+    uint32_t lba;                           /*!< First sector held */
+    uint32_t count;                         /*!< Sectors held */
+    bool valid;                             /*!< Data matches the medium */
+} msc_readahead_window_t;
+
+/**
+ * @brief Sequential read-ahead for one storage medium.
+ *
+ * TinyUSB asks for READ10 data one endpoint buffer (512 bytes on the S3) at a time, so a host copying
+ * a long file would otherwise issue one single-sector card read per packet. Once a few reads in a row
+ * continue each other, a worker task reads the next window of sectors in one multi-sector read while
+ * the host is served from the current window (ping-pong). A window is refilled as soon as the host
+ * starts on the other one, so the card read overlaps the USB transfer.
+ *
+ * The worker reads the medium without the storage mutex; the SDMMC host driver serialises commands.
+ * Anything that writes the medium must call msc_readahead_invalidate() afterwards.
+ *
+ * @note Reads are serialised by the caller, in tinyusb_msc.c with the storage mutex.
+ */
+typedef struct {
+    const storage_medium_t *medium;         /*!< Medium read on misses and by the worker */
+    uint8_t *buf;                           /*!< Two windows of depth sectors; NULL when read-ahead is disabled */
+    uint32_t depth;                         /*!< Window size in sectors */
+    uint32_t sector_size;                   /*!< Medium sector size in bytes */
+    uint32_t sector_count;                  /*!< Medium size in sectors, read-ahead stops at the end */
+    uint32_t trigger;                       /*!< Sequential reads in a row that start read-ahead */
+    msc_readahead_window_t win[2];          /*!< Windows backed by buf */
+    uint8_t cur;                            /*!< Window the host is reading from; the worker only fills the other one */
+    bool filling;                           /*!< Worker is reading into win[!cur] */
+    uint32_t fill_lba;                      /*!< First sector of the fill in flight */
+    uint32_t fill_count;                    /*!< Sectors of the fill in flight */
+    uint32_t generation;                    /*!< Bumped by invalidation; a fill started before is dropped */
+    uint32_t next_lba;                      /*!< Sector after the last host read, for stream detection */
+    uint32_t streak;                        /*!< Host reads in a row continuing the previous one */
+    SemaphoreHandle_t lock;                 /*!< Protects the fields above against the worker */
+    SemaphoreHandle_t done;                 /*!< Given by the worker after each fill */
+    TaskHandle_t task;                      /*!< Worker task */
+    tinyusb_msc_readahead_stats_t stats;    /*!< Counters reported by tinyusb_msc_get_readahead_stats(). Protected by lock. */
+} msc_readahead_t;
+
+/**
+ * @brief Allocate the windows, from PSRAM when available, and start the worker.
+ *
+ * @param[out] ra Read-ahead to initialise.
+ * @param[in] medium Storage medium.
+ * @param[in] depth Window size in sectors, 0 leaves read-ahead disabled and all reads go to the medium.
+ * @param[in] sector_size Medium sector size in bytes.
+ * @param[in] sector_count Medium size in sectors.
+ *
+ * @return
+ *    - ESP_OK: Read-ahead started, or disabled by a zero depth
+ *    - ESP_ERR_NO_MEM: No memory for the windows or the worker; read-ahead is left disabled
+ */
+esp_err_t msc_readahead_init(msc_readahead_t *ra, const storage_medium_t *medium,
+                             uint32_t depth, uint32_t sector_size, uint32_t sector_count);
+
+/**
+ * @brief Stop the worker and free the windows.
+ */
+void msc_readahead_deinit(msc_readahead_t *ra);
+
+/**
+ * @brief Read whole sectors for the host, from a window when possible, otherwise from the medium.
+ *
+ * @return
+ *    - ESP_OK: Data read
+ *    - Other: Error of the medium read
+ */
+esp_err_t msc_readahead_read(msc_readahead_t *ra, uint32_t lba, size_t size, void *dest);
+
+/**
+ * @brief Drop all windows after the medium was written. A fill in flight is dropped when it completes.
+ */
+void msc_readahead_invalidate(msc_readahead_t *ra);
+
+/**
+ * @brief Drop all windows and wait for the worker to leave the medium, before the application takes it.
+ */
+void msc_readahead_quiesce(msc_readahead_t *ra);
+
+/**
+ * @brief Copy the statistics.
+ */
+void msc_readahead_get_stats(msc_readahead_t *ra, tinyusb_msc_readahead_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
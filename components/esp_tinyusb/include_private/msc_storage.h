@@ -25,6 +25,7 @@ extern "C" {
 typedef enum {
     STORAGE_MEDIUM_TYPE_SPIFLASH = 0, /*!< Storage type is SPI flash with wear leveling. */
     STORAGE_MEDIUM_TYPE_SDMMC,        /*!< Storage type is SDMMC card. */
+    STORAGE_MEDIUM_TYPE_VIRTUAL,      /*!< Read-only storage produced by the application, see tinyusb_msc_new_storage_virtual(). */
 } storage_medium_type_t;
 
 /**
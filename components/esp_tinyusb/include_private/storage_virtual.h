@@ -0,0 +1,40 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <string.h>
+#include "stdint.h"
+#include "esp_err.h"
+#include "msc_storage.h"
+#include "tinyusb_msc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Open a read-only virtual storage medium
+ *
+ * This function returns a storage API whose sectors are produced by the application's read callback.
+ * The medium cannot be written and cannot be mounted to the application.
+ *
+ * @note Only one virtual medium can be opened at a time.
+ * To open a new virtual medium, the previous one must be closed first.
+ *
+ * @param[in] config Pointer to the virtual medium configuration.
+ * @param[out] medium Pointer to the storage medium.
+ *
+ * @return
+ *    - ESP_OK: Storage API returned successfully.
+ *    - ESP_ERR_INVALID_ARG: Invalid argument, config or medium is NULL, or the config is incomplete.
+ *    - ESP_ERR_INVALID_STATE: A virtual medium is already open.
+ */
+esp_err_t storage_virtual_open_medium(const tinyusb_msc_virtual_config_t *config, const storage_medium_t **medium);
+
+#ifdef __cplusplus
+}
+#endif
@@ -55,6 +55,15 @@ esp_err_t tinyusb_task_start(tinyusb_port_t port, const tinyusb_task_config_t *t
  */
 esp_err_t tinyusb_task_stop(void);
 
+/**
+ * @brief Port the TinyUSB stack was started on
+ *
+ * For the class code that queues transfers of its own on the endpoints of its interface.
+ *
+ * @return Peripheral port number, 0 when the TinyUSB Task is not running
+ */
+uint8_t tinyusb_task_get_port(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,178 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <inttypes.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "msc_cache.h"
+
+static const char *TAG = "msc_cache";
+
+// PSRAM buffers must be cache line aligned for the SDMMC DMA, otherwise sdmmc_write_sectors()
+// bounces the data through an internal buffer one sector at a time and the coalescing is lost.
+#define MSC_CACHE_BUF_ALIGN 64
+
+esp_err_t msc_cache_init(msc_cache_t *cache, uint32_t capacity, uint32_t sector_size)
+{
+    memset(cache, 0, sizeof(*cache));
+    cache->sector_size = sector_size;
+    if (capacity == 0 || sector_size == 0) {
+        return ESP_OK;
+    }
+
+    const size_t size = (size_t)capacity * sector_size;
+    cache->buf = heap_caps_aligned_alloc(MSC_CACHE_BUF_ALIGN, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (cache->buf == NULL) {
+        cache->buf = heap_caps_aligned_alloc(MSC_CACHE_BUF_ALIGN, size, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    }
+    if (cache->buf == NULL) {
+        ESP_LOGW(TAG, "No memory for a %u KB write cache, writing through", (unsigned)(size / 1024));
+        return ESP_ERR_NO_MEM;
+    }
+    cache->capacity = capacity;
+    ESP_LOGD(TAG, "Write cache of %"PRIu32" sectors", capacity);
+    return ESP_OK;
+}
+
+void msc_cache_deinit(msc_cache_t *cache)
+{
+    if (cache->count) {
+        ESP_LOGW(TAG, "Dropping %"PRIu32" unflushed sectors", cache->count);
+    }
+    heap_caps_free(cache->buf);
+    cache->buf = NULL;
+    cache->capacity = 0;
+    cache->count = 0;
+}
+
+bool msc_cache_accepts(const msc_cache_t *cache, uint32_t offset, size_t size)
+{
+    return cache->buf != NULL && offset == 0 && size != 0 && (size % cache->sector_size) == 0;
+}
+
+/**
+ * @brief Write sectors to the medium in one call and account for it.
+ */
+static esp_err_t msc_cache_medium_write(msc_cache_t *cache, const storage_medium_t *medium,
+                                        uint32_t lba, uint32_t sectors, const void *src)
+{
+    esp_err_t ret = medium->write(lba, 0, (size_t)sectors * cache->sector_size, src);
+    if (ret != ESP_OK) {
+        cache->stats.errors++;
+        ESP_LOGE(TAG, "Write of %"PRIu32" sectors at %"PRIu32" failed, %s", sectors, lba, esp_err_to_name(ret));
+        return ret;
+    }
+    cache->stats.medium_writes++;
+    cache->stats.medium_sectors += sectors;
+    if (sectors > cache->stats.longest_write) {
+        cache->stats.longest_write = sectors;
+    }
+    return ESP_OK;
+}
+
+esp_err_t msc_cache_flush(msc_cache_t *cache, const storage_medium_t *medium, msc_cache_flush_reason_t reason)
+{
+    if (cache->count == 0) {
+        return ESP_OK;
+    }
+
+    switch (reason) {
+    case MSC_CACHE_FLUSH_SYNC:
+        cache->stats.flush_sync++;
+        break;
+    case MSC_CACHE_FLUSH_IDLE:
+        cache->stats.flush_idle++;
+        break;
+    case MSC_CACHE_FLUSH_FULL:
+        cache->stats.flush_full++;
+        break;
+    case MSC_CACHE_FLUSH_SEEK:
+    case MSC_CACHE_FLUSH_BYPASS:
+        cache->stats.flush_seek++;
+        break;
+    case MSC_CACHE_FLUSH_UNMOUNT:
+        cache->stats.flush_unmount++;
+        break;
+    }
+
+    const uint32_t count = cache->count;
+    // Empty the cache even if the write fails: retrying a run the card rejects would stall every later write.
+    cache->count = 0;
+    return msc_cache_medium_write(cache, medium, cache->lba, count, cache->buf);
+}
+
+esp_err_t msc_cache_write(msc_cache_t *cache, const storage_medium_t *medium, uint32_t lba, size_t size, const void *src)
+{
+    const uint32_t sectors = size / cache->sector_size;
+    esp_err_t ret;
+
+    cache->stats.write_sectors += sectors;
+    cache->last_write_us = esp_timer_get_time();
+
+    // Joins the run if it starts inside it or right after it and still fits, e.g. the next packet of a
+    // WRITE10 or a FAT sector written twice within one copy.
+    if (cache->count && lba >= cache->lba && lba <= cache->lba + cache->count
+            && (uint64_t)(lba - cache->lba) + sectors <= cache->capacity) {
+        const uint32_t at = lba - cache->lba;
+        const uint32_t end = at + sectors;
+        const uint32_t overlap = (end < cache->count ? end : cache->count) - at;
+        memcpy(cache->buf + (size_t)at * cache->sector_size, src, size);
+        cache->stats.write_hits += overlap;
+        if (end > cache->count) {
+            cache->count = end;
+        }
+    } else {
+        if (cache->count) {
+            const bool sequential = (lba == cache->lba + cache->count);
+            ret = msc_cache_flush(cache, medium, sequential ? MSC_CACHE_FLUSH_FULL : MSC_CACHE_FLUSH_SEEK);
+            if (ret != ESP_OK) {
+                return ret;
+            }
+        }
+        if (sectors > cache->capacity) {
+            return msc_cache_medium_write(cache, medium, lba, sectors, src);
+        }
+        memcpy(cache->buf, src, size);
+        cache->lba = lba;
+        cache->count = sectors;
+    }
+
+    // Write a full cache out now rather than on the next packet, the host is still sending.
+    if (cache->count == cache->capacity) {
+        return msc_cache_flush(cache, medium, MSC_CACHE_FLUSH_FULL);
+    }
+    return ESP_OK;
+}
+
+bool msc_cache_covers(const msc_cache_t *cache, uint32_t lba, size_t size)
+{
+    const uint32_t sectors = size / cache->sector_size;
+    return cache->count && lba >= cache->lba && (uint64_t)lba + sectors <= (uint64_t)cache->lba + cache->count;
+}
+
+void msc_cache_overlay(msc_cache_t *cache, uint32_t lba, size_t size, void *dest)
+{
+    if (cache->buf == NULL) {
+        return;
+    }
+    const uint32_t sectors = size / cache->sector_size;
+    cache->stats.read_sectors += sectors;
+
+    // Intersection of the request with the run
+    const uint32_t run_end = cache->lba + cache->count;
+    const uint32_t start = lba > cache->lba ? lba : cache->lba;
+    const uint32_t end = (lba + sectors) < run_end ? (lba + sectors) : run_end;
+    if (cache->count == 0 || start >= end) {
+        return;
+    }
+    memcpy((uint8_t *)dest + (size_t)(start - lba) * cache->sector_size,
+           cache->buf + (size_t)(start - cache->lba) * cache->sector_size,
+           (size_t)(end - start) * cache->sector_size);
+    cache->stats.read_hits += end - start;
+}
@@ -0,0 +1,269 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <inttypes.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "sdkconfig.h"
+#include "msc_readahead.h"
+
+static const char *TAG = "msc_readahead";
+
+#define MSC_READAHEAD_BUF_ALIGN     64      // Cache line, so the SDMMC DMA can fill PSRAM directly
+#define MSC_READAHEAD_TASK_SIZE     3072
+#define MSC_READAHEAD_TASK_PRIO     5       // Same as the default TinyUSB task, which waits on the worker
+
+/**
+ * @brief Worker task: reads the window requested by msc_readahead_start_fill() into win[!cur].
+ *
+ * @param arg Pointer to the read-ahead object.
+ */
+static void msc_readahead_task(void *arg)
+{
+    msc_readahead_t *ra = (msc_readahead_t *)arg;
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        xSemaphoreTake(ra->lock, portMAX_DELAY);
+        if (!ra->filling) {
+            xSemaphoreGive(ra->lock);
+            continue;
+        }
+        const uint8_t slot = !ra->cur;
+        const uint32_t lba = ra->fill_lba;
+        const uint32_t count = ra->fill_count;
+        const uint32_t generation = ra->generation;
+        xSemaphoreGive(ra->lock);
+
+        uint8_t *dest = ra->buf + (size_t)slot * ra->depth * ra->sector_size;
+        esp_err_t err = ra->medium->read(lba, 0, (size_t)count * ra->sector_size, dest);
+
+        xSemaphoreTake(ra->lock, portMAX_DELAY);
+        ra->filling = false;
+        if (err != ESP_OK) {
+            ra->stats.errors++;
+        } else if (generation == ra->generation) {
+            ra->win[slot].lba = lba;
+            ra->win[slot].count = count;
+            ra->win[slot].valid = true;
+            ra->stats.prefetches++;
+            ra->stats.prefetch_sectors += count;
+        }
+        xSemaphoreGive(ra->lock);
+        xSemaphoreGive(ra->done);
+
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Read-ahead of %"PRIu32" sectors at %"PRIu32" failed, %s", count, lba, esp_err_to_name(err));
+        }
+    }
+}
+
+esp_err_t msc_readahead_init(msc_readahead_t *ra, const storage_medium_t *medium,
+                             uint32_t depth, uint32_t sector_size, uint32_t sector_count)
+{
+    memset(ra, 0, sizeof(*ra));
+    ra->medium = medium;
+    ra->sector_size = sector_size;
+    ra->sector_count = sector_count;
+    ra->trigger = CONFIG_TINYUSB_MSC_READAHEAD_TRIGGER;
+    if (depth == 0 || sector_size == 0) {
+        return ESP_OK;
+    }
+
+    const size_t size = 2 * (size_t)depth * sector_size;
+    ra->buf = heap_caps_aligned_alloc(MSC_READAHEAD_BUF_ALIGN, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (ra->buf == NULL) {
+        ra->buf = heap_caps_aligned_alloc(MSC_READAHEAD_BUF_ALIGN, size, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    }
+    ra->lock = xSemaphoreCreateMutex();
+    ra->done = xSemaphoreCreateBinary();
+    if (ra->buf == NULL || ra->lock == NULL || ra->done == NULL) {
+        goto fail;
+    }
+    ra->depth = depth;
+    if (xTaskCreate(msc_readahead_task, "msc_readahead", MSC_READAHEAD_TASK_SIZE, ra,
+                    MSC_READAHEAD_TASK_PRIO, &ra->task) != pdPASS) {
+        goto fail;
+    }
+    ESP_LOGD(TAG, "Read-ahead of 2 x %"PRIu32" sectors", depth);
+    return ESP_OK;
+
+fail:
+    ESP_LOGW(TAG, "No memory for a %u KB read-ahead, reading on demand", (unsigned)(size / 1024));
+    msc_readahead_deinit(ra);
+    return ESP_ERR_NO_MEM;
+}
+
+void msc_readahead_deinit(msc_readahead_t *ra)
+{
+    if (ra->task) {
+        msc_readahead_quiesce(ra);
+        vTaskDelete(ra->task);
+        ra->task = NULL;
+    }
+    if (ra->lock) {
+        vSemaphoreDelete(ra->lock);
+        ra->lock = NULL;
+    }
+    if (ra->done) {
+        vSemaphoreDelete(ra->done);
+        ra->done = NULL;
+    }
+    heap_caps_free(ra->buf);
+    ra->buf = NULL;
+    ra->depth = 0;
+}
+
+/**
+ * @brief Ask the worker to read the window starting at lba into win[!cur]. Called with the lock held.
+ */
+static void msc_readahead_start_fill(msc_readahead_t *ra, uint32_t lba)
+{
+    if (ra->filling || lba >= ra->sector_count) {
+        return;
+    }
+    const uint32_t left = ra->sector_count - lba;
+    ra->win[!ra->cur].valid = false;
+    ra->fill_lba = lba;
+    ra->fill_count = left < ra->depth ? left : ra->depth;
+    ra->filling = true;
+    xTaskNotifyGive(ra->task);
+}
+
+/**
+ * @brief Check whether a window holds a sector.
+ */
+static inline bool msc_readahead_window_has(const msc_readahead_window_t *win, uint32_t lba)
+{
+    return win->valid && lba >= win->lba && lba - win->lba < win->count;
+}
+
+esp_err_t msc_readahead_read(msc_readahead_t *ra, uint32_t lba, size_t size, void *dest)
+{
+    uint32_t sectors = size / ra->sector_size;
+
+    if (ra->buf == NULL) {
+        ra->stats.read_sectors += sectors;
+        ra->stats.miss_sectors += sectors;
+        return ra->medium->read(lba, 0, size, dest);
+    }
+
+    uint8_t *out = (uint8_t *)dest;
+    bool waited = false;
+
+    xSemaphoreTake(ra->lock, portMAX_DELAY);
+    ra->stats.read_sectors += sectors;
+    if (lba == ra->next_lba) {
+        if (++ra->streak == ra->trigger) {
+            ra->stats.streams++;
+        }
+    } else {
+        ra->streak = 0;
+    }
+    ra->next_lba = lba + sectors;
+
+    // Serve what the windows hold; a request may end in the current window and continue in the next one.
+    while (sectors > 0) {
+        msc_readahead_window_t *win = &ra->win[ra->cur];
+        if (!msc_readahead_window_has(win, lba)) {
+            msc_readahead_window_t *next = &ra->win[!ra->cur];
+            if (msc_readahead_window_has(next, lba)) {
+                // The host moved on to the prefetched window, the old one becomes the fill target
+                ra->cur = !ra->cur;
+                win = next;
+            } else if (ra->filling && lba - ra->fill_lba < ra->fill_count) {
+                // The sector is on its way; waiting is shorter than a read of its own
+                xSemaphoreGive(ra->lock);
+                xSemaphoreTake(ra->done, portMAX_DELAY);
+                xSemaphoreTake(ra->lock, portMAX_DELAY);
+                waited = true;
+                continue;
+            } else {
+                break;
+            }
+        }
+        const uint32_t avail = win->lba + win->count - lba;
+        const uint32_t n = sectors < avail ? sectors : avail;
+        memcpy(out, ra->buf + ((size_t)ra->cur * ra->depth + (lba - win->lba)) * ra->sector_size,
+               (size_t)n * ra->sector_size);
+        ra->stats.hit_sectors += n;
+        if (waited) {
+            ra->stats.wait_sectors += n;
+        }
+        out += (size_t)n * ra->sector_size;
+        lba += n;
+        sectors -= n;
+
+        // Double buffering: refill the other window as soon as the host is reading this one
+        const uint32_t win_end = win->lba + win->count;
+        if (!msc_readahead_window_has(&ra->win[!ra->cur], win_end)) {
+            msc_readahead_start_fill(ra, win_end);
+        }
+    }
+
+    if (sectors == 0) {
+        xSemaphoreGive(ra->lock);
+        return ESP_OK;
+    }
+
+    ra->stats.miss_sectors += sectors;
+    const bool stream = ra->streak >= ra->trigger;
+    xSemaphoreGive(ra->lock);
+
+    esp_err_t ret = ra->medium->read(lba, 0, (size_t)sectors * ra->sector_size, out);
+
+    if (ret == ESP_OK && stream) {
+        xSemaphoreTake(ra->lock, portMAX_DELAY);
+        msc_readahead_start_fill(ra, lba + sectors);
+        xSemaphoreGive(ra->lock);
+    }
+    return ret;
+}
+
+void msc_readahead_invalidate(msc_readahead_t *ra)
+{
+    if (ra->buf == NULL) {
+        return;
+    }
+    xSemaphoreTake(ra->lock, portMAX_DELAY);
+    if (ra->win[0].valid || ra->win[1].valid || ra->filling) {
+        ra->stats.invalidations++;
+    }
+    ra->generation++;
+    ra->win[0].valid = false;
+    ra->win[1].valid = false;
+    ra->streak = 0;
+    xSemaphoreGive(ra->lock);
+}
+
+void msc_readahead_quiesce(msc_readahead_t *ra)
+{
+    if (ra->buf == NULL) {
+        return;
+    }
+    msc_readahead_invalidate(ra);
+    xSemaphoreTake(ra->lock, portMAX_DELAY);
+    while (ra->filling) {
+        xSemaphoreGive(ra->lock);
+        xSemaphoreTake(ra->done, portMAX_DELAY);
+        xSemaphoreTake(ra->lock, portMAX_DELAY);
+    }
+    xSemaphoreGive(ra->lock);
+}
+
+void msc_readahead_get_stats(msc_readahead_t *ra, tinyusb_msc_readahead_stats_t *stats)
+{
+    if (ra->lock == NULL) {
+        *stats = ra->stats;
+        return;
+    }
+    xSemaphoreTake(ra->lock, portMAX_DELAY);
+    *stats = ra->stats;
+    xSemaphoreGive(ra->lock);
+}
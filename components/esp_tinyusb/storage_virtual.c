@@ -0,0 +1,88 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <inttypes.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_check.h"
+#include "storage_virtual.h"
+
+static const char *TAG = "storage_virtual";
+
+static tinyusb_msc_virtual_config_t _vconfig;
+static bool _vopen = false;
+
+static esp_err_t storage_virtual_mount(BYTE pdrv)
+{
+    (void) pdrv;
+    // There is no filesystem for the application, it produces the sectors itself
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+static esp_err_t storage_virtual_unmount(void)
+{
+    return ESP_OK;
+}
+
+static esp_err_t storage_virtual_sector_read(uint32_t lba, uint32_t offset, size_t size, void *dest)
+{
+    assert(_vopen);
+    ESP_RETURN_ON_FALSE(offset == 0 && size % _vconfig.sector_size == 0, ESP_ERR_INVALID_SIZE, TAG,
+                        "Partial sector read, offset %"PRIu32" size %u", offset, (unsigned)size);
+    const uint32_t count = size / _vconfig.sector_size;
+    ESP_RETURN_ON_FALSE(lba < _vconfig.sector_count && count <= _vconfig.sector_count - lba, ESP_ERR_INVALID_ARG, TAG,
+                        "Read past the end, lba %"PRIu32" count %"PRIu32, lba, count);
+    return _vconfig.read(lba, count, dest, _vconfig.arg);
+}
+
+static esp_err_t storage_virtual_sector_write(uint32_t lba, uint32_t offset, size_t size, const void *src)
+{
+    (void) lba;
+    (void) offset;
+    (void) size;
+    (void) src;
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+static esp_err_t storage_virtual_get_info(storage_info_t *info)
+{
+    ESP_RETURN_ON_FALSE(info, ESP_ERR_INVALID_ARG, TAG, "Storage info pointer can't be NULL");
+
+    info->total_sectors = _vconfig.sector_count;
+    info->sector_size = _vconfig.sector_size;
+    return ESP_OK;
+}
+
+static void storage_virtual_close(void)
+{
+    memset(&_vconfig, 0, sizeof(_vconfig));
+    _vopen = false;
+}
+
+// Constant struct of function pointers
+const storage_medium_t virtual_storage_medium = {
+    .type = STORAGE_MEDIUM_TYPE_VIRTUAL,
+    .mount = &storage_virtual_mount,
+    .unmount = &storage_virtual_unmount,
+    .read = &storage_virtual_sector_read,
+    .write = &storage_virtual_sector_write,
+    .get_info = &storage_virtual_get_info,
+    .close = &storage_virtual_close,
+};
+
+esp_err_t storage_virtual_open_medium(const tinyusb_msc_virtual_config_t *config, const storage_medium_t **medium)
+{
+    ESP_RETURN_ON_FALSE(medium != NULL, ESP_ERR_INVALID_ARG, TAG, "Storage API pointer can't be NULL");
+    ESP_RETURN_ON_FALSE(config != NULL && config->read != NULL, ESP_ERR_INVALID_ARG, TAG, "Read callback can't be NULL");
+    ESP_RETURN_ON_FALSE(config->sector_size != 0 && config->sector_count != 0, ESP_ERR_INVALID_ARG, TAG, "Medium size can't be zero");
+    ESP_RETURN_ON_FALSE(!_vopen, ESP_ERR_INVALID_STATE, TAG, "Virtual medium already open");
+
+    _vconfig = *config;
+    _vopen = true;
+    *medium = &virtual_storage_medium;
+    return ESP_OK;
+}
@@ -0,0 +1,532 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "soc/soc_caps.h"
+
+#if SOC_USB_OTG_SUPPORTED
+//
+#include <stdio.h>
+#include <string.h>
+//
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+//
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+//
+#include "unity.h"
+#include "tinyusb.h"
+#include "tinyusb_msc.h"
+#include "msc_cache.h"
+#include "storage_common.h"
+//
+#include "test_msc_common.h"
+
+//
+// ========================== Test Configuration Parameters =====================================
+//
+
+#define TEST_SECTOR_SIZE            512
+#define TEST_CACHE_CAPACITY         8                   // Sectors in the cache under test
+#define TEST_MEDIUM_SECTORS         64                  // Sectors of the RAM medium behind it
+#define TEST_LUN                    0
+#define TEST_PACKET                 TEST_SECTOR_SIZE    // One READ10/WRITE10 callback in the order and error tests
+#define TEST_ORDER_PACKETS          40                  // More than the storage worker has write buffers
+#define TEST_BENCH_PACKET           CONFIG_TINYUSB_MSC_BUFSIZE  // Largest callback TinyUSB makes, as in a file copy
+#define TEST_BENCH_SPIFLASH_BYTES   (64 * 1024)
+#define TEST_BENCH_SDMMC_BYTES      (4 * 1024 * 1024)
+#define TEST_BENCH_SDMMC_LBA        32768               // 16 MB into the card, clear of the FAT
+#if CONFIG_TINYUSB_MSC_ASYNC
+// A packet the worker holds is written before its buffer comes round again: the ring is longer than the worker queue
+#define TEST_BENCH_RING             (CONFIG_TINYUSB_MSC_ASYNC_DEPTH + 8)
+#else
+#define TEST_BENCH_RING             1
+#endif // CONFIG_TINYUSB_MSC_ASYNC
+
+//
+// ========================== RAM medium for the write-back cache ==============================
+//
+
+static uint8_t *test_medium_data;
+static uint32_t test_medium_writes;
+static bool test_medium_fail;
+
+static esp_err_t test_medium_read(uint32_t lba, uint32_t offset, size_t size, void *dest)
+{
+    TEST_ASSERT_LESS_OR_EQUAL(TEST_MEDIUM_SECTORS * TEST_SECTOR_SIZE, lba * TEST_SECTOR_SIZE + offset + size);
+    memcpy(dest, test_medium_data + lba * TEST_SECTOR_SIZE + offset, size);
+    return ESP_OK;
+}
+
+static esp_err_t test_medium_write(uint32_t lba, uint32_t offset, size_t size, const void *src)
+{
+    if (test_medium_fail) {
+        return ESP_FAIL;
+    }
+    TEST_ASSERT_LESS_OR_EQUAL(TEST_MEDIUM_SECTORS * TEST_SECTOR_SIZE, lba * TEST_SECTOR_SIZE + offset + size);
+    memcpy(test_medium_data + lba * TEST_SECTOR_SIZE + offset, src, size);
+    test_medium_writes++;
+    return ESP_OK;
+}
+
+static const storage_medium_t test_medium = {
+    .type = STORAGE_MEDIUM_TYPE_SDMMC,
+    .read = test_medium_read,
+    .write = test_medium_write,
+};
+
+/**
+ * @brief Fill sectors with a pattern that identifies the sector and the write generation
+ */
+static void test_fill(uint8_t *buf, uint32_t lba, uint32_t sectors, uint8_t gen)
+{
+    for (uint32_t s = 0; s < sectors; s++) {
+        for (uint32_t i = 0; i < TEST_SECTOR_SIZE; i++) {
+            buf[s * TEST_SECTOR_SIZE + i] = (uint8_t)((lba + s) * 7 + gen * 31 + i);
+        }
+    }
+}
+
+/**
+ * @brief Check that a sector of the RAM medium holds the given generation
+ */
+static void test_medium_expect(uint32_t lba, uint8_t gen)
+{
+    uint8_t want[TEST_SECTOR_SIZE];
+    test_fill(want, lba, 1, gen);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(want, test_medium_data + lba * TEST_SECTOR_SIZE, TEST_SECTOR_SIZE);
+}
+
+/**
+ * @brief Write one sector through the cache
+ */
+static esp_err_t test_cache_put(msc_cache_t *cache, uint32_t lba, uint8_t gen)
+{
+    uint8_t buf[TEST_SECTOR_SIZE];
+    test_fill(buf, lba, 1, gen);
+    return msc_cache_write(cache, &test_medium, lba, sizeof(buf), buf);
+}
+
+/**
+ * @brief Write-back cache against a RAM medium
+ *
+ * Scenario:
+ * 1. Write 20 sectors one packet at a time: the medium sees two full 8-sector writes, 4 sectors stay cached.
+ * 2. Read across the medium and the cache: the overlay returns the cached sectors.
+ * 3. Rewrite a cached sector, then seek: the run is written once with the newest data.
+ * 4. Sync, then write through a write larger than the cache.
+ */
+TEST_CASE("MSC: write-back cache coalesces sequential writes", "[ci][cache]")
+{
+    test_medium_data = heap_caps_calloc(TEST_MEDIUM_SECTORS, TEST_SECTOR_SIZE, MALLOC_CAP_8BIT);
+    TEST_ASSERT_NOT_NULL(test_medium_data);
+    test_medium_writes = 0;
+    test_medium_fail = false;
+
+    msc_cache_t cache;
+    TEST_ASSERT_EQUAL(ESP_OK, msc_cache_init(&cache, TEST_CACHE_CAPACITY, TEST_SECTOR_SIZE));
+    TEST_ASSERT_NOT_NULL(cache.buf);
+    TEST_ASSERT_TRUE(msc_cache_accepts(&cache, 0, TEST_SECTOR_SIZE));
+    TEST_ASSERT_FALSE(msc_cache_accepts(&cache, 1, TEST_SECTOR_SIZE));
+    TEST_ASSERT_FALSE(msc_cache_accepts(&cache, 0, TEST_SECTOR_SIZE / 2));
+
+    for (uint32_t lba = 0; lba < 20; lba++) {
+        TEST_ASSERT_EQUAL(ESP_OK, test_cache_put(&cache, lba, 1));
+    }
+    TEST_ASSERT_EQUAL(2, test_medium_writes);
+    TEST_ASSERT_EQUAL(2, cache.stats.flush_full);
+    TEST_ASSERT_EQUAL(TEST_CACHE_CAPACITY, cache.stats.longest_write);
+    TEST_ASSERT_EQUAL(4, cache.count);
+    for (uint32_t lba = 0; lba < 16; lba++) {
+        test_medium_expect(lba, 1);
+    }
+
+    // Sectors 12..19: four from the medium, four only in the cache
+    static uint8_t read[8 * TEST_SECTOR_SIZE];
+    static uint8_t want[8 * TEST_SECTOR_SIZE];
+    TEST_ASSERT_TRUE(msc_cache_covers(&cache, 16, 4 * TEST_SECTOR_SIZE));
+    TEST_ASSERT_FALSE(msc_cache_covers(&cache, 12, sizeof(read)));
+    TEST_ASSERT_EQUAL(ESP_OK, test_medium_read(12, 0, sizeof(read), read));
+    msc_cache_overlay(&cache, 12, sizeof(read), read);
+    test_fill(want, 12, 8, 1);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(want, read, sizeof(read));
+    TEST_ASSERT_EQUAL(4, cache.stats.read_hits);
+
+    // A rewrite inside the run is absorbed; the seek writes the run once
+    TEST_ASSERT_EQUAL(ESP_OK, test_cache_put(&cache, 17, 2));
+    TEST_ASSERT_EQUAL(1, cache.stats.write_hits);
+    TEST_ASSERT_EQUAL(ESP_OK, test_cache_put(&cache, 40, 1));
+    TEST_ASSERT_EQUAL(1, cache.stats.flush_seek);
+    TEST_ASSERT_EQUAL(3, test_medium_writes);
+    test_medium_expect(16, 1);
+    test_medium_expect(17, 2);
+    test_medium_expect(19, 1);
+
+    TEST_ASSERT_EQUAL(ESP_OK, msc_cache_flush(&cache, &test_medium, MSC_CACHE_FLUSH_SYNC));
+    TEST_ASSERT_EQUAL(0, cache.count);
+    TEST_ASSERT_EQUAL(1, cache.stats.flush_sync);
+    test_medium_expect(40, 1);
+    // Flushing a clean cache does not touch the medium
+    TEST_ASSERT_EQUAL(ESP_OK, msc_cache_flush(&cache, &test_medium, MSC_CACHE_FLUSH_SYNC));
+    TEST_ASSERT_EQUAL(4, test_medium_writes);
+
+    // Larger than the cache: one write straight to the medium
+    static uint8_t big[(TEST_CACHE_CAPACITY + 2) * TEST_SECTOR_SIZE];
+    test_fill(big, 20, TEST_CACHE_CAPACITY + 2, 3);
+    TEST_ASSERT_EQUAL(ESP_OK, msc_cache_write(&cache, &test_medium, 20, sizeof(big), big));
+    TEST_ASSERT_EQUAL(5, test_medium_writes);
+    TEST_ASSERT_EQUAL(0, cache.count);
+    TEST_ASSERT_EQUAL(TEST_CACHE_CAPACITY + 2, cache.stats.longest_write);
+    test_medium_expect(20 + TEST_CACHE_CAPACITY + 1, 3);
+
+    TEST_ASSERT_EQUAL(20 + 1 + 1 + TEST_CACHE_CAPACITY + 2, cache.stats.write_sectors);
+    TEST_ASSERT_EQUAL(16 + 4 + 1 + TEST_CACHE_CAPACITY + 2, cache.stats.medium_sectors);
+    TEST_ASSERT_EQUAL(0, cache.stats.errors);
+
+    msc_cache_deinit(&cache);
+    heap_caps_free(test_medium_data);
+}
+
+/**
+ * @brief Write-back cache when the medium rejects a run
+ *
+ * Scenario:
+ * 1. Cache two sectors and fail the flush: the error is returned and the run is dropped.
+ * 2. The cache takes the next write and flushes it normally.
+ */
+TEST_CASE("MSC: write-back cache drops a failed run", "[ci][cache]")
+{
+    test_medium_data = heap_caps_calloc(TEST_MEDIUM_SECTORS, TEST_SECTOR_SIZE, MALLOC_CAP_8BIT);
+    TEST_ASSERT_NOT_NULL(test_medium_data);
+    test_medium_writes = 0;
+    test_medium_fail = false;
+
+    msc_cache_t cache;
+    TEST_ASSERT_EQUAL(ESP_OK, msc_cache_init(&cache, TEST_CACHE_CAPACITY, TEST_SECTOR_SIZE));
+    TEST_ASSERT_EQUAL(ESP_OK, test_cache_put(&cache, 50, 1));
+    TEST_ASSERT_EQUAL(ESP_OK, test_cache_put(&cache, 51, 1));
+
+    test_medium_fail = true;
+    TEST_ASSERT_NOT_EQUAL(ESP_OK, msc_cache_flush(&cache, &test_medium, MSC_CACHE_FLUSH_SYNC));
+    TEST_ASSERT_EQUAL(0, cache.count);
+    TEST_ASSERT_EQUAL(1, cache.stats.errors);
+    test_medium_fail = false;
+
+    TEST_ASSERT_EQUAL(ESP_OK, test_cache_put(&cache, 52, 1));
+    TEST_ASSERT_EQUAL(ESP_OK, msc_cache_flush(&cache, &test_medium, MSC_CACHE_FLUSH_SYNC));
+    TEST_ASSERT_EQUAL(1, test_medium_writes);
+    test_medium_expect(52, 1);
+    // The dropped run never reached the medium
+    const uint8_t zero[TEST_SECTOR_SIZE] = { 0 };
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(zero, test_medium_data + 50 * TEST_SECTOR_SIZE, TEST_SECTOR_SIZE);
+
+    msc_cache_deinit(&cache);
+    heap_caps_free(test_medium_data);
+}
+
+//
+// ========================== Host I/O through the TinyUSB callbacks ===========================
+//
+
+/**
+ * @brief Hand data to the WRITE10 callback one packet at a time, as TinyUSB does for one command
+ *
+ * @return Number of packets that returned an error
+ */
+static int test_io_write(uint32_t lba, const uint8_t *src, size_t size, uint32_t packet)
+{
+    int errors = 0;
+    for (size_t off = 0; off < size; off += packet) {
+        const int32_t ret = tud_msc_write10_cb(TEST_LUN, lba + off / TEST_SECTOR_SIZE, 0, (uint8_t *)src + off, packet);
+        if (ret < 0 && ret != TUD_MSC_RET_ASYNC) {
+            errors++;
+        } else {
+            TEST_ASSERT_TRUE(ret == (int32_t)packet || ret == TUD_MSC_RET_ASYNC);
+        }
+    }
+    return errors;
+}
+
+/**
+ * @brief Hand READ10 packets to the callback; with the storage worker the data is there after test_io_sync()
+ */
+static void test_io_read(uint32_t lba, uint8_t *dest, size_t size, uint32_t packet)
+{
+    for (size_t off = 0; off < size; off += packet) {
+        const int32_t ret = tud_msc_read10_cb(TEST_LUN, lba + off / TEST_SECTOR_SIZE, 0, dest + off, packet);
+        TEST_ASSERT_TRUE(ret == (int32_t)packet || ret == TUD_MSC_RET_ASYNC);
+    }
+}
+
+/**
+ * @brief Send SYNCHRONIZE CACHE(10): waits for the storage worker and flushes the write-back cache
+ *
+ * @return Callback result, negative when a write failed
+ */
+static int32_t test_io_sync(void)
+{
+    const uint8_t cmd[16] = { SCSI_CMD_SYNCHRONIZE_CACHE_10 };
+    return tud_msc_scsi_cb(TEST_LUN, cmd, NULL, 0);
+}
+
+/**
+ * @brief Install the MSC driver and expose the SPI Flash storage to USB, without a USB host
+ *
+ * The READ10/WRITE10 callbacks are called directly; with no transfer pending, tud_msc_async_io_done() does nothing.
+ */
+static void test_io_open_spiflash(wl_handle_t *wl_handle, tinyusb_msc_storage_handle_t *storage_hdl)
+{
+#if !CONFIG_TINYUSB_MSC_ASYNC && (CONFIG_TINYUSB_MSC_CACHE_SECTORS == 0)
+    // Writes are then deferred to the TinyUSB task, which only runs with the USB stack installed
+    TEST_IGNORE_MESSAGE("Needs CONFIG_TINYUSB_MSC_ASYNC or CONFIG_TINYUSB_MSC_CACHE_SECTORS");
+#endif
+    storage_init_spiflash(wl_handle);
+    TEST_ASSERT_NOT_EQUAL_MESSAGE(WL_INVALID_HANDLE, *wl_handle, "Wear leveling handle is invalid, check the partition configuration");
+
+    tinyusb_msc_driver_config_t driver_cfg = {
+        .callback = test_storage_event_cb,
+        .callback_arg = NULL,
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, tinyusb_msc_install_driver(&driver_cfg));
+
+    tinyusb_msc_storage_config_t config = {
+        .medium.wl_handle = *wl_handle,
+        .mount_point = TINYUSB_MSC_STORAGE_MOUNT_USB,       // Host access only, the filesystem stays unmounted
+        .fat_fs = {
+            .base_path = NULL,
+            .config.max_files = 5,
+            .format_flags = 0,
+        },
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, tinyusb_msc_new_storage_spiflash(&config, storage_hdl));
+}
+
+static void test_io_close_spiflash(wl_handle_t wl_handle, tinyusb_msc_storage_handle_t storage_hdl)
+{
+    TEST_ASSERT_EQUAL(ESP_OK, tinyusb_msc_delete_storage(storage_hdl));
+    TEST_ASSERT_EQUAL(ESP_OK, tinyusb_msc_uninstall_driver());
+    storage_deinit_spiflash(wl_handle);
+}
+
+/**
+ * @brief Storage worker keeps host packets in order
+ *
+ * Scenario:
+ * 1. Save the last sectors of the SPI Flash storage.
+ * 2. Write more packets than the worker has buffers, then rewrite the first ones: the later data must win.
+ * 3. Read the range back through the worker and compare.
+ * 4. Restore the saved sectors.
+ */
+TEST_CASE("MSC: storage worker keeps host packets in order", "[ci][storage][spiflash][async]")
+{
+    wl_handle_t wl_handle = WL_INVALID_HANDLE;
+    tinyusb_msc_storage_handle_t storage_hdl = NULL;
+    test_io_open_spiflash(&wl_handle, &storage_hdl);
+
+    uint32_t sectors = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, tinyusb_msc_get_storage_capacity(storage_hdl, &sectors));
+    const size_t size = (size_t)TEST_ORDER_PACKETS * TEST_PACKET;
+    const uint32_t lba = sectors - size / TEST_SECTOR_SIZE;
+
+    uint8_t *saved = heap_caps_malloc(size, MALLOC_CAP_8BIT);
+    uint8_t *data = heap_caps_malloc(size, MALLOC_CAP_8BIT);
+    uint8_t *again = heap_caps_malloc(4 * TEST_PACKET, MALLOC_CAP_8BIT);
+    uint8_t *read = heap_caps_malloc(size, MALLOC_CAP_8BIT);
+    TEST_ASSERT_TRUE(saved && data && again && read);
+
+    test_io_read(lba, saved, size, TEST_PACKET);
+    TEST_ASSERT_EQUAL(0, test_io_sync());
+
+    // Every packet keeps its own buffer: a packet the worker holds is not done until it is written
+    test_fill(data, lba, size / TEST_SECTOR_SIZE, 1);
+    test_fill(again, lba, 4 * TEST_PACKET / TEST_SECTOR_SIZE, 2);
+    TEST_ASSERT_EQUAL(0, test_io_write(lba, data, size, TEST_PACKET));
+    TEST_ASSERT_EQUAL(0, test_io_write(lba, again, 4 * TEST_PACKET, TEST_PACKET));
+    memset(read, 0, size);
+    test_io_read(lba, read, size, TEST_PACKET);
+    TEST_ASSERT_EQUAL(0, test_io_sync());
+
+    memcpy(data, again, 4 * TEST_PACKET);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(data, read, size);
+
+    tinyusb_msc_io_stats_t io;
+    TEST_ASSERT_EQUAL(ESP_OK, tinyusb_msc_get_io_stats(&io));
+    TEST_ASSERT_EQUAL(0, io.errors);
+    TEST_ASSERT_EQUAL_UINT64((uint64_t)(TEST_ORDER_PACKETS + 4) * TEST_PACKET, io.write_bytes);
+#if CONFIG_TINYUSB_MSC_ASYNC
+    TEST_ASSERT_GREATER_THAN(0, io.max_queued);
+    TEST_ASSERT_GREATER_THAN(0, io.worker_busy_us);
+#endif // CONFIG_TINYUSB_MSC_ASYNC
+
+    TEST_ASSERT_EQUAL(0, test_io_write(lba, saved, size, TEST_PACKET));
+    TEST_ASSERT_EQUAL(0, test_io_sync());
+
+    heap_caps_free(read);
+    heap_caps_free(again);
+    heap_caps_free(data);
+    heap_caps_free(saved);
+    test_io_close_spiflash(wl_handle, storage_hdl);
+}
+
+/**
+ * @brief A failed write the host was already told succeeded is reported once
+ *
+ * Scenario:
+ * 1. Write a packet past the end of the medium, then one elsewhere: the first reaches the medium and fails.
+ * 2. The error comes back exactly once, on the next WRITE10 or on SYNCHRONIZE CACHE.
+ * 3. Later syncs succeed.
+ */
+TEST_CASE("MSC: failed buffered write is reported once", "[ci][storage][spiflash][async]")
+{
+    wl_handle_t wl_handle = WL_INVALID_HANDLE;
+    tinyusb_msc_storage_handle_t storage_hdl = NULL;
+    test_io_open_spiflash(&wl_handle, &storage_hdl);
+
+    uint32_t sectors = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, tinyusb_msc_get_storage_capacity(storage_hdl, &sectors));
+    uint8_t *data = heap_caps_malloc(2 * TEST_PACKET, MALLOC_CAP_8BIT);
+    TEST_ASSERT_NOT_NULL(data);
+    test_fill(data, 0, 2 * TEST_PACKET / TEST_SECTOR_SIZE, 1);
+
+    const int bad = test_io_write(sectors + 16, data, TEST_PACKET, TEST_PACKET);
+    vTaskDelay(pdMS_TO_TICKS(50));
+    // Whichever command comes next after the failure carries the error
+    const int next = test_io_write(sectors - 1, data + TEST_PACKET, TEST_PACKET, TEST_PACKET);
+    vTaskDelay(pdMS_TO_TICKS(50));
+    const int sync = test_io_sync() < 0;
+#if CONFIG_TINYUSB_MSC_ASYNC
+    // The bad packet was acknowledged before it reached the medium
+    TEST_ASSERT_EQUAL(0, bad);
+    TEST_ASSERT_EQUAL_MESSAGE(1, next + sync, "The failed write must be reported exactly once");
+#else
+    // Without the worker the error is reported by the command that hits it: at once, or when the cache is written
+    TEST_ASSERT_EQUAL_MESSAGE(1, bad + next + sync, "The failed write must be reported exactly once");
+#endif // CONFIG_TINYUSB_MSC_ASYNC
+    TEST_ASSERT_EQUAL(0, test_io_sync());
+
+    tinyusb_msc_io_stats_t io;
+    TEST_ASSERT_EQUAL(ESP_OK, tinyusb_msc_get_io_stats(&io));
+#if CONFIG_TINYUSB_MSC_ASYNC
+    TEST_ASSERT_GREATER_THAN(0, io.errors);
+#endif // CONFIG_TINYUSB_MSC_ASYNC
+
+    heap_caps_free(data);
+    test_io_close_spiflash(wl_handle, storage_hdl);
+}
+
+/**
+ * @brief Measure host write and read throughput through the MSC callbacks
+ *
+ * Each packet goes through the same callback, cache, worker and medium path as a host transfer; the USB
+ * transfer itself is not included, so this is the rate the storage side can sustain.
+ * The write time runs until SYNCHRONIZE CACHE returns, so everything has reached the medium.
+ */
+static void test_io_bench(const char *medium, uint32_t lba, size_t size)
+{
+    uint8_t *ring = heap_caps_malloc((size_t)TEST_BENCH_RING * TEST_BENCH_PACKET, MALLOC_CAP_DMA);
+    TEST_ASSERT_NOT_NULL(ring);
+    test_fill(ring, lba, (uint32_t)((size_t)TEST_BENCH_RING * TEST_BENCH_PACKET / TEST_SECTOR_SIZE), 1);
+
+    tinyusb_msc_io_stats_t before;
+    TEST_ASSERT_EQUAL(ESP_OK, tinyusb_msc_get_io_stats(&before));
+    int64_t start = esp_timer_get_time();
+    for (size_t off = 0; off < size; off += TEST_BENCH_PACKET) {
+        const size_t slot = (off / TEST_BENCH_PACKET) % TEST_BENCH_RING;
+        TEST_ASSERT_EQUAL(0, test_io_write(lba + off / TEST_SECTOR_SIZE, ring + slot * TEST_BENCH_PACKET, TEST_BENCH_PACKET, TEST_BENCH_PACKET));
+    }
+    TEST_ASSERT_EQUAL(0, test_io_sync());
+    const int64_t write_us = esp_timer_get_time() - start;
+
+    start = esp_timer_get_time();
+    for (size_t off = 0; off < size; off += TEST_BENCH_PACKET) {
+        const size_t slot = (off / TEST_BENCH_PACKET) % TEST_BENCH_RING;
+        test_io_read(lba + off / TEST_SECTOR_SIZE, ring + slot * TEST_BENCH_PACKET, TEST_BENCH_PACKET, TEST_BENCH_PACKET);
+    }
+    TEST_ASSERT_EQUAL(0, test_io_sync());
+    const int64_t read_us = esp_timer_get_time() - start;
+
+    tinyusb_msc_io_stats_t io;
+    TEST_ASSERT_EQUAL(ESP_OK, tinyusb_msc_get_io_stats(&io));
+    TEST_ASSERT_EQUAL(before.errors, io.errors);
+    printf("[perf] MSC %s, %s, %u B packets: write %u KB in %lld us, %lu KB/s; read %lu KB/s; %lu stalls\n",
+           medium, CONFIG_TINYUSB_MSC_ASYNC ? "storage worker" : "synchronous", (unsigned)TEST_BENCH_PACKET,
+           (unsigned)(size / 1024), (long long)write_us, (unsigned long)tinyusb_rate_kbps(size, write_us),
+           (unsigned long)tinyusb_rate_kbps(size, read_us), (unsigned long)(io.write_stalls - before.write_stalls));
+    heap_caps_free(ring);
+}
+
+/**
+ * @brief Host I/O throughput on SPI Flash
+ *
+ * Scenario:
+ * 1. Save the last TEST_BENCH_SPIFLASH_BYTES of the storage.
+ * 2. Time sequential writes and reads through the callbacks and print the rates.
+ * 3. Restore the saved sectors.
+ */
+TEST_CASE("MSC: host I/O throughput SPI Flash", "[ci][storage][spiflash][perf]")
+{
+    wl_handle_t wl_handle = WL_INVALID_HANDLE;
+    tinyusb_msc_storage_handle_t storage_hdl = NULL;
+    test_io_open_spiflash(&wl_handle, &storage_hdl);
+
+    uint32_t sectors = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, tinyusb_msc_get_storage_capacity(storage_hdl, &sectors));
+    const uint32_t lba = sectors - TEST_BENCH_SPIFLASH_BYTES / TEST_SECTOR_SIZE;
+    uint8_t *saved = heap_caps_malloc(TEST_BENCH_SPIFLASH_BYTES, MALLOC_CAP_8BIT);
+    TEST_ASSERT_NOT_NULL(saved);
+    test_io_read(lba, saved, TEST_BENCH_SPIFLASH_BYTES, TEST_BENCH_PACKET);
+    TEST_ASSERT_EQUAL(0, test_io_sync());
+
+    test_io_bench("SPI Flash", lba, TEST_BENCH_SPIFLASH_BYTES);
+
+    TEST_ASSERT_EQUAL(0, test_io_write(lba, saved, TEST_BENCH_SPIFLASH_BYTES, TEST_BENCH_PACKET));
+    TEST_ASSERT_EQUAL(0, test_io_sync());
+    heap_caps_free(saved);
+    test_io_close_spiflash(wl_handle, storage_hdl);
+}
+
+#if (SOC_SDMMC_HOST_SUPPORTED)
+/**
+ * @brief Host I/O throughput on an SD card
+ *
+ * Scenario:
+ * 1. Expose the SD card to USB; the sectors at TEST_BENCH_SDMMC_LBA are overwritten.
+ * 2. Time sequential writes and reads through the callbacks and print the rates.
+ */
+TEST_CASE("MSC: host I/O throughput SD/MMC", "[storage][sdmmc][perf]")
+{
+    sdmmc_card_t *card = NULL;
+    storage_init_sdmmc(&card);
+    TEST_ASSERT_NOT_NULL_MESSAGE(card, "SD/MMC card handle is NULL, check the SDMMC configuration");
+
+    tinyusb_msc_driver_config_t driver_cfg = {
+        .callback = test_storage_event_cb,
+        .callback_arg = NULL,
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, tinyusb_msc_install_driver(&driver_cfg));
+    tinyusb_msc_storage_config_t config = {
+        .medium.card = card,
+        .mount_point = TINYUSB_MSC_STORAGE_MOUNT_USB,
+        .fat_fs = {
+            .base_path = NULL,
+            .config.max_files = 5,
+            .format_flags = 0,
+        },
+    };
+    tinyusb_msc_storage_handle_t storage_hdl = NULL;
+    TEST_ASSERT_EQUAL(ESP_OK, tinyusb_msc_new_storage_sdmmc(&config, &storage_hdl));
+
+    test_io_bench("SD/MMC", TEST_BENCH_SDMMC_LBA, TEST_BENCH_SDMMC_BYTES);
+
+    TEST_ASSERT_EQUAL(ESP_OK, tinyusb_msc_delete_storage(storage_hdl));
+    TEST_ASSERT_EQUAL(ESP_OK, tinyusb_msc_uninstall_driver());
+    storage_deinit_sdmmc(card);
+}
+#endif // SOC_SDMMC_HOST_SUPPORTED
+
+#endif // SOC_USB_OTG_SUPPORTED
@@ -0,0 +1,314 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "soc/soc_caps.h"
+
+#if SOC_USB_OTG_SUPPORTED
+//
+#include <stdio.h>
+#include <string.h>
+//
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+//
+#include "esp_err.h"
+#include "esp_timer.h"
+//
+#include "unity.h"
+#include "tinyusb.h"
+#include "tinyusb_default_config.h"
+#include "tinyusb_msc.h"
+//
+#include "device_common.h"
+#include "storage_common.h"
+#include "test_msc_common.h"
+
+//
+// ========================== Test Configuration Parameters =====================================
+//
+
+#define TEST_LUN                    0
+#define TEST_SWITCH_ROUNDS          10      // Switches each way without a USB host
+#define TEST_SWITCH_HOST_ROUNDS     3       // Switches each way and per mode with a USB host; re-enumeration takes seconds
+#define TEST_SWITCH_ATTACH_MS       10000   // Longest wait for the host to configure the device
+#define TEST_SWITCH_SETTLE_MS       500     // Time the host gets to see each state before the next switch
+
+//
+// ========================== Switch timing helpers ==============================================
+//
+
+typedef struct {
+    int64_t min_us;
+    int64_t max_us;
+    int64_t sum_us;
+    uint32_t count;
+} test_switch_time_t;
+
+static SemaphoreHandle_t test_switch_attached;
+static volatile int64_t test_switch_attached_us;
+
+/**
+ * @brief Device event handler that records when the host configured the device
+ */
+static void test_switch_event_handler(tinyusb_event_t *event, void *arg)
+{
+    if (event->id == TINYUSB_EVENT_ATTACHED) {
+        test_switch_attached_us = esp_timer_get_time();
+        xSemaphoreGive(test_switch_attached);
+    }
+}
+
+static void test_switch_time_add(test_switch_time_t *t, int64_t us)
+{
+    if (t->count == 0 || us < t->min_us) {
+        t->min_us = us;
+    }
+    if (t->count == 0 || us > t->max_us) {
+        t->max_us = us;
+    }
+    t->sum_us += us;
+    t->count++;
+}
+
+static void test_switch_time_print(const char *medium, const char *mode, const char *to, const test_switch_time_t *t)
+{
+    TEST_ASSERT_GREATER_THAN(0, t->count);
+    printf("[perf] MSC switch, %s, %s: to %s min %lld us, avg %lld us, max %lld us over %lu\n",
+           medium, mode, to, (long long)t->min_us, (long long)(t->sum_us / t->count), (long long)t->max_us,
+           (unsigned long)t->count);
+}
+
+/**
+ * @brief Hand the storage to the application and time it, up to the filesystem being mounted
+ */
+static int64_t test_switch_to_app(tinyusb_msc_storage_handle_t storage_hdl)
+{
+    const int64_t start = esp_timer_get_time();
+    TEST_ASSERT_EQUAL(ESP_OK, tinyusb_msc_set_storage_mount_point(storage_hdl, TINYUSB_MSC_STORAGE_MOUNT_APP));
+    const int64_t us = esp_timer_get_time() - start;
+    test_storage_event_wait_callback(TINYUSB_MSC_EVENT_MOUNT_START);
+    test_storage_event_wait_callback(TINYUSB_MSC_EVENT_MOUNT_COMPLETE);
+    return us;
+}
+
+/**
+ * @brief Hand the storage back to the USB host and time it, up to the filesystem being unmounted
+ */
+static int64_t test_switch_to_usb(tinyusb_msc_storage_handle_t storage_hdl)
+{
+    const int64_t start = esp_timer_get_time();
+    TEST_ASSERT_EQUAL(ESP_OK, tinyusb_msc_set_storage_mount_point(storage_hdl, TINYUSB_MSC_STORAGE_MOUNT_USB));
+    const int64_t us = esp_timer_get_time() - start;
+    test_storage_event_wait_callback(TINYUSB_MSC_EVENT_MOUNT_START);
+    test_storage_event_wait_callback(TINYUSB_MSC_EVENT_MOUNT_COMPLETE);
+    return us;
+}
+
+static void test_switch_install_msc(void)
+{
+    tinyusb_msc_driver_config_t driver_cfg = {
+        .callback = test_storage_event_cb,
+        .callback_arg = NULL,
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, tinyusb_msc_install_driver(&driver_cfg));
+}
+
+/**
+ * @brief Install the TinyUSB driver and wait for the host to configure the device
+ *
+ * @return Microseconds from start_us to the host configuring the device
+ */
+static int64_t test_switch_attach(int64_t start_us)
+{
+    tinyusb_config_t tusb_cfg = TINYUSB_DEFAULT_CONFIG(test_switch_event_handler);
+    TEST_ASSERT_EQUAL(ESP_OK, tinyusb_driver_install(&tusb_cfg));
+    TEST_ASSERT_EQUAL_MESSAGE(pdTRUE, xSemaphoreTake(test_switch_attached, pdMS_TO_TICKS(TEST_SWITCH_ATTACH_MS)),
+                              "The host did not configure the device");
+    return test_switch_attached_us - start_us;
+}
+
+/**
+ * @brief Switch the storage back and forth with the device enumerated, then by re-enumerating, and print both
+ *
+ * Kept: only the storage changes hands, the host sees the medium go and come back.
+ * Re-enumerated: the TinyUSB driver is uninstalled around the application's turn, as before the device could
+ * stay enumerated. The way back is timed up to the host configuring the device again.
+ */
+static void test_switch_host_rounds(const char *medium, tinyusb_msc_storage_handle_t storage_hdl)
+{
+    test_switch_attached = xSemaphoreCreateBinary();
+    TEST_ASSERT_NOT_NULL(test_switch_attached);
+    test_switch_attach(esp_timer_get_time());
+    vTaskDelay(pdMS_TO_TICKS(TEST_SWITCH_SETTLE_MS));
+
+    // The first mount may format the medium, which is not what is measured
+    test_switch_to_app(storage_hdl);
+    test_switch_to_usb(storage_hdl);
+    vTaskDelay(pdMS_TO_TICKS(TEST_SWITCH_SETTLE_MS));
+
+    test_switch_time_t to_app = { 0 };
+    test_switch_time_t to_usb = { 0 };
+    for (int i = 0; i < TEST_SWITCH_HOST_ROUNDS; i++) {
+        test_switch_time_add(&to_app, test_switch_to_app(storage_hdl));
+        vTaskDelay(pdMS_TO_TICKS(TEST_SWITCH_SETTLE_MS));
+        test_switch_time_add(&to_usb, test_switch_to_usb(storage_hdl));
+        vTaskDelay(pdMS_TO_TICKS(TEST_SWITCH_SETTLE_MS));
+    }
+    test_switch_time_print(medium, "USB kept", "app", &to_app);
+    test_switch_time_print(medium, "USB kept", "USB", &to_usb);
+
+    test_switch_time_t re_app = { 0 };
+    test_switch_time_t re_usb = { 0 };
+    for (int i = 0; i < TEST_SWITCH_HOST_ROUNDS; i++) {
+        int64_t start = esp_timer_get_time();
+        TEST_ASSERT_EQUAL(ESP_OK, tinyusb_driver_uninstall());
+        TEST_ASSERT_EQUAL(ESP_OK, tinyusb_msc_set_storage_mount_point(storage_hdl, TINYUSB_MSC_STORAGE_MOUNT_APP));
+        test_switch_time_add(&re_app, esp_timer_get_time() - start);
+        test_storage_event_wait_callback(TINYUSB_MSC_EVENT_MOUNT_START);
+        test_storage_event_wait_callback(TINYUSB_MSC_EVENT_MOUNT_COMPLETE);
+        vTaskDelay(pdMS_TO_TICKS(TEST_SWITCH_SETTLE_MS));
+
+        start = esp_timer_get_time();
+        TEST_ASSERT_EQUAL(ESP_OK, tinyusb_msc_set_storage_mount_point(storage_hdl, TINYUSB_MSC_STORAGE_MOUNT_USB));
+        test_switch_time_add(&re_usb, test_switch_attach(start));
+        test_storage_event_wait_callback(TINYUSB_MSC_EVENT_MOUNT_START);
+        test_storage_event_wait_callback(TINYUSB_MSC_EVENT_MOUNT_COMPLETE);
+        vTaskDelay(pdMS_TO_TICKS(TEST_SWITCH_SETTLE_MS));
+    }
+    test_switch_time_print(medium, "USB reinstalled", "app", &re_app);
+    test_switch_time_print(medium, "USB reinstalled", "USB, host configured", &re_usb);
+
+    TEST_ASSERT_EQUAL(ESP_OK, tinyusb_driver_uninstall());
+    vSemaphoreDelete(test_switch_attached);
+    test_switch_attached = NULL;
+}
+
+/**
+ * @brief Storage switch without a USB host: the LUN stays, the host view follows the owner
+ *
+ * Scenario:
+ * 1. Expose the SPI Flash storage to USB and take it to the application once, so it is formatted.
+ * 2. Switch to the application: TEST UNIT READY fails, as a reader with no card.
+ * 3. Switch back: the first TEST UNIT READY reports the medium change, the next one succeeds.
+ * 4. Print the time each switch took.
+ */
+TEST_CASE("MSC: storage switch reports the medium gone and changed", "[ci][storage][spiflash][switch]")
+{
+    wl_handle_t wl_handle = WL_INVALID_HANDLE;
+    storage_init_spiflash(&wl_handle);
+    TEST_ASSERT_NOT_EQUAL_MESSAGE(WL_INVALID_HANDLE, wl_handle, "Wear leveling handle is invalid, check the partition configuration");
+    test_switch_install_msc();
+
+    tinyusb_msc_storage_config_t config = {
+        .medium.wl_handle = wl_handle,
+        .mount_point = TINYUSB_MSC_STORAGE_MOUNT_USB,
+        .fat_fs = {
+            .base_path = NULL,
+            .config.max_files = 5,
+            .format_flags = 0,
+        },
+    };
+    tinyusb_msc_storage_handle_t storage_hdl = NULL;
+    TEST_ASSERT_EQUAL(ESP_OK, tinyusb_msc_new_storage_spiflash(&config, &storage_hdl));
+
+    // The first mount may format the medium, which is not what is measured
+    test_switch_to_app(storage_hdl);
+    test_switch_to_usb(storage_hdl);
+    TEST_ASSERT_FALSE(tud_msc_test_unit_ready_cb(TEST_LUN));
+    TEST_ASSERT_TRUE(tud_msc_test_unit_ready_cb(TEST_LUN));
+
+    test_switch_time_t to_app = { 0 };
+    test_switch_time_t to_usb = { 0 };
+    for (int i = 0; i < TEST_SWITCH_ROUNDS; i++) {
+        test_switch_time_add(&to_app, test_switch_to_app(storage_hdl));
+        TEST_ASSERT_FALSE(tud_msc_test_unit_ready_cb(TEST_LUN));
+        TEST_ASSERT_FALSE(tud_msc_test_unit_ready_cb(TEST_LUN));
+
+        test_switch_time_add(&to_usb, test_switch_to_usb(storage_hdl));
+        // Unit attention once, then ready
+        TEST_ASSERT_FALSE(tud_msc_test_unit_ready_cb(TEST_LUN));
+        TEST_ASSERT_TRUE(tud_msc_test_unit_ready_cb(TEST_LUN));
+    }
+    test_switch_time_print("SPI Flash", "no host", "app", &to_app);
+    test_switch_time_print("SPI Flash", "no host", "USB", &to_usb);
+
+    TEST_ASSERT_EQUAL(ESP_OK, tinyusb_msc_delete_storage(storage_hdl));
+    TEST_ASSERT_EQUAL(ESP_OK, tinyusb_msc_uninstall_driver());
+    storage_deinit_spiflash(wl_handle);
+}
+
+/**
+ * @brief Storage switch latency with a USB host, device kept enumerated against re-enumerated, on SPI Flash
+ *
+ * Scenario:
+ * 1. Expose the SPI Flash storage and wait for the host to configure the device.
+ * 2. Switch to the application and back with the device enumerated, timing each switch.
+ * 3. Do the same with the TinyUSB driver uninstalled and installed around each switch.
+ * 4. Print both.
+ */
+TEST_CASE("MSC: storage switch latency SPI Flash", "[ci][storage][spiflash][switch][perf]")
+{
+    wl_handle_t wl_handle = WL_INVALID_HANDLE;
+    storage_init_spiflash(&wl_handle);
+    TEST_ASSERT_NOT_EQUAL_MESSAGE(WL_INVALID_HANDLE, wl_handle, "Wear leveling handle is invalid, check the partition configuration");
+    test_switch_install_msc();
+
+    tinyusb_msc_storage_config_t config = {
+        .medium.wl_handle = wl_handle,
+        .mount_point = TINYUSB_MSC_STORAGE_MOUNT_USB,
+        .fat_fs = {
+            .base_path = NULL,
+            .config.max_files = 5,
+            .format_flags = 0,
+        },
+    };
+    tinyusb_msc_storage_handle_t storage_hdl = NULL;
+    TEST_ASSERT_EQUAL(ESP_OK, tinyusb_msc_new_storage_spiflash(&config, &storage_hdl));
+
+    test_switch_host_rounds("SPI Flash", storage_hdl);
+
+    TEST_ASSERT_EQUAL(ESP_OK, tinyusb_msc_delete_storage(storage_hdl));
+    TEST_ASSERT_EQUAL(ESP_OK, tinyusb_msc_uninstall_driver());
+    storage_deinit_spiflash(wl_handle);
+}
+
+#if (SOC_SDMMC_HOST_SUPPORTED)
+/**
+ * @brief Storage switch latency with a USB host on an SD card, as the recorder switches it
+ *
+ * Scenario:
+ * 1. Expose the SD card and wait for the host to configure the device; a card without a filesystem is formatted.
+ * 2. Time the switches with the device kept enumerated and re-enumerated, and print both.
+ */
+TEST_CASE("MSC: storage switch latency SD/MMC", "[storage][sdmmc][switch][perf]")
+{
+    sdmmc_card_t *card = NULL;
+    storage_init_sdmmc(&card);
+    TEST_ASSERT_NOT_NULL_MESSAGE(card, "SD/MMC card handle is NULL, check the SDMMC configuration");
+    test_switch_install_msc();
+
+    tinyusb_msc_storage_config_t config = {
+        .medium.card = card,
+        .mount_point = TINYUSB_MSC_STORAGE_MOUNT_USB,
+        .fat_fs = {
+            .base_path = NULL,
+            .config.max_files = 5,
+            .format_flags = 0,
+        },
+    };
+    tinyusb_msc_storage_handle_t storage_hdl = NULL;
+    TEST_ASSERT_EQUAL(ESP_OK, tinyusb_msc_new_storage_sdmmc(&config, &storage_hdl));
+
+    test_switch_host_rounds("SD/MMC", storage_hdl);
+
+    TEST_ASSERT_EQUAL(ESP_OK, tinyusb_msc_delete_storage(storage_hdl));
+    TEST_ASSERT_EQUAL(ESP_OK, tinyusb_msc_uninstall_driver());
+    storage_deinit_sdmmc(card);
+}
+#endif // SOC_SDMMC_HOST_SUPPORTED
+
+#endif // SOC_USB_OTG_SUPPORTED
@@ -4,6 +4,7 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include <stdint.h>
 #include <string.h>
 #include "esp_log.h"
 #include "esp_err.h"
@@ -11,6 +12,8 @@
 #include "esp_vfs_fat.h"
 #include "esp_partition.h"
 #include "esp_memory_utils.h"
+#include "esp_timer.h"
+#include "freertos/queue.h"
 #include "soc/soc_caps.h"
 #include "sdkconfig.h"
 #include "vfs_fat_internal.h"
@@ -19,7 +22,10 @@
 #include "class/msc/msc_device.h"
 
 #include "storage_spiflash.h"
+#include "storage_virtual.h"
 #include "msc_storage.h"
+#include "msc_cache.h"
+#include "msc_readahead.h"
 #include "tinyusb_msc.h"
 
 #if (SOC_SDMMC_HOST_SUPPORTED)
@@ -38,6 +44,24 @@ static const char *TAG = "tinyusb_msc_storage";
 
 #define TINYUSB_MSC_STORAGE_MAX_LUNS    2                               /*!< Maximum number of LUNs supported by TinyUSB MSC storage. Dafult value is 2 */
 #define TINYUSB_DEFAULT_BASE_PATH       CONFIG_TINYUSB_MSC_MOUNT_PATH   /*!< Default base path for the filesystem, configured via menuconfig */
+#define MSC_STORAGE_CACHE_SECTORS       CONFIG_TINYUSB_MSC_CACHE_SECTORS                 /*!< Write-back cache size in sectors, 0 disables the cache */
+#define MSC_STORAGE_CACHE_IDLE_US       ((uint64_t)CONFIG_TINYUSB_MSC_CACHE_IDLE_MS * 1000) /*!< Flush the cache after this long without host writes */
+#define MSC_STORAGE_READAHEAD_SECTORS   CONFIG_TINYUSB_MSC_READAHEAD_SECTORS             /*!< Read-ahead window size in sectors, 0 disables read-ahead */
+#define MSC_IO_BURST_GAP_US             50000                                            /*!< A longer pause between host packets ends an I/O burst */
+#if CONFIG_TINYUSB_MSC_ASYNC
+#define MSC_WORKER_DEPTH                CONFIG_TINYUSB_MSC_ASYNC_DEPTH                   /*!< Write buffers queued to the storage worker */
+#define MSC_WORKER_QUEUE_LEN            (MSC_WORKER_DEPTH + 4)                           /*!< Buffered writes, a held write or a read, a sync, and room for the idle timers and the application */
+#define MSC_WORKER_TASK_SIZE            4096
+#define MSC_WORKER_TASK_PRIO            5                                                /*!< Same as the default TinyUSB task, which waits on the worker */
+#endif // CONFIG_TINYUSB_MSC_ASYNC
+
+/** SCSI ASC/ASCQ codes. **/
+/** User can add and use more codes as per the need of the application **/
+#define SCSI_CODE_ASC_MEDIUM_NOT_PRESENT                0x3A /** SCSI ASC code for 'MEDIUM NOT PRESENT' **/
+#define SCSI_CODE_ASC_INVALID_COMMAND_OPERATION_CODE    0x20 /** SCSI ASC code for 'INVALID COMMAND OPERATION CODE' **/
+#define SCSI_CODE_ASC_WRITE_ERROR                       0x0C /** SCSI ASC code for 'WRITE ERROR' **/
+#define SCSI_CODE_ASC_MEDIUM_CHANGED                    0x28 /** SCSI ASC code for 'NOT READY TO READY CHANGE, MEDIUM MAY HAVE CHANGED' **/
+#define SCSI_CODE_ASCQ                                  0x00
 
 /**
  * @brief Structure representing a single write buffer for MSC operations.
@@ -59,7 +83,8 @@ typedef struct {
 typedef struct {
     // Storage related
     const storage_medium_t *medium;             /*!< Pointer to the storage medium. */
-    tinyusb_msc_mount_point_t mount_point;      /*!< Current mount point type (application or USB host). */
+    tinyusb_msc_mount_point_t mount_point;      /*!< Current mount point type (application or USB host). Host access to the medium is checked against it under mux_lock. */
+    bool medium_changed;                        /*!< Medium returned to the USB host; the next TEST UNIT READY reports a unit attention. */
     // Optimisation purpose
     uint32_t sector_count;                      /*!< Total number of sectors in the storage medium. */
     uint32_t sector_size;                       /*!< Size of a single sector in bytes. */
@@ -73,6 +98,10 @@ typedef struct {
     // Buffer for storage operations
     msc_storage_buffer_t storage_buffer;        /*!< Buffer for storing data during write operations. */
     uint32_t deffered_writes;                   /*!< Number of deferred writes pending in the buffer. */
+    // Write-back cache, used instead of the deferred buffer when allocated
+    msc_cache_t cache;                          /*!< Run of host writes not yet on the medium. Protected by mux_lock. */
+    esp_timer_handle_t cache_timer;             /*!< Idle timer flushing the cache when the host stops writing. */
+    msc_readahead_t readahead;                  /*!< Sequential read-ahead for host reads. */
     SemaphoreHandle_t mux_lock;                 /**< Mutex for storage operations */
 } tinyusb_msc_storage_s;
 
@@ -124,6 +153,50 @@ static portMUX_TYPE msc_lock = portMUX_INITIALIZER_UNLOCKED;
         }                                       \
     } while(0)
 
+static tinyusb_msc_io_stats_t msc_io_stats;     /*!< Host I/O statistics. Protected by msc_lock. */
+static int64_t msc_io_last_us[2];               /*!< Time of the last read and write callback, for the burst accounting */
+
+#if CONFIG_TINYUSB_MSC_ASYNC
+/**
+ * @brief Storage worker request
+ */
+typedef enum {
+    MSC_WORK_READ = 0,                          /*!< READ10 packet into the endpoint buffer, completed with tud_msc_async_io_done() */
+    MSC_WORK_WRITE,                             /*!< WRITE10 packet, from a write buffer or held in the endpoint buffer */
+    MSC_WORK_IDLE,                              /*!< Write-back cache idle timer expired */
+    MSC_WORK_BARRIER,                           /*!< Signal a semaphore once everything queued before is done */
+} msc_work_op_t;
+
+typedef struct {
+    msc_work_op_t op;                           /*!< Request type */
+    uint8_t lun;                                /*!< Logical unit for reads and writes */
+    int8_t slot;                                /*!< Write buffer holding the data, -1 when the endpoint buffer is held */
+    uint32_t lba;                               /*!< Logical Block Address */
+    uint32_t offset;                            /*!< Offset within the sector */
+    uint32_t size;                              /*!< Bytes to transfer */
+    void *buf;                                  /*!< Endpoint buffer for reads and held writes */
+    void *arg;                                  /*!< Storage object for MSC_WORK_IDLE, semaphore for MSC_WORK_BARRIER */
+} msc_work_t;
+
+/**
+ * @brief Storage worker
+ *
+ * TinyUSB hands READ10/WRITE10 data over one endpoint buffer at a time and cannot receive the next packet
+ * before the callback for the current one returns. The worker takes the medium access off the TinyUSB task:
+ * writes are copied into one of MSC_WORKER_DEPTH buffers and acknowledged at once, reads complete with
+ * tud_msc_async_io_done(), so the USB transfer of packet N+1 overlaps the medium access for packet N.
+ */
+typedef struct {
+    TaskHandle_t task;                          /*!< Worker task, NULL when not running */
+    QueueHandle_t queue;                        /*!< msc_work_t requests, processed in order */
+    uint8_t *slots;                             /*!< MSC_WORKER_DEPTH write buffers of MSC_STORAGE_BUFFER_SIZE bytes */
+    uint32_t free_slots;                        /*!< Bit mask of free write buffers. Protected by msc_lock. */
+    esp_err_t error;                            /*!< First failed write the host was already told succeeded. Protected by msc_lock. */
+} msc_worker_t;
+
+static msc_worker_t msc_worker;
+#endif // CONFIG_TINYUSB_MSC_ASYNC
+
 //
 // ========================== TinyUSB MSC Storage Event Handling =================================
 //
@@ -223,6 +296,43 @@ static inline bool _msc_storage_unmap_from_lun(msc_storage_obj_t *storage)
     return false;
 }
 
+/**
+ * @brief Check whether the USB host may access the storage mapped to a LUN.
+ *
+ * @param[in] lun The logical unit number (LUN).
+ *
+ * @return true when the storage is mounted to the USB host
+ */
+static bool msc_storage_host_ready(uint8_t lun)
+{
+    msc_storage_obj_t *storage = NULL;
+
+    MSC_ENTER_CRITICAL();
+    bool found = _msc_storage_get_by_lun(lun, &storage);
+    bool ready = found && storage != NULL && storage->mount_point == TINYUSB_MSC_STORAGE_MOUNT_USB;
+    MSC_EXIT_CRITICAL();
+    return ready;
+}
+
+/**
+ * @brief Set the sense data for a failed host access.
+ *
+ * A medium taken by the application is reported as not present, so the host retries once it is back.
+ *
+ * @param[in] lun The logical unit number (LUN).
+ * @param[in] err Error of the access.
+ * @param[in] sense_key Sense key for any other error.
+ * @param[in] add_sense_code Additional sense code for any other error.
+ */
+static void msc_storage_set_sense(uint8_t lun, esp_err_t err, uint8_t sense_key, uint8_t add_sense_code)
+{
+    if (err == ESP_ERR_INVALID_STATE) {
+        tud_msc_set_sense(lun, SCSI_SENSE_NOT_READY, SCSI_CODE_ASC_MEDIUM_NOT_PRESENT, SCSI_CODE_ASCQ);
+    } else {
+        tud_msc_set_sense(lun, sense_key, add_sense_code, SCSI_CODE_ASCQ);
+    }
+}
+
 /**
  * @brief Read a sector from the storage medium
  *
@@ -237,6 +347,7 @@ static inline bool _msc_storage_unmap_from_lun(msc_storage_obj_t *storage)
  * @return
  *   - ESP_OK: Read operation successful
  *   - ESP_ERR_NOT_FOUND: Storage not found for the specified LUN
+ *   - ESP_ERR_INVALID_STATE: Storage is mounted to the application
  */
 static inline esp_err_t msc_storage_read_sector(uint8_t lun, uint32_t lba, uint32_t offset, size_t size, void *dest)
 {
@@ -253,7 +364,27 @@ static inline esp_err_t msc_storage_read_sector(uint8_t lun, uint32_t lba, uint3
     }
     // Otherwise, take the lock and proceed with the read
     xSemaphoreTake(storage->mux_lock, portMAX_DELAY);
-    ret = storage->medium->read(lba, offset, size, dest);
+    if (storage->mount_point != TINYUSB_MSC_STORAGE_MOUNT_USB) {
+        // The application took the medium while the command was on its way
+        ret = ESP_ERR_INVALID_STATE;
+    } else if (offset != 0 || size % storage->sector_size != 0) {
+        // Neither the cache nor the read-ahead deal in partial sectors
+        ret = msc_cache_flush(&storage->cache, storage->medium, MSC_CACHE_FLUSH_BYPASS);
+        msc_readahead_invalidate(&storage->readahead);
+        if (ret == ESP_OK) {
+            ret = storage->medium->read(lba, offset, size, dest);
+        }
+    } else {
+        if (!msc_cache_covers(&storage->cache, lba, size)) {
+            ret = msc_readahead_read(&storage->readahead, lba, size, dest);
+        } else {
+            ret = ESP_OK;
+        }
+        // Sectors the host wrote but which are still cached are newer than the medium and the read-ahead
+        if (ret == ESP_OK) {
+            msc_cache_overlay(&storage->cache, lba, size, dest);
+        }
+    }
     xSemaphoreGive(storage->mux_lock);
     return ret;
 }
@@ -272,6 +403,7 @@ static inline esp_err_t msc_storage_read_sector(uint8_t lun, uint32_t lba, uint3
  * @return
  *  - ESP_OK: Write operation successful
  *  - ESP_ERR_NOT_FOUND: Storage not found for the specified LUN
+ *  - ESP_ERR_INVALID_STATE: Storage is mounted to the application
  */
 static inline esp_err_t msc_storage_write_sector(uint8_t lun, uint32_t lba, uint32_t offset, size_t size, const void *src)
 {
@@ -288,7 +420,12 @@ static inline esp_err_t msc_storage_write_sector(uint8_t lun, uint32_t lba, uint
     }
     // Otherwise, take the lock and proceed with the write
     xSemaphoreTake(storage->mux_lock, portMAX_DELAY);
+    if (storage->mount_point != TINYUSB_MSC_STORAGE_MOUNT_USB) {
+        xSemaphoreGive(storage->mux_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
     ret = storage->medium->write(lba, offset, size, src);
+    msc_readahead_invalidate(&storage->readahead);
     xSemaphoreGive(storage->mux_lock);
     return ret;
 }
@@ -384,6 +521,421 @@ static inline esp_err_t msc_storage_write_sector_deferred(uint8_t lun, uint32_t
     return ESP_OK;
 }
 
+/**
+ * @brief Flush the write-back cache once the host has stopped writing.
+ *
+ * The idle timer is armed by the first write into an empty cache and re-armed here until
+ * CONFIG_TINYUSB_MSC_CACHE_IDLE_MS have passed since the last write, so a busy copy costs
+ * no timer calls per packet.
+ *
+ * @param storage Pointer to the storage object.
+ */
+static void msc_storage_cache_idle(msc_storage_obj_t *storage)
+{
+    xSemaphoreTake(storage->mux_lock, portMAX_DELAY);
+    const int64_t idle_us = esp_timer_get_time() - storage->cache.last_write_us;
+    if (storage->cache.count == 0) {
+        // Already flushed by a sync or a full cache
+    } else if (idle_us < (int64_t)MSC_STORAGE_CACHE_IDLE_US) {
+        esp_timer_start_once(storage->cache_timer, MSC_STORAGE_CACHE_IDLE_US - idle_us);
+    } else {
+        esp_err_t err = msc_cache_flush(&storage->cache, storage->medium, MSC_CACHE_FLUSH_IDLE);
+        msc_readahead_invalidate(&storage->readahead);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Idle cache flush failed, error=0x%x", err);
+        }
+    }
+    xSemaphoreGive(storage->mux_lock);
+}
+
+/**
+ * @brief Idle timer callback, runs in the esp_timer task.
+ *
+ * With the storage worker the flush is queued behind the host writes still waiting in the worker,
+ * otherwise it is done here.
+ *
+ * @param arg Pointer to the storage object.
+ */
+static void msc_storage_cache_idle_cb(void *arg)
+{
+    msc_storage_obj_t *storage = (msc_storage_obj_t *)arg;
+
+#if CONFIG_TINYUSB_MSC_ASYNC
+    if (msc_worker.task != NULL) {
+        const msc_work_t work = {
+            .op = MSC_WORK_IDLE,
+            .arg = storage,
+        };
+        if (xQueueSend(msc_worker.queue, &work, 0) != pdTRUE) {
+            // Queue full of host writes, try again later
+            esp_timer_start_once(storage->cache_timer, MSC_STORAGE_CACHE_IDLE_US);
+        }
+        return;
+    }
+#endif // CONFIG_TINYUSB_MSC_ASYNC
+    msc_storage_cache_idle(storage);
+}
+
+/**
+ * @brief Write host data through the write-back cache.
+ *
+ * Consecutive packets are gathered into one run and written to the medium in a single call when the run
+ * breaks, the cache fills, the host syncs or the storage is handed back to the application.
+ * Unlike the deferred path, the write happens in the callback, so medium errors reach the host.
+ *
+ * @param[in] storage Storage object with an allocated cache.
+ * @param[in] lba Logical Block Address of the sector to write to.
+ * @param[in] offset Offset within the sector to write to.
+ * @param[in] size Number of bytes to write.
+ * @param[in] src Pointer to the source buffer containing the data to write.
+ *
+ * @return
+ *  - ESP_OK: Data cached or written
+ *  - ESP_ERR_INVALID_STATE: Storage is mounted to the application
+ *  - Other: Error of a medium write triggered by this call
+ */
+static esp_err_t msc_storage_write_sector_cached(msc_storage_obj_t *storage, uint32_t lba, uint32_t offset, size_t size, const void *src)
+{
+    esp_err_t ret;
+
+    xSemaphoreTake(storage->mux_lock, portMAX_DELAY);
+    if (storage->mount_point != TINYUSB_MSC_STORAGE_MOUNT_USB) {
+        xSemaphoreGive(storage->mux_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (msc_cache_accepts(&storage->cache, offset, size)) {
+        ret = msc_cache_write(&storage->cache, storage->medium, lba, size, src);
+        if (storage->cache.count && !esp_timer_is_active(storage->cache_timer)) {
+            esp_timer_start_once(storage->cache_timer, MSC_STORAGE_CACHE_IDLE_US);
+        }
+    } else {
+        ret = msc_cache_flush(&storage->cache, storage->medium, MSC_CACHE_FLUSH_BYPASS);
+        if (ret == ESP_OK) {
+            ret = storage->medium->write(lba, offset, size, src);
+        }
+    }
+    // Prefetched sectors may be older than what was just written to the medium
+    msc_readahead_invalidate(&storage->readahead);
+    xSemaphoreGive(storage->mux_lock);
+    return ret;
+}
+
+/**
+ * @brief Flush the write-back cache of a storage object.
+ *
+ * @param[in] storage Storage object.
+ * @param[in] reason Why the cache is flushed, for the statistics.
+ *
+ * @return
+ *  - ESP_OK: Cache flushed, or it was empty or disabled
+ *  - Other: Error of the medium write
+ */
+static esp_err_t msc_storage_cache_flush(msc_storage_obj_t *storage, msc_cache_flush_reason_t reason)
+{
+    xSemaphoreTake(storage->mux_lock, portMAX_DELAY);
+    esp_err_t ret = msc_cache_flush(&storage->cache, storage->medium, reason);
+    msc_readahead_invalidate(&storage->readahead);
+    xSemaphoreGive(storage->mux_lock);
+    return ret;
+}
+
+/**
+ * @brief Account a host packet in the I/O statistics.
+ *
+ * Called from the READ10/WRITE10 callbacks in both the synchronous and the asynchronous path.
+ *
+ * @param[in] write True for WRITE10 data, false for READ10 data.
+ * @param[in] bytes Bytes of the packet.
+ */
+static void msc_io_account(bool write, uint32_t bytes)
+{
+    const int64_t now = esp_timer_get_time();
+
+    MSC_ENTER_CRITICAL();
+    const int64_t gap = now - msc_io_last_us[write];
+    if (gap < MSC_IO_BURST_GAP_US) {
+        if (write) {
+            msc_io_stats.write_active_us += gap;
+        } else {
+            msc_io_stats.read_active_us += gap;
+        }
+    }
+    msc_io_last_us[write] = now;
+    if (write) {
+        msc_io_stats.write_bytes += bytes;
+    } else {
+        msc_io_stats.read_bytes += bytes;
+    }
+    MSC_EXIT_CRITICAL();
+}
+
+#if CONFIG_TINYUSB_MSC_ASYNC
+/**
+ * @brief Write a host packet from the storage worker, through the write-back cache when allocated.
+ *
+ * @return
+ *  - ESP_OK: Data cached or written
+ *  - ESP_ERR_NOT_FOUND: Storage not found for the specified LUN
+ *  - ESP_ERR_INVALID_STATE: Storage is mounted to the application
+ *  - Other: Error of the medium write
+ */
+static esp_err_t msc_worker_write_sector(uint8_t lun, uint32_t lba, uint32_t offset, size_t size, const void *src)
+{
+    msc_storage_obj_t *storage = NULL;
+
+    MSC_ENTER_CRITICAL();
+    bool found = _msc_storage_get_by_lun(lun, &storage);
+    MSC_EXIT_CRITICAL();
+
+    if (found && storage != NULL && storage->cache.buf != NULL) {
+        return msc_storage_write_sector_cached(storage, lba, offset, size, src);
+    }
+    return msc_storage_write_sector(lun, lba, offset, size, src);
+}
+
+/**
+ * @brief Storage worker task: processes the queued requests in order.
+ *
+ * @param arg Unused.
+ */
+static void msc_worker_task(void *arg)
+{
+    (void) arg;
+    msc_work_t work;
+
+    while (true) {
+        xQueueReceive(msc_worker.queue, &work, portMAX_DELAY);
+        const int64_t start = esp_timer_get_time();
+        esp_err_t err = ESP_OK;
+
+        switch (work.op) {
+        case MSC_WORK_READ:
+            err = msc_storage_read_sector(work.lun, work.lba, work.offset, work.size, work.buf);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "READ(10) command failed, %s", esp_err_to_name(err));
+                msc_storage_set_sense(work.lun, err, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_CODE_ASC_INVALID_COMMAND_OPERATION_CODE);
+            }
+            tud_msc_async_io_done(err == ESP_OK ? (int32_t)work.size : TUD_MSC_RET_ERROR, false);
+            break;
+        case MSC_WORK_WRITE:
+            if (work.slot >= 0) {
+                err = msc_worker_write_sector(work.lun, work.lba, work.offset, work.size,
+                                              msc_worker.slots + (size_t)work.slot * MSC_STORAGE_BUFFER_SIZE);
+                MSC_ENTER_CRITICAL();
+                msc_worker.free_slots |= 1UL << work.slot;
+                if (err != ESP_OK && err != ESP_ERR_INVALID_STATE && msc_worker.error == ESP_OK) {
+                    // The host already has its status; fail its next WRITE10 or SYNCHRONIZE CACHE instead.
+                    // A medium taken by the application is reported by the unit attention when it comes back.
+                    msc_worker.error = err;
+                }
+                MSC_EXIT_CRITICAL();
+                if (err != ESP_OK) {
+                    ESP_LOGE(TAG, "Buffered WRITE(10) failed, %s", esp_err_to_name(err));
+                }
+            } else {
+                err = msc_worker_write_sector(work.lun, work.lba, work.offset, work.size, work.buf);
+                if (err != ESP_OK) {
+                    ESP_LOGE(TAG, "WRITE(10) command failed, %s", esp_err_to_name(err));
+                    msc_storage_set_sense(work.lun, err, SCSI_SENSE_MEDIUM_ERROR, SCSI_CODE_ASC_WRITE_ERROR);
+                }
+                tud_msc_async_io_done(err == ESP_OK ? (int32_t)work.size : TUD_MSC_RET_ERROR, false);
+            }
+            break;
+        case MSC_WORK_IDLE:
+            msc_storage_cache_idle((msc_storage_obj_t *)work.arg);
+            break;
+        case MSC_WORK_BARRIER:
+            xSemaphoreGive((SemaphoreHandle_t)work.arg);
+            continue;
+        }
+
+        const int64_t busy = esp_timer_get_time() - start;
+        MSC_ENTER_CRITICAL();
+        msc_io_stats.worker_busy_us += busy;
+        if (err != ESP_OK) {
+            msc_io_stats.errors++;
+        }
+        MSC_EXIT_CRITICAL();
+    }
+}
+
+/**
+ * @brief Post a request to the storage worker.
+ *
+ * The queue holds every write buffer plus the requests TinyUSB and the idle timer can have outstanding,
+ * so the TinyUSB task never waits for a free entry.
+ */
+static void msc_worker_post(const msc_work_t *work)
+{
+    xQueueSend(msc_worker.queue, work, portMAX_DELAY);
+
+    const uint32_t queued = uxQueueMessagesWaiting(msc_worker.queue);
+    MSC_ENTER_CRITICAL();
+    if (queued > msc_io_stats.max_queued) {
+        msc_io_stats.max_queued = queued;
+    }
+    MSC_EXIT_CRITICAL();
+}
+
+/**
+ * @brief Wait until the storage worker has processed everything queued so far.
+ *
+ * Must not be called from the worker itself.
+ *
+ * @return
+ *  - ESP_OK: Worker idle, or not running
+ *  - Other: Error of a buffered write the host was already told succeeded
+ */
+static esp_err_t msc_worker_drain(void)
+{
+    if (msc_worker.task == NULL) {
+        return ESP_OK;
+    }
+    // A semaphore per caller, so concurrent drains from the TinyUSB and the application task do not wake each other
+    StaticSemaphore_t done_buf;
+    SemaphoreHandle_t done = xSemaphoreCreateBinaryStatic(&done_buf);
+    const msc_work_t work = {
+        .op = MSC_WORK_BARRIER,
+        .arg = done,
+    };
+    msc_worker_post(&work);
+    xSemaphoreTake(done, portMAX_DELAY);
+    vSemaphoreDelete(done);
+
+    MSC_ENTER_CRITICAL();
+    esp_err_t ret = msc_worker.error;
+    msc_worker.error = ESP_OK;
+    MSC_EXIT_CRITICAL();
+    return ret;
+}
+
+/**
+ * @brief Hand a READ10 packet to the storage worker.
+ *
+ * @return
+ *  - true: Read queued, complete the callback with TUD_MSC_RET_ASYNC
+ *  - false: Worker not running, read synchronously
+ */
+static bool msc_worker_read(uint8_t lun, uint32_t lba, uint32_t offset, uint32_t size, void *dest)
+{
+    if (msc_worker.task == NULL) {
+        return false;
+    }
+    const msc_work_t work = {
+        .op = MSC_WORK_READ,
+        .lun = lun,
+        .slot = -1,
+        .lba = lba,
+        .offset = offset,
+        .size = size,
+        .buf = dest,
+    };
+    msc_worker_post(&work);
+    return true;
+}
+
+/**
+ * @brief Hand a WRITE10 packet to the storage worker.
+ *
+ * The packet is copied into a free write buffer and acknowledged at once. When every buffer is in use,
+ * the endpoint buffer itself is queued and the packet completes asynchronously once the worker reaches it,
+ * which holds the host back until the medium catches up.
+ *
+ * @return
+ *  - Number of bytes accepted
+ *  - TUD_MSC_RET_ASYNC: Packet queued from the endpoint buffer
+ *  - TUD_MSC_RET_ERROR: An earlier buffered write failed
+ */
+static int32_t msc_worker_write(uint8_t lun, uint32_t lba, uint32_t offset, uint32_t size, const uint8_t *src)
+{
+    msc_work_t work = {
+        .op = MSC_WORK_WRITE,
+        .lun = lun,
+        .slot = -1,
+        .lba = lba,
+        .offset = offset,
+        .size = size,
+        .buf = (void *)src,
+    };
+
+    MSC_ENTER_CRITICAL();
+    const esp_err_t err = msc_worker.error;
+    msc_worker.error = ESP_OK;
+    if (err == ESP_OK && msc_worker.free_slots != 0) {
+        work.slot = __builtin_ctz(msc_worker.free_slots);
+        msc_worker.free_slots &= ~(1UL << work.slot);
+    } else if (err == ESP_OK) {
+        msc_io_stats.write_stalls++;
+    }
+    MSC_EXIT_CRITICAL();
+
+    if (err != ESP_OK) {
+        return TUD_MSC_RET_ERROR;
+    }
+    if (work.slot >= 0) {
+        memcpy(msc_worker.slots + (size_t)work.slot * MSC_STORAGE_BUFFER_SIZE, src, size);
+    }
+    msc_worker_post(&work);
+    return work.slot >= 0 ? (int32_t)size : TUD_MSC_RET_ASYNC;
+}
+
+/**
+ * @brief Allocate the write buffers and start the storage worker.
+ *
+ * @return
+ *  - ESP_OK: Worker running
+ *  - ESP_ERR_NO_MEM: Not enough memory for the buffers, the queue or the task
+ */
+static esp_err_t msc_worker_start(void)
+{
+    msc_worker.slots = heap_caps_aligned_alloc(MSC_STORAGE_MEM_ALIGN, (size_t)MSC_WORKER_DEPTH * MSC_STORAGE_BUFFER_SIZE, MALLOC_CAP_DMA);
+    msc_worker.queue = xQueueCreate(MSC_WORKER_QUEUE_LEN, sizeof(msc_work_t));
+    if (msc_worker.slots == NULL || msc_worker.queue == NULL) {
+        goto fail;
+    }
+    msc_worker.free_slots = (MSC_WORKER_DEPTH >= 32) ? UINT32_MAX : ((1UL << MSC_WORKER_DEPTH) - 1);
+    msc_worker.error = ESP_OK;
+    if (xTaskCreate(msc_worker_task, "msc_worker", MSC_WORKER_TASK_SIZE, NULL,
+                    MSC_WORKER_TASK_PRIO, &msc_worker.task) != pdPASS) {
+        msc_worker.task = NULL;
+        goto fail;
+    }
+    return ESP_OK;
+
+fail:
+    ESP_LOGE(TAG, "Failed to start the storage worker");
+    if (msc_worker.queue) {
+        vQueueDelete(msc_worker.queue);
+        msc_worker.queue = NULL;
+    }
+    heap_caps_free(msc_worker.slots);
+    msc_worker.slots = NULL;
+    return ESP_ERR_NO_MEM;
+}
+
+/**
+ * @brief Finish the queued requests and stop the storage worker.
+ */
+static void msc_worker_stop(void)
+{
+    if (msc_worker.task == NULL) {
+        return;
+    }
+    msc_worker_drain();
+    vTaskDelete(msc_worker.task);
+    msc_worker.task = NULL;
+    vQueueDelete(msc_worker.queue);
+    msc_worker.queue = NULL;
+    heap_caps_free(msc_worker.slots);
+    msc_worker.slots = NULL;
+}
+#else
+static inline esp_err_t msc_worker_drain(void)
+{
+    return ESP_OK;
+}
+#endif // CONFIG_TINYUSB_MSC_ASYNC
+
 static esp_err_t vfs_fat_format(BYTE format_flags)
 {
     esp_err_t ret;
@@ -464,15 +1016,40 @@ static esp_err_t msc_storage_mount(msc_storage_obj_t *storage)
         return ESP_OK;
     }
 
+    if (storage->medium->type == STORAGE_MEDIUM_TYPE_VIRTUAL) {
+        // No filesystem to mount, only hide the medium from the host; a host read in progress finishes first
+        xSemaphoreTake(storage->mux_lock, portMAX_DELAY);
+        storage->mount_point = TINYUSB_MSC_STORAGE_MOUNT_APP;
+        xSemaphoreGive(storage->mux_lock);
+        return ESP_OK;
+    }
+
     tinyusb_event_cb(storage, TINYUSB_MSC_EVENT_MOUNT_START);
 
     // Get the vacant driver number
     BYTE pdrv = 0xFF;
     ESP_RETURN_ON_ERROR(ff_diskio_get_drive(&pdrv), TAG, "The maximum count of volumes is already mounted");
 
+    // Host writes still queued to the storage worker go to the medium first
+    ret = msc_worker_drain();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Buffered host write failed, %s", esp_err_to_name(ret));
+    }
+
     // Lock the storage
     xSemaphoreTake(storage->mux_lock, portMAX_DELAY);
 
+    // Everything the host wrote must be on the medium before FATFS reads it
+    if (storage->cache_timer) {
+        esp_timer_stop(storage->cache_timer);
+    }
+    ret = msc_cache_flush(&storage->cache, storage->medium, MSC_CACHE_FLUSH_UNMOUNT);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Write cache flush failed, %s", esp_err_to_name(ret));
+    }
+    // The application may change any sector; the read-ahead must also be off the card before FATFS uses it
+    msc_readahead_quiesce(&storage->readahead);
+
     // Register the partition under the drive number
     ret = storage->medium->mount(pdrv);
     if (ret != ESP_OK) {
@@ -531,6 +1108,8 @@ static esp_err_t msc_storage_mount(msc_storage_obj_t *storage)
     tinyusb_event_cb(storage, TINYUSB_MSC_EVENT_MOUNT_COMPLETE);
     return ESP_OK;
 fail:
+    // No filesystem for the application; give the medium back to the host
+    storage->mount_point = TINYUSB_MSC_STORAGE_MOUNT_USB;
     xSemaphoreGive(storage->mux_lock);
     tinyusb_event_cb(storage, TINYUSB_MSC_EVENT_FORMAT_FAILED);
 exit:
@@ -559,6 +1138,17 @@ static esp_err_t msc_storage_unmount(msc_storage_obj_t *storage)
         return ESP_OK;
     }
 
+    if (storage->medium->type == STORAGE_MEDIUM_TYPE_VIRTUAL) {
+        // Publish the medium again; the unit attention makes the host drop what it read before
+        xSemaphoreTake(storage->mux_lock, portMAX_DELAY);
+        MSC_ENTER_CRITICAL();
+        storage->mount_point = TINYUSB_MSC_STORAGE_MOUNT_USB;
+        storage->medium_changed = true;
+        MSC_EXIT_CRITICAL();
+        xSemaphoreGive(storage->mux_lock);
+        return ESP_OK;
+    }
+
     tinyusb_event_cb(storage, TINYUSB_MSC_EVENT_MOUNT_START);
 
     xSemaphoreTake(storage->mux_lock, portMAX_DELAY);
@@ -578,7 +1168,10 @@ static esp_err_t msc_storage_unmount(msc_storage_obj_t *storage)
         return ret;
     }
 
+    MSC_ENTER_CRITICAL();
     storage->mount_point = TINYUSB_MSC_STORAGE_MOUNT_USB;
+    storage->medium_changed = true;
+    MSC_EXIT_CRITICAL();
     xSemaphoreGive(storage->mux_lock);
 
     tinyusb_event_cb(storage, TINYUSB_MSC_EVENT_MOUNT_COMPLETE);
@@ -666,6 +1259,24 @@ static esp_err_t msc_storage_new(const tinyusb_msc_storage_config_t *config,
              storage_obj->sector_count,
              storage_obj->sector_size);
 
+    // Write-back cache; without memory for it the storage falls back to the deferred write path
+    const uint32_t cache_sectors = (medium->type == STORAGE_MEDIUM_TYPE_VIRTUAL) ? 0 : MSC_STORAGE_CACHE_SECTORS;
+    if (msc_cache_init(&storage_obj->cache, cache_sectors, storage_obj->sector_size) == ESP_OK
+            && storage_obj->cache.buf != NULL) {
+        const esp_timer_create_args_t timer_args = {
+            .callback = msc_storage_cache_idle_cb,
+            .arg = storage_obj,
+            .name = "msc_cache",
+        };
+        if (esp_timer_create(&timer_args, &storage_obj->cache_timer) != ESP_OK) {
+            ESP_LOGW(TAG, "Failed to create the cache idle timer, writing through");
+            msc_cache_deinit(&storage_obj->cache);
+        }
+    }
+    // Read-ahead only pays off on SD cards; wear levelling on SPI flash is not safe to read from a second task
+    const uint32_t readahead = (medium->type == STORAGE_MEDIUM_TYPE_SDMMC) ? MSC_STORAGE_READAHEAD_SECTORS : 0;
+    msc_readahead_init(&storage_obj->readahead, medium, readahead, storage_obj->sector_size, storage_obj->sector_count);
+
     *storage_hdl = storage_obj;
     return ESP_OK;
 fail:
@@ -687,6 +1298,13 @@ fail:
  */
 static void msc_storage_delete(msc_storage_obj_t *storage)
 {
+    if (storage->cache_timer) {
+        esp_timer_stop(storage->cache_timer);
+        esp_timer_delete(storage->cache_timer);
+        storage->cache_timer = NULL;
+    }
+    msc_cache_deinit(&storage->cache);
+    msc_readahead_deinit(&storage->readahead);
     storage->medium = NULL;
 
     if (storage->mux_lock) {
@@ -730,13 +1348,25 @@ static esp_err_t msc_driver_install(const tinyusb_msc_driver_config_t *config, b
     msc_driver->constant.flags.val = (uint16_t) config->user_flags.val; // Config flags for the MSC driver
     msc_driver->constant.flags.internally_installed = internally_installed;
 
+#if CONFIG_TINYUSB_MSC_ASYNC
+    ret = msc_worker_start();
+    if (ret != ESP_OK) {
+        heap_caps_free(msc_driver);
+        return ret;
+    }
+#endif // CONFIG_TINYUSB_MSC_ASYNC
+
     MSC_ENTER_CRITICAL();
     MSC_GOTO_ON_FALSE_CRITICAL(p_msc_driver == NULL, ESP_ERR_INVALID_STATE);
     p_msc_driver = msc_driver;
+    memset(&msc_io_stats, 0, sizeof(msc_io_stats));
     MSC_EXIT_CRITICAL();
 
     return ESP_OK;
 fail:
+#if CONFIG_TINYUSB_MSC_ASYNC
+    msc_worker_stop();
+#endif // CONFIG_TINYUSB_MSC_ASYNC
     heap_caps_free(msc_driver);
     return ret;
 }
@@ -745,6 +1375,17 @@ fail:
 // ============================ TinyUSB MSC Storage Private Functions ==========================
 //
 
+/**
+ * @brief Check whether a storage follows the USB connection automatically.
+ *
+ * Virtual storages are only published and hidden by the application.
+ */
+static inline bool msc_storage_auto_mounted(const msc_storage_obj_t *storage)
+{
+    return storage != NULL && !p_msc_driver->constant.flags.auto_mount_off
+           && storage->medium->type != STORAGE_MEDIUM_TYPE_VIRTUAL;
+}
+
 void msc_storage_mount_to_app(void)
 {
     if (p_msc_driver == NULL) {
@@ -752,7 +1393,7 @@ void msc_storage_mount_to_app(void)
     }
 
     for (uint8_t i = 0; i < TINYUSB_MSC_STORAGE_MAX_LUNS; i++) {
-        if (p_msc_driver->dynamic.storage[i] != NULL && !p_msc_driver->constant.flags.auto_mount_off) {
+        if (msc_storage_auto_mounted(p_msc_driver->dynamic.storage[i])) {
             if (msc_storage_mount(p_msc_driver->dynamic.storage[i]) != ESP_OK) {
                 ESP_LOGW(TAG, "Unable to mount storage to app");
                 tinyusb_event_cb(p_msc_driver->dynamic.storage[i], TINYUSB_MSC_EVENT_MOUNT_FAILED);
@@ -768,7 +1409,7 @@ void msc_storage_mount_to_usb(void)
     }
 
     for (uint8_t i = 0; i < TINYUSB_MSC_STORAGE_MAX_LUNS; i++) {
-        if (p_msc_driver->dynamic.storage[i] != NULL && !p_msc_driver->constant.flags.auto_mount_off) {
+        if (msc_storage_auto_mounted(p_msc_driver->dynamic.storage[i])) {
             if (msc_storage_unmount(p_msc_driver->dynamic.storage[i]) != ESP_OK) {
                 ESP_LOGW(TAG, "Unable to mount storage to usb");
                 tinyusb_event_cb(p_msc_driver->dynamic.storage[i], TINYUSB_MSC_EVENT_MOUNT_FAILED);
@@ -807,6 +1448,9 @@ esp_err_t tinyusb_msc_uninstall_driver(void)
     p_msc_driver = NULL;
     MSC_EXIT_CRITICAL();
 
+#if CONFIG_TINYUSB_MSC_ASYNC
+    msc_worker_stop();
+#endif // CONFIG_TINYUSB_MSC_ASYNC
     // Free the driver memory
     heap_caps_free(msc_driver);
     return ESP_OK;
@@ -978,6 +1622,83 @@ driver_err:
 }
 #endif // SOC_SDMMC_HOST_SUPPORTED
 
+esp_err_t tinyusb_msc_new_storage_virtual(const tinyusb_msc_virtual_config_t *config,
+                                          tinyusb_msc_storage_handle_t *handle)
+{
+    ESP_RETURN_ON_FALSE(config != NULL, ESP_ERR_INVALID_ARG, TAG, "Config can't be NULL");
+    ESP_RETURN_ON_FALSE(config->sector_size != 0 && MSC_STORAGE_BUFFER_SIZE % config->sector_size == 0,
+                        ESP_ERR_INVALID_ARG, TAG, "Sector size %"PRIu32" must divide the MSC buffer size %d",
+                        config->sector_size, MSC_STORAGE_BUFFER_SIZE);
+
+    bool need_to_install_driver = false;
+    const storage_medium_t *medium = NULL;
+    msc_storage_obj_t *storage = NULL;
+    esp_err_t ret;
+
+    MSC_ENTER_CRITICAL();
+    if (p_msc_driver == NULL) {
+        need_to_install_driver = true;
+    }
+    MSC_EXIT_CRITICAL();
+
+    // Driver was not installed, install it now
+    if (need_to_install_driver) {
+        tinyusb_msc_driver_config_t default_cfg = {
+            .callback = msc_storage_event_default_cb,
+        };
+        ret = msc_driver_install(&default_cfg, true);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to install MSC driver");
+            goto driver_err;
+        }
+    }
+
+    // Create a medium for storage
+    ret = storage_virtual_open_medium(config, &medium);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open virtual medium");
+        goto medium_err;
+    }
+    // Create a storage object; the FAT settings are unused, there is no filesystem for the application
+    const tinyusb_msc_storage_config_t storage_cfg = {
+        .fat_fs.do_not_format = true,
+    };
+    ret = msc_storage_new(&storage_cfg, medium, &storage);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create MSC storage object");
+        goto storage_err;
+    }
+    // Hidden until the application publishes it
+    storage->mount_point = TINYUSB_MSC_STORAGE_MOUNT_APP;
+
+    // Map the storage object to the MSC Lun
+    MSC_ENTER_CRITICAL();
+    if (!_msc_storage_map_to_lun(storage)) {
+        MSC_EXIT_CRITICAL();
+        ESP_LOGE(TAG, "Failed to map storage to LUN");
+        ret = ESP_FAIL;
+        goto map_err;
+    }
+    MSC_EXIT_CRITICAL();
+
+    // Return the handle to the storage
+    if (handle != NULL) {
+        *handle = (tinyusb_msc_storage_handle_t)storage;
+    }
+    return ESP_OK;
+
+map_err:
+    msc_storage_delete(storage);
+storage_err:
+    medium->close();
+medium_err:
+    if (need_to_install_driver) {
+        tinyusb_msc_uninstall_driver();
+    }
+driver_err:
+    return ret;
+}
+
 esp_err_t tinyusb_msc_delete_storage(tinyusb_msc_storage_handle_t handle)
 {
     ESP_RETURN_ON_FALSE(handle != NULL, ESP_ERR_INVALID_ARG, TAG, "Storage handle can't be NULL");
@@ -995,6 +1716,12 @@ esp_err_t tinyusb_msc_delete_storage(tinyusb_msc_storage_handle_t handle)
         ESP_ERROR_CHECK(msc_storage_unmount(storage));
     }
 
+    // Nothing queued to the storage worker may refer to the storage once it is unmapped
+    if (storage->cache_timer) {
+        esp_timer_stop(storage->cache_timer);
+    }
+    msc_worker_drain();
+
     // Unmap the storage from the MSC Lun
     MSC_ENTER_CRITICAL();
     if (!_msc_storage_unmap_from_lun(storage)) {
@@ -1005,7 +1732,8 @@ esp_err_t tinyusb_msc_delete_storage(tinyusb_msc_storage_handle_t handle)
     no_more_luns = (p_msc_driver->dynamic.lun_count == 0);
     MSC_EXIT_CRITICAL();
 
-    // Close the storage medium
+    // Write out what the host left in the cache, then close the storage medium
+    msc_storage_cache_flush(storage, MSC_CACHE_FLUSH_UNMOUNT);
     storage->medium->close();
 
     // If no LUNs left and driver was installed internally, uninstall the driver
@@ -1056,16 +1784,14 @@ esp_err_t tinyusb_msc_set_storage_mount_point(tinyusb_msc_storage_handle_t handl
         return ESP_OK;
     }
 
+    // The TinyUSB driver stays installed: while the application owns the medium the host sees it as not present,
+    // and a unit attention when it comes back. The mount functions update the mount point once the switch is done.
     if (mount_point == TINYUSB_MSC_STORAGE_MOUNT_APP) {
         // If the storage is mounted to application, mount it
-        msc_storage_mount(storage);
-    } else {
-        // If the storage is mounted to USB host, unmount it
-        msc_storage_unmount(storage);
+        return msc_storage_mount(storage);
     }
-    storage->mount_point = mount_point;
-
-    return ESP_OK;
+    // If the storage is mounted to USB host, unmount it
+    return msc_storage_unmount(storage);
 }
 
 esp_err_t tinyusb_msc_config_storage_fat_fs(tinyusb_msc_storage_handle_t handle,
@@ -1113,6 +1839,46 @@ esp_err_t tinyusb_msc_get_storage_mount_point(tinyusb_msc_storage_handle_t handl
     return ESP_OK;
 }
 
+esp_err_t tinyusb_msc_get_cache_stats(tinyusb_msc_storage_handle_t handle, tinyusb_msc_cache_stats_t *stats)
+{
+    ESP_RETURN_ON_FALSE(p_msc_driver != NULL, ESP_ERR_INVALID_STATE, TAG, "MSC driver is not initialized");
+    ESP_RETURN_ON_FALSE(handle != NULL, ESP_ERR_INVALID_STATE, TAG, "MSC storage is not initialized");
+    ESP_RETURN_ON_FALSE(stats != NULL, ESP_ERR_INVALID_ARG, TAG, "Stats pointer can't be NULL");
+
+    msc_storage_obj_t *storage = (msc_storage_obj_t *) handle;
+    xSemaphoreTake(storage->mux_lock, portMAX_DELAY);
+    *stats = storage->cache.stats;
+    xSemaphoreGive(storage->mux_lock);
+
+    return ESP_OK;
+}
+
+esp_err_t tinyusb_msc_get_readahead_stats(tinyusb_msc_storage_handle_t handle, tinyusb_msc_readahead_stats_t *stats)
+{
+    ESP_RETURN_ON_FALSE(p_msc_driver != NULL, ESP_ERR_INVALID_STATE, TAG, "MSC driver is not initialized");
+    ESP_RETURN_ON_FALSE(handle != NULL, ESP_ERR_INVALID_STATE, TAG, "MSC storage is not initialized");
+    ESP_RETURN_ON_FALSE(stats != NULL, ESP_ERR_INVALID_ARG, TAG, "Stats pointer can't be NULL");
+
+    msc_storage_obj_t *storage = (msc_storage_obj_t *) handle;
+    xSemaphoreTake(storage->mux_lock, portMAX_DELAY);
+    msc_readahead_get_stats(&storage->readahead, stats);
+    xSemaphoreGive(storage->mux_lock);
+
+    return ESP_OK;
+}
+
+esp_err_t tinyusb_msc_get_io_stats(tinyusb_msc_io_stats_t *stats)
+{
+    ESP_RETURN_ON_FALSE(p_msc_driver != NULL, ESP_ERR_INVALID_STATE, TAG, "MSC driver is not initialized");
+    ESP_RETURN_ON_FALSE(stats != NULL, ESP_ERR_INVALID_ARG, TAG, "Stats pointer can't be NULL");
+
+    MSC_ENTER_CRITICAL();
+    *stats = msc_io_stats;
+    MSC_EXIT_CRITICAL();
+
+    return ESP_OK;
+}
+
 esp_err_t tinyusb_msc_format_storage(tinyusb_msc_storage_handle_t handle)
 {
     ESP_RETURN_ON_FALSE(p_msc_driver != NULL, ESP_ERR_INVALID_STATE, TAG, "MSC driver is not initialized");
@@ -1126,6 +1892,7 @@ esp_err_t tinyusb_msc_format_storage(tinyusb_msc_storage_handle_t handle)
     int max_files = storage->fat_fs.max_files;
 
     ESP_RETURN_ON_FALSE(storage->mount_point == TINYUSB_MSC_STORAGE_MOUNT_APP, ESP_ERR_INVALID_ARG, TAG, "Storage must be mounted to APP to format it");
+    ESP_RETURN_ON_FALSE(storage->medium->type != STORAGE_MEDIUM_TYPE_VIRTUAL, ESP_ERR_NOT_SUPPORTED, TAG, "Virtual storage can't be formatted");
     // Register the diskio driver on the storage medium
     ESP_RETURN_ON_ERROR(ff_diskio_get_drive(&pdrv), TAG, "The maximum count of volumes is already mounted");
     ESP_RETURN_ON_ERROR(storage->medium->mount(pdrv), TAG, "Failed pdrv=%d", pdrv);
@@ -1156,11 +1923,7 @@ esp_err_t tinyusb_msc_format_storage(tinyusb_msc_storage_handle_t handle)
 /* TinyUSB MSC callbacks
    ********************************************************************* */
 
-/** SCSI ASC/ASCQ codes. **/
-/** User can add and use more codes as per the need of the application **/
-#define SCSI_CODE_ASC_MEDIUM_NOT_PRESENT                0x3A /** SCSI ASC code for 'MEDIUM NOT PRESENT' **/
-#define SCSI_CODE_ASC_INVALID_COMMAND_OPERATION_CODE    0x20 /** SCSI ASC code for 'INVALID COMMAND OPERATION CODE' **/
-#define SCSI_CODE_ASCQ                                  0x00
+#define SCSI_CMD_SYNCHRONIZE_CACHE_10                   0x35 /** Not in TinyUSB's list of SCSI commands **/
 
 // Invoked when received GET_MAX_LUN request, required for multiple LUNs implementation
 uint8_t tud_msc_get_maxlun_cb(void)
@@ -1198,9 +1961,19 @@ bool tud_msc_test_unit_ready_cb(uint8_t lun)
 
     MSC_ENTER_CRITICAL();
     bool found = _msc_storage_get_by_lun(lun, &storage);
+    bool ready = found && (storage != NULL) && (storage->mount_point == TINYUSB_MSC_STORAGE_MOUNT_USB);
+    bool changed = ready && storage->medium_changed;
+    if (changed) {
+        storage->medium_changed = false;
+    }
     MSC_EXIT_CRITICAL();
 
-    if (found && (storage != NULL) && (storage->mount_point == TINYUSB_MSC_STORAGE_MOUNT_USB)) {
+    if (changed) {
+        // The application may have changed any sector; the host must drop what it cached before reading again
+        tud_msc_set_sense(lun, SCSI_SENSE_UNIT_ATTENTION, SCSI_CODE_ASC_MEDIUM_CHANGED, SCSI_CODE_ASCQ);
+        return false;
+    }
+    if (ready) {
         // Storage media is ready for access by USB host
         return true;
     }
@@ -1209,6 +1982,19 @@ bool tud_msc_test_unit_ready_cb(uint8_t lun)
     return false;
 }
 
+// Invoked to check if the LUN accepts writes; the host sees a virtual storage write protected
+bool tud_msc_is_writable_cb(uint8_t lun)
+{
+    msc_storage_obj_t *storage = NULL;
+
+    MSC_ENTER_CRITICAL();
+    bool found = _msc_storage_get_by_lun(lun, &storage);
+    bool writable = !(found && storage != NULL && storage->medium->type == STORAGE_MEDIUM_TYPE_VIRTUAL);
+    MSC_EXIT_CRITICAL();
+
+    return writable;
+}
+
 // Invoked when received SCSI_CMD_READ_CAPACITY_10 and SCSI_CMD_READ_FORMAT_CAPACITY to determine the disk size
 // Application update block count and block size
 void tud_msc_capacity_cb(uint8_t lun, uint32_t *block_count, uint16_t *block_size)
@@ -1252,10 +2038,21 @@ bool tud_msc_start_stop_cb(uint8_t lun, uint8_t power_condition, bool start, boo
 // - Application fill the buffer (up to bufsize) with address contents and return number of read byte.
 int32_t tud_msc_read10_cb(uint8_t lun, uint32_t lba, uint32_t offset, void *buffer, uint32_t bufsize)
 {
+    if (!msc_storage_host_ready(lun)) {
+        tud_msc_set_sense(lun, SCSI_SENSE_NOT_READY, SCSI_CODE_ASC_MEDIUM_NOT_PRESENT, SCSI_CODE_ASCQ);
+        return -1;
+    }
+    msc_io_account(false, bufsize);
+#if CONFIG_TINYUSB_MSC_ASYNC
+    // The worker fills the endpoint buffer and completes the packet with tud_msc_async_io_done()
+    if (msc_worker_read(lun, lba, offset, bufsize, buffer)) {
+        return TUD_MSC_RET_ASYNC;
+    }
+#endif // CONFIG_TINYUSB_MSC_ASYNC
     esp_err_t err = msc_storage_read_sector(lun, lba, offset, bufsize, buffer);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "READ(10) command failed, %s", esp_err_to_name(err));
-        tud_msc_set_sense(lun, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_CODE_ASC_INVALID_COMMAND_OPERATION_CODE, SCSI_CODE_ASCQ);
+        msc_storage_set_sense(lun, err, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_CODE_ASC_INVALID_COMMAND_OPERATION_CODE);
         return -1; // Indicate an error occurred
     }
     return bufsize;
@@ -1271,7 +2068,39 @@ int32_t tud_msc_write10_cb(uint8_t lun, uint32_t lba, uint32_t offset, uint8_t *
         ESP_LOGE(TAG, "Buffer size %"PRIu32" exceeds maximum allowed size %d", bufsize, MSC_STORAGE_BUFFER_SIZE);
         goto error;
     }
-    esp_err_t err = msc_storage_write_sector_deferred(lun, lba, offset, bufsize, buffer);
+    if (!msc_storage_host_ready(lun)) {
+        tud_msc_set_sense(lun, SCSI_SENSE_NOT_READY, SCSI_CODE_ASC_MEDIUM_NOT_PRESENT, SCSI_CODE_ASCQ);
+        return -1;
+    }
+    msc_io_account(true, bufsize);
+#if CONFIG_TINYUSB_MSC_ASYNC
+    if (msc_worker.task != NULL) {
+        int32_t ret = msc_worker_write(lun, lba, offset, bufsize, buffer);
+        if (ret == TUD_MSC_RET_ERROR) {
+            // An earlier buffered write did not reach the medium
+            ESP_LOGE(TAG, "WRITE(10) command failed, earlier write error");
+            tud_msc_set_sense(lun, SCSI_SENSE_MEDIUM_ERROR, SCSI_CODE_ASC_WRITE_ERROR, SCSI_CODE_ASCQ);
+        }
+        return ret;
+    }
+#endif // CONFIG_TINYUSB_MSC_ASYNC
+    msc_storage_obj_t *storage = NULL;
+    MSC_ENTER_CRITICAL();
+    bool found = _msc_storage_get_by_lun(lun, &storage);
+    MSC_EXIT_CRITICAL();
+
+    esp_err_t err;
+    if (found && storage != NULL && storage->cache.buf != NULL) {
+        err = msc_storage_write_sector_cached(storage, lba, offset, bufsize, buffer);
+        if (err != ESP_OK) {
+            // Data of this or an earlier command did not reach the medium
+            ESP_LOGE(TAG, "WRITE(10) command failed, %s", esp_err_to_name(err));
+            msc_storage_set_sense(lun, err, SCSI_SENSE_MEDIUM_ERROR, SCSI_CODE_ASC_WRITE_ERROR);
+            return -1;
+        }
+        return bufsize;
+    }
+    err = msc_storage_write_sector_deferred(lun, lba, offset, bufsize, buffer);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "WRITE(10) command failed, %s", esp_err_to_name(err));
         goto error;
@@ -1284,6 +2113,35 @@ error:
     return -1; // Indicate an error occurred
 }
 
+/**
+ * @brief Write everything the host sent to the storage mapped to a LUN to the medium.
+ *
+ * Waits for the storage worker, then flushes the write-back cache.
+ *
+ * @param[in] lun Logical unit number.
+ *
+ * @return
+ *  - ESP_OK: Cache flushed, or no storage is mapped to the LUN
+ *  - Other: Error of the medium write, or of a buffered write since the last sync
+ */
+static esp_err_t msc_storage_sync(uint8_t lun)
+{
+    msc_storage_obj_t *storage = NULL;
+
+    // Buffered writes first, they may still be on their way into the cache
+    esp_err_t ret = msc_worker_drain();
+
+    MSC_ENTER_CRITICAL();
+    bool found = _msc_storage_get_by_lun(lun, &storage);
+    MSC_EXIT_CRITICAL();
+
+    if (!found || storage == NULL) {
+        return ret;
+    }
+    esp_err_t err = msc_storage_cache_flush(storage, MSC_CACHE_FLUSH_SYNC);
+    return ret != ESP_OK ? ret : err;
+}
+
 /**
  * Invoked when received an SCSI command not in built-in list below.
  * - READ_CAPACITY10, READ_FORMAT_CAPACITY, INQUIRY, TEST_UNIT_READY, START_STOP_UNIT, MODE_SENSE6, REQUEST_SENSE
@@ -1308,8 +2166,22 @@ int32_t tud_msc_scsi_cb(uint8_t lun, uint8_t const scsi_cmd[16], void *buffer, u
     case SCSI_CMD_PREVENT_ALLOW_MEDIUM_REMOVAL:
         /* SCSI_CMD_PREVENT_ALLOW_MEDIUM_REMOVAL is the Prevent/Allow Medium Removal
         command (1Eh) that requests the library to enable or disable user access to
-        the storage media/partition. */
+        the storage media/partition. The host allows removal when it is done with the
+        medium, so the write-back cache is flushed then. */
+        ret = 0;
+        if ((scsi_cmd[4] & 0x01) == 0 && msc_storage_sync(lun) != ESP_OK) {
+            tud_msc_set_sense(lun, SCSI_SENSE_MEDIUM_ERROR, SCSI_CODE_ASC_WRITE_ERROR, SCSI_CODE_ASCQ);
+            ret = -1;
+        }
+        break;
+    case SCSI_CMD_SYNCHRONIZE_CACHE_10:
+        /* SYNCHRONIZE CACHE(10) (35h): write everything held in the write-back cache
+        to the medium before reporting success. */
         ret = 0;
+        if (msc_storage_sync(lun) != ESP_OK) {
+            tud_msc_set_sense(lun, SCSI_SENSE_MEDIUM_ERROR, SCSI_CODE_ASC_WRITE_ERROR, SCSI_CODE_ASCQ);
+            ret = -1;
+        }
         break;
     default:
         ESP_LOGW(TAG, "tud_msc_scsi_cb() invoked: %d", scsi_cmd[0]);
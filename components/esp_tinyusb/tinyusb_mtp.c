@@ -0,0 +1,964 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_check.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#include "tinyusb.h"
+#include "class/mtp/mtp_device.h"
+#include "device/usbd_pvt.h"
+#include "tinyusb_mtp.h"
+#include "tinyusb_task.h"
+
+static const char *TAG = "tinyusb_mtp";
+
+#define MTP_CHUNK_SIZE          CONFIG_TINYUSB_MTP_CHUNK_SIZE
+#define MTP_SECTOR_SIZE         512     // Object reads start on a sector, so FatFs reads straight into the chunk
+#define MTP_BUF_ALIGN           64      // Cache line, so the SDMMC DMA can fill PSRAM directly
+#define MTP_TASK_SIZE           3072
+#define MTP_TASK_PRIO           5       // Same as the default TinyUSB task, which waits on the worker
+#define MTP_DATE_LEN            16      // "YYYYMMDDThhmmss"
+#define MTP_OBJECT_MAX          (UINT32_MAX - sizeof(mtp_container_header_t)) // Largest GetObject data phase
+#define MTP_LOG_MIN_BYTES       (1024 * 1024) // Transfers logged at info level, the rest at debug
+#define MTP_HANDLE_ALL          0xFFFFFFFF
+#define MTP_EVENT_NO_TRANSACTION 0xFFFFFFFF
+
+_Static_assert(MTP_CHUNK_SIZE % MTP_SECTOR_SIZE == 0, "CONFIG_TINYUSB_MTP_CHUNK_SIZE must be a multiple of 512");
+
+/**
+ * @brief Stream chunk: a run of object bytes read ahead of the host.
+ */
+typedef struct {
+    uint64_t offset;                        /*!< Object offset of the first byte held */
+    uint32_t len;                           /*!< Bytes held */
+    bool valid;                             /*!< Holds data the host has not been sent yet */
+} mtp_chunk_t;
+
+/**
+ * @brief Object stream: the open object is read ahead into two chunks on a worker task.
+ *
+ * GetObject data goes out one CONFIG_TINYUSB_MTP_EP_BUFSIZE transfer at a time. Reading each transfer
+ * from the filesystem on the TinyUSB task would leave the bus idle during every read, so the worker reads
+ * whole chunks ahead into one buffer while the host is served from the other (ping-pong), the same way the
+ * MSC read-ahead does for sectors. The first read starts on the sector holding the first requested byte
+ * and ends on a chunk boundary, all later reads are whole aligned chunks.
+ */
+typedef struct {
+    uint8_t *buf;                           /*!< Two chunks of MTP_CHUNK_SIZE bytes */
+    mtp_chunk_t chunk[2];                   /*!< Chunks backed by buf */
+    bool open;                              /*!< The backend has the streamed object open */
+    bool filling;                           /*!< Worker is in the backend read */
+    uint64_t next_fill;                     /*!< Object offset of the next read */
+    uint64_t pos;                           /*!< Next byte for the host */
+    uint64_t end;                           /*!< Byte after the last one to send */
+    uint32_t generation;                    /*!< Bumped when the stream stops; a read started before is dropped */
+    esp_err_t error;                        /*!< First read error of the stream */
+    SemaphoreHandle_t lock;                 /*!< Protects the fields above against the worker */
+    SemaphoreHandle_t done;                 /*!< Given by the worker after each read */
+    TaskHandle_t task;                      /*!< Worker task */
+} mtp_stream_t;
+
+/**
+ * @brief MTP responder state.
+ */
+typedef struct {
+    tinyusb_mtp_config_t config;            /*!< Backend and strings */
+    mtp_stream_t stream;                    /*!< Object data read ahead for the host */
+    bool session_open;                      /*!< OpenSession received */
+    uint32_t session_id;                    /*!< Session of the host, for events */
+    bool xfer_active;                       /*!< An object data phase is in progress */
+    uint16_t xfer_op;                       /*!< GetObject or GetPartialObject */
+    uint32_t xfer_handle;                   /*!< Object being sent */
+    uint64_t xfer_len;                      /*!< Object bytes of the data phase */
+    uint64_t xfer_sent;                     /*!< Object bytes copied into the endpoint buffer so far */
+    int64_t xfer_start_us;                  /*!< Time of the command */
+    esp_err_t xfer_error;                   /*!< First stream error of the data phase */
+    bool list_active;                       /*!< A GetObjectHandles data phase is in progress */
+    uint32_t list_format;                   /*!< Format filter of the listing, 0 for all */
+    uint32_t list_next;                     /*!< Next object index to look at */
+    uint32_t list_left;                     /*!< Handles announced in the header but not sent yet */
+    tinyusb_mtp_stats_t stats;              /*!< Transfer statistics. Protected by mtp_lock. */
+} mtp_responder_t;
+
+static mtp_responder_t *p_mtp_responder;
+static portMUX_TYPE mtp_lock = portMUX_INITIALIZER_UNLOCKED;
+
+#define MTP_ENTER_CRITICAL()    portENTER_CRITICAL(&mtp_lock)
+#define MTP_EXIT_CRITICAL()     portEXIT_CRITICAL(&mtp_lock)
+
+// --------------------------- Object stream ---------------------------------
+
+/**
+ * @brief Worker task: reads the next chunks of the open object into the free chunk buffers.
+ *
+ * @param arg Pointer to the responder.
+ */
+static void mtp_stream_task(void *arg)
+{
+    mtp_responder_t *mtp = (mtp_responder_t *)arg;
+    mtp_stream_t *st = &mtp->stream;
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        while (true) {
+            xSemaphoreTake(st->lock, portMAX_DELAY);
+            const int slot = !st->chunk[0].valid ? 0 : (!st->chunk[1].valid ? 1 : -1);
+            if (!st->open || st->error != ESP_OK || st->next_fill >= st->end || slot < 0) {
+                xSemaphoreGive(st->lock);
+                break;
+            }
+            const uint64_t offset = st->next_fill;
+            uint32_t size = MTP_CHUNK_SIZE - (uint32_t)(offset % MTP_CHUNK_SIZE);
+            if (st->end - offset < size) {
+                size = (uint32_t)((st->end - offset + MTP_SECTOR_SIZE - 1) / MTP_SECTOR_SIZE * MTP_SECTOR_SIZE);
+            }
+            st->next_fill = offset + size;
+            st->filling = true;
+            const uint32_t generation = st->generation;
+            xSemaphoreGive(st->lock);
+
+            size_t read_size = 0;
+            const int64_t start_us = esp_timer_get_time();
+            esp_err_t err = mtp->config.ops.read(offset, st->buf + (size_t)slot * MTP_CHUNK_SIZE, size,
+                                                 &read_size, mtp->config.arg);
+            const int64_t read_us = esp_timer_get_time() - start_us;
+
+            MTP_ENTER_CRITICAL();
+            mtp->stats.read_us += read_us;
+            MTP_EXIT_CRITICAL();
+
+            xSemaphoreTake(st->lock, portMAX_DELAY);
+            st->filling = false;
+            if (generation == st->generation) {
+                if (err != ESP_OK) {
+                    st->error = err;
+                } else if (read_size > 0) {
+                    st->chunk[slot].offset = offset;
+                    st->chunk[slot].len = (uint32_t)read_size;
+                    st->chunk[slot].valid = true;
+                }
+                if (err == ESP_OK && read_size < size) {
+                    st->next_fill = st->end; // End of the file
+                }
+            }
+            xSemaphoreGive(st->lock);
+            xSemaphoreGive(st->done);
+
+            if (err != ESP_OK) {
+                ESP_LOGW(TAG, "Object read of %"PRIu32" bytes at %llu failed, %s", size,
+                         (unsigned long long)offset, esp_err_to_name(err));
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Stop the stream and close the object, after the worker has left the backend.
+ */
+static void mtp_stream_stop(mtp_responder_t *mtp)
+{
+    mtp_stream_t *st = &mtp->stream;
+
+    xSemaphoreTake(st->lock, portMAX_DELAY);
+    if (!st->open) {
+        xSemaphoreGive(st->lock);
+        return;
+    }
+    st->open = false;
+    st->generation++;
+    st->chunk[0].valid = false;
+    st->chunk[1].valid = false;
+    while (st->filling) {
+        xSemaphoreGive(st->lock);
+        xSemaphoreTake(st->done, portMAX_DELAY);
+        xSemaphoreTake(st->lock, portMAX_DELAY);
+    }
+    xSemaphoreGive(st->lock);
+    mtp->config.ops.close(mtp->config.arg);
+}
+
+/**
+ * @brief Open an object and start reading it ahead from the sector holding offset.
+ *
+ * @return
+ *    - ESP_OK: Stream started
+ *    - Other: Error of the backend open
+ */
+static esp_err_t mtp_stream_start(mtp_responder_t *mtp, uint32_t index, uint64_t offset, uint64_t length)
+{
+    mtp_stream_t *st = &mtp->stream;
+
+    mtp_stream_stop(mtp);
+    esp_err_t ret = mtp->config.ops.open(index, mtp->config.arg);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    xSemaphoreTake(st->lock, portMAX_DELAY);
+    st->open = true;
+    st->error = ESP_OK;
+    st->chunk[0].valid = false;
+    st->chunk[1].valid = false;
+    st->pos = offset;
+    st->end = offset + length;
+    st->next_fill = offset - offset % MTP_SECTOR_SIZE;
+    xSemaphoreGive(st->lock);
+    xTaskNotifyGive(st->task);
+    return ESP_OK;
+}
+
+/**
+ * @brief Copy the next object bytes for the host, waiting for the worker when they are not read yet.
+ *
+ * @return
+ *    - ESP_OK: Data copied
+ *    - ESP_ERR_INVALID_SIZE: The object ended before its listed size
+ *    - Other: Error of the backend read
+ */
+static esp_err_t mtp_stream_copy(mtp_responder_t *mtp, uint8_t *dest, uint32_t size)
+{
+    mtp_stream_t *st = &mtp->stream;
+    bool waited = false;
+
+    xSemaphoreTake(st->lock, portMAX_DELAY);
+    while (size > 0) {
+        int slot = -1;
+        for (int i = 0; i < 2; i++) {
+            if (st->chunk[i].valid && st->pos >= st->chunk[i].offset && st->pos - st->chunk[i].offset < st->chunk[i].len) {
+                slot = i;
+                break;
+            }
+        }
+        if (slot < 0) {
+            if (st->error == ESP_OK && !st->filling && st->next_fill >= st->end) {
+                st->error = ESP_ERR_INVALID_SIZE;
+            }
+            if (st->error != ESP_OK) {
+                break;
+            }
+            // The chunk is being read, or the worker is about to start on it
+            xTaskNotifyGive(st->task);
+            xSemaphoreGive(st->lock);
+            xSemaphoreTake(st->done, portMAX_DELAY);
+            xSemaphoreTake(st->lock, portMAX_DELAY);
+            waited = true;
+            continue;
+        }
+        mtp_chunk_t *chunk = &st->chunk[slot];
+        const uint64_t avail = chunk->offset + chunk->len - st->pos;
+        const uint32_t n = (size < avail) ? size : (uint32_t)avail;
+        memcpy(dest, st->buf + (size_t)slot * MTP_CHUNK_SIZE + (st->pos - chunk->offset), n);
+        dest += n;
+        size -= n;
+        st->pos += n;
+        if (st->pos == chunk->offset + chunk->len) {
+            // Double buffering: refill a chunk as soon as the host is done with it
+            chunk->valid = false;
+            xTaskNotifyGive(st->task);
+        }
+    }
+    const esp_err_t ret = (size == 0) ? ESP_OK : st->error;
+    xSemaphoreGive(st->lock);
+
+    if (waited) {
+        MTP_ENTER_CRITICAL();
+        mtp->stats.waits++;
+        MTP_EXIT_CRITICAL();
+    }
+    return ret;
+}
+
+// --------------------------- Data phases -----------------------------------
+
+/**
+ * @brief Find the bulk IN endpoint of the MTP interface in the active configuration descriptor.
+ */
+static bool mtp_find_ep_in(uint8_t *ep_in)
+{
+    const uint8_t *desc = tud_descriptor_configuration_cb(0);
+    if (desc == NULL) {
+        return false;
+    }
+    const uint8_t *end = desc + tu_le16toh(((const tusb_desc_configuration_t *)desc)->wTotalLength);
+    bool mtp_itf = false;
+    for (const uint8_t *p = tu_desc_next(desc); p < end; p = tu_desc_next(p)) {
+        if (tu_desc_type(p) == TUSB_DESC_INTERFACE) {
+            mtp_itf = ((const tusb_desc_interface_t *)p)->bInterfaceClass == TUSB_CLASS_IMAGE;
+        } else if (mtp_itf && tu_desc_type(p) == TUSB_DESC_ENDPOINT) {
+            const tusb_desc_endpoint_t *ep = (const tusb_desc_endpoint_t *)p;
+            if (ep->bmAttributes.xfer == TUSB_XFER_BULK && tu_edpt_dir(ep->bEndpointAddress) == TUSB_DIR_IN) {
+                *ep_in = ep->bEndpointAddress;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief End an IN data phase that went out in whole packets with a zero-length packet.
+ *
+ * The host only sees the end of such a data phase on a short packet, and the class driver sends none: its
+ * next tud_mtp_data_send() has no bytes left and queues nothing. The ZLP completes through the class driver
+ * like any short packet, which then calls tud_mtp_data_complete_cb().
+ */
+static bool mtp_send_zlp(mtp_container_info_t *io_container)
+{
+    const uint8_t rhport = tinyusb_task_get_port();
+    uint8_t ep_in;
+
+    if (!mtp_find_ep_in(&ep_in) || !usbd_edpt_claim(rhport, ep_in)) {
+        return false;
+    }
+    if (!usbd_edpt_xfer(rhport, ep_in, io_container->payload, 0)) {
+        usbd_edpt_release(rhport, ep_in);
+        return false;
+    }
+    return true;
+}
+
+// --------------------------- Object transfers ------------------------------
+
+/**
+ * @brief Fill the next part of an object data phase and send it.
+ *
+ * A backend error cannot end the data phase early, the class driver always sends the length announced in
+ * the header. The rest is sent as zeros and the response reports MTP_RESP_INCOMPLETE_TRANSFER.
+ */
+static void mtp_transfer_send(mtp_responder_t *mtp, mtp_container_info_t *io_container)
+{
+    const uint64_t left = mtp->xfer_len - mtp->xfer_sent;
+    const uint32_t n = (left < io_container->payload_bytes) ? (uint32_t)left : io_container->payload_bytes;
+
+    if (mtp->xfer_error == ESP_OK) {
+        mtp->xfer_error = mtp_stream_copy(mtp, io_container->payload, n);
+        if (mtp->xfer_error != ESP_OK) {
+            ESP_LOGW(TAG, "Object 0x%08"PRIx32" cut short at %llu of %llu bytes, %s", mtp->xfer_handle,
+                     (unsigned long long)mtp->xfer_sent, (unsigned long long)mtp->xfer_len,
+                     esp_err_to_name(mtp->xfer_error));
+        }
+    }
+    if (mtp->xfer_error != ESP_OK) {
+        memset(io_container->payload, 0, n);
+    }
+    mtp->xfer_sent += n;
+    tud_mtp_data_send(io_container);
+}
+
+/**
+ * @brief Start the data phase of GetObject or GetPartialObject.
+ *
+ * @return MTP response code, 0 when the data phase started.
+ */
+static int32_t mtp_transfer_begin(mtp_responder_t *mtp, mtp_container_info_t *io_container, uint16_t op_code,
+                                  uint32_t handle, uint64_t offset, uint64_t length)
+{
+    if (mtp_stream_start(mtp, handle - 1, offset, length) != ESP_OK) {
+        return MTP_RESP_GENERAL_ERROR;
+    }
+    mtp->xfer_active = true;
+    mtp->xfer_op = op_code;
+    mtp->xfer_handle = handle;
+    mtp->xfer_len = length;
+    mtp->xfer_sent = 0;
+    mtp->xfer_error = ESP_OK;
+    mtp->xfer_start_us = esp_timer_get_time();
+
+    io_container->header->len = (uint32_t)(sizeof(mtp_container_header_t) + length);
+    mtp_transfer_send(mtp, io_container);
+    return 0;
+}
+
+/**
+ * @brief End an object data phase: close the object and account the transfer.
+ *
+ * @param[in] ok The data phase completed on the bus.
+ *
+ * @return MTP response code.
+ */
+static uint16_t mtp_transfer_end(mtp_responder_t *mtp, bool ok)
+{
+    if (!mtp->xfer_active) {
+        return MTP_RESP_GENERAL_ERROR;
+    }
+    mtp->xfer_active = false;
+    mtp_stream_stop(mtp);
+
+    const int64_t elapsed_us = esp_timer_get_time() - mtp->xfer_start_us;
+    const bool complete = ok && mtp->xfer_error == ESP_OK;
+    const bool partial = (mtp->xfer_op == MTP_OP_GET_PARTIAL_OBJECT);
+
+    MTP_ENTER_CRITICAL();
+    mtp->stats.sent_bytes += mtp->xfer_sent;
+    mtp->stats.active_us += elapsed_us;
+    if (partial) {
+        mtp->stats.partial_objects++;
+    } else {
+        mtp->stats.objects++;
+    }
+    if (!complete) {
+        mtp->stats.errors++;
+    }
+    MTP_EXIT_CRITICAL();
+
+    const uint32_t kbps = elapsed_us > 0 ? tinyusb_rate_kbps(mtp->xfer_sent, (uint64_t)elapsed_us) : 0;
+    ESP_LOG_LEVEL_LOCAL(mtp->xfer_sent >= MTP_LOG_MIN_BYTES ? ESP_LOG_INFO : ESP_LOG_DEBUG, TAG,
+                        "%s 0x%08"PRIx32": %llu KB in %llu ms, %lu KB/s",
+                        partial ? "GetPartialObject" : "GetObject", mtp->xfer_handle,
+                        (unsigned long long)(mtp->xfer_sent / 1024), (unsigned long long)(elapsed_us / 1000),
+                        (unsigned long)kbps);
+
+    if (complete) {
+        return MTP_RESP_OK;
+    }
+    return ok ? MTP_RESP_INCOMPLETE_TRANSFER : MTP_RESP_GENERAL_ERROR;
+}
+
+/**
+ * @brief Abandon an object data phase on a cancel or a reset from the host.
+ */
+static void mtp_transfer_abort(mtp_responder_t *mtp)
+{
+    if (mtp->xfer_active) {
+        ESP_LOGW(TAG, "Object 0x%08"PRIx32" transfer aborted by the host", mtp->xfer_handle);
+        mtp_transfer_end(mtp, false);
+    }
+}
+
+// --------------------------- Operations ------------------------------------
+
+/**
+ * @brief Check an object handle against the backend.
+ */
+static bool mtp_handle_get(mtp_responder_t *mtp, uint32_t handle, tinyusb_mtp_object_t *object)
+{
+    return handle != 0 && handle <= mtp->config.ops.count(mtp->config.arg)
+           && mtp->config.ops.get(handle - 1, object, mtp->config.arg) == ESP_OK;
+}
+
+/**
+ * @brief Check the storage and parent parameters of GetNumObjects and GetObjectHandles.
+ *
+ * All objects are in the root of the only storage.
+ *
+ * @return MTP response code, MTP_RESP_OK when the parameters are valid.
+ */
+static uint16_t mtp_check_listing(const mtp_container_command_t *command)
+{
+    const uint32_t storage_id = command->params[0];
+    const uint32_t parent = command->params[2];
+
+    if (storage_id != MTP_HANDLE_ALL && storage_id != TINYUSB_MTP_STORAGE_ID) {
+        return MTP_RESP_INVALID_STORAGE_ID;
+    }
+    if (parent != 0 && parent != MTP_HANDLE_ALL) {
+        return MTP_RESP_INVALID_PARENT_OBJECT;
+    }
+    return MTP_RESP_OK;
+}
+
+/**
+ * @brief Check whether an object passes the format filter of a listing.
+ */
+static bool mtp_format_matches(mtp_responder_t *mtp, uint32_t index, uint32_t format)
+{
+    tinyusb_mtp_object_t object;
+    return format == 0 || (mtp->config.ops.get(index, &object, mtp->config.arg) == ESP_OK && object.format == format);
+}
+
+/**
+ * @brief Format a Unix time as an MTP date string, empty when unknown.
+ */
+static void mtp_format_date(int64_t mtime, char *out, size_t size)
+{
+    struct tm tm;
+    const time_t t = (time_t)mtime;
+
+    out[0] = '\0';
+    if (mtime > 0 && localtime_r(&t, &tm) != NULL) {
+        strftime(out, size, "%Y%m%dT%H%M%S", &tm);
+    }
+}
+
+static int32_t mtp_op_get_device_info(mtp_responder_t *mtp, tud_mtp_cb_data_t *cb_data)
+{
+    // The class driver filled in the dataset up to the playback formats
+    mtp_container_info_t *io_container = &cb_data->io_container;
+    const tinyusb_mtp_config_t *config = mtp ? &mtp->config : NULL;
+
+    mtp_container_add_cstring(io_container, (config && config->manufacturer) ? config->manufacturer : "Espressif");
+    mtp_container_add_cstring(io_container, (config && config->model) ? config->model : "ESP TinyUSB MTP");
+    mtp_container_add_cstring(io_container, (config && config->version) ? config->version : "1.0");
+    mtp_container_add_cstring(io_container, (config && config->serial) ? config->serial : "0");
+    tud_mtp_data_send(io_container);
+    return 0;
+}
+
+static int32_t mtp_op_session(mtp_responder_t *mtp, tud_mtp_cb_data_t *cb_data)
+{
+    const mtp_container_command_t *command = cb_data->command_container;
+
+    if (command->header.code == MTP_OP_OPEN_SESSION) {
+        if (mtp->session_open) {
+            return MTP_RESP_SESSION_ALREADY_OPEN;
+        }
+        mtp->session_id = command->params[0];
+        mtp->session_open = true;
+    } else {
+        mtp_transfer_abort(mtp);
+        mtp->list_active = false;
+        mtp->session_open = false;
+    }
+    return MTP_RESP_OK;
+}
+
+static int32_t mtp_op_get_storage_ids(mtp_responder_t *mtp, tud_mtp_cb_data_t *cb_data)
+{
+    const uint32_t storage_ids[] = { TINYUSB_MTP_STORAGE_ID };
+
+    mtp_container_add_auint32(&cb_data->io_container, 1, storage_ids);
+    tud_mtp_data_send(&cb_data->io_container);
+    return 0;
+}
+
+static int32_t mtp_op_get_storage_info(mtp_responder_t *mtp, tud_mtp_cb_data_t *cb_data)
+{
+    mtp_container_info_t *io_container = &cb_data->io_container;
+
+    if (cb_data->command_container->params[0] != TINYUSB_MTP_STORAGE_ID) {
+        return MTP_RESP_INVALID_STORAGE_ID;
+    }
+    uint64_t total_bytes = 0;
+    uint64_t free_bytes = 0;
+    if (mtp->config.ops.capacity == NULL
+            || mtp->config.ops.capacity(&total_bytes, &free_bytes, mtp->config.arg) != ESP_OK) {
+        total_bytes = 0;
+        free_bytes = 0;
+    }
+    mtp_container_add_uint16(io_container, MTP_STORAGE_TYPE_REMOVABLE_ROM);
+    mtp_container_add_uint16(io_container, MTP_FILESYSTEM_TYPE_GENERIC_FLAT);
+    mtp_container_add_uint16(io_container, MTP_ACCESS_CAPABILITY_READ_ONLY_WITHOUT_OBJECT_DELETION);
+    mtp_container_add_uint64(io_container, total_bytes);
+    mtp_container_add_uint64(io_container, free_bytes);
+    mtp_container_add_uint32(io_container, 0); // Free space in objects: the host cannot add any
+    mtp_container_add_cstring(io_container, mtp->config.description ? mtp->config.description : "Storage");
+    mtp_container_add_cstring(io_container, ""); // Volume identifier
+    tud_mtp_data_send(io_container);
+    return 0;
+}
+
+static int32_t mtp_op_get_num_objects(mtp_responder_t *mtp, tud_mtp_cb_data_t *cb_data)
+{
+    const mtp_container_command_t *command = cb_data->command_container;
+    const uint16_t check = mtp_check_listing(command);
+    if (check != MTP_RESP_OK) {
+        return check;
+    }
+    const uint32_t total = mtp->config.ops.count(mtp->config.arg);
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < total; i++) {
+        if (mtp_format_matches(mtp, i, command->params[1])) {
+            count++;
+        }
+    }
+    mtp_container_add_uint32(&cb_data->io_container, count);
+    return MTP_RESP_OK;
+}
+
+/**
+ * @brief Fill the next part of a GetObjectHandles data phase and send it.
+ *
+ * The list can be longer than one endpoint buffer, so it is written one transfer at a time, each time
+ * from where the previous one stopped. Objects are only ever appended, so the listing does not move
+ * under the host; should it run short of the count announced in the header, the rest is padded with 0.
+ *
+ * @param[in] used Payload bytes already filled in.
+ */
+static void mtp_listing_send(mtp_responder_t *mtp, mtp_container_info_t *io_container, uint32_t used)
+{
+    const uint32_t total = mtp->config.ops.count(mtp->config.arg);
+    uint8_t *out = io_container->payload + used;
+    uint32_t room = (io_container->payload_bytes - used) / sizeof(uint32_t);
+
+    while (room > 0 && mtp->list_left > 0) {
+        uint32_t handle = 0;
+        while (mtp->list_next < total && handle == 0) {
+            if (mtp_format_matches(mtp, mtp->list_next, mtp->list_format)) {
+                handle = mtp->list_next + 1;
+            }
+            mtp->list_next++;
+        }
+        memcpy(out, &handle, sizeof(handle));
+        out += sizeof(handle);
+        room--;
+        mtp->list_left--;
+    }
+    mtp->list_active = (mtp->list_left > 0);
+    tud_mtp_data_send(io_container);
+}
+
+static int32_t mtp_op_get_object_handles(mtp_responder_t *mtp, tud_mtp_cb_data_t *cb_data)
+{
+    const mtp_container_command_t *command = cb_data->command_container;
+    mtp_container_info_t *io_container = &cb_data->io_container;
+
+    if (cb_data->phase == MTP_PHASE_DATA) {
+        // Next transfer of the data phase: payload only
+        mtp_listing_send(mtp, io_container, 0);
+        return 0;
+    }
+
+    const uint16_t check = mtp_check_listing(command);
+    if (check != MTP_RESP_OK) {
+        return check;
+    }
+    // Count first: the header carries the length of the whole list
+    const uint32_t total = mtp->config.ops.count(mtp->config.arg);
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < total; i++) {
+        if (mtp_format_matches(mtp, i, command->params[1])) {
+            count++;
+        }
+    }
+    mtp->list_format = command->params[1];
+    mtp->list_next = 0;
+    mtp->list_left = count;
+    memcpy(io_container->payload, &count, sizeof(count));
+    io_container->header->len += (uint32_t)(sizeof(uint32_t) * (count + 1));
+    mtp_listing_send(mtp, io_container, sizeof(uint32_t));
+    return 0;
+}
+
+static int32_t mtp_op_get_object_info(mtp_responder_t *mtp, tud_mtp_cb_data_t *cb_data)
+{
+    mtp_container_info_t *io_container = &cb_data->io_container;
+    tinyusb_mtp_object_t object;
+
+    if (!mtp_handle_get(mtp, cb_data->command_container->params[0], &object)) {
+        return MTP_RESP_INVALID_OBJECT_HANDLE;
+    }
+    const mtp_object_info_header_t info = {
+        .storage_id = TINYUSB_MTP_STORAGE_ID,
+        .object_format = object.format,
+        .protection_status = MTP_PROTECTION_STATUS_READ_ONLY,
+        .object_compressed_size = (object.size > UINT32_MAX) ? UINT32_MAX : (uint32_t)object.size,
+        .thumb_format = MTP_OBJ_FORMAT_UNDEFINED,
+        .parent_object = 0,
+        .association_type = MTP_ASSOCIATION_UNDEFINED,
+    };
+    char date[MTP_DATE_LEN];
+    mtp_format_date(object.mtime, date, sizeof(date));
+
+    object.name[sizeof(object.name) - 1] = '\0';
+    mtp_container_add_raw(io_container, &info, sizeof(info));
+    mtp_container_add_cstring(io_container, object.name);
+    mtp_container_add_cstring(io_container, date); // Date created
+    mtp_container_add_cstring(io_container, date); // Date modified
+    mtp_container_add_cstring(io_container, "");   // Keywords
+    tud_mtp_data_send(io_container);
+    return 0;
+}
+
+static int32_t mtp_op_get_object(mtp_responder_t *mtp, tud_mtp_cb_data_t *cb_data)
+{
+    const mtp_container_command_t *command = cb_data->command_container;
+
+    if (cb_data->phase == MTP_PHASE_DATA) {
+        // Next transfer of the data phase: payload only
+        mtp_transfer_send(mtp, &cb_data->io_container);
+        return 0;
+    }
+
+    tinyusb_mtp_object_t object;
+    const uint32_t handle = command->params[0];
+    if (!mtp_handle_get(mtp, handle, &object)) {
+        return MTP_RESP_INVALID_OBJECT_HANDLE;
+    }
+    uint64_t offset = 0;
+    uint64_t length = object.size;
+    if (command->header.code == MTP_OP_GET_PARTIAL_OBJECT) {
+        // Resumed or ranged reads: offset and maximum length, both 32 bit
+        offset = command->params[1];
+        if (offset > object.size) {
+            return MTP_RESP_INVALID_PARAMETER;
+        }
+        length = object.size - offset;
+        if (length > command->params[2]) {
+            length = command->params[2];
+        }
+    }
+    if (length > MTP_OBJECT_MAX) {
+        ESP_LOGW(TAG, "Object 0x%08"PRIx32" is too large for one data phase", handle);
+        return MTP_RESP_GENERAL_ERROR;
+    }
+    return mtp_transfer_begin(mtp, &cb_data->io_container, command->header.code, handle, offset, length);
+}
+
+static int32_t mtp_op_get_device_prop(mtp_responder_t *mtp, tud_mtp_cb_data_t *cb_data)
+{
+    const mtp_container_command_t *command = cb_data->command_container;
+    mtp_container_info_t *io_container = &cb_data->io_container;
+    const uint16_t prop_code = (uint16_t)command->params[0];
+    const char *name = mtp->config.model ? mtp->config.model : "ESP TinyUSB MTP";
+
+    if (prop_code != MTP_DEV_PROP_DEVICE_FRIENDLY_NAME) {
+        return MTP_RESP_PARAMETER_NOT_SUPPORTED;
+    }
+    if (command->header.code == MTP_OP_GET_DEVICE_PROP_DESC) {
+        const mtp_device_prop_desc_header_t desc = {
+            .device_property_code = prop_code,
+            .datatype = MTP_DATA_TYPE_STR,
+            .get_set = MTP_MODE_GET,
+        };
+        mtp_container_add_raw(io_container, &desc, sizeof(desc));
+        mtp_container_add_cstring(io_container, name); // Factory default
+        mtp_container_add_cstring(io_container, name); // Current value
+        mtp_container_add_uint8(io_container, 0);      // No form
+    } else {
+        mtp_container_add_cstring(io_container, name);
+    }
+    tud_mtp_data_send(io_container);
+    return 0;
+}
+
+typedef int32_t (*mtp_op_handler_t)(mtp_responder_t *mtp, tud_mtp_cb_data_t *cb_data);
+
+/**
+ * @brief Operation handler table. A handler returns an MTP response code, or 0 once it started a data phase.
+ */
+static const struct {
+    uint16_t op_code;
+    bool needs_session;
+    mtp_op_handler_t handler;
+} mtp_op_handlers[] = {
+    { MTP_OP_GET_DEVICE_INFO,       false, mtp_op_get_device_info    },
+    { MTP_OP_OPEN_SESSION,          false, mtp_op_session            },
+    { MTP_OP_CLOSE_SESSION,         true,  mtp_op_session            },
+    { MTP_OP_GET_STORAGE_IDS,       true,  mtp_op_get_storage_ids    },
+    { MTP_OP_GET_STORAGE_INFO,      true,  mtp_op_get_storage_info   },
+    { MTP_OP_GET_NUM_OBJECTS,       true,  mtp_op_get_num_objects    },
+    { MTP_OP_GET_OBJECT_HANDLES,    true,  mtp_op_get_object_handles },
+    { MTP_OP_GET_OBJECT_INFO,       true,  mtp_op_get_object_info    },
+    { MTP_OP_GET_OBJECT,            true,  mtp_op_get_object         },
+    { MTP_OP_GET_PARTIAL_OBJECT,    true,  mtp_op_get_object         },
+    { MTP_OP_GET_DEVICE_PROP_DESC,  true,  mtp_op_get_device_prop    },
+    { MTP_OP_GET_DEVICE_PROP_VALUE, true,  mtp_op_get_device_prop    },
+};
+
+// --------------------------- TinyUSB callbacks -----------------------------
+
+int32_t tud_mtp_command_received_cb(tud_mtp_cb_data_t *cb_data)
+{
+    const mtp_container_command_t *command = cb_data->command_container;
+    mtp_container_info_t *io_container = &cb_data->io_container;
+    mtp_responder_t *mtp = p_mtp_responder;
+
+    int32_t resp_code = MTP_RESP_OPERATION_NOT_SUPPORTED;
+    for (size_t i = 0; i < sizeof(mtp_op_handlers) / sizeof(mtp_op_handlers[0]); i++) {
+        if (mtp_op_handlers[i].op_code != command->header.code) {
+            continue;
+        }
+        if (mtp == NULL && command->header.code != MTP_OP_GET_DEVICE_INFO) {
+            resp_code = MTP_RESP_DEVICE_BUSY;
+        } else if (mtp_op_handlers[i].needs_session && !mtp->session_open) {
+            resp_code = MTP_RESP_SESSION_NOT_OPEN;
+        } else {
+            resp_code = mtp_op_handlers[i].handler(mtp, cb_data);
+        }
+        break;
+    }
+    if (resp_code > MTP_RESP_UNDEFINED) {
+        io_container->header->code = (uint16_t)resp_code;
+        tud_mtp_response_send(io_container);
+    }
+    return 0;
+}
+
+int32_t tud_mtp_data_xfer_cb(tud_mtp_cb_data_t *cb_data)
+{
+    const mtp_container_command_t *command = cb_data->command_container;
+    mtp_container_info_t *io_container = &cb_data->io_container;
+
+    if (cb_data->total_xferred_bytes >= io_container->header->len) {
+        // All data went out in whole packets: end the data phase with a zero-length packet
+        if (mtp_send_zlp(io_container)) {
+            return 0;
+        }
+        // No endpoint to send it on: answer right away, the response is built at the start of the endpoint buffer
+        ESP_LOGW(TAG, "No zero-length packet after %"PRIu32" bytes", cb_data->total_xferred_bytes);
+        mtp_container_info_t resp = {
+            .header = (mtp_container_header_t *)io_container->payload,
+            .payload = io_container->payload + sizeof(mtp_container_header_t),
+            .payload_bytes = io_container->payload_bytes - sizeof(mtp_container_header_t),
+        };
+        resp.header->len = sizeof(mtp_container_header_t);
+        cb_data->io_container = resp;
+        return tud_mtp_data_complete_cb(cb_data);
+    }
+    if (p_mtp_responder != NULL && p_mtp_responder->xfer_active
+            && (command->header.code == MTP_OP_GET_OBJECT || command->header.code == MTP_OP_GET_PARTIAL_OBJECT)) {
+        return mtp_op_get_object(p_mtp_responder, cb_data);
+    }
+    if (p_mtp_responder != NULL && p_mtp_responder->list_active && command->header.code == MTP_OP_GET_OBJECT_HANDLES) {
+        return mtp_op_get_object_handles(p_mtp_responder, cb_data);
+    }
+    return 0;
+}
+
+int32_t tud_mtp_data_complete_cb(tud_mtp_cb_data_t *cb_data)
+{
+    const mtp_container_command_t *command = cb_data->command_container;
+    mtp_container_info_t *resp = &cb_data->io_container;
+    mtp_responder_t *mtp = p_mtp_responder;
+    const bool ok = (cb_data->xfer_result == XFER_RESULT_SUCCESS);
+
+    if (mtp != NULL && mtp->xfer_active
+            && (command->header.code == MTP_OP_GET_OBJECT || command->header.code == MTP_OP_GET_PARTIAL_OBJECT)) {
+        const uint64_t sent = mtp->xfer_sent;
+        resp->header->code = mtp_transfer_end(mtp, ok);
+        if (command->header.code == MTP_OP_GET_PARTIAL_OBJECT) {
+            mtp_container_add_uint32(resp, (uint32_t)sent); // Actual number of bytes sent
+        }
+    } else {
+        if (mtp != NULL) {
+            mtp->list_active = false;
+        }
+        resp->header->code = ok ? MTP_RESP_OK : MTP_RESP_GENERAL_ERROR;
+    }
+    tud_mtp_response_send(resp);
+    return 0;
+}
+
+int32_t tud_mtp_response_complete_cb(tud_mtp_cb_data_t *cb_data)
+{
+    (void)cb_data;
+    return 0;
+}
+
+bool tud_mtp_request_cancel_cb(tud_mtp_request_cb_data_t *cb_data)
+{
+    (void)cb_data;
+    // The host stops reading; the class driver leaves the data phase until the Device Reset that follows
+    if (p_mtp_responder != NULL) {
+        mtp_transfer_abort(p_mtp_responder);
+        p_mtp_responder->list_active = false;
+    }
+    return true;
+}
+
+bool tud_mtp_request_device_reset_cb(tud_mtp_request_cb_data_t *cb_data)
+{
+    (void)cb_data;
+    if (p_mtp_responder != NULL) {
+        mtp_transfer_abort(p_mtp_responder);
+        p_mtp_responder->list_active = false;
+        p_mtp_responder->session_open = false;
+    }
+    return true;
+}
+
+int32_t tud_mtp_request_get_device_status_cb(tud_mtp_request_cb_data_t *cb_data)
+{
+    uint16_t *buf16 = (uint16_t *)(uintptr_t)cb_data->buf;
+    buf16[0] = 4;           // Length
+    buf16[1] = MTP_RESP_OK; // Status
+    return 4;
+}
+
+// --------------------------- Public API ------------------------------------
+
+esp_err_t tinyusb_mtp_init(const tinyusb_mtp_config_t *config)
+{
+    ESP_RETURN_ON_FALSE(config != NULL, ESP_ERR_INVALID_ARG, TAG, "Config can't be NULL");
+    ESP_RETURN_ON_FALSE(config->ops.count && config->ops.get && config->ops.open && config->ops.read && config->ops.close,
+                        ESP_ERR_INVALID_ARG, TAG, "Storage backend callbacks missing");
+    ESP_RETURN_ON_FALSE(p_mtp_responder == NULL, ESP_ERR_INVALID_STATE, TAG, "MTP responder already started");
+
+    mtp_responder_t *mtp = heap_caps_calloc(1, sizeof(mtp_responder_t), MALLOC_CAP_DEFAULT);
+    ESP_RETURN_ON_FALSE(mtp != NULL, ESP_ERR_NO_MEM, TAG, "No memory for the MTP responder");
+    mtp->config = *config;
+
+    mtp_stream_t *st = &mtp->stream;
+    const size_t size = 2 * (size_t)MTP_CHUNK_SIZE;
+    st->buf = heap_caps_aligned_alloc(MTP_BUF_ALIGN, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (st->buf == NULL) {
+        st->buf = heap_caps_aligned_alloc(MTP_BUF_ALIGN, size, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    }
+    st->lock = xSemaphoreCreateMutex();
+    st->done = xSemaphoreCreateBinary();
+    if (st->buf == NULL || st->lock == NULL || st->done == NULL
+            || xTaskCreate(mtp_stream_task, "mtp_stream", MTP_TASK_SIZE, mtp, MTP_TASK_PRIO, &st->task) != pdPASS) {
+        ESP_LOGE(TAG, "No memory for 2 x %u KB MTP stream buffers", (unsigned)(MTP_CHUNK_SIZE / 1024));
+        if (st->lock) {
+            vSemaphoreDelete(st->lock);
+        }
+        if (st->done) {
+            vSemaphoreDelete(st->done);
+        }
+        heap_caps_free(st->buf);
+        heap_caps_free(mtp);
+        return ESP_ERR_NO_MEM;
+    }
+
+    p_mtp_responder = mtp;
+    ESP_LOGD(TAG, "MTP responder, reads of 2 x %u KB", (unsigned)(MTP_CHUNK_SIZE / 1024));
+    return ESP_OK;
+}
+
+esp_err_t tinyusb_mtp_deinit(void)
+{
+    mtp_responder_t *mtp = p_mtp_responder;
+    ESP_RETURN_ON_FALSE(mtp != NULL, ESP_ERR_INVALID_STATE, TAG, "MTP responder not started");
+
+    p_mtp_responder = NULL;
+    mtp->xfer_active = false;
+    mtp_stream_stop(mtp);
+    vTaskDelete(mtp->stream.task);
+    vSemaphoreDelete(mtp->stream.lock);
+    vSemaphoreDelete(mtp->stream.done);
+    heap_caps_free(mtp->stream.buf);
+    heap_caps_free(mtp);
+    return ESP_OK;
+}
+
+esp_err_t tinyusb_mtp_object_added(uint32_t index)
+{
+    mtp_responder_t *mtp = p_mtp_responder;
+    ESP_RETURN_ON_FALSE(mtp != NULL, ESP_ERR_INVALID_STATE, TAG, "MTP responder not started");
+
+    if (!tud_mtp_mounted() || !mtp->session_open) {
+        return ESP_OK;
+    }
+    mtp_event_t event = {
+        .code = MTP_EVENT_OBJECT_ADDED,
+        .session_id = mtp->session_id,
+        .transaction_id = MTP_EVENT_NO_TRANSACTION,
+        .params = { index + 1 },
+    };
+    return tud_mtp_event_send(&event) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t tinyusb_mtp_get_stats(tinyusb_mtp_stats_t *stats)
+{
+    ESP_RETURN_ON_FALSE(p_mtp_responder != NULL, ESP_ERR_INVALID_STATE, TAG, "MTP responder not started");
+    ESP_RETURN_ON_FALSE(stats != NULL, ESP_ERR_INVALID_ARG, TAG, "Stats pointer can't be NULL");
+
+    MTP_ENTER_CRITICAL();
+    *stats = p_mtp_responder->stats;
+    MTP_EXIT_CRITICAL();
+    return ESP_OK;
+}
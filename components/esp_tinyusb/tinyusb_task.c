@@ -181,3 +181,11 @@ esp_err_t tinyusb_task_stop(void)
     heap_caps_free(task_ctx);
     return ESP_OK;
 }
+
+uint8_t tinyusb_task_get_port(void)
+{
+    TINYUSB_TASK_ENTER_CRITICAL();
+    const uint8_t port = (p_tusb_task_ctx != NULL) ? p_tusb_task_ctx->rhport : 0;
+    TINYUSB_TASK_EXIT_CRITICAL();
+    return port;
+}
@@ -0,0 +1,434 @@
+#include "flac_enc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define FLAC_SYNC_CODE          0x3ffe
+#define FLAC_BLOCK_SIZE_16BIT   7      // Block size - 1 follows the header as 16 bits
+#define FLAC_SUBFRAME_CONSTANT  0x00
+#define FLAC_SUBFRAME_VERBATIM  0x01
+#define FLAC_SUBFRAME_FIXED     0x08
+#define FLAC_RICE_PARAM_MAX     14     // Largest parameter of the 4-bit Rice coding method
+#define FLAC_RICE2_PARAM_MAX    30     // Largest parameter of the 5-bit method (31 is the escape code)
+#define FLAC_FRAME_OVERHEAD     32     // Frame header, subframe header, padding and CRC-16
+#define FLAC_HIST_CONSTANT      (FLAC_ENC_MAX_ORDER + 1)
+#define FLAC_HIST_VERBATIM      (FLAC_ENC_MAX_ORDER + 2)
+
+// MSB-first bit writer over the frame buffer. Running out of room sets overflow instead of writing.
+typedef struct {
+    uint8_t *buf;
+    size_t cap;
+    size_t pos;
+    uint64_t acc;
+    unsigned bits;
+    bool overflow;
+} s_bitw_t;
+
+// Appends the low nbits (0-32) of value.
+static inline void s_put(s_bitw_t *bw, uint32_t value, unsigned nbits)
+{
+    if (nbits == 0) {
+        return;
+    }
+    bw->acc = (bw->acc << nbits) | (value & (uint32_t)((1ULL << nbits) - 1));
+    bw->bits += nbits;
+    while (bw->bits >= 8) {
+        bw->bits -= 8;
+        if (bw->pos < bw->cap) {
+            bw->buf[bw->pos++] = (uint8_t)(bw->acc >> bw->bits);
+        } else {
+            bw->overflow = true;
+        }
+    }
+}
+
+// Pads with zero bits up to the next byte boundary.
+static void s_align(s_bitw_t *bw)
+{
+    if (bw->bits > 0) {
+        s_put(bw, 0, 8 - bw->bits);
+    }
+}
+
+// Appends one Rice-coded residual: unary quotient, then k low bits.
+static inline void s_put_rice(s_bitw_t *bw, int32_t residual, unsigned k)
+{
+    const uint32_t u = ((uint32_t)residual << 1) ^ (uint32_t)(residual >> 31);
+    uint32_t q = u >> k;
+    while (q >= 32) {
+        if (bw->overflow) {
+            return;
+        }
+        s_put(bw, 0, 32);
+        q -= 32;
+    }
+    s_put(bw, 1, q + 1);
+    s_put(bw, u, k);
+}
+
+// CRC-8, polynomial x^8 + x^2 + x + 1, as used by the frame header.
+static uint8_t s_crc8(const uint8_t *data, size_t len)
+{
+    uint8_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++) {
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+// CRC-16, polynomial x^16 + x^15 + x^2 + 1, covering the whole frame.
+static uint16_t s_crc16(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int b = 0; b < 8; b++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x8005) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+// Returns the frame header sample rate code, 0 meaning "see STREAMINFO".
+static unsigned s_rate_code(uint32_t rate)
+{
+    switch (rate) {
+    case 8000:
+        return 4;
+    case 16000:
+        return 5;
+    case 22050:
+        return 6;
+    case 24000:
+        return 7;
+    case 32000:
+        return 8;
+    case 44100:
+        return 9;
+    case 48000:
+        return 10;
+    case 96000:
+        return 11;
+    default:
+        return 0;
+    }
+}
+
+// Writes the frame number in FLAC's UTF-8 style variable length coding.
+static void s_put_utf8(s_bitw_t *bw, uint32_t v)
+{
+    if (v < 0x80) {
+        s_put(bw, v, 8);
+        return;
+    }
+    int extra = (v < 0x800) ? 1 : (v < 0x10000) ? 2 : (v < 0x200000) ? 3 : (v < 0x4000000) ? 4 : 5;
+    const uint32_t lead_mask = 0xff00u >> (extra + 1);
+    s_put(bw, (lead_mask & 0xff) | (v >> (6 * extra)), 8);
+    while (extra-- > 0) {
+        s_put(bw, 0x80 | ((v >> (6 * extra)) & 0x3f), 8);
+    }
+}
+
+// Computes the order-n fixed prediction residual of x[i].
+static inline int32_t s_fixed_residual(const int32_t *x, size_t i, unsigned order)
+{
+    switch (order) {
+    case 0:
+        return x[i];
+    case 1:
+        return x[i] - x[i - 1];
+    case 2:
+        return x[i] - 2 * x[i - 1] + x[i - 2];
+    case 3:
+        return x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3];
+    default:
+        return x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4];
+    }
+}
+
+// Picks the fixed predictor order with the smallest residual magnitude.
+static unsigned s_best_order(const int32_t *x, size_t n, unsigned max_order)
+{
+    uint64_t sum[FLAC_ENC_MAX_ORDER + 1] = {0};
+    for (size_t i = max_order; i < n; i++) {
+        for (unsigned o = 0; o <= max_order; o++) {
+            const int32_t e = s_fixed_residual(x, i, o);
+            sum[o] += (uint32_t)((e < 0) ? -e : e);
+        }
+    }
+    unsigned best = 0;
+    for (unsigned o = 1; o <= max_order; o++) {
+        if (sum[o] < sum[best]) {
+            best = o;
+        }
+    }
+    return best;
+}
+
+// Returns the Rice parameter that suits a partition with the given folded residual sum.
+static unsigned s_rice_param(uint64_t sum, uint32_t count)
+{
+    unsigned k = 0;
+    while (k < FLAC_RICE2_PARAM_MAX && ((uint64_t)count << (k + 1)) <= sum) {
+        k++;
+    }
+    return k;
+}
+
+// Estimated bits for one partition coded with parameter k.
+static uint64_t s_rice_bits(uint64_t sum, uint32_t count, unsigned k)
+{
+    return (uint64_t)count * (k + 1) + (sum >> k);
+}
+
+// Sums the folded residuals of each partition at the given order.
+static void s_partition_sums(const int32_t *res, size_t n, unsigned order, unsigned porder, uint64_t *sums)
+{
+    const size_t psize = n >> porder;
+    size_t r = 0;
+    for (size_t p = 0; p < ((size_t)1 << porder); p++) {
+        const size_t count = (p == 0) ? psize - order : psize;
+        uint64_t sum = 0;
+        for (size_t i = 0; i < count; i++, r++) {
+            sum += ((uint32_t)res[r] << 1) ^ (uint32_t)(res[r] >> 31);
+        }
+        sums[p] = sum;
+    }
+}
+
+// Chooses the partition order with the fewest estimated bits.
+static unsigned s_best_partition_order(const int32_t *res, size_t n, unsigned order, unsigned max_porder)
+{
+    unsigned top = 0;
+    while (top < max_porder && (n & (((size_t)2 << top) - 1)) == 0 && (n >> (top + 1)) > order) {
+        top++;
+    }
+    uint64_t sums[1 << FLAC_ENC_MAX_PARTITION];
+    s_partition_sums(res, n, order, top, sums);
+
+    unsigned best = top;
+    uint64_t best_bits = UINT64_MAX;
+    for (int p = (int)top; p >= 0; p--) {
+        const size_t parts = (size_t)1 << p;
+        const size_t psize = n >> p;
+        uint64_t bits = 0;
+        for (size_t j = 0; j < parts; j++) {
+            const uint32_t count = (uint32_t)((j == 0) ? psize - order : psize);
+            bits += 5 + s_rice_bits(sums[j], count, s_rice_param(sums[j], count));
+        }
+        if (bits < best_bits) {
+            best_bits = bits;
+            best = (unsigned)p;
+        }
+        // Merge neighbours to get the sums of the next coarser level.
+        for (size_t j = 0; j < parts / 2; j++) {
+            sums[j] = sums[2 * j] + sums[2 * j + 1];
+        }
+    }
+    return best;
+}
+
+// Writes a fixed-predictor subframe with partitioned Rice residuals.
+static void s_put_fixed(s_bitw_t *bw, const int32_t *x, const int32_t *res, size_t n, unsigned order,
+                        unsigned porder, unsigned bps)
+{
+    uint64_t sums[1 << FLAC_ENC_MAX_PARTITION];
+    uint8_t params[1 << FLAC_ENC_MAX_PARTITION];
+    const size_t parts = (size_t)1 << porder;
+    const size_t psize = n >> porder;
+    s_partition_sums(res, n, order, porder, sums);
+    unsigned max_param = 0;
+    for (size_t j = 0; j < parts; j++) {
+        params[j] = (uint8_t)s_rice_param(sums[j], (uint32_t)((j == 0) ? psize - order : psize));
+        if (params[j] > max_param) {
+            max_param = params[j];
+        }
+    }
+    const bool rice2 = max_param > FLAC_RICE_PARAM_MAX;
+
+    s_put(bw, 0, 1);
+    s_put(bw, FLAC_SUBFRAME_FIXED | order, 6);
+    s_put(bw, 0, 1);
+    for (unsigned i = 0; i < order; i++) {
+        s_put(bw, (uint32_t)x[i], bps);
+    }
+    s_put(bw, rice2 ? 1 : 0, 2);
+    s_put(bw, porder, 4);
+    size_t r = 0;
+    for (size_t j = 0; j < parts && !bw->overflow; j++) {
+        const size_t count = (j == 0) ? psize - order : psize;
+        s_put(bw, params[j], rice2 ? 5 : 4);
+        for (size_t i = 0; i < count; i++, r++) {
+            s_put_rice(bw, res[r], params[j]);
+        }
+    }
+}
+
+// Encodes the buffered block as one frame and hands it to the output callback.
+static int s_encode_frame(flac_enc_t *enc)
+{
+    const int32_t *x = enc->block;
+    const size_t n = enc->fill;
+    const unsigned bps = enc->cfg.bits_per_sample;
+    s_bitw_t bw = {
+        .buf = enc->frame,
+        .cap = enc->frame_cap,
+    };
+
+    s_put(&bw, FLAC_SYNC_CODE, 14);
+    s_put(&bw, 0, 1);
+    s_put(&bw, 0, 1);                                   // Fixed block size stream
+    s_put(&bw, FLAC_BLOCK_SIZE_16BIT, 4);
+    s_put(&bw, s_rate_code(enc->cfg.sample_rate_hz), 4);
+    s_put(&bw, 0, 4);                                   // Mono
+    s_put(&bw, (bps == 16) ? 4 : 6, 3);
+    s_put(&bw, 0, 1);
+    s_put_utf8(&bw, enc->frame_number);
+    s_put(&bw, (uint32_t)(n - 1), 16);
+    s_put(&bw, s_crc8(bw.buf, bw.pos), 8);
+
+    bool constant = true;
+    for (size_t i = 1; i < n && constant; i++) {
+        constant = (x[i] == x[0]);
+    }
+
+    const s_bitw_t subframe_start = bw;
+    unsigned kind;
+    if (constant) {
+        kind = FLAC_HIST_CONSTANT;
+        s_put(&bw, FLAC_SUBFRAME_CONSTANT << 1, 8);
+        s_put(&bw, (uint32_t)x[0], bps);
+    } else {
+        kind = FLAC_HIST_VERBATIM;
+        if (n > FLAC_ENC_MAX_ORDER) {
+            const unsigned order = s_best_order(x, n, enc->cfg.max_order);
+            for (size_t i = order; i < n; i++) {
+                enc->residual[i - order] = s_fixed_residual(x, i, order);
+            }
+            const unsigned porder = s_best_partition_order(enc->residual, n, order, enc->cfg.max_partition_order);
+            s_put_fixed(&bw, x, enc->residual, n, order, porder, bps);
+            const size_t verbatim_bits = 8 + n * bps;
+            const size_t used_bits = (bw.pos - subframe_start.pos) * 8 + bw.bits - subframe_start.bits;
+            if (!bw.overflow && used_bits < verbatim_bits) {
+                kind = order;
+            }
+        }
+        if (kind == FLAC_HIST_VERBATIM) {
+            bw = subframe_start;
+            s_put(&bw, FLAC_SUBFRAME_VERBATIM << 1, 8);
+            for (size_t i = 0; i < n; i++) {
+                s_put(&bw, (uint32_t)x[i], bps);
+            }
+        }
+    }
+
+    s_align(&bw);
+    const uint16_t crc = s_crc16(bw.buf, bw.pos);
+    s_put(&bw, crc, 16);
+    if (bw.overflow) {
+        return -1;
+    }
+
+    const uint32_t frame_bytes = (uint32_t)bw.pos;
+    if (enc->min_frame_bytes == 0 || frame_bytes < enc->min_frame_bytes) {
+        enc->min_frame_bytes = frame_bytes;
+    }
+    if (frame_bytes > enc->max_frame_bytes) {
+        enc->max_frame_bytes = frame_bytes;
+    }
+    enc->order_hist[kind]++;
+    enc->frame_number++;
+    enc->total_samples += n;
+    enc->fill = 0;
+    return enc->write(enc->arg, enc->frame, bw.pos);
+}
+
+// Allocates the block, residual and frame buffers. Returns 0 on success.
+int flac_enc_init(flac_enc_t *enc, const flac_enc_config_t *cfg, flac_enc_write_fn write, void *arg)
+{
+    memset(enc, 0, sizeof(*enc));
+    if ((cfg->bits_per_sample != 16 && cfg->bits_per_sample != 24) || cfg->block_size < 16 ||
+            cfg->max_order > FLAC_ENC_MAX_ORDER || cfg->max_partition_order > FLAC_ENC_MAX_PARTITION ||
+            cfg->sample_rate_hz == 0 || cfg->sample_rate_hz >= (1u << 20)) {
+        return -1;
+    }
+    enc->cfg = *cfg;
+    enc->write = write;
+    enc->arg = arg;
+    enc->frame_cap = (size_t)cfg->block_size * (cfg->bits_per_sample / 8) + FLAC_FRAME_OVERHEAD;
+    enc->block = malloc((size_t)cfg->block_size * sizeof(int32_t));
+    enc->residual = malloc((size_t)cfg->block_size * sizeof(int32_t));
+    enc->frame = malloc(enc->frame_cap);
+    if (enc->block == NULL || enc->residual == NULL || enc->frame == NULL) {
+        flac_enc_deinit(enc);
+        return -1;
+    }
+    return 0;
+}
+
+// Feeds left-justified 32-bit samples; every completed block is emitted as a frame.
+int flac_enc_process(flac_enc_t *enc, const int32_t *samples, size_t count)
+{
+    const unsigned shift = 32 - enc->cfg.bits_per_sample;
+    while (count > 0) {
+        size_t n = enc->cfg.block_size - enc->fill;
+        if (n > count) {
+            n = count;
+        }
+        int32_t *dst = enc->block + enc->fill;
+        for (size_t i = 0; i < n; i++) {
+            dst[i] = samples[i] >> shift;
+        }
+        enc->fill += n;
+        samples += n;
+        count -= n;
+        if (enc->fill == enc->cfg.block_size) {
+            int ret = s_encode_frame(enc);
+            if (ret != 0) {
+                return ret;
+            }
+        }
+    }
+    return 0;
+}
+
+// Emits the final, possibly short, frame.
+int flac_enc_finish(flac_enc_t *enc)
+{
+    return (enc->fill > 0) ? s_encode_frame(enc) : 0;
+}
+
+// Builds the STREAMINFO block body for the samples encoded so far. MD5 is left unset.
+void flac_enc_streaminfo(const flac_enc_t *enc, uint8_t out[FLAC_ENC_STREAMINFO_BYTES])
+{
+    memset(out, 0, FLAC_ENC_STREAMINFO_BYTES);
+    out[0] = enc->cfg.block_size >> 8;
+    out[1] = enc->cfg.block_size & 0xff;
+    out[2] = out[0];
+    out[3] = out[1];
+    out[4] = (enc->min_frame_bytes >> 16) & 0xff;
+    out[5] = (enc->min_frame_bytes >> 8) & 0xff;
+    out[6] = enc->min_frame_bytes & 0xff;
+    out[7] = (enc->max_frame_bytes >> 16) & 0xff;
+    out[8] = (enc->max_frame_bytes >> 8) & 0xff;
+    out[9] = enc->max_frame_bytes & 0xff;
+    const uint64_t v = ((uint64_t)enc->cfg.sample_rate_hz << 44) | ((uint64_t)(enc->cfg.bits_per_sample - 1) << 36) |
+                       (enc->total_samples & 0xfffffffffULL);
+    for (int i = 0; i < 8; i++) {
+        out[10 + i] = (uint8_t)(v >> (56 - 8 * i));
+    }
+}
+
+// Frees the encoder buffers.
+void flac_enc_deinit(flac_enc_t *enc)
+{
+    free(enc->block);
+    free(enc->residual);
+    free(enc->frame);
+    enc->block = NULL;
+    enc->residual = NULL;
+    enc->frame = NULL;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Streaming FLAC frame encoder: mono, fixed block size, fixed predictors (order 0-4) and Rice coding.
+// Depends only on the C library so it can be built and tested on a host.
+
+#define FLAC_ENC_STREAMINFO_BYTES 34
+#define FLAC_ENC_MAX_ORDER        4
+#define FLAC_ENC_MAX_PARTITION    6
+
+typedef struct {
+    uint32_t sample_rate_hz;
+    uint8_t bits_per_sample;     // 16 or 24
+    uint16_t block_size;         // Samples per frame, 16-65535
+    uint8_t max_order;           // Highest fixed predictor order tried, 0-4
+    uint8_t max_partition_order; // Highest Rice partition order tried, 0-6
+} flac_enc_config_t;
+
+// Receives each encoded frame; returns 0 on success.
+typedef int (*flac_enc_write_fn)(void *arg, const uint8_t *data, size_t len);
+
+typedef struct {
+    flac_enc_config_t cfg;
+    flac_enc_write_fn write;
+    void *arg;
+    int32_t *block;              // Pending samples, right-justified
+    int32_t *residual;
+    uint8_t *frame;
+    size_t frame_cap;
+    size_t fill;
+    uint32_t frame_number;
+    uint64_t total_samples;
+    uint32_t min_frame_bytes;
+    uint32_t max_frame_bytes;
+    uint32_t order_hist[FLAC_ENC_MAX_ORDER + 3]; // Frames per fixed order, then constant and verbatim
+} flac_enc_t;
+
+int flac_enc_init(flac_enc_t *enc, const flac_enc_config_t *cfg, flac_enc_write_fn write, void *arg);
+int flac_enc_process(flac_enc_t *enc, const int32_t *samples, size_t count);
+int flac_enc_finish(flac_enc_t *enc);
+void flac_enc_streaminfo(const flac_enc_t *enc, uint8_t out[FLAC_ENC_STREAMINFO_BYTES]);
+void flac_enc_deinit(flac_enc_t *enc);
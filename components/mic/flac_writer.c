@@ -0,0 +1,222 @@
+#include "flac_writer.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "esp_cpu.h"
+#include "esp_log.h"
+
+#define FLAC_BLOCK_STREAMINFO  0
+#define FLAC_BLOCK_APPLICATION 2
+#define FLAC_BLOCK_LAST        0x80
+#define FLAC_STREAMINFO_OFFSET 8
+#define FLAC_REC_APP_ID        "erec"
+#define FLAC_REC_VERSION       1
+#define FLAC_REC_STATE_CLOSED  0
+#define FLAC_REC_STATE_OPEN    1
+#define FLAC_PATH_MAX          300
+
+// Offsets of the recorder state block fields.
+#define FLAC_REC_BLOCK         (FLAC_STREAMINFO_OFFSET + FLAC_ENC_STREAMINFO_BYTES)
+#define FLAC_REC_VERSION_OFF   (FLAC_REC_BLOCK + 8)
+#define FLAC_REC_STATE_OFF     (FLAC_REC_BLOCK + 12)
+#define FLAC_REC_BYTES_OFF     (FLAC_REC_BLOCK + 16)
+
+static const char *TAG = "flac";
+
+// Stores a 24-bit big-endian value.
+static void s_put_be24(uint8_t *p, uint32_t value)
+{
+    p[0] = (value >> 16) & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = value & 0xff;
+}
+
+// Stores a 32-bit big-endian value.
+static void s_put_be32(uint8_t *p, uint32_t value)
+{
+    p[0] = (value >> 24) & 0xff;
+    s_put_be24(p + 1, value);
+}
+
+// Loads a 32-bit big-endian value.
+static uint32_t s_get_be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+// Builds the one-sector header: fLaC, STREAMINFO and an APPLICATION block holding the recorder state.
+static void s_build_header(uint8_t *h, const flac_writer_t *w, bool open)
+{
+    memset(h, 0, FLAC_HEADER_BYTES);
+    memcpy(h, "fLaC", 4);
+    h[4] = FLAC_BLOCK_STREAMINFO;
+    s_put_be24(h + 5, FLAC_ENC_STREAMINFO_BYTES);
+    flac_enc_streaminfo(&w->enc, h + FLAC_STREAMINFO_OFFSET);
+    if (open) {
+        // Frame sizes and the sample count stay "unknown" until the recording is closed.
+        uint8_t *si = h + FLAC_STREAMINFO_OFFSET;
+        memset(si + 4, 0, 6);
+        si[13] &= 0xf0;
+        memset(si + 14, 0, 4);
+    }
+
+    uint8_t *p = h + FLAC_REC_BLOCK;
+    p[0] = FLAC_BLOCK_LAST | FLAC_BLOCK_APPLICATION;
+    s_put_be24(p + 1, FLAC_HEADER_BYTES - FLAC_REC_BLOCK - 4);
+    memcpy(p + 4, FLAC_REC_APP_ID, 4);
+    s_put_be32(h + FLAC_REC_VERSION_OFF, FLAC_REC_VERSION);
+    s_put_be32(h + FLAC_REC_STATE_OFF, open ? FLAC_REC_STATE_OPEN : FLAC_REC_STATE_CLOSED);
+}
+
+// Records the encoded bytes that have reached the card so far.
+static esp_err_t s_checkpoint(flac_writer_t *w)
+{
+    uint8_t header[FLAC_HEADER_BYTES];
+    const uint64_t flushed = (w->file.pos > FLAC_HEADER_BYTES) ? w->file.pos - FLAC_HEADER_BYTES : 0;
+    s_build_header(header, w, true);
+    s_put_be32(header + FLAC_REC_BYTES_OFF, (uint32_t)flushed);
+    esp_err_t ret = rec_file_patch(&w->file, 0, header, sizeof(header));
+    if (ret == ESP_OK && w->file.alloc_bytes == 0) {
+        // Without preallocation the directory entry holds the only record of the file size.
+        fsync(w->file.fd);
+    }
+    return ret;
+}
+
+// Encoder output: appends one frame to the file.
+static int s_on_frame(void *arg, const uint8_t *data, size_t len)
+{
+    flac_writer_t *w = (flac_writer_t *)arg;
+    const esp_cpu_cycle_count_t start_cycles = esp_cpu_get_cycle_count();
+    w->write_err = rec_file_write(&w->file, data, len);
+    w->io_cycles += esp_cpu_get_cycle_count() - start_cycles;
+    w->data_bytes += len;
+    return (w->write_err == ESP_OK) ? 0 : -1;
+}
+
+// Opens a FLAC file; prealloc_bytes should cover the uncompressed worst case.
+esp_err_t flac_writer_open(flac_writer_t *w, const char *path, const flac_enc_config_t *cfg,
+                           uint64_t prealloc_bytes, size_t block_size, uint32_t checkpoint_s)
+{
+    memset(w, 0, sizeof(*w));
+    if (flac_enc_init(&w->enc, cfg, s_on_frame, w) != 0) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t ret = rec_file_open(&w->file, path, FLAC_HEADER_BYTES + prealloc_bytes, block_size);
+    if (ret != ESP_OK) {
+        flac_enc_deinit(&w->enc);
+        return ret;
+    }
+
+    w->checkpoint_samples = (uint64_t)cfg->sample_rate_hz * checkpoint_s;
+    w->next_checkpoint = w->checkpoint_samples;
+
+    uint8_t header[FLAC_HEADER_BYTES];
+    s_build_header(header, w, true);
+    return rec_file_write(&w->file, header, sizeof(header));
+}
+
+// Encodes left-justified 32-bit samples.
+esp_err_t flac_writer_write(flac_writer_t *w, const int32_t *samples, size_t count)
+{
+    const uint64_t io_before = w->io_cycles;
+    const esp_cpu_cycle_count_t start_cycles = esp_cpu_get_cycle_count();
+    const int ret = flac_enc_process(&w->enc, samples, count);
+    const uint64_t elapsed = esp_cpu_get_cycle_count() - start_cycles;
+    w->encode_cycles += elapsed - (w->io_cycles - io_before);
+    if (ret != 0) {
+        return (w->write_err != ESP_OK) ? w->write_err : ESP_FAIL;
+    }
+    if (w->checkpoint_samples > 0 && w->enc.total_samples >= w->next_checkpoint) {
+        w->next_checkpoint += w->checkpoint_samples;
+        return s_checkpoint(w);
+    }
+    return ESP_OK;
+}
+
+// Emits the last frame, writes the final STREAMINFO and closes the file.
+esp_err_t flac_writer_close(flac_writer_t *w)
+{
+    esp_err_t ret = ESP_OK;
+    if (flac_enc_finish(&w->enc) != 0) {
+        ret = (w->write_err != ESP_OK) ? w->write_err : ESP_FAIL;
+    }
+    uint8_t header[FLAC_HEADER_BYTES];
+    s_build_header(header, w, false);
+    s_put_be32(header + FLAC_REC_BYTES_OFF, (uint32_t)w->data_bytes);
+    esp_err_t patch_ret = rec_file_patch(&w->file, 0, header, sizeof(header));
+    esp_err_t close_ret = rec_file_close(&w->file);
+    flac_enc_deinit(&w->enc);
+    if (ret == ESP_OK) {
+        ret = (patch_ret != ESP_OK) ? patch_ret : close_ret;
+    }
+    return ret;
+}
+
+// Repairs a file left open by a power loss: trims it after the last checkpoint and closes the state block.
+static bool s_recover_file(const char *path)
+{
+    uint8_t h[FLAC_HEADER_BYTES];
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        return false;
+    }
+    bool repaired = false;
+    struct stat st;
+    if (read(fd, h, sizeof(h)) != sizeof(h) || fstat(fd, &st) != 0 || memcmp(h, "fLaC", 4) != 0 ||
+            (h[FLAC_REC_BLOCK] & 0x7f) != FLAC_BLOCK_APPLICATION ||
+            memcmp(h + FLAC_REC_BLOCK + 4, FLAC_REC_APP_ID, 4) != 0 ||
+            s_get_be32(h + FLAC_REC_STATE_OFF) != FLAC_REC_STATE_OPEN) {
+        goto done;
+    }
+
+    // The stream is cut at the checkpoint; decoders drop a trailing partial frame.
+    uint32_t data_bytes = s_get_be32(h + FLAC_REC_BYTES_OFF);
+    if ((uint64_t)FLAC_HEADER_BYTES + data_bytes > (uint64_t)st.st_size) {
+        data_bytes = (st.st_size > FLAC_HEADER_BYTES) ? (uint32_t)(st.st_size - FLAC_HEADER_BYTES) : 0;
+    }
+    s_put_be32(h + FLAC_REC_BYTES_OFF, data_bytes);
+    s_put_be32(h + FLAC_REC_STATE_OFF, FLAC_REC_STATE_CLOSED);
+    if (ftruncate(fd, (off_t)(FLAC_HEADER_BYTES + data_bytes)) != 0 ||
+            pwrite(fd, h, sizeof(h), 0) != sizeof(h)) {
+        ESP_LOGW(TAG, "Repair of %s failed (%d)", path, errno);
+        goto done;
+    }
+    fsync(fd);
+    repaired = true;
+    ESP_LOGW(TAG, "Recovered %s: %lu encoded bytes", path, (unsigned long)data_bytes);
+done:
+    close(fd);
+    return repaired;
+}
+
+// Boot-time scan: repairs every FLAC recording in dir that was never closed. Returns the number repaired.
+int flac_writer_recover_dir(const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        return 0;
+    }
+    int repaired = 0;
+    char path[FLAC_PATH_MAX];
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        const char *dot = strrchr(entry->d_name, '.');
+        if (dot == NULL || strcasecmp(dot, ".flac") != 0) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        if (s_recover_file(path)) {
+            repaired++;
+        }
+    }
+    closedir(d);
+    return repaired;
+}
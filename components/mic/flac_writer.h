@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "flac_enc.h"
+#include "rec_file.h"
+
+// Metadata (fLaC, STREAMINFO, recorder state block) fills exactly one sector, like the WAV header.
+#define FLAC_HEADER_BYTES 512
+
+typedef struct {
+    rec_file_t file;
+    flac_enc_t enc;
+    esp_err_t write_err;
+    uint64_t data_bytes;         // Encoded frame bytes
+    uint64_t checkpoint_samples; // Samples between header checkpoints, 0 to disable
+    uint64_t next_checkpoint;
+    uint64_t encode_cycles;      // CPU cycles spent encoding, excluding SD writes
+    uint64_t io_cycles;
+} flac_writer_t;
+
+esp_err_t flac_writer_open(flac_writer_t *w, const char *path, const flac_enc_config_t *cfg,
+                           uint64_t prealloc_bytes, size_t block_size, uint32_t checkpoint_s);
+esp_err_t flac_writer_write(flac_writer_t *w, const int32_t *samples, size_t count);
+esp_err_t flac_writer_close(flac_writer_t *w);
+int flac_writer_recover_dir(const char *dir);
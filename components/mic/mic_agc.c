@@ -0,0 +1,160 @@
+#include "mic_agc.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define AGC_UNITY      (1u << 16)
+#define AGC_MIN_GAIN   (AGC_UNITY >> 4)   // -24 dB
+#define AGC_COEF_ONE   (1u << 15)
+
+// Converts dBFS to a left-justified 32-bit amplitude.
+static uint32_t s_amplitude(int dbfs)
+{
+    const double amp = 2147483647.0 * pow(10.0, dbfs / 20.0);
+    return (amp >= 2147483647.0) ? INT32_MAX : (uint32_t)amp;
+}
+
+// One-pole smoothing coefficient (Q15) for a time constant, applied once per sub-block.
+static uint32_t s_coef(uint32_t time_ms, uint32_t sample_rate_hz)
+{
+    if (time_ms == 0) {
+        return AGC_COEF_ONE;
+    }
+    const double samples = (double)time_ms * sample_rate_hz / 1000.0;
+    const double coef = 1.0 - exp(-(double)MIC_AGC_SUBBLOCK / samples);
+    const uint32_t q15 = (uint32_t)(coef * AGC_COEF_ONE + 0.5);
+    return (q15 > 0) ? q15 : 1;
+}
+
+// Derives the fixed-point coefficients without touching the signal state.
+void mic_agc_configure(mic_agc_t *agc, const mic_agc_config_t *cfg)
+{
+    agc->target = s_amplitude(cfg->target_dbfs);
+    agc->limit = s_amplitude(cfg->limit_dbfs);
+    agc->gate = s_amplitude(cfg->gate_dbfs);
+    const double max_gain = pow(10.0, cfg->max_gain_db / 20.0) * AGC_UNITY;
+    agc->max_gain = (max_gain > (double)UINT32_MAX / 2) ? UINT32_MAX / 2 : (uint32_t)max_gain;
+    agc->attack_q15 = s_coef(cfg->attack_ms, cfg->sample_rate_hz);
+    agc->release_q15 = s_coef(cfg->release_ms, cfg->sample_rate_hz);
+}
+
+// Resets the state and applies cfg. Starts at unity gain.
+void mic_agc_init(mic_agc_t *agc, const mic_agc_config_t *cfg)
+{
+    memset(agc, 0, sizeof(*agc));
+    mic_agc_configure(agc, cfg);
+    agc->envelope = agc->gate;
+    agc->agc_gain = AGC_UNITY;
+    agc->gain = AGC_UNITY;
+    agc->gain_target = AGC_UNITY;
+}
+
+// Per sub-block: follows the envelope and sets the gain ramp for the next output sub-block.
+static void s_update(mic_agc_t *agc)
+{
+    // Land exactly on the previous ramp target so rounding never accumulates.
+    const uint32_t next_gain = agc->gain_target;
+    const uint32_t peak = agc->sub_peak;
+    const uint32_t coef = (peak > agc->envelope) ? agc->attack_q15 : agc->release_q15;
+    agc->envelope = (uint32_t)((int64_t)agc->envelope + (((int64_t)peak - agc->envelope) * coef >> 15));
+
+    // Below the gate the envelope is noise; hold the gain rather than amplify it to the target.
+    if (agc->envelope >= agc->gate && agc->envelope > 0) {
+        uint64_t g = ((uint64_t)agc->target << 16) / agc->envelope;
+        if (g > agc->max_gain) {
+            g = agc->max_gain;
+        }
+        if (g < AGC_MIN_GAIN) {
+            g = AGC_MIN_GAIN;
+        }
+        agc->agc_gain = (uint32_t)g;
+    }
+
+    // The next output sub-block is the previous input one, so both peaks are already known.
+    uint32_t target = agc->agc_gain;
+    const uint32_t lookahead_peak = (peak > agc->prev_peak) ? peak : agc->prev_peak;
+    if (lookahead_peak > 0) {
+        const uint64_t limit_gain = ((uint64_t)agc->limit << 16) / lookahead_peak;
+        if (limit_gain < target) {
+            target = (uint32_t)limit_gain;
+            agc->limited_blocks++;
+        }
+    }
+    if (target > next_gain) {
+        target = next_gain + (uint32_t)(((uint64_t)(target - next_gain) * agc->release_q15) >> 15);
+    }
+
+    agc->gain = next_gain;
+    agc->gain_target = target;
+    agc->gain_step = (int32_t)(((int64_t)target - next_gain) / MIC_AGC_SUBBLOCK);
+    agc->prev_peak = peak;
+    agc->sub_peak = 0;
+    agc->sub_fill = 0;
+}
+
+// The sample loop, instantiated with and without the meter so the unmetered loop carries none of it.
+static inline __attribute__((always_inline)) void s_process(mic_agc_t *agc, int32_t *samples, size_t count,
+                                                             mic_meter_t *meter, bool metered)
+{
+    // A local copy, so the compiler can keep it in registers although samples may alias it
+    mic_meter_t acc = {0};
+    if (metered) {
+        acc = *meter;
+    }
+    uint32_t pos = agc->delay_pos;
+    for (size_t i = 0; i < count; ++i) {
+        const int32_t in = samples[i];
+        const int32_t out = agc->delay[pos];
+        agc->delay[pos] = in;
+        if (++pos == MIC_AGC_LOOKAHEAD) {
+            pos = 0;
+        }
+
+        const uint32_t mag = (in < 0) ? (uint32_t)(-(int64_t)in) : (uint32_t)in;
+        if (mag > agc->sub_peak) {
+            agc->sub_peak = mag;
+        }
+
+        int64_t v = ((int64_t)out * agc->gain) >> 16;
+        if (v > INT32_MAX) {
+            v = INT32_MAX;
+        } else if (v < INT32_MIN) {
+            v = INT32_MIN;
+        }
+        samples[i] = (int32_t)v;
+        if (metered) {
+            mic_meter_add(&acc, (int32_t)v);
+        }
+        agc->gain += agc->gain_step;
+
+        if (++agc->sub_fill == MIC_AGC_SUBBLOCK) {
+            s_update(agc);
+        }
+    }
+    agc->delay_pos = pos;
+    if (metered) {
+        acc.count += (uint32_t)count;
+        *meter = acc;
+    }
+}
+
+// Applies AGC and limiting in place. Output is delayed by MIC_AGC_LOOKAHEAD samples. meter, when not NULL,
+// accumulates every output sample as it is written.
+void mic_agc_process(mic_agc_t *agc, int32_t *samples, size_t count, mic_meter_t *meter)
+{
+    if (meter != NULL) {
+        s_process(agc, samples, count, meter, true);
+    } else {
+        s_process(agc, samples, count, NULL, false);
+    }
+}
+
+// Returns the gain currently applied, in tenths of a dB.
+int mic_agc_gain_db_x10(const mic_agc_t *agc)
+{
+    if (agc->gain == 0) {
+        return -999;
+    }
+    return (int)lround(200.0 * log10((double)agc->gain / AGC_UNITY));
+}
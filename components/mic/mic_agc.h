@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mic_meter.h"
+
+// Look-ahead AGC and peak limiter for left-justified 32-bit samples. The per-sample path is fixed point;
+// gains are recomputed once per sub-block, so the cost per block does not depend on the signal.
+// Depends only on the C library so it can be built and benchmarked on a host.
+
+#define MIC_AGC_SUBBLOCK   32                        // Samples between gain updates
+#define MIC_AGC_LOOKAHEAD  (2 * MIC_AGC_SUBBLOCK)    // Delay that lets the gain drop before a peak arrives
+
+typedef struct {
+    uint32_t sample_rate_hz;
+    int target_dbfs;             // Level the speech envelope is steered to, e.g. -18
+    int max_gain_db;             // Upper gain bound, so silence is not pumped up to the target
+    int limit_dbfs;              // Peak ceiling enforced by the limiter, e.g. -1
+    int gate_dbfs;               // Envelope below this holds the gain instead of raising it
+    uint32_t attack_ms;          // Envelope rise time
+    uint32_t release_ms;         // Envelope fall time, and the gain recovery time after limiting
+} mic_agc_config_t;
+
+typedef struct {
+    // Coefficients derived from mic_agc_config_t.
+    uint32_t target;             // Envelope target, in |sample| units
+    uint32_t limit;
+    uint32_t gate;
+    uint32_t max_gain;           // Q16
+    uint32_t attack_q15;
+    uint32_t release_q15;
+    // State.
+    int32_t delay[MIC_AGC_LOOKAHEAD];
+    uint32_t delay_pos;
+    uint32_t sub_fill;
+    uint32_t sub_peak;
+    uint32_t prev_peak;
+    uint32_t envelope;
+    uint32_t agc_gain;           // Q16, from the envelope
+    uint32_t gain;               // Q16, applied (after limiting), ramps per sample
+    uint32_t gain_target;        // Q16, where the ramp ends at the next sub-block boundary
+    int32_t gain_step;
+    uint32_t limited_blocks;     // Sub-blocks where the limiter cut the AGC gain
+} mic_agc_t;
+
+void mic_agc_init(mic_agc_t *agc, const mic_agc_config_t *cfg);
+void mic_agc_configure(mic_agc_t *agc, const mic_agc_config_t *cfg);
+void mic_agc_process(mic_agc_t *agc, int32_t *samples, size_t count, mic_meter_t *meter);
+int mic_agc_gain_db_x10(const mic_agc_t *agc);
@@ -5,39 +5,226 @@
 #include <string.h>
 #include <stdint.h>
 #include <errno.h>
-#include <unistd.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <unistd.h>
 
+#include "esp_attr.h"
+#include "esp_cpu.h"
+#include "esp_heap_caps.h"
 #include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
 #include "button.h"
+#include "flac_writer.h"
 #include "driver/i2s_std.h"
 #include "freertos/FreeRTOS.h"
-#include "oled_ssd1306.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "mic_agc.h"
+#include "mic_dsp.h"
+#include "mic_meter.h"
+#include "mic_resample.h"
+#include "mic_ring.h"
+#include "mic_segment.h"
+#include "mic_vad.h"
+#include "oled_display.h"
+#include "opus_writer.h"
+#include "wav_writer.h"
 
-#define I2S_SAMPLE_RATE_HZ 16000 // Sample rate
+#define I2S_SAMPLE_RATE_HZ 48000 // Capture rate; the output rate is reached by decimation
 #define I2S_BCLK_IO        38 // Bit clock
 #define I2S_WS_IO          39 // Also known as LRCK
 #define I2S_DIN_IO         40 // Microphone data input
-#define MIC_GAIN_MULT      4  // Microphone gain multiplier
+#define MIC_GAIN_MULT      CONFIG_MIC_FIXED_GAIN // Microphone gain multiplier when AGC is off
+
+#define MIC_BYTES_PER_SAMPLE   4
+#define MIC_CHUNK_MS           32
+#define MIC_CHUNK_SAMPLES      (I2S_SAMPLE_RATE_HZ * MIC_CHUNK_MS / 1000) // Per I2S read, at the capture rate
+#define MIC_CHUNK_BYTES        (MIC_CHUNK_SAMPLES * MIC_BYTES_PER_SAMPLE)
+#define MIC_DMA_DESC_NUM       8
+#define MIC_DMA_FRAME_NUM      480 // 10 ms per DMA buffer at 48 kHz, 80 ms of slack in total
+#define MIC_RING_BYTES         ((size_t)CONFIG_MIC_RING_SIZE_KB * 1024)
+#define MIC_WRITE_BLOCK_BYTES  ((size_t)CONFIG_MIC_WRITE_BLOCK_KB * 1024)
+#define MIC_PREALLOC_SECONDS   ((size_t)CONFIG_MIC_PREALLOC_MINUTES * 60)
+#define MIC_CHECKPOINT_SECONDS CONFIG_MIC_HEADER_CHECKPOINT_S
+#define MIC_CAPTURE_TASK_PRIO  (configMAX_PRIORITIES - 2)
+#define MIC_CAPTURE_TASK_CORE  CONFIG_MIC_CAPTURE_TASK_CORE
+#define MIC_CAPTURE_TASK_STACK 3072
+#define MIC_PREROLL_MS         CONFIG_MIC_PREROLL_MS
+#define MIC_IDLE_KEEP_BYTES    (MIC_RING_BYTES / 4 * 3) // History kept while idle; the rest absorbs the splice
+#define MIC_WRITER_TASK_PRIO   6
+#define MIC_WRITER_TASK_CORE   (1 - CONFIG_MIC_CAPTURE_TASK_CORE)
+#define MIC_WRITER_IDLE_MS     200
+#define MIC_WRITER_TASK_STACK  6144
+#define MIC_FLAC_BLOCK_SAMPLES 4096
+#define MIC_FLAC_MAX_ORDER     4
+#define MIC_FLAC_MAX_PARTITION 6
+#define MIC_OPUS_BITRATE_BPS   (CONFIG_MIC_OPUS_BITRATE_KBPS * 1000)
+#define MIC_OPUS_COMPLEXITY    CONFIG_MIC_OPUS_COMPLEXITY
+#define MIC_SEGMENT_SLOTS      3   // Current, pre-opened next and retired segment
+#define MIC_SEGMENT_TASK_PRIO  (MIC_WRITER_TASK_PRIO - 1)
+#define MIC_SEGMENT_TASK_STACK 4096
+#define MIC_SEGMENT_RETRY_MS   5000
+#define MIC_PATH_MAX           128
+
+#if CONFIG_MIC_OUTPUT_FORMAT_PCM16
+#define MIC_DEFAULT_FORMAT     MIC_FORMAT_PCM16
+#elif CONFIG_MIC_OUTPUT_FORMAT_PCM24
+#define MIC_DEFAULT_FORMAT     MIC_FORMAT_PCM24
+#elif CONFIG_MIC_OUTPUT_FORMAT_PCM24_IN_32
+#define MIC_DEFAULT_FORMAT     MIC_FORMAT_PCM24_IN_32
+#else
+#define MIC_DEFAULT_FORMAT     MIC_FORMAT_PCM32
+#endif
+#define MIC_DITHER_SEED        0x9e3779b9u
+
+#define MIC_VAD_HANGOVER_BLOCKS ((CONFIG_MIC_VAD_HANGOVER_MS + MIC_CHUNK_MS - 1) / MIC_CHUNK_MS)
+#define MIC_VAD_PREROLL_BLOCKS ((CONFIG_MIC_VAD_PREROLL_MS + MIC_CHUNK_MS - 1) / MIC_CHUNK_MS)
+#define MIC_VAD_MAX_GAPS       512
+#define MIC_VAD_GAP_LABEL      "gap"
+#define MIC_AGC_LIMIT_DBFS     -1
+#define MIC_AGC_GATE_DBFS      -65
+
+// Container the recording is written in, chosen from the file extension.
+typedef enum {
+    MIC_SINK_RAW,
+    MIC_SINK_WAV,
+    MIC_SINK_FLAC,
+    MIC_SINK_OPUS,
+} mic_sink_t;
+
+// Capture service states. The capture task owns the transitions except IDLE -> ARM and STOPPED -> IDLE.
+typedef enum {
+    MIC_SVC_IDLE,                       // The ring holds recent audio as pre-roll history
+    MIC_SVC_ARM,                        // Recording requested; the capture task splices the pre-roll in
+    MIC_SVC_RECORDING,                  // Chunks go through the gate to the writer
+    MIC_SVC_STOPPED,                    // Recording over; chunks are dropped until the writer is done
+} mic_svc_state_t;
+
+// Always-on capture service: the I2S channel, capture task and ring outlive individual recordings.
+typedef struct {
+    i2s_chan_handle_t rx_handle;
+    TaskHandle_t capture_task;
+    volatile mic_svc_state_t state;
+    int32_t *chunk;
+    mic_ring_t ring;
+    mic_resample_t resample;
+    uint32_t sample_rate_hz;            // Output rate the history is kept at
+    size_t chunk_samples;
+    bool agc_enabled;
+    mic_agc_t agc;
+    int64_t head_us;                    // Arrival time of the newest sample in the ring
+    volatile uint32_t dma_overruns;
+} mic_service_t;
+
+// State shared by the caller, the capture task and the writer task for one recording.
+typedef struct {
+    wav_writer_t *wav;                  // Current WAV or raw segment, one of seg_slots
+    flac_writer_t flac;
+    opus_writer_t opus;
+    mic_sink_t sink;
+    bool opened;                        // The output file was created, so the counters describe this recording
+    bool stop_on_button;
+    uint32_t sample_rate_hz;            // Output rate
+    size_t chunk_samples;               // Output samples per capture chunk
+    size_t total_samples;
+    uint8_t *pack;
+    mic_format_t format;
+    bool dither;
+    mic_dsp_dither_t dither_state;
+    TaskHandle_t writer_task;
+    SemaphoreHandle_t done;
+    volatile bool capture_done;
+    volatile bool abort;
+    esp_err_t capture_err;
+    esp_err_t writer_err;
+    size_t captured_samples;
+    size_t written_bytes;
+    uint64_t output_bytes;
+    uint32_t dma_overruns;
+    uint32_t dma_overrun_base;
+    uint32_t ring_overruns;
+    uint32_t ring_high_water;
+    uint32_t dropped_samples;
+    uint32_t read_underruns;
+    uint32_t writer_underruns;
+    uint64_t dsp_cycles;
+    uint32_t dsp_block_max_cycles;
+    uint64_t resample_cycles;
+    bool agc_enabled;
+    int32_t agc_gain_db_x10;
+    uint32_t agc_limited_base;
+    uint32_t agc_limited_blocks;
+    uint64_t dsp_samples;
+    uint64_t pack_cycles;
+    size_t elapsed_samples;             // Output samples produced, kept or skipped
+    bool vad_enabled;
+    mic_vad_t vad;
+    int32_t *preroll;                   // Ring of the most recent skipped chunks
+    uint16_t preroll_count[MIC_VAD_PREROLL_BLOCKS];
+    size_t preroll_next;
+    size_t preroll_used;
+    bool in_gap;
+    uint32_t gap_start;
+    uint64_t gap_samples;
+    wav_cue_t *gaps;                    // In session frames until a segment takes them
+    atomic_size_t gap_count;            // Published after the entry, so the writer only sees whole gaps
+    uint64_t vad_skipped_samples;
+    const char *path;                   // Name of the first segment; later ones get a _NNN suffix
+    wav_format_t wav_fmt;
+    uint32_t session_id;                // Shared by all segments of the recording
+    mic_segment_t seg;                  // Split position; its limit is MIC_SEGMENT_UNLIMITED when not splitting
+    wav_writer_t seg_slots[MIC_SEGMENT_SLOTS];
+    char seg_paths[MIC_SEGMENT_SLOTS][MIC_PATH_MAX];
+    int seg_cur;
+    volatile int seg_retired;           // Slot the segment task must close, -1 for none
+    atomic_bool seg_ready;              // The slot after seg_cur holds the pre-opened next segment
+    volatile bool seg_stop;
+    TaskHandle_t seg_task;
+    SemaphoreHandle_t seg_done;
+    esp_err_t seg_err;
+    uint32_t seg_switch_max_us;
+    int64_t press_us;                   // Button press that started the recording, 0 if unknown
+    int64_t press_to_arm_us;
+    int64_t first_sample_us;            // Arrival time of the first sample in the file
+    size_t preroll_samples;             // History spliced in ahead of the live audio
+} mic_capture_ctx_t;
 
 static const char *TAG = "mic";
 
-// Applies software gain with clipping.
-static int32_t s_apply_gain(int32_t sample)
-{
-#if MIC_GAIN_MULT > 1
-    int64_t v = (int64_t)sample * MIC_GAIN_MULT;
-    if (v > INT32_MAX) {
-        return INT32_MAX;
-    }
-    if (v < INT32_MIN) {
-        return INT32_MIN;
-    }
-    return (int32_t)v;
+static mic_service_t s_svc;
+static mic_capture_ctx_t s_ctx;
+static mic_format_t s_format = MIC_DEFAULT_FORMAT;
+static uint32_t s_sample_rate_hz = CONFIG_MIC_SAMPLE_RATE_HZ;
+#if CONFIG_MIC_OUTPUT_DITHER
+static bool s_dither = true;
 #else
-    return sample;
+static bool s_dither = false;
 #endif
-}
+#if CONFIG_MIC_VAD_ENABLE
+static bool s_vad_enabled = true;
+#else
+static bool s_vad_enabled = false;
+#endif
+#if CONFIG_MIC_AGC_ENABLE
+static bool s_agc_enabled = true;
+#else
+static bool s_agc_enabled = false;
+#endif
+static mic_agc_config_t s_agc_cfg = {
+    .target_dbfs = CONFIG_MIC_AGC_TARGET_DBFS,
+    .max_gain_db = CONFIG_MIC_AGC_MAX_GAIN_DB,
+    .limit_dbfs = MIC_AGC_LIMIT_DBFS,
+    .gate_dbfs = MIC_AGC_GATE_DBFS,
+    .attack_ms = CONFIG_MIC_AGC_ATTACK_MS,
+    .release_ms = CONFIG_MIC_AGC_RELEASE_MS,
+};
+static volatile bool s_agc_pending;
+static portMUX_TYPE s_agc_lock = portMUX_INITIALIZER_UNLOCKED;
+// Level snapshot: the largest block peak since the last mic_capture_get_level() in the high half, the RMS of the
+// latest block in the low half. One word, so the reader never sees a torn pair.
+static atomic_uint s_level;
 
 // Logs an info message (and optionally OLED if enabled).
 static void s_log_info(const char *fmt, ...)
@@ -48,7 +235,7 @@ static void s_log_info(const char *fmt, ...)
     vsnprintf(buf, sizeof(buf), fmt, args);
     va_end(args);
     ESP_LOGI(TAG, "%s", buf);
-    //oled_ssd1306_display_text(buf);
+    //oled_display_post(buf);
 }
 
 // Logs an error message (and shows it on OLED).
@@ -60,64 +247,713 @@ static void s_log_error(const char *fmt, ...)
     vsnprintf(buf, sizeof(buf), fmt, args);
     va_end(args);
     ESP_LOGE(TAG, "%s", buf);
-    oled_ssd1306_display_text(buf);
+    oled_display_post(buf);
 }
 
-// Writes a 16-bit little-endian value to a file.
-static void s_write_le16(FILE *f, uint16_t value)
+// Returns the container size of one output sample.
+static size_t s_format_bytes(mic_format_t format)
 {
-    uint8_t b[2] = {value & 0xff, (value >> 8) & 0xff};
-    fwrite(b, 1, sizeof(b), f);
+    switch (format) {
+    case MIC_FORMAT_PCM16:
+        return 2;
+    case MIC_FORMAT_PCM24:
+        return 3;
+    default:
+        return 4;
+    }
 }
 
-// Writes a 32-bit little-endian value to a file.
-static void s_write_le32(FILE *f, uint32_t value)
+// Picks the container from the path extension.
+static mic_sink_t s_sink_for_path(const char *path)
 {
-    uint8_t b[4] = {
-        value & 0xff,
-        (value >> 8) & 0xff,
-        (value >> 16) & 0xff,
-        (value >> 24) & 0xff
-    };
-    fwrite(b, 1, sizeof(b), f);
+    const char *dot = strrchr(path, '.');
+    if (dot != NULL && strcmp(dot, ".wav") == 0) {
+        return MIC_SINK_WAV;
+    }
+    if (dot != NULL && strcmp(dot, ".flac") == 0) {
+        return MIC_SINK_FLAC;
+    }
+    if (dot != NULL && strcmp(dot, ".opus") == 0) {
+        return MIC_SINK_OPUS;
+    }
+    return MIC_SINK_RAW;
 }
 
-// Checks if the path ends with .wav.
-static bool s_has_wav_extension(const char *path)
+// Counts DMA queue overflows, i.e. samples lost before the capture task could read them.
+static bool IRAM_ATTR s_on_recv_q_ovf(i2s_chan_handle_t handle, i2s_event_data_t *event, void *user_ctx)
 {
-    const char *dot = strrchr(path, '.');
-    return (dot != NULL) && (strcmp(dot, ".wav") == 0);
+    (void)handle;
+    (void)event;
+    (void)user_ctx;
+    s_svc.dma_overruns++;
+    return false;
 }
 
-// Writes/updates a PCM WAV header.
-static void s_write_wav_header(FILE *f, uint32_t sample_rate_hz, uint16_t bits_per_sample,
-                               uint16_t channels, uint32_t data_bytes)
+// Queues a chunk into the ring, counting it as dropped when the ring is full.
+static void s_ring_push(const int32_t *samples, size_t count)
 {
-    const uint32_t byte_rate = sample_rate_hz * channels * (bits_per_sample / 8);
-    const uint16_t block_align = channels * (bits_per_sample / 8);
-    const uint32_t riff_size = 36 + data_bytes;
+    if (mic_ring_write(&s_svc.ring, samples, count * MIC_BYTES_PER_SAMPLE)) {
+        s_ctx.captured_samples += count;
+    } else {
+        s_ctx.dropped_samples += count;
+    }
+}
 
-    fwrite("RIFF", 1, 4, f);
-    s_write_le32(f, riff_size);
-    fwrite("WAVE", 1, 4, f);
-    fwrite("fmt ", 1, 4, f);
-    s_write_le32(f, 16);
-    s_write_le16(f, 1);
-    s_write_le16(f, channels);
-    s_write_le32(f, sample_rate_hz);
-    s_write_le32(f, byte_rate);
-    s_write_le16(f, block_align);
-    s_write_le16(f, bits_per_sample);
-    fwrite("data", 1, 4, f);
-    s_write_le32(f, data_bytes);
+// Keeps a skipped chunk for pre-roll, evicting the oldest one.
+static void s_preroll_push(const int32_t *samples, size_t count)
+{
+    memcpy(s_ctx.preroll + s_ctx.preroll_next * s_ctx.chunk_samples, samples, count * MIC_BYTES_PER_SAMPLE);
+    s_ctx.preroll_count[s_ctx.preroll_next] = (uint16_t)count;
+    s_ctx.preroll_next = (s_ctx.preroll_next + 1) % MIC_VAD_PREROLL_BLOCKS;
+    if (s_ctx.preroll_used < MIC_VAD_PREROLL_BLOCKS) {
+        s_ctx.preroll_used++;
+    }
 }
 
-// Captures I2S audio to a file; stops on button or after N seconds.
-esp_err_t mic_capture_to_file(const char *path, int seconds, int *out_seconds)
+// Returns the samples held in the pre-roll.
+static size_t s_preroll_held(void)
+{
+    size_t held = 0;
+    for (size_t i = 0; i < s_ctx.preroll_used; i++) {
+        held += s_ctx.preroll_count[(s_ctx.preroll_next + MIC_VAD_PREROLL_BLOCKS - 1 - i) % MIC_VAD_PREROLL_BLOCKS];
+    }
+    return held;
+}
+
+// Moves the pre-roll into the ring, oldest first.
+static void s_preroll_flush(void)
+{
+    for (size_t i = 0; i < s_ctx.preroll_used; i++) {
+        const size_t slot = (s_ctx.preroll_next + MIC_VAD_PREROLL_BLOCKS - s_ctx.preroll_used + i) % MIC_VAD_PREROLL_BLOCKS;
+        s_ring_push(s_ctx.preroll + slot * s_ctx.chunk_samples, s_ctx.preroll_count[slot]);
+    }
+    s_ctx.preroll_used = 0;
+}
+
+// Records the gap that just ended, at its position in the kept audio.
+static void s_end_gap(void)
+{
+    const size_t n = atomic_load(&s_ctx.gap_count);
+    if (s_ctx.gap_samples > 0 && n < MIC_VAD_MAX_GAPS) {
+        s_ctx.gaps[n].position = s_ctx.gap_start;
+        s_ctx.gaps[n].length = (uint32_t)s_ctx.gap_samples;
+        atomic_store(&s_ctx.gap_count, n + 1);
+    }
+    s_ctx.in_gap = false;
+    s_ctx.gap_samples = 0;
+}
+
+// Passes a processed chunk on, or holds it back while the VAD reports silence.
+static void s_gate_chunk(const int32_t *samples, size_t count)
+{
+    if (!s_ctx.vad_enabled) {
+        s_ring_push(samples, count);
+        return;
+    }
+    if (!mic_vad_process(&s_ctx.vad, samples, count)) {
+        if (!s_ctx.in_gap) {
+            s_ctx.in_gap = true;
+            s_ctx.gap_start = (uint32_t)s_ctx.captured_samples;
+        }
+        s_ctx.gap_samples += count;
+        s_ctx.vad_skipped_samples += count;
+        s_preroll_push(samples, count);
+        return;
+    }
+    if (s_ctx.in_gap) {
+        // The gap is published before any audio after it reaches the ring, so a segment the writer closes past
+        // its position always sees it.
+        const size_t held = s_preroll_held();
+        s_ctx.gap_samples -= held;
+        s_ctx.vad_skipped_samples -= held;
+        s_end_gap();
+        s_preroll_flush();
+    }
+    s_ring_push(samples, count);
+}
+
+// Picks up AGC settings changed while recording, at a block boundary.
+static void s_agc_apply_pending(void)
+{
+    if (!s_agc_pending) {
+        return;
+    }
+    mic_agc_config_t cfg;
+    portENTER_CRITICAL(&s_agc_lock);
+    cfg = s_agc_cfg;
+    s_agc_pending = false;
+    portEXIT_CRITICAL(&s_agc_lock);
+    cfg.sample_rate_hz = s_svc.sample_rate_hz;
+    mic_agc_configure(&s_svc.agc, &cfg);
+}
+
+// Sets the decimator and AGC up for a rate or AGC mode; the history no longer matches and is dropped.
+static void s_service_configure(uint32_t sample_rate_hz, bool agc_enabled)
+{
+    // Rates are validated by mic_capture_set_sample_rate(), so the init cannot fail here.
+    mic_resample_init(&s_svc.resample, I2S_SAMPLE_RATE_HZ, sample_rate_hz);
+    s_svc.sample_rate_hz = sample_rate_hz;
+    s_svc.chunk_samples = sample_rate_hz * MIC_CHUNK_MS / 1000;
+    s_svc.agc_enabled = agc_enabled;
+    portENTER_CRITICAL(&s_agc_lock);
+    mic_agc_config_t cfg = s_agc_cfg;
+    s_agc_pending = false;
+    portEXIT_CRITICAL(&s_agc_lock);
+    cfg.sample_rate_hz = sample_rate_hz;
+    mic_agc_init(&s_svc.agc, &cfg);
+    mic_ring_reset(&s_svc.ring);
+}
+
+// Appends a chunk to the pre-roll history, dropping the oldest audio beyond the idle limit.
+static void s_history_push(const int32_t *samples, size_t count, int64_t arrival_us)
+{
+    const size_t len = count * MIC_BYTES_PER_SAMPLE;
+    const size_t used = mic_ring_used(&s_svc.ring);
+    if (used + len > MIC_IDLE_KEEP_BYTES) {
+        // No writer exists while idle, so the producer may release the oldest bytes itself.
+        mic_ring_consume(&s_svc.ring, used + len - MIC_IDLE_KEEP_BYTES);
+    }
+    mic_ring_write(&s_svc.ring, samples, len);
+    s_svc.head_us = arrival_us;
+}
+
+// Starts a recording: trims the history to the pre-roll point before the press and resets the counters.
+static void s_arm(void)
+{
+    if (s_svc.sample_rate_hz != s_ctx.sample_rate_hz || s_svc.agc_enabled != s_ctx.agc_enabled) {
+        s_service_configure(s_ctx.sample_rate_hz, s_ctx.agc_enabled);
+    }
+    const int64_t now_us = esp_timer_get_time();
+    const int64_t press_us = (s_ctx.press_us != 0) ? s_ctx.press_us : now_us;
+    const size_t used_samples = mic_ring_used(&s_svc.ring) / MIC_BYTES_PER_SAMPLE;
+    int64_t wanted = (s_svc.head_us - press_us + MIC_PREROLL_MS * 1000LL) * s_svc.sample_rate_hz / 1000000;
+    if (wanted < 0) {
+        wanted = 0;
+    }
+    const size_t keep = ((uint64_t)wanted < used_samples) ? (size_t)wanted : used_samples;
+    mic_ring_consume(&s_svc.ring, (used_samples - keep) * MIC_BYTES_PER_SAMPLE);
+    s_svc.ring.high_water = keep * MIC_BYTES_PER_SAMPLE;
+    s_svc.ring.overruns = 0;
+
+    s_ctx.preroll_samples = keep;
+    s_ctx.captured_samples = keep;
+    s_ctx.press_us = press_us;
+    s_ctx.press_to_arm_us = now_us - press_us;
+    s_ctx.first_sample_us = (keep > 0) ? s_svc.head_us - (int64_t)keep * 1000000 / s_svc.sample_rate_hz : now_us;
+    s_ctx.dma_overrun_base = s_svc.dma_overruns;
+    s_ctx.agc_limited_base = s_svc.agc.limited_blocks;
+    s_svc.state = MIC_SVC_RECORDING;
+    xSemaphoreGive(s_ctx.done);
+}
+
+// Copies the counters the capture task owns into the recording state.
+static void s_update_stats(void)
 {
+    s_ctx.dma_overruns = s_svc.dma_overruns - s_ctx.dma_overrun_base;
+    s_ctx.ring_overruns = s_svc.ring.overruns;
+    s_ctx.ring_high_water = (uint32_t)s_svc.ring.high_water;
+    s_ctx.agc_limited_blocks = s_svc.agc.limited_blocks - s_ctx.agc_limited_base;
+}
+
+// Ends the recording at the current chunk and lets the writer drain what is left.
+static void s_stop(esp_err_t err)
+{
+    if (s_ctx.in_gap) {
+        s_end_gap();
+    }
+    s_update_stats();
+    s_ctx.agc_gain_db_x10 = s_ctx.agc_enabled ? mic_agc_gain_db_x10(&s_svc.agc) : 0;
+    s_ctx.capture_err = err;
+    s_svc.state = MIC_SVC_STOPPED;
+    s_ctx.capture_done = true;
+    if (s_ctx.writer_task != NULL) {
+        xTaskNotifyGive(s_ctx.writer_task);
+    }
+}
+
+// Publishes a block's level: raises the held peak and replaces the RMS.
+static void s_level_publish(const mic_meter_t *meter)
+{
+    const uint32_t peak = mic_meter_peak(meter);
+    const uint32_t rms = mic_meter_rms(meter);
+    unsigned int old = atomic_load_explicit(&s_level, memory_order_relaxed);
+    unsigned int next;
+    do {
+        const uint32_t held = old >> 16;
+        next = ((peak > held ? peak : held) << 16) | rms;
+    } while (!atomic_compare_exchange_weak_explicit(&s_level, &old, next, memory_order_relaxed,
+                                                    memory_order_relaxed));
+}
+
+// Drains I2S continuously: into the pre-roll history while idle, through the gate while recording.
+// Never touches the SD card.
+static void s_capture_task(void *arg)
+{
+    (void)arg;
+
+    while (true) {
+        const mic_svc_state_t state = s_svc.state;
+        if (state == MIC_SVC_IDLE &&
+                (s_svc.sample_rate_hz != s_sample_rate_hz || s_svc.agc_enabled != s_agc_enabled)) {
+            s_service_configure(s_sample_rate_hz, s_agc_enabled);
+        }
+        size_t samples_to_read = s_svc.chunk_samples;
+        if (state == MIC_SVC_RECORDING && s_ctx.elapsed_samples + samples_to_read > s_ctx.total_samples) {
+            samples_to_read = s_ctx.total_samples - s_ctx.elapsed_samples;
+        }
+        const size_t bytes_to_read = samples_to_read * s_svc.resample.factor * MIC_BYTES_PER_SAMPLE;
+
+        size_t bytes_read = 0;
+        esp_err_t ret = i2s_channel_read(s_svc.rx_handle, s_svc.chunk, bytes_to_read, &bytes_read, pdMS_TO_TICKS(1000));
+        const int64_t arrival_us = esp_timer_get_time();
+        if (s_svc.state == MIC_SVC_ARM) {
+            s_arm();
+        }
+        // One snapshot per chunk, so a chunk arriving as the caller arms goes to the history, not nowhere.
+        const mic_svc_state_t chunk_state = s_svc.state;
+        const bool recording = (chunk_state == MIC_SVC_RECORDING);
+        if (ret != ESP_OK) {
+            s_log_error("I2S read failed (%s)", esp_err_to_name(ret));
+            if (recording) {
+                s_stop(ret);
+            }
+            continue;
+        }
+        if (recording && bytes_read < bytes_to_read) {
+            s_ctx.read_underruns++;
+        }
+        if (bytes_read == 0) {
+            continue;
+        }
+
+        esp_cpu_cycle_count_t start_cycles = esp_cpu_get_cycle_count();
+        const size_t count = mic_resample_process(&s_svc.resample, s_svc.chunk, bytes_read / MIC_BYTES_PER_SAMPLE,
+                                                  s_svc.chunk);
+        const uint32_t resample_cycles = esp_cpu_get_cycle_count() - start_cycles;
+        if (count == 0) {
+            continue;
+        }
+
+        start_cycles = esp_cpu_get_cycle_count();
+#if CONFIG_MIC_LEVEL_METER
+        mic_meter_t meter = {0};
+#endif
+        if (recording && button_is_paused()) {
+            mic_dsp_mute_s32(s_svc.chunk, count);
+        } else if (s_svc.agc_enabled) {
+            s_agc_apply_pending();
+#if CONFIG_MIC_LEVEL_METER
+            mic_agc_process(&s_svc.agc, s_svc.chunk, count, &meter);
+#else
+            mic_agc_process(&s_svc.agc, s_svc.chunk, count, NULL);
+#endif
+        } else {
+#if CONFIG_MIC_LEVEL_METER
+            mic_dsp_gain_meter_s32(s_svc.chunk, count, MIC_GAIN_MULT, &meter);
+#else
+            mic_dsp_gain_s32(s_svc.chunk, count, MIC_GAIN_MULT);
+#endif
+        }
+#if CONFIG_MIC_LEVEL_METER
+        // A muted block leaves the meter empty, so pause reads as silence
+        s_level_publish(&meter);
+#endif
+        const uint32_t block_cycles = esp_cpu_get_cycle_count() - start_cycles;
+
+        if (!recording) {
+            if (chunk_state == MIC_SVC_IDLE) {
+                s_history_push(s_svc.chunk, count, arrival_us);
+            }
+            continue;
+        }
+        s_ctx.resample_cycles += resample_cycles;
+        s_ctx.dsp_cycles += block_cycles;
+        if (block_cycles > s_ctx.dsp_block_max_cycles) {
+            s_ctx.dsp_block_max_cycles = block_cycles;
+        }
+        s_ctx.dsp_samples += count;
+        s_ctx.elapsed_samples += count;
+        s_gate_chunk(s_svc.chunk, count);
+        s_update_stats();
+        if (s_ctx.writer_task != NULL && mic_ring_used(&s_svc.ring) >= MIC_WRITE_BLOCK_BYTES) {
+            xTaskNotifyGive(s_ctx.writer_task);
+        }
+
+        if (s_ctx.stop_on_button && !button_is_recording()) {
+            s_log_info("Stop requested");
+            s_stop(ESP_OK);
+        } else if (s_ctx.elapsed_samples >= s_ctx.total_samples || s_ctx.abort) {
+            s_stop(ESP_OK);
+        }
+    }
+}
+
+// Converts 32-bit samples to the output format; returns the packed data and its length.
+static const void *s_pack(const int32_t *samples, size_t count, size_t *out_len)
+{
+    mic_dsp_dither_t *dither = s_ctx.dither ? &s_ctx.dither_state : NULL;
+    const esp_cpu_cycle_count_t start_cycles = esp_cpu_get_cycle_count();
+    const void *out = s_ctx.pack;
+    switch (s_ctx.format) {
+    case MIC_FORMAT_PCM16:
+        mic_dsp_pack_s16(samples, count, (int16_t *)s_ctx.pack, dither);
+        break;
+    case MIC_FORMAT_PCM24:
+        mic_dsp_pack_s24(samples, count, s_ctx.pack, dither);
+        break;
+    case MIC_FORMAT_PCM24_IN_32:
+        mic_dsp_pack_s24_in_32(samples, count, (int32_t *)s_ctx.pack, dither);
+        break;
+    default:
+        out = samples;
+        break;
+    }
+    s_ctx.pack_cycles += esp_cpu_get_cycle_count() - start_cycles;
+    *out_len = count * s_format_bytes(s_ctx.format);
+    return out;
+}
+
+// Opens a segment into a slot, preallocated for expected_bytes of audio.
+static esp_err_t s_segment_open(int slot, uint32_t segment, uint64_t expected_bytes)
+{
+    mic_segment_path(s_ctx.path, segment, s_ctx.seg_paths[slot], MIC_PATH_MAX);
+    wav_writer_t *w = &s_ctx.seg_slots[slot];
+    if (s_ctx.sink == MIC_SINK_WAV) {
+        const wav_session_t session = {
+            .id = s_ctx.session_id,
+            .segment = segment,
+        };
+        return wav_writer_open(w, s_ctx.seg_paths[slot], &s_ctx.wav_fmt, &session, expected_bytes,
+                               MIC_WRITE_BLOCK_BYTES, MIC_CHECKPOINT_SECONDS);
+    }
+    memset(w, 0, sizeof(*w));
+    return rec_file_open(&w->file, s_ctx.seg_paths[slot], expected_bytes, MIC_WRITE_BLOCK_BYTES);
+}
+
+// Finalizes the segment in a slot.
+static esp_err_t s_segment_close(int slot)
+{
+    wav_writer_t *w = &s_ctx.seg_slots[slot];
+    return (s_ctx.sink == MIC_SINK_WAV) ? wav_writer_close(w) : rec_file_close(&w->file);
+}
+
+// Gives the current WAV segment the VAD gaps that fall in it; last takes the rest.
+static void s_segment_set_cues(bool last)
+{
+    size_t first = 0;
+    const size_t n = mic_segment_cues(&s_ctx.seg, s_ctx.gaps, atomic_load(&s_ctx.gap_count), last, &first);
+    if (n > 0) {
+        wav_writer_set_cues(s_ctx.wav, s_ctx.gaps + first, n, MIC_VAD_GAP_LABEL);
+    }
+}
+
+// Switches the writer to the pre-opened next segment; the old one is closed by the segment task.
+static void s_segment_rotate(void)
+{
+    const int64_t start_us = esp_timer_get_time();
+    const int retired = s_ctx.seg_cur;
+    if (s_ctx.sink == MIC_SINK_WAV) {
+        s_segment_set_cues(false);
+    }
+    mic_segment_rotate(&s_ctx.seg);
+    s_ctx.seg_cur = (s_ctx.seg_cur + 1) % MIC_SEGMENT_SLOTS;
+    s_ctx.wav = &s_ctx.seg_slots[s_ctx.seg_cur];
+    s_ctx.wav->session.start_frame = s_ctx.seg.start_frame;
+    atomic_store(&s_ctx.seg_ready, false);
+    s_ctx.seg_retired = retired;
+    xTaskNotifyGive(s_ctx.seg_task);
+    const uint32_t elapsed_us = (uint32_t)(esp_timer_get_time() - start_us);
+    if (elapsed_us > s_ctx.seg_switch_max_us) {
+        s_ctx.seg_switch_max_us = elapsed_us;
+    }
+}
+
+// Writes PCM to the current segment, splitting the data at the segment limit so segments are sample-contiguous.
+static esp_err_t s_segment_write(const uint8_t *data, size_t len)
+{
+    while (len > 0) {
+        const bool ready = atomic_load(&s_ctx.seg_ready);
+        const size_t n = mic_segment_room(&s_ctx.seg, len, ready);
+        if (n > 0) {
+            esp_err_t ret = (s_ctx.sink == MIC_SINK_WAV) ? wav_writer_write(s_ctx.wav, data, n) :
+                            rec_file_write(&s_ctx.wav->file, data, n);
+            if (ret != ESP_OK) {
+                return ret;
+            }
+            data += n;
+            len -= n;
+        }
+        if (mic_segment_wrote(&s_ctx.seg, n, ready)) {
+            s_segment_rotate();
+        }
+    }
+    return ESP_OK;
+}
+
+// Closes retired segments and pre-opens the next one, so the writer never waits for the file system.
+static void s_segment_task(void *arg)
+{
+    (void)arg;
+    bool open_failed = false;
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, open_failed ? pdMS_TO_TICKS(MIC_SEGMENT_RETRY_MS) : portMAX_DELAY);
+        const int retired = s_ctx.seg_retired;
+        if (retired >= 0) {
+            esp_err_t ret = s_segment_close(retired);
+            if (ret != ESP_OK) {
+                s_log_error("Segment close failed (%s)", esp_err_to_name(ret));
+                s_ctx.seg_err = ret;
+            }
+            s_ctx.seg_retired = -1;
+        }
+        if (s_ctx.seg_stop) {
+            break;
+        }
+        // seg_cur and segment only change on rotation, which waits for seg_ready.
+        if (!atomic_load(&s_ctx.seg_ready)) {
+            const int slot = (s_ctx.seg_cur + 1) % MIC_SEGMENT_SLOTS;
+            open_failed = (s_segment_open(slot, s_ctx.seg.segment + 1, s_ctx.seg.limit_bytes) != ESP_OK);
+            if (open_failed) {
+                ESP_LOGW(TAG, "Next segment open failed, retrying");
+            } else {
+                atomic_store(&s_ctx.seg_ready, true);
+            }
+        }
+    }
+    xSemaphoreGive(s_ctx.seg_done);
+    vTaskDelete(NULL);
+}
+
+// Stops the segment task and deletes the pre-opened segment that was never used.
+static void s_segment_finish(void)
+{
+    if (s_ctx.seg_task == NULL) {
+        return;
+    }
+    s_ctx.seg_stop = true;
+    xTaskNotifyGive(s_ctx.seg_task);
+    xSemaphoreTake(s_ctx.seg_done, portMAX_DELAY);
+    s_ctx.seg_task = NULL;
+    if (atomic_load(&s_ctx.seg_ready)) {
+        const int slot = (s_ctx.seg_cur + 1) % MIC_SEGMENT_SLOTS;
+        s_segment_close(slot);
+        unlink(s_ctx.seg_paths[slot]);
+    }
+}
+
+// Passes audio to the FLAC/Opus encoder or the WAV writer, or straight to the file for raw captures.
+static esp_err_t s_sink_write(const int32_t *samples, size_t count)
+{
+    if (s_ctx.sink == MIC_SINK_FLAC) {
+        esp_err_t ret = flac_writer_write(&s_ctx.flac, samples, count);
+        s_ctx.output_bytes = s_ctx.flac.data_bytes;
+        return ret;
+    }
+    size_t len = 0;
+    const void *data = s_pack(samples, count, &len);
+    if (s_ctx.sink == MIC_SINK_OPUS) {
+        esp_err_t ret = opus_writer_write(&s_ctx.opus, (const int16_t *)data, count);
+        s_ctx.output_bytes = rec_file_size(&s_ctx.opus.file);
+        return ret;
+    }
+    s_ctx.output_bytes += len;
+    return s_segment_write(data, len);
+}
+
+// Finalizes the output file.
+static esp_err_t s_sink_close(void)
+{
+    switch (s_ctx.sink) {
+    case MIC_SINK_FLAC:
+        return flac_writer_close(&s_ctx.flac);
+    case MIC_SINK_OPUS:
+        return opus_writer_close(&s_ctx.opus);
+    default:
+        return s_segment_close(s_ctx.seg_cur);
+    }
+}
+
+// Drains the ring to the SD card in large blocks.
+static void s_writer_task(void *arg)
+{
+    (void)arg;
+
+    while (true) {
+        const bool finishing = s_ctx.capture_done;
+        const size_t used = mic_ring_used(&s_svc.ring);
+        if (used == 0 && finishing) {
+            break;
+        }
+        if (used < MIC_WRITE_BLOCK_BYTES && !finishing) {
+            if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(MIC_WRITER_IDLE_MS)) == 0) {
+                s_ctx.writer_underruns++;
+            }
+            continue;
+        }
+
+        const uint8_t *data = NULL;
+        size_t len = mic_ring_peek(&s_svc.ring, &data);
+        if (len > MIC_WRITE_BLOCK_BYTES) {
+            len = MIC_WRITE_BLOCK_BYTES;
+        }
+        esp_err_t ret = s_sink_write((const int32_t *)data, len / MIC_BYTES_PER_SAMPLE);
+        mic_ring_consume(&s_svc.ring, len);
+        if (ret != ESP_OK) {
+            s_log_error("SD write failed (%d)", errno);
+            s_ctx.writer_err = ret;
+            s_ctx.abort = true;
+            break;
+        }
+        s_ctx.written_bytes += len;
+    }
+
+    xSemaphoreGive(s_ctx.done);
+    vTaskDelete(NULL);
+}
+
+// Returns the file behind the active sink, or NULL before a WAV sink was set up.
+static const rec_file_t *s_sink_file(void)
+{
+    switch (s_ctx.sink) {
+    case MIC_SINK_FLAC:
+        return &s_ctx.flac.file;
+    case MIC_SINK_OPUS:
+        return &s_ctx.opus.file;
+    default:
+        return (s_ctx.wav != NULL) ? &s_ctx.wav->file : NULL;
+    }
+}
+
+// Releases per-recording buffers.
+static void s_free_buffers(void)
+{
+    heap_caps_free(s_ctx.pack);
+    s_ctx.pack = NULL;
+    heap_caps_free(s_ctx.preroll);
+    s_ctx.preroll = NULL;
+    heap_caps_free(s_ctx.gaps);
+    s_ctx.gaps = NULL;
+    if (s_ctx.seg_done != NULL) {
+        vSemaphoreDelete(s_ctx.seg_done);
+        s_ctx.seg_done = NULL;
+    }
+    if (s_ctx.done != NULL) {
+        vSemaphoreDelete(s_ctx.done);
+        s_ctx.done = NULL;
+    }
+}
+
+// Returns the output level after the gain stage: the largest peak since the previous call and the latest RMS.
+// Lock-free, for a display that samples at its own rate.
+void mic_capture_get_level(mic_capture_level_t *out)
+{
+    const unsigned int level = atomic_fetch_and_explicit(&s_level, 0xFFFFu, memory_order_relaxed);
+    out->peak = (uint16_t)(level >> 16);
+    out->rms = (uint16_t)(level & 0xFFFFu);
+}
+
+// Copies the pipeline counters of the current or last recording. Returns ESP_ERR_INVALID_STATE, with out zeroed,
+// when that recording never got as far as creating its file.
+esp_err_t mic_capture_get_stats(mic_capture_stats_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    if (!s_ctx.opened) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    const rec_file_t *file = s_sink_file();
+    out->dma_overruns = s_ctx.dma_overruns;
+    out->ring_overruns = s_ctx.ring_overruns;
+    out->dropped_samples = s_ctx.dropped_samples;
+    out->read_underruns = s_ctx.read_underruns;
+    out->writer_underruns = s_ctx.writer_underruns;
+    out->ring_size = (uint32_t)MIC_RING_BYTES;
+    out->ring_high_water = s_ctx.ring_high_water;
+    out->write_max_us = (file != NULL) ? file->write_max_us : 0;
+    out->dsp_cycles_per_sample_x100 = (s_ctx.dsp_samples > 0) ?
+                                      (uint32_t)(s_ctx.dsp_cycles * 100 / s_ctx.dsp_samples) : 0;
+    const uint64_t written_samples = s_ctx.written_bytes / MIC_BYTES_PER_SAMPLE;
+    const uint64_t pack_cycles = s_ctx.pack_cycles + s_ctx.flac.encode_cycles;
+    out->pack_cycles_per_sample_x100 = (written_samples > 0) ?
+                                       (uint32_t)(pack_cycles * 100 / written_samples) : 0;
+    out->sd_bytes_per_s = (written_samples > 0) ?
+                          (uint32_t)(s_ctx.output_bytes * s_ctx.sample_rate_hz / written_samples) : 0;
+    out->dsp_block_max_cycles = s_ctx.dsp_block_max_cycles;
+    out->sample_rate_hz = s_ctx.sample_rate_hz;
+    out->resample_cycles_per_sample_x100 = (s_ctx.dsp_samples > 0) ?
+                                           (uint32_t)(s_ctx.resample_cycles * 100 / s_ctx.dsp_samples) : 0;
+    out->agc_gain_db_x10 = s_ctx.agc_gain_db_x10;
+    out->agc_limited_blocks = s_ctx.agc_limited_blocks;
+    out->output_bytes = s_ctx.output_bytes;
+    out->segments = s_ctx.seg.segment + 1;
+    out->segment_switch_max_us = s_ctx.seg_switch_max_us;
+    out->segment_late = s_ctx.seg.late;
+    out->preroll_ms = (s_ctx.sample_rate_hz > 0) ? (uint32_t)(s_ctx.preroll_samples * 1000 / s_ctx.sample_rate_hz) : 0;
+    out->press_to_arm_ms = (uint32_t)(s_ctx.press_to_arm_us / 1000);
+    out->press_to_first_sample_ms = (int32_t)((s_ctx.first_sample_us - s_ctx.press_us) / 1000);
+    out->vad_skipped_samples = (uint32_t)s_ctx.vad_skipped_samples;
+    out->vad_gaps = (uint32_t)atomic_load(&s_ctx.gap_count);
+    out->encode_frame_max_us = s_ctx.opus.encode_max_us;
+    out->encode_frame_avg_us = (s_ctx.opus.frames > 0) ? (uint32_t)(s_ctx.opus.encode_us / s_ctx.opus.frames) : 0;
+    return ESP_OK;
+}
+
+// Sets the AGC target level and envelope times; takes effect immediately, even mid-recording.
+// enable only applies from the next recording on.
+esp_err_t mic_capture_set_agc(bool enable, int target_dbfs, uint32_t attack_ms, uint32_t release_ms)
+{
+    if (target_dbfs > MIC_AGC_LIMIT_DBFS || target_dbfs < -60 || attack_ms > 10000 || release_ms > 60000) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    portENTER_CRITICAL(&s_agc_lock);
+    s_agc_enabled = enable;
+    s_agc_cfg.target_dbfs = target_dbfs;
+    s_agc_cfg.attack_ms = attack_ms;
+    s_agc_cfg.release_ms = release_ms;
+    s_agc_pending = true;
+    portEXIT_CRITICAL(&s_agc_lock);
+    return ESP_OK;
+}
+
+// Selects the output sample rate of the next recording; it must divide the 48 kHz capture rate.
+esp_err_t mic_capture_set_sample_rate(uint32_t sample_rate_hz)
+{
+    switch (sample_rate_hz) {
+    case 8000:
+    case 16000:
+    case 24000:
+    case 48000:
+        s_sample_rate_hz = sample_rate_hz;
+        return ESP_OK;
+    default:
+        return ESP_ERR_INVALID_ARG;
+    }
+}
+
+// Enables or disables silence skipping for the next recording.
+void mic_capture_set_vad(bool enable)
+{
+    s_vad_enabled = enable;
+}
+
+// Selects the sample format and dithering used by the next recording.
+void mic_capture_set_format(mic_format_t format, bool dither)
+{
+    s_format = format;
+    s_dither = dither;
+}
+
+// Starts the always-on capture service so recent audio is available as pre-roll. Safe to call again.
+esp_err_t mic_capture_start(void)
+{
+    if (s_svc.capture_task != NULL) {
+        return ESP_OK;
+    }
     esp_err_t ret;
     i2s_chan_handle_t rx_handle = NULL;
     i2s_chan_config_t chan_cfg = I2S_CHANNEL_DEFAULT_CONFIG(I2S_NUM_0, I2S_ROLE_MASTER);
+    chan_cfg.dma_desc_num = MIC_DMA_DESC_NUM;
+    chan_cfg.dma_frame_num = MIC_DMA_FRAME_NUM;
 
     ret = i2s_new_channel(&chan_cfg, NULL, &rx_handle);
     if (ret != ESP_OK) {
@@ -150,109 +986,242 @@ esp_err_t mic_capture_to_file(const char *path, int seconds, int *out_seconds)
         return ret;
     }
 
+    s_svc.rx_handle = rx_handle;
+    i2s_event_callbacks_t cbs = {
+        .on_recv_q_ovf = s_on_recv_q_ovf,
+    };
+    i2s_channel_register_event_callback(rx_handle, &cbs, NULL);
+
+    // 16-byte alignment lets the gain kernel use the S3 vector unit.
+    s_svc.chunk = (int32_t *)heap_caps_aligned_alloc(16, MIC_CHUNK_BYTES, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    ret = mic_ring_init(&s_svc.ring, MIC_RING_BYTES);
+    if (s_svc.chunk == NULL || ret != ESP_OK) {
+        s_log_error("Audio buffer alloc failed");
+        if (s_svc.ring.buf != NULL) {
+            mic_ring_deinit(&s_svc.ring);
+        }
+        heap_caps_free(s_svc.chunk);
+        s_svc.chunk = NULL;
+        i2s_del_channel(rx_handle);
+        return ESP_ERR_NO_MEM;
+    }
+    s_service_configure(s_sample_rate_hz, s_agc_enabled);
+    s_svc.state = MIC_SVC_IDLE;
+
     ret = i2s_channel_enable(rx_handle);
     if (ret != ESP_OK) {
         s_log_error("I2S enable (%s)", esp_err_to_name(ret));
+        mic_ring_deinit(&s_svc.ring);
+        heap_caps_free(s_svc.chunk);
+        s_svc.chunk = NULL;
         i2s_del_channel(rx_handle);
         return ret;
     }
+    xTaskCreatePinnedToCore(s_capture_task, "mic_capture", MIC_CAPTURE_TASK_STACK, NULL,
+                            MIC_CAPTURE_TASK_PRIO, &s_svc.capture_task, MIC_CAPTURE_TASK_CORE);
+    ESP_LOGI(TAG, "Capture service running, %d ms pre-roll", MIC_PREROLL_MS);
+    return ESP_OK;
+}
 
-    s_log_info("Waiting for long press");
-    while (!button_is_recording()) {
-        vTaskDelay(pdMS_TO_TICKS(50));
+// Captures I2S audio to a file, starting with the pre-roll from before the press; stops on button or after N seconds.
+esp_err_t mic_capture_to_file(const char *path, int seconds, int *out_seconds)
+{
+    esp_err_t ret = mic_capture_start();
+    if (ret != ESP_OK) {
+        // Keep mic_capture_get_stats() from reporting the previous recording as this one
+        s_ctx.opened = false;
+        return ret;
     }
+
+    s_log_info("Waiting for long press");
+    button_wait_recording(portMAX_DELAY);
     s_log_info("Recording started");
 
-    FILE *f = fopen(path, "wb");
-    if (f == NULL) {
-        s_log_error("Open failed %s (%d)", path, errno);
-        i2s_channel_disable(rx_handle);
-        i2s_del_channel(rx_handle);
-        return ESP_FAIL;
-    }
+    memset(&s_ctx, 0, sizeof(s_ctx));
+    s_ctx.press_us = button_get_record_press_us();
+    s_ctx.path = path;
+    s_ctx.session_id = esp_random();
+    s_ctx.seg_retired = -1;
+    atomic_init(&s_ctx.seg_ready, false);
 
-    const bool write_wav = s_has_wav_extension(path);
-    const bool stop_on_button = (seconds <= 0);
-    if (!stop_on_button && seconds < 1) {
+    s_ctx.sink = s_sink_for_path(path);
+    s_ctx.stop_on_button = (seconds <= 0);
+    if (!s_ctx.stop_on_button && seconds < 1) {
         seconds = 1;
     }
+    s_ctx.sample_rate_hz = s_sample_rate_hz;
+    s_ctx.agc_enabled = s_agc_enabled;
+    s_ctx.chunk_samples = s_ctx.sample_rate_hz * MIC_CHUNK_MS / 1000;
+    s_ctx.total_samples = s_ctx.stop_on_button ? SIZE_MAX : (size_t)s_ctx.sample_rate_hz * (size_t)seconds;
 
-    const size_t bytes_per_sample = 4;
-    const size_t samples_per_chunk = 512;
-    const int flush_interval_ms = 1000;
-    uint32_t next_flush_ms = flush_interval_ms;
-    const size_t chunk_bytes = samples_per_chunk * bytes_per_sample;
-    uint8_t *buffer = (uint8_t *)malloc(chunk_bytes);
-    if (buffer == NULL) {
-        s_log_error("Audio buffer alloc failed");
-        fclose(f);
-        i2s_channel_disable(rx_handle);
-        i2s_del_channel(rx_handle);
-        return ESP_ERR_NO_MEM;
-    }
+    // The Opus encoder takes 16-bit input.
+    s_ctx.format = (s_ctx.sink == MIC_SINK_OPUS) ? MIC_FORMAT_PCM16 : s_format;
+    s_ctx.dither = s_dither && (s_ctx.format != MIC_FORMAT_PCM32);
+    s_ctx.dither_state.state = MIC_DITHER_SEED;
 
-    size_t total_samples = stop_on_button ? SIZE_MAX : (size_t)I2S_SAMPLE_RATE_HZ * (size_t)seconds;
-    size_t captured_samples = 0;
-    if (write_wav) {
-        s_write_wav_header(f, I2S_SAMPLE_RATE_HZ, 32, 1, 0);
+    const size_t sample_bytes = s_format_bytes(s_ctx.format);
+    mic_segment_init(&s_ctx.seg, MIC_SEGMENT_UNLIMITED, sample_bytes);
+    const size_t expected_seconds = s_ctx.stop_on_button ? MIC_PREALLOC_SECONDS : (size_t)seconds;
+    const uint64_t expected_bytes = (uint64_t)expected_seconds * s_ctx.sample_rate_hz * sample_bytes;
+    if (s_ctx.sink == MIC_SINK_FLAC) {
+        // FLAC carries 16 or 24 bits; the mic has no more than 24 significant bits to offer.
+        const flac_enc_config_t cfg = {
+            .sample_rate_hz = s_ctx.sample_rate_hz,
+            .bits_per_sample = (s_ctx.format == MIC_FORMAT_PCM16) ? 16 : 24,
+            .block_size = MIC_FLAC_BLOCK_SAMPLES,
+            .max_order = MIC_FLAC_MAX_ORDER,
+            .max_partition_order = MIC_FLAC_MAX_PARTITION,
+        };
+        ret = flac_writer_open(&s_ctx.flac, path, &cfg, expected_bytes, MIC_WRITE_BLOCK_BYTES, MIC_CHECKPOINT_SECONDS);
+    } else if (s_ctx.sink == MIC_SINK_OPUS) {
+        const opus_writer_config_t cfg = {
+            .sample_rate_hz = s_ctx.sample_rate_hz,
+            .bitrate_bps = MIC_OPUS_BITRATE_BPS,
+            .complexity = MIC_OPUS_COMPLEXITY,
+        };
+        ret = opus_writer_open(&s_ctx.opus, path, &cfg, MIC_WRITE_BLOCK_BYTES, MIC_CHECKPOINT_SECONDS);
+    } else {
+        s_ctx.wav_fmt = (wav_format_t) {
+            .sample_rate_hz = s_ctx.sample_rate_hz,
+            .bits_per_sample = (uint16_t)(sample_bytes * 8),
+            .valid_bits = (s_ctx.format == MIC_FORMAT_PCM24_IN_32) ? 24 : 0,
+            .channels = 1,
+        };
+        mic_segment_init(&s_ctx.seg, mic_segment_limit(CONFIG_MIC_SEGMENT_MINUTES, CONFIG_MIC_SEGMENT_MAX_MB,
+                                                       s_ctx.sample_rate_hz, sample_bytes), sample_bytes);
+        s_ctx.wav = &s_ctx.seg_slots[0];
+        ret = s_segment_open(0, 0, (expected_bytes < s_ctx.seg.limit_bytes) ? expected_bytes : s_ctx.seg.limit_bytes);
     }
-    while (captured_samples < total_samples) {
-        if (stop_on_button && !button_is_recording()) {
-            s_log_info("Stop requested");
-            break;
-        }
-        size_t bytes_read = 0;
-        size_t samples_to_read = samples_per_chunk;
-        if (captured_samples + samples_to_read > total_samples) {
-            samples_to_read = total_samples - captured_samples;
-        }
-        size_t bytes_to_read = samples_to_read * bytes_per_sample;
+    if (ret != ESP_OK) {
+        s_log_error("Open failed %s (%s)", path, esp_err_to_name(ret));
+        return ret;
+    }
+    s_ctx.opened = true;
 
-        ret = i2s_channel_read(rx_handle, buffer, bytes_to_read, &bytes_read, pdMS_TO_TICKS(1000));
-        if (ret != ESP_OK) {
-            s_log_error("I2S read failed (%s)", esp_err_to_name(ret));
-            break;
+    s_ctx.pack = heap_caps_malloc(MIC_WRITE_BLOCK_BYTES, MALLOC_CAP_INTERNAL | MALLOC_CAP_32BIT);
+    s_ctx.done = xSemaphoreCreateBinary();
+    s_ctx.vad_enabled = s_vad_enabled;
+    if (s_ctx.vad_enabled) {
+        mic_vad_init(&s_ctx.vad, CONFIG_MIC_VAD_THRESHOLD_DBFS, MIC_VAD_HANGOVER_BLOCKS);
+        s_ctx.preroll = heap_caps_malloc(MIC_VAD_PREROLL_BLOCKS * s_ctx.chunk_samples * MIC_BYTES_PER_SAMPLE,
+                                         MALLOC_CAP_8BIT);
+        s_ctx.gaps = heap_caps_malloc(MIC_VAD_MAX_GAPS * sizeof(wav_cue_t), MALLOC_CAP_8BIT);
+        if (s_ctx.preroll == NULL || s_ctx.gaps == NULL) {
+            ret = ESP_ERR_NO_MEM;
         }
-        if (bytes_read > 0) {
-            if (button_is_paused()) {
-                memset(buffer, 0, bytes_read);
-            } else {
-                int32_t *samples = (int32_t *)buffer;
-                size_t count = bytes_read / sizeof(int32_t);
-                for (size_t i = 0; i < count; ++i) {
-                    samples[i] = s_apply_gain(samples[i]);
-                }
-            }
-            fwrite(buffer, 1, bytes_read, f);
-            captured_samples += bytes_read / bytes_per_sample;
+    }
+    if (s_ctx.seg.limit_bytes != MIC_SEGMENT_UNLIMITED) {
+        s_ctx.seg_done = xSemaphoreCreateBinary();
+        if (s_ctx.seg_done == NULL) {
+            ret = ESP_ERR_NO_MEM;
         }
+    }
+    if (s_ctx.pack == NULL || s_ctx.done == NULL || ret != ESP_OK) {
+        s_log_error("Audio buffer alloc failed");
+        s_free_buffers();
+        s_sink_close();
+        return ESP_ERR_NO_MEM;
+    }
+    if (s_ctx.seg_done != NULL) {
+        // Opens the second segment right away, long before the writer reaches the limit.
+        xTaskCreatePinnedToCore(s_segment_task, "mic_segment", MIC_SEGMENT_TASK_STACK, NULL,
+                                MIC_SEGMENT_TASK_PRIO, &s_ctx.seg_task, MIC_WRITER_TASK_CORE);
+        xTaskNotifyGive(s_ctx.seg_task);
+    }
 
-        if (write_wav && (captured_samples * 1000 / I2S_SAMPLE_RATE_HZ) >= next_flush_ms) {
-            const uint32_t data_bytes = (uint32_t)(captured_samples * bytes_per_sample);
-            fflush(f);
-            fsync(fileno(f));
-            fseek(f, 0, SEEK_SET);
-            s_write_wav_header(f, I2S_SAMPLE_RATE_HZ, 32, 1, data_bytes);
-            fseek(f, 0, SEEK_END);
-            next_flush_ms += flush_interval_ms;
-        }
+    // The capture task splices the pre-roll in at its next chunk. The writer must not see the ring before that.
+    s_svc.state = MIC_SVC_ARM;
+    xSemaphoreTake(s_ctx.done, portMAX_DELAY);
+    xTaskCreatePinnedToCore(s_writer_task, "mic_writer", MIC_WRITER_TASK_STACK, NULL,
+                            MIC_WRITER_TASK_PRIO, &s_ctx.writer_task, MIC_WRITER_TASK_CORE);
+    xSemaphoreTake(s_ctx.done, portMAX_DELAY);
+
+    // A writer error ends the writer first; the capture task stops at its next chunk.
+    while (s_svc.state != MIC_SVC_STOPPED) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    // Neither task touches the ring now, so it can be emptied before history collection resumes.
+    mic_ring_reset(&s_svc.ring);
+    s_svc.state = MIC_SVC_IDLE;
+
+    s_segment_finish();
+    if (s_ctx.sink == MIC_SINK_WAV) {
+        s_segment_set_cues(true);
     }
 
-    if (write_wav) {
-        const uint32_t data_bytes = (uint32_t)(captured_samples * bytes_per_sample);
-        fseek(f, 0, SEEK_SET);
-        s_write_wav_header(f, I2S_SAMPLE_RATE_HZ, 32, 1, data_bytes);
+    esp_err_t close_ret = s_sink_close();
+    if (close_ret == ESP_OK) {
+        close_ret = s_ctx.seg_err;
+    }
+    if (close_ret != ESP_OK && s_ctx.writer_err == ESP_OK) {
+        s_ctx.writer_err = close_ret;
     }
 
-    free(buffer);
-    fclose(f);
-    i2s_channel_disable(rx_handle);
-    i2s_del_channel(rx_handle);
+    mic_capture_stats_t stats;
+    mic_capture_get_stats(&stats);
+    ESP_LOGI(TAG, "Ring high water %lu/%lu bytes (%s), max write %lu us",
+             (unsigned long)stats.ring_high_water, (unsigned long)stats.ring_size,
+             s_svc.ring.in_psram ? "PSRAM" : "internal", (unsigned long)stats.write_max_us);
+    ESP_LOGI(TAG, "Dropped %lu samples (ring overruns %lu, DMA overruns %lu), read underruns %lu",
+             (unsigned long)stats.dropped_samples, (unsigned long)stats.ring_overruns,
+             (unsigned long)stats.dma_overruns, (unsigned long)stats.read_underruns);
+    ESP_LOGI(TAG, "Pre-roll %lu ms: first sample %ld ms from the press, armed %lu ms after it",
+             (unsigned long)stats.preroll_ms, (long)stats.press_to_first_sample_ms,
+             (unsigned long)stats.press_to_arm_ms);
+    if (s_ctx.seg.limit_bytes != MIC_SEGMENT_UNLIMITED) {
+        ESP_LOGI(TAG, "Session %08lx: %lu segments, slowest switch %lu us, %lu late",
+                 (unsigned long)s_ctx.session_id, (unsigned long)stats.segments,
+                 (unsigned long)stats.segment_switch_max_us, (unsigned long)stats.segment_late);
+    }
+    if (s_svc.resample.factor > 1) {
+        ESP_LOGI(TAG, "Decimating %d -> %lu Hz, %lu taps, %lu.%02lu cycles/output sample",
+                 I2S_SAMPLE_RATE_HZ, (unsigned long)s_ctx.sample_rate_hz, (unsigned long)s_svc.resample.taps,
+                 (unsigned long)(stats.resample_cycles_per_sample_x100 / 100),
+                 (unsigned long)(stats.resample_cycles_per_sample_x100 % 100));
+    }
+    // The gain stage cost per sample is rate independent, so one run gives the load at 16 and 48 kHz.
+    const uint32_t load_16k_x100 = stats.dsp_cycles_per_sample_x100 * 16 / CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ / 10;
+    ESP_LOGI(TAG, "%s: max %lu cycles/block, %lu.%02lu%% of a core at 16 kHz, %lu.%02lu%% at 48 kHz, gain %d.%d dB",
+             s_ctx.agc_enabled ? "AGC" : "Fixed gain", (unsigned long)stats.dsp_block_max_cycles,
+             (unsigned long)(load_16k_x100 / 100), (unsigned long)(load_16k_x100 % 100),
+             (unsigned long)(load_16k_x100 * 3 / 100), (unsigned long)(load_16k_x100 * 3 % 100),
+             (int)stats.agc_gain_db_x10 / 10, abs((int)stats.agc_gain_db_x10 % 10));
+    ESP_LOGI(TAG, "Gain stage %lu.%02lu cycles/sample, pack %lu.%02lu cycles/sample, SD load %lu B/s",
+             (unsigned long)(stats.dsp_cycles_per_sample_x100 / 100),
+             (unsigned long)(stats.dsp_cycles_per_sample_x100 % 100),
+             (unsigned long)(stats.pack_cycles_per_sample_x100 / 100),
+             (unsigned long)(stats.pack_cycles_per_sample_x100 % 100),
+             (unsigned long)stats.sd_bytes_per_s);
+    if (s_ctx.sink == MIC_SINK_FLAC && s_ctx.flac.data_bytes > 0) {
+        // Real-time factor: encoder cycles per second of audio over the cycles one core provides.
+        const uint64_t pcm_bytes = s_ctx.flac.enc.total_samples * (s_ctx.flac.enc.cfg.bits_per_sample / 8);
+        const uint64_t rtf_x10000 = (uint64_t)stats.pack_cycles_per_sample_x100 * s_ctx.sample_rate_hz /
+                                    (CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ * 10000ULL);
+        ESP_LOGI(TAG, "FLAC ratio %lu.%02lu, encoder RTF %lu.%04lu",
+                 (unsigned long)(pcm_bytes / s_ctx.flac.data_bytes),
+                 (unsigned long)(pcm_bytes * 100 / s_ctx.flac.data_bytes % 100),
+                 (unsigned long)(rtf_x10000 / 10000), (unsigned long)(rtf_x10000 % 10000));
+    }
+    if (s_ctx.vad_enabled && s_ctx.elapsed_samples > 0) {
+        ESP_LOGI(TAG, "VAD kept %lu%% of %lu samples, %lu gaps, %lu onsets",
+                 (unsigned long)((s_ctx.elapsed_samples - s_ctx.vad_skipped_samples) * 100 / s_ctx.elapsed_samples),
+                 (unsigned long)s_ctx.elapsed_samples, (unsigned long)atomic_load(&s_ctx.gap_count),
+                 (unsigned long)s_ctx.vad.onsets);
+    }
+    if (s_ctx.sink == MIC_SINK_OPUS) {
+        ESP_LOGI(TAG, "Opus %lu frames, encode avg %lu us, max %lu us per 20 ms frame",
+                 (unsigned long)s_ctx.opus.frames, (unsigned long)stats.encode_frame_avg_us,
+                 (unsigned long)stats.encode_frame_max_us);
+    }
+    s_free_buffers();
 
-    int captured_seconds = (int)(captured_samples / I2S_SAMPLE_RATE_HZ);
+    int captured_seconds = (int)(s_ctx.written_bytes / MIC_BYTES_PER_SAMPLE / s_ctx.sample_rate_hz);
     if (out_seconds != NULL) {
         *out_seconds = captured_seconds;
     }
     s_log_info("Captured %d sec to %s", captured_seconds, path);
-    return ret;
+    if (s_ctx.writer_err != ESP_OK) {
+        return s_ctx.writer_err;
+    }
+    return s_ctx.capture_err;
 }
@@ -1,5 +1,60 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "esp_err.h"
 
+// Sample format written to the file.
+typedef enum {
+    MIC_FORMAT_PCM16,           // 16-bit, 32 KB/s at 16 kHz
+    MIC_FORMAT_PCM24,           // Packed 3-byte samples, 48 KB/s
+    MIC_FORMAT_PCM24_IN_32,     // 24 valid bits in a 32-bit container, 64 KB/s
+    MIC_FORMAT_PCM32,           // Full 32-bit, 64 KB/s
+} mic_format_t;
+
+// Capture pipeline counters; all zero means no sample was lost.
+typedef struct {
+    uint32_t dma_overruns;      // I2S DMA queue overflows (capture task too slow)
+    uint32_t ring_overruns;     // Chunks rejected because the ring was full (SD too slow)
+    uint32_t dropped_samples;   // Samples lost to ring overruns
+    uint32_t read_underruns;    // I2S reads that returned less than a full chunk
+    uint32_t writer_underruns;  // Writer wakeups that found less than a write block
+    uint32_t ring_size;
+    uint32_t ring_high_water;
+    uint32_t write_max_us;      // Slowest single SD write
+    uint32_t dsp_cycles_per_sample_x100;  // Gain/mute stage cost, CPU cycles per sample x100
+    uint32_t pack_cycles_per_sample_x100; // Format conversion or FLAC encoding cost, CPU cycles per sample x100
+    uint32_t sd_bytes_per_s;    // Bytes written to the card per second of audio
+    uint32_t dsp_block_max_cycles; // Worst gain stage cost for one capture block
+    uint32_t sample_rate_hz;    // Output rate of the recording
+    uint32_t resample_cycles_per_sample_x100; // Decimator cost, CPU cycles per output sample x100
+    int32_t agc_gain_db_x10;    // AGC gain at the end of the recording, tenths of a dB
+    uint32_t agc_limited_blocks; // AGC sub-blocks where the peak limiter engaged
+    uint32_t vad_skipped_samples; // Silence not written to the card
+    uint32_t vad_gaps;          // Skipped regions marked in the file
+    uint32_t encode_frame_avg_us; // Opus encode time per 20 ms frame
+    uint32_t encode_frame_max_us;
+    uint64_t output_bytes;      // Audio bytes written, all segments together
+    uint32_t segments;          // Files the recording was split into
+    uint32_t segment_switch_max_us; // Slowest switch to the next segment, as seen by the writer
+    uint32_t segment_late;      // Switches delayed because the next segment was not open yet
+    uint32_t preroll_ms;        // Audio from before the recording was armed, spliced in at the start
+    uint32_t press_to_arm_ms;   // Button press to the capture task starting the recording
+    int32_t press_to_first_sample_ms; // First sample in the file relative to the press; negative is earlier
+} mic_capture_stats_t;
+
+// Output level after the gain stage, in 1/32768 of full scale; a peak of 32767 means the signal clipped.
+typedef struct {
+    uint16_t peak;              // Largest sample since the previous mic_capture_get_level()
+    uint16_t rms;               // RMS of the latest capture block
+} mic_capture_level_t;
+
+esp_err_t mic_capture_start(void);
 esp_err_t mic_capture_to_file(const char *path, int seconds, int *out_seconds);
+esp_err_t mic_capture_get_stats(mic_capture_stats_t *out);
+void mic_capture_get_level(mic_capture_level_t *out);
+void mic_capture_set_format(mic_format_t format, bool dither);
+esp_err_t mic_capture_set_sample_rate(uint32_t sample_rate_hz);
+void mic_capture_set_vad(bool enable);
+esp_err_t mic_capture_set_agc(bool enable, int target_dbfs, uint32_t attack_ms, uint32_t release_ms);
@@ -0,0 +1,279 @@
+#include "mic_dsp.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+// Multiplies by gain (>= 0) with saturation. Compares against precomputed limits instead of widening to int64.
+void mic_dsp_gain_s32_ansi(int32_t *samples, size_t count, int32_t gain)
+{
+    if (gain == 1) {
+        return;
+    }
+    if (gain == 0) {
+        mic_dsp_mute_s32(samples, count);
+        return;
+    }
+    // Limits for a positive gain; C division truncates toward zero, which is what the bounds need.
+    const int32_t hi = INT32_MAX / gain;
+    const int32_t lo = INT32_MIN / gain;
+    for (size_t i = 0; i < count; ++i) {
+        const int32_t s = samples[i];
+        samples[i] = (s > hi) ? INT32_MAX : (s < lo) ? INT32_MIN : s * gain;
+    }
+}
+
+// Zeroes a block (used while paused).
+void mic_dsp_mute_s32(int32_t *samples, size_t count)
+{
+    memset(samples, 0, count * sizeof(int32_t));
+}
+
+// Advances the dither generator.
+static inline uint32_t s_xorshift32(mic_dsp_dither_t *d)
+{
+    uint32_t x = d->state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    d->state = x;
+    return x;
+}
+
+// Rounds s to (32 - shift) bits with +/-1 LSB triangular dither, saturating at full scale.
+static inline int32_t s_requantize_tpdf(int32_t s, int shift, mic_dsp_dither_t *d)
+{
+    const uint32_t mask = (1u << shift) - 1;
+    const uint32_t r = s_xorshift32(d);
+    // Difference of two uniform values in [0, LSB) is triangular on (-LSB, LSB); LSB/2 rounds to nearest.
+    const int64_t v = (int64_t)s + (int32_t)(r & mask) - (int32_t)((r >> 16) & mask) + (int32_t)(mask >> 1) + 1;
+    if (v > INT32_MAX) {
+        return INT32_MAX >> shift;
+    }
+    if (v < INT32_MIN) {
+        return INT32_MIN >> shift;
+    }
+    return (int32_t)v >> shift;
+}
+
+// Converts to 16-bit samples.
+void mic_dsp_pack_s16(const int32_t *in, size_t count, int16_t *out, mic_dsp_dither_t *dither)
+{
+    if (dither == NULL) {
+        for (size_t i = 0; i < count; ++i) {
+            out[i] = (int16_t)(in[i] >> 16);
+        }
+        return;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = (int16_t)s_requantize_tpdf(in[i], 16, dither);
+    }
+}
+
+// Converts to packed little-endian 3-byte samples.
+void mic_dsp_pack_s24(const int32_t *in, size_t count, uint8_t *out, mic_dsp_dither_t *dither)
+{
+    size_t i = 0;
+    if (dither == NULL) {
+        // Four samples become three 32-bit words.
+        uint32_t *out32 = (uint32_t *)out;
+        const bool aligned = ((uintptr_t)out & 3) == 0;
+        for (; aligned && i + 4 <= count; i += 4) {
+            const uint32_t a = (uint32_t)in[i] >> 8;
+            const uint32_t b = (uint32_t)in[i + 1] >> 8;
+            const uint32_t c = (uint32_t)in[i + 2] >> 8;
+            const uint32_t d = (uint32_t)in[i + 3] >> 8;
+            *out32++ = a | (b << 24);
+            *out32++ = (b >> 8) | (c << 16);
+            *out32++ = (c >> 16) | (d << 8);
+        }
+        out = (uint8_t *)out32;
+    }
+    for (; i < count; ++i) {
+        const int32_t v = (dither != NULL) ? s_requantize_tpdf(in[i], 8, dither) : (in[i] >> 8);
+        *out++ = v & 0xff;
+        *out++ = (v >> 8) & 0xff;
+        *out++ = (v >> 16) & 0xff;
+    }
+}
+
+// Keeps the top 24 bits in a 32-bit container (left-justified, as WAVE_FORMAT_EXTENSIBLE expects).
+void mic_dsp_pack_s24_in_32(const int32_t *in, size_t count, int32_t *out, mic_dsp_dither_t *dither)
+{
+    if (dither == NULL) {
+        for (size_t i = 0; i < count; ++i) {
+            out[i] = in[i] & (int32_t)0xffffff00;
+        }
+        return;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = (int32_t)((uint32_t)s_requantize_tpdf(in[i], 8, dither) << 8);
+    }
+}
+
+// Sum of squares (of the top 20 bits) and sign changes over a block, in one pass.
+void mic_dsp_block_stats_s32(const int32_t *samples, size_t count, uint64_t *energy, uint32_t *zero_crossings)
+{
+    uint64_t acc[4] = {0};
+    uint32_t zc[4] = {0};
+    int32_t prev = (count > 0) ? samples[0] : 0;
+    size_t i = 0;
+    // Four independent lanes keep the MAC units busy instead of serializing on one accumulator.
+    for (; i + 4 <= count; i += 4) {
+        for (int lane = 0; lane < 4; ++lane) {
+            const int32_t v = samples[i + lane] >> 12;
+            acc[lane] += (uint64_t)((int64_t)v * v);
+        }
+        zc[0] += (uint32_t)((samples[i] ^ prev) < 0);
+        zc[1] += (uint32_t)((samples[i + 1] ^ samples[i]) < 0);
+        zc[2] += (uint32_t)((samples[i + 2] ^ samples[i + 1]) < 0);
+        zc[3] += (uint32_t)((samples[i + 3] ^ samples[i + 2]) < 0);
+        prev = samples[i + 3];
+    }
+    for (; i < count; ++i) {
+        const int32_t v = samples[i] >> 12;
+        acc[0] += (uint64_t)((int64_t)v * v);
+        zc[0] += (uint32_t)((samples[i] ^ prev) < 0);
+        prev = samples[i];
+    }
+    *energy = acc[0] + acc[1] + acc[2] + acc[3];
+    *zero_crossings = zc[0] + zc[1] + zc[2] + zc[3];
+}
+
+// Sums a[i] * b[i] in 64 bits and saturates to 32, as the PIE accumulator readout does.
+int32_t mic_dsp_dot_s16_ansi(const int16_t *a, const int16_t *b, size_t count)
+{
+    int64_t acc = 0;
+    for (size_t i = 0; i < count; ++i) {
+        acc += (int32_t)a[i] * b[i];
+    }
+    if (acc > INT32_MAX) {
+        return INT32_MAX;
+    }
+    if (acc < INT32_MIN) {
+        return INT32_MIN;
+    }
+    return (int32_t)acc;
+}
+
+// Dot product, eight lanes per instruction on the ESP32-S3 when both vectors are aligned.
+int32_t mic_dsp_dot_s16(const int16_t *a, const int16_t *b, size_t count)
+{
+#if CONFIG_IDF_TARGET_ESP32S3
+    if ((count & 7) == 0 && (((uintptr_t)a | (uintptr_t)b) & 15) == 0) {
+        return mic_dsp_dot_s16_aes3(a, b, count);
+    }
+#endif
+    return mic_dsp_dot_s16_ansi(a, b, count);
+}
+
+#if CONFIG_IDF_TARGET_ESP32S3
+// Returns log2(gain) for gains 2..2^30, or -1 when the SIMD path can't be used.
+static int s_pow2_shift(int32_t gain)
+{
+    if (gain < 2 || (gain & (gain - 1)) != 0) {
+        return -1;
+    }
+    return __builtin_ctz((unsigned)gain);
+}
+#endif
+
+// Applies gain with saturation, using PIE saturating adds on the ESP32-S3 for power-of-two gains.
+void mic_dsp_gain_s32(int32_t *samples, size_t count, int32_t gain)
+{
+#if CONFIG_IDF_TARGET_ESP32S3
+    const int shift = s_pow2_shift(gain);
+    if (shift > 0 && ((uintptr_t)samples & 15) == 0) {
+        // Repeated saturating doubling equals a single saturating multiply by 2^shift.
+        const size_t vec_count = count & ~(size_t)3;
+        int remaining = shift;
+        while (remaining >= 2) {
+            mic_dsp_sat_x4_s32_aes3(samples, vec_count);
+            remaining -= 2;
+        }
+        if (remaining == 1) {
+            mic_dsp_sat_x2_s32_aes3(samples, vec_count);
+        }
+        mic_dsp_gain_s32_ansi(samples + vec_count, count - vec_count, gain);
+        return;
+    }
+#endif
+    mic_dsp_gain_s32_ansi(samples, count, gain);
+}
+
+// Fused scalar gain and meter: each saturated sample goes into the meter as it is stored.
+static void s_gain_meter_ansi(int32_t *samples, size_t count, int32_t gain, mic_meter_t *meter)
+{
+    if (gain <= 1) {
+        if (gain == 0) {
+            mic_dsp_mute_s32(samples, count);
+            meter->count += (uint32_t)count;
+        } else {
+            mic_meter_add_block(meter, samples, count);
+        }
+        return;
+    }
+    // A local copy, so the compiler can keep it in registers although samples may alias it
+    mic_meter_t acc = *meter;
+    const int32_t hi = INT32_MAX / gain;
+    const int32_t lo = INT32_MIN / gain;
+    for (size_t i = 0; i < count; ++i) {
+        const int32_t s = samples[i];
+        const int32_t v = (s > hi) ? INT32_MAX : (s < lo) ? INT32_MIN : s * gain;
+        samples[i] = v;
+        mic_meter_add(&acc, v);
+    }
+    acc.count += (uint32_t)count;
+    *meter = acc;
+}
+
+#if CONFIG_IDF_TARGET_ESP32S3
+// Samples per metering PIE call. The 40-bit accumulator holds the squares of up to 508 full-scale samples.
+#define MIC_DSP_METER_CHUNK 256
+
+// Power-of-two gain on the vector unit, the last saturating pass metering in its lanes as it stores.
+static void s_gain_meter_aes3(int32_t *samples, size_t count, int shift, int32_t gain, mic_meter_t *meter)
+{
+    const size_t vec_count = count & ~(size_t)3;
+    int remaining = shift;
+    while (remaining > 2) {
+        mic_dsp_sat_x4_s32_aes3(samples, vec_count);
+        remaining -= 2;
+    }
+    // Lane maxima, lane minima, and the mask that keeps the top 16 bits of each lane for the squares
+    int32_t range[12] __attribute__((aligned(16)));
+    for (int lane = 0; lane < 4; ++lane) {
+        range[lane] = meter->max;
+        range[4 + lane] = meter->min;
+        range[8 + lane] = -65536;
+    }
+    for (size_t done = 0; done < vec_count; done += MIC_DSP_METER_CHUNK) {
+        const size_t n = (vec_count - done < MIC_DSP_METER_CHUNK) ? vec_count - done : MIC_DSP_METER_CHUNK;
+        meter->energy += (remaining == 2) ? mic_dsp_sat_x4_meter_s32_aes3(samples + done, n, range)
+                                          : mic_dsp_sat_x2_meter_s32_aes3(samples + done, n, range);
+    }
+    for (int lane = 0; lane < 4; ++lane) {
+        if (range[lane] > meter->max) {
+            meter->max = range[lane];
+        }
+        if (range[4 + lane] < meter->min) {
+            meter->min = range[4 + lane];
+        }
+    }
+    meter->count += (uint32_t)vec_count;
+    s_gain_meter_ansi(samples + vec_count, count - vec_count, gain, meter);
+}
+#endif
+
+// mic_dsp_gain_s32() that meters every output sample in the same pass, on the vector unit for the gains
+// mic_dsp_gain_s32() runs there.
+void mic_dsp_gain_meter_s32(int32_t *samples, size_t count, int32_t gain, mic_meter_t *meter)
+{
+#if CONFIG_IDF_TARGET_ESP32S3
+    const int shift = s_pow2_shift(gain);
+    if (shift > 0 && ((uintptr_t)samples & 15) == 0) {
+        s_gain_meter_aes3(samples, count, shift, gain, meter);
+        return;
+    }
+#endif
+    s_gain_meter_ansi(samples, count, gain, meter);
+}
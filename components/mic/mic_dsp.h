@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mic_meter.h"
+#include "sdkconfig.h"
+
+// Sample-processing kernels for the capture path. Buffers passed to the dispatching
+// functions should be 16-byte aligned so the ESP32-S3 SIMD path can be used.
+
+void mic_dsp_gain_s32(int32_t *samples, size_t count, int32_t gain);
+void mic_dsp_mute_s32(int32_t *samples, size_t count);
+// mic_dsp_gain_s32() that also accumulates every output sample into meter, in the same pass.
+void mic_dsp_gain_meter_s32(int32_t *samples, size_t count, int32_t gain, mic_meter_t *meter);
+
+// TPDF dither source (xorshift32). Seed with any non-zero value.
+typedef struct {
+    uint32_t state;
+} mic_dsp_dither_t;
+
+// Output-format converters from left-justified 32-bit samples. dither may be NULL to truncate.
+void mic_dsp_pack_s16(const int32_t *in, size_t count, int16_t *out, mic_dsp_dither_t *dither);
+void mic_dsp_pack_s24(const int32_t *in, size_t count, uint8_t *out, mic_dsp_dither_t *dither);
+void mic_dsp_pack_s24_in_32(const int32_t *in, size_t count, int32_t *out, mic_dsp_dither_t *dither);
+
+// Block statistics for voice activity detection.
+void mic_dsp_block_stats_s32(const int32_t *samples, size_t count, uint64_t *energy, uint32_t *zero_crossings);
+
+// Dot product of 16-bit vectors, saturated to 32 bits. The SIMD path needs count a multiple of 8.
+int32_t mic_dsp_dot_s16(const int16_t *a, const int16_t *b, size_t count);
+
+// Portable reference implementations, bit-exact with the SIMD path.
+void mic_dsp_gain_s32_ansi(int32_t *samples, size_t count, int32_t gain);
+int32_t mic_dsp_dot_s16_ansi(const int16_t *a, const int16_t *b, size_t count);
+
+#if CONFIG_IDF_TARGET_ESP32S3
+// PIE kernels: saturating x2 / x4 over count samples (multiple of 4, 16-byte aligned).
+void mic_dsp_sat_x2_s32_aes3(int32_t *samples, size_t count);
+void mic_dsp_sat_x4_s32_aes3(int32_t *samples, size_t count);
+// The same, also folding the output into lane maxima range[0..3] and minima range[4..7] (updated in place,
+// range[8..11] = 0xffff0000, 16-byte aligned). Returns the sum of squares of the top 16 bits; count at most 508.
+uint64_t mic_dsp_sat_x2_meter_s32_aes3(int32_t *samples, size_t count, int32_t *range);
+uint64_t mic_dsp_sat_x4_meter_s32_aes3(int32_t *samples, size_t count, int32_t *range);
+// PIE 16-bit dot product into the 40-bit accumulator (count multiple of 8, 16-byte aligned).
+int32_t mic_dsp_dot_s16_aes3(const int16_t *a, const int16_t *b, size_t count);
+#endif
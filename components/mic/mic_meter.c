@@ -0,0 +1,39 @@
+#include "mic_meter.h"
+
+// Accumulates every sample of a block that was produced without a metering gain loop.
+void mic_meter_add_block(mic_meter_t *meter, const int32_t *samples, size_t count)
+{
+    mic_meter_t acc = *meter;
+    for (size_t i = 0; i < count; ++i) {
+        mic_meter_add(&acc, samples[i]);
+    }
+    acc.count += (uint32_t)count;
+    *meter = acc;
+}
+
+// Returns the block peak in level units; full scale means the block clipped.
+uint16_t mic_meter_peak(const mic_meter_t *meter)
+{
+    const int64_t low = -(int64_t)meter->min;
+    const uint32_t peak = (uint32_t)(((low > meter->max) ? low : meter->max) >> 16);
+    return (peak > MIC_METER_FULL_SCALE) ? MIC_METER_FULL_SCALE : (uint16_t)peak;
+}
+
+// Returns the block RMS in level units. Integer square root, once per block.
+uint16_t mic_meter_rms(const mic_meter_t *meter)
+{
+    if (meter->count == 0) {
+        return 0;
+    }
+    uint32_t mean = (uint32_t)(meter->energy / meter->count);
+    uint32_t root = 0;
+    for (uint32_t bit = 1u << 30; bit != 0; bit >>= 2) {
+        if (mean >= root + bit) {
+            mean -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+    }
+    return (root > MIC_METER_FULL_SCALE) ? MIC_METER_FULL_SCALE : (uint16_t)root;
+}
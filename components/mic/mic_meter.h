@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Output level of one block, accumulated by the gain stage as it writes each sample: every sample goes into a
+// max/min pair and a sum of squares, so the peak is exact and metering takes no extra pass over the buffer.
+// Depends only on the C library.
+
+#define MIC_METER_FULL_SCALE 32767          // Level units: 1/32768 of full scale
+
+typedef struct {
+    int32_t max;                // Largest sample, 0 when none was positive
+    int32_t min;                // Smallest sample, 0 when none was negative
+    uint64_t energy;            // Sum of squares of the top 16 bits
+    uint32_t count;             // Samples accumulated
+} mic_meter_t;
+
+// Adds one output sample; inlined into the gain loops.
+static inline void mic_meter_add(mic_meter_t *meter, int32_t sample)
+{
+    if (sample > meter->max) {
+        meter->max = sample;
+    }
+    if (sample < meter->min) {
+        meter->min = sample;
+    }
+    const int32_t top = sample >> 16;
+    meter->energy += (uint32_t)(top * top);
+}
+
+void mic_meter_add_block(mic_meter_t *meter, const int32_t *samples, size_t count);
+uint16_t mic_meter_peak(const mic_meter_t *meter);
+uint16_t mic_meter_rms(const mic_meter_t *meter);
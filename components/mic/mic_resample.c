@@ -0,0 +1,129 @@
+#include "mic_resample.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "mic_dsp.h"
+
+#define RESAMPLE_COEF_ONE     (1 << 15)
+#define RESAMPLE_TRANSITION   0.2   // Transition width as a fraction of the output rate, centred on its Nyquist
+#define RESAMPLE_LO_BIAS      ((int64_t)RESAMPLE_COEF_ONE << 15) // Undoes the low-half offset: 32768 * sum(coefs)
+
+// Zeroth-order modified Bessel function, for the Kaiser window.
+static double s_bessel_i0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 32; ++k) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+// Designs the Kaiser windowed-sinc low-pass and stores it as Q15 taps summing to exactly unity gain.
+static int s_design(mic_resample_t *rs)
+{
+    const double stopband = MIC_RESAMPLE_STOPBAND_DB;
+    const double transition = RESAMPLE_TRANSITION / rs->factor;
+    uint32_t taps = (uint32_t)ceil((stopband - 7.95) / (14.36 * transition)) + 1;
+    taps |= 1;                                      // Odd length puts the centre on a sample
+    if (taps > MIC_RESAMPLE_MAX_TAPS) {
+        return -1;
+    }
+    const double beta = 0.1102 * (stopband - 8.7);
+    const double cutoff = 0.5 / rs->factor;         // Passband ends at 0.4, stopband starts at 0.6 of the output rate
+    const double centre = (taps - 1) / 2.0;
+    int16_t h[MIC_RESAMPLE_MAX_TAPS];
+    int32_t sum = 0;
+    for (uint32_t i = 0; i < taps; ++i) {
+        const double t = i - centre;
+        const double sinc = (t == 0.0) ? 1.0 : sin(M_PI * 2.0 * cutoff * t) / (M_PI * 2.0 * cutoff * t);
+        const double r = t / centre;
+        const double window = s_bessel_i0(beta * sqrt(1.0 - r * r)) / s_bessel_i0(beta);
+        h[i] = (int16_t)lround(2.0 * cutoff * sinc * window * RESAMPLE_COEF_ONE);
+        sum += h[i];
+    }
+    // Rounding error goes to the centre tap so DC passes unchanged; the output stage relies on the exact sum.
+    h[taps / 2] += (int16_t)(RESAMPLE_COEF_ONE - sum);
+
+    rs->taps = taps;
+    rs->window = (taps + 7 + 7) & ~7u;
+    memset(rs->coefs, 0, sizeof(rs->coefs));
+    for (int shift = 0; shift < 8; ++shift) {
+        memcpy(&rs->coefs[shift][shift], h, taps * sizeof(int16_t));
+    }
+    return 0;
+}
+
+// Sets up decimation by in/out. Returns 0 on success, -1 if the ratio is not a supported integer.
+int mic_resample_init(mic_resample_t *rs, uint32_t in_rate_hz, uint32_t out_rate_hz)
+{
+    memset(rs, 0, sizeof(*rs));
+    if (out_rate_hz == 0 || out_rate_hz > in_rate_hz || in_rate_hz % out_rate_hz != 0) {
+        return -1;
+    }
+    rs->factor = in_rate_hz / out_rate_hz;
+    if (rs->factor == 1) {
+        return 0;
+    }
+    if (s_design(rs) != 0) {
+        return -1;
+    }
+    // Start on a zero history, with the first output aligned to the first input sample.
+    rs->next = rs->taps - 1;
+    return 0;
+}
+
+// Filters one output sample whose window starts at history index start.
+static int32_t s_output(const mic_resample_t *rs, uint32_t start)
+{
+    const uint32_t base = start & ~7u;
+    const int16_t *coefs = rs->coefs[start & 7];
+    const int64_t hi = mic_dsp_dot_s16(rs->hist_hi + base, coefs, rs->window);
+    const int64_t lo = mic_dsp_dot_s16(rs->hist_lo + base, coefs, rs->window);
+    // x = hi * 65536 + lo + 32768, and the taps are Q15, so y = 2 * sum(h * hi) + (sum(h * lo) + bias) / 32768.
+    const int64_t y = 2 * hi + ((lo + RESAMPLE_LO_BIAS + (RESAMPLE_COEF_ONE >> 1)) >> 15);
+    if (y > INT32_MAX) {
+        return INT32_MAX;
+    }
+    if (y < INT32_MIN) {
+        return INT32_MIN;
+    }
+    return (int32_t)y;
+}
+
+// Decimates count samples; returns the number written to out. out may equal in.
+size_t mic_resample_process(mic_resample_t *rs, const int32_t *in, size_t count, int32_t *out)
+{
+    if (rs->factor == 1) {
+        if (out != in) {
+            memmove(out, in, count * sizeof(int32_t));
+        }
+        return count;
+    }
+    const uint32_t keep = rs->taps - 1;
+    size_t produced = 0;
+    while (count > 0) {
+        const size_t n = (count < MIC_RESAMPLE_BLOCK) ? count : MIC_RESAMPLE_BLOCK;
+        for (size_t i = 0; i < n; ++i) {
+            // The low half is stored offset by -32768 so both halves fit a signed 16-bit MAC.
+            rs->hist_hi[keep + i] = (int16_t)(in[i] >> 16);
+            rs->hist_lo[keep + i] = (int16_t)(((uint32_t)in[i] & 0xffff) ^ 0x8000);
+        }
+        in += n;
+        count -= n;
+
+        // Outputs never outnumber the inputs consumed so far, so writing in place stays behind the reads.
+        const uint32_t end = keep + (uint32_t)n;
+        uint32_t t = rs->next;
+        for (; t < end; t += rs->factor) {
+            out[produced++] = s_output(rs, t - keep);
+        }
+        rs->next = t - (uint32_t)n;
+
+        memmove(rs->hist_hi, rs->hist_hi + n, keep * sizeof(int16_t));
+        memmove(rs->hist_lo, rs->hist_lo + n, keep * sizeof(int16_t));
+    }
+    return produced;
+}
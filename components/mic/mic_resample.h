@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Integer-ratio decimator for left-justified 32-bit samples: a linear-phase Kaiser low-pass FIR evaluated
+// only at the output instants. Samples are kept as 16-bit high/low halves so the dot products run on
+// 16-bit MACs (the ESP32-S3 vector unit) without losing the low bits.
+// Depends only on mic_dsp and the C library so it can be built and benchmarked on a host.
+
+#define MIC_RESAMPLE_MAX_TAPS     160
+#define MIC_RESAMPLE_BLOCK        256                                    // Input samples handled per pass
+#define MIC_RESAMPLE_WINDOW_MAX   ((MIC_RESAMPLE_MAX_TAPS + 7 + 7) & ~7) // Taps padded for any 16-byte alignment
+#define MIC_RESAMPLE_STOPBAND_DB  80
+
+typedef struct {
+    uint32_t factor;             // Input samples per output sample; 1 passes samples through
+    uint32_t taps;
+    uint32_t window;             // Dot product length, multiple of 8
+    uint32_t next;               // History index of the next output instant
+    // One copy of the taps per start alignment, shifted right by 0..7 and zero padded to window.
+    int16_t coefs[8][MIC_RESAMPLE_WINDOW_MAX] __attribute__((aligned(16)));
+    int16_t hist_hi[MIC_RESAMPLE_WINDOW_MAX + MIC_RESAMPLE_BLOCK] __attribute__((aligned(16)));
+    int16_t hist_lo[MIC_RESAMPLE_WINDOW_MAX + MIC_RESAMPLE_BLOCK] __attribute__((aligned(16)));
+} mic_resample_t;
+
+int mic_resample_init(mic_resample_t *rs, uint32_t in_rate_hz, uint32_t out_rate_hz);
+size_t mic_resample_process(mic_resample_t *rs, const int32_t *in, size_t count, int32_t *out);
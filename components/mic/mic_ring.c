@@ -0,0 +1,106 @@
+#include "mic_ring.h"
+
+#include <string.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+static const char *TAG = "mic_ring";
+
+// Allocates the ring, preferring PSRAM and falling back to internal RAM.
+esp_err_t mic_ring_init(mic_ring_t *ring, size_t size)
+{
+    memset(ring, 0, sizeof(*ring));
+    if (size == 0 || (size & (size - 1)) != 0) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    ring->buf = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    ring->in_psram = (ring->buf != NULL);
+    if (ring->buf == NULL) {
+        ESP_LOGW(TAG, "No PSRAM for %u byte ring, using internal RAM", (unsigned)size);
+        ring->buf = heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    if (ring->buf == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    ring->size = size;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return ESP_OK;
+}
+
+// Frees the ring storage.
+void mic_ring_deinit(mic_ring_t *ring)
+{
+    heap_caps_free(ring->buf);
+    ring->buf = NULL;
+    ring->size = 0;
+}
+
+// Empties the ring and clears its statistics. Both tasks must be idle.
+void mic_ring_reset(mic_ring_t *ring)
+{
+    atomic_store(&ring->head, 0);
+    atomic_store(&ring->tail, 0);
+    ring->high_water = 0;
+    ring->overruns = 0;
+}
+
+// Returns the number of bytes waiting to be consumed.
+size_t mic_ring_used(const mic_ring_t *ring)
+{
+    return atomic_load_explicit(&ring->head, memory_order_acquire) -
+           atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+// Returns the number of bytes that can be written without overrun.
+size_t mic_ring_free(const mic_ring_t *ring)
+{
+    return ring->size - mic_ring_used(ring);
+}
+
+// Copies a block into the ring. The whole block is rejected if it does not fit.
+bool mic_ring_write(mic_ring_t *ring, const void *data, size_t len)
+{
+    const size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    const size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    const size_t used = head - tail;
+    if (len > ring->size - used) {
+        ring->overruns++;
+        return false;
+    }
+
+    const size_t offset = head & (ring->size - 1);
+    const size_t first = (len < ring->size - offset) ? len : ring->size - offset;
+    memcpy(ring->buf + offset, data, first);
+    if (len > first) {
+        memcpy(ring->buf, (const uint8_t *)data + first, len - first);
+    }
+    atomic_store_explicit(&ring->head, head + len, memory_order_release);
+
+    if (used + len > ring->high_water) {
+        ring->high_water = used + len;
+    }
+    return true;
+}
+
+// Returns the largest contiguous readable span starting at the tail.
+size_t mic_ring_peek(mic_ring_t *ring, const uint8_t **data)
+{
+    const size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    const size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    const size_t offset = tail & (ring->size - 1);
+    size_t len = head - tail;
+    if (len > ring->size - offset) {
+        len = ring->size - offset;
+    }
+    *data = ring->buf + offset;
+    return len;
+}
+
+// Releases bytes returned by mic_ring_peek() back to the producer.
+void mic_ring_consume(mic_ring_t *ring, size_t len)
+{
+    const size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + len, memory_order_release);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// Single-producer/single-consumer byte ring shared by the capture and writer tasks.
+typedef struct {
+    uint8_t *buf;
+    size_t size;               // Power of two so the free-running indices wrap cleanly
+    atomic_size_t head;        // Total bytes written (producer owned)
+    atomic_size_t tail;        // Total bytes consumed (consumer owned)
+    size_t high_water;         // Largest fill level seen by the producer
+    uint32_t overruns;         // Writes rejected because the ring was full
+    bool in_psram;
+} mic_ring_t;
+
+esp_err_t mic_ring_init(mic_ring_t *ring, size_t size);
+void mic_ring_deinit(mic_ring_t *ring);
+void mic_ring_reset(mic_ring_t *ring);
+size_t mic_ring_used(const mic_ring_t *ring);
+size_t mic_ring_free(const mic_ring_t *ring);
+bool mic_ring_write(mic_ring_t *ring, const void *data, size_t len);
+size_t mic_ring_peek(mic_ring_t *ring, const uint8_t **data);
+void mic_ring_consume(mic_ring_t *ring, size_t len);
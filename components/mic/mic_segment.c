@@ -0,0 +1,96 @@
+#include "mic_segment.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Audio bytes per segment from the duration and size limits (0 disables either); MIC_SEGMENT_UNLIMITED when
+// neither is set. Always a whole number of frames.
+uint64_t mic_segment_limit(uint32_t minutes, uint32_t max_mb, uint32_t sample_rate_hz, size_t frame_bytes)
+{
+    uint64_t frames = UINT64_MAX;
+    if (minutes > 0) {
+        frames = (uint64_t)minutes * 60 * sample_rate_hz;
+    }
+    if (max_mb > 0) {
+        const uint64_t size_frames = (uint64_t)max_mb * 1024 * 1024 / frame_bytes;
+        if (size_frames < frames) {
+            frames = size_frames;
+        }
+    }
+    return (frames == UINT64_MAX) ? MIC_SEGMENT_UNLIMITED : frames * frame_bytes;
+}
+
+// Starts the first segment of a session.
+void mic_segment_init(mic_segment_t *seg, uint64_t limit_bytes, size_t frame_bytes)
+{
+    memset(seg, 0, sizeof(*seg));
+    seg->limit_bytes = limit_bytes;
+    seg->frame_bytes = frame_bytes;
+}
+
+// Returns how many of len bytes belong in the current segment. Until the next segment is open everything does,
+// so a slow card makes one segment run long rather than stall the writer.
+size_t mic_segment_room(const mic_segment_t *seg, size_t len, bool next_ready)
+{
+    if (!next_ready) {
+        return len;
+    }
+    const uint64_t room = (seg->bytes < seg->limit_bytes) ? seg->limit_bytes - seg->bytes : 0;
+    return (len > room) ? (size_t)room : len;
+}
+
+// Accounts for len bytes written to the current segment. Returns true when the segment is full and the next
+// one is ready, i.e. the caller should switch files and call mic_segment_rotate().
+bool mic_segment_wrote(mic_segment_t *seg, size_t len, bool next_ready)
+{
+    seg->bytes += len;
+    if (seg->bytes < seg->limit_bytes) {
+        return false;
+    }
+    if (next_ready) {
+        return true;
+    }
+    if (!seg->late_counted) {
+        seg->late++;
+        seg->late_counted = true;
+    }
+    return false;
+}
+
+// Hands the current segment the cues that fall in it, rebased in place to its first frame; the last segment
+// takes every cue left, including one at its very end. cues are in session frames, sorted, and may grow between
+// calls. Call before mic_segment_rotate(). Returns how many cues belong to the segment, from *first on.
+size_t mic_segment_cues(mic_segment_t *seg, wav_cue_t *cues, size_t count, bool last, size_t *first)
+{
+    const uint64_t end_frame = seg->start_frame + seg->bytes / seg->frame_bytes;
+    size_t i = seg->cue_next;
+    *first = i;
+    for (; i < count && (last || cues[i].position < end_frame); i++) {
+        cues[i].position -= (uint32_t)seg->start_frame;
+    }
+    seg->cue_next = i;
+    return i - *first;
+}
+
+// Moves on to the next segment, which starts where the current one ended.
+void mic_segment_rotate(mic_segment_t *seg)
+{
+    seg->start_frame += seg->bytes / seg->frame_bytes;
+    seg->segment++;
+    seg->bytes = 0;
+    seg->late_counted = false;
+}
+
+// Builds the name of a segment: the first keeps the recording's name, later ones add _002, _003, ...
+void mic_segment_path(const char *first_path, uint32_t segment, char *out, size_t out_size)
+{
+    const char *dot = strrchr(first_path, '.');
+    const char *slash = strrchr(first_path, '/');
+    if (segment == 0) {
+        snprintf(out, out_size, "%s", first_path);
+    } else if (dot != NULL && (slash == NULL || dot > slash)) {
+        snprintf(out, out_size, "%.*s_%03u%s", (int)(dot - first_path), first_path, (unsigned)segment + 1, dot);
+    } else {
+        snprintf(out, out_size, "%s_%03u", first_path, (unsigned)segment + 1);
+    }
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "wav_writer.h"
+
+// Bookkeeping for splitting a recording into sample-contiguous segments: where the limit falls, how much of
+// each write still fits, where the next segment starts in the session and which VAD gap cues belong to each
+// segment. The file handling stays with the caller, so this can be tested on a host.
+
+#define MIC_SEGMENT_UNLIMITED UINT64_MAX
+
+typedef struct {
+    uint64_t limit_bytes;        // Audio bytes per segment, MIC_SEGMENT_UNLIMITED when not splitting
+    size_t frame_bytes;
+    uint32_t segment;            // Index of the current segment
+    uint64_t bytes;              // Audio bytes in the current segment
+    uint64_t start_frame;        // Session frames before the current segment
+    bool late_counted;
+    uint32_t late;               // Rotations delayed because the next segment was not open yet
+    size_t cue_next;             // First cue not yet handed to a segment
+} mic_segment_t;
+
+uint64_t mic_segment_limit(uint32_t minutes, uint32_t max_mb, uint32_t sample_rate_hz, size_t frame_bytes);
+void mic_segment_init(mic_segment_t *seg, uint64_t limit_bytes, size_t frame_bytes);
+size_t mic_segment_room(const mic_segment_t *seg, size_t len, bool next_ready);
+bool mic_segment_wrote(mic_segment_t *seg, size_t len, bool next_ready);
+size_t mic_segment_cues(mic_segment_t *seg, wav_cue_t *cues, size_t count, bool last, size_t *first);
+void mic_segment_rotate(mic_segment_t *seg);
+void mic_segment_path(const char *first_path, uint32_t segment, char *out, size_t out_size);
@@ -0,0 +1,63 @@
+#include "mic_vad.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "mic_dsp.h"
+
+#define VAD_FULL_SCALE_LOG2    38   // Mean square of a full-scale block as measured by mic_dsp_block_stats_s32()
+#define VAD_SPEECH_RATIO       4    // Speech must be 6 dB over the noise floor
+#define VAD_FRICATIVE_RATIO    2    // ...or 3 dB over it with a high zero-crossing rate
+#define VAD_FRICATIVE_ZCR_DIV  4    // High zero-crossing rate: more than one crossing per 4 samples
+#define VAD_NOISE_RISE_IDLE    7    // Floor rises by 1/128 of the gap per idle block (~4 s at 32 ms blocks)
+#define VAD_NOISE_RISE_ACTIVE  10   // ...and 8x slower while speech is present
+
+// Sets the absolute threshold and the hangover length in blocks.
+void mic_vad_init(mic_vad_t *vad, int threshold_dbfs, uint32_t hangover_blocks)
+{
+    memset(vad, 0, sizeof(*vad));
+    vad->threshold = (uint64_t)ldexp(pow(10.0, threshold_dbfs / 10.0), VAD_FULL_SCALE_LOG2);
+    if (vad->threshold == 0) {
+        vad->threshold = 1;
+    }
+    vad->noise = vad->threshold;
+    vad->hangover_blocks = hangover_blocks;
+}
+
+// Classifies one block; returns true while speech or its hangover lasts.
+bool mic_vad_process(mic_vad_t *vad, const int32_t *samples, size_t count)
+{
+    if (count == 0) {
+        return vad->active;
+    }
+    uint64_t energy = 0;
+    uint32_t zero_crossings = 0;
+    mic_dsp_block_stats_s32(samples, count, &energy, &zero_crossings);
+    const uint64_t level = energy / count;
+
+    const uint64_t speech_level = (vad->noise * VAD_SPEECH_RATIO > vad->threshold) ?
+                                  vad->noise * VAD_SPEECH_RATIO : vad->threshold;
+    const bool fricative = (level > vad->noise * VAD_FRICATIVE_RATIO) && (level > vad->threshold) &&
+                           (zero_crossings * VAD_FRICATIVE_ZCR_DIV > count);
+    const bool speech = (level > speech_level) || fricative;
+
+    // The floor follows drops immediately and rises slowly, so speech cannot drag it up.
+    if (level < vad->noise) {
+        vad->noise = (level > 0) ? level : 1;
+    } else {
+        vad->noise += (level - vad->noise) >> (speech ? VAD_NOISE_RISE_ACTIVE : VAD_NOISE_RISE_IDLE);
+    }
+
+    if (speech) {
+        if (!vad->active) {
+            vad->onsets++;
+        }
+        vad->active = true;
+        vad->hang = vad->hangover_blocks;
+    } else if (vad->hang > 0) {
+        vad->hang--;
+    } else {
+        vad->active = false;
+    }
+    return vad->active;
+}
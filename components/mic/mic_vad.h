@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Block-based voice activity detector: energy over an adaptive noise floor, zero-crossing rate
+// for unvoiced speech, and a hangover that keeps short pauses inside one segment.
+typedef struct {
+    uint64_t threshold;          // Absolute mean-square level below which nothing is speech
+    uint64_t noise;              // Tracked noise floor, mean square
+    uint32_t hangover_blocks;
+    uint32_t hang;
+    bool active;
+    uint32_t onsets;             // Idle to active transitions
+} mic_vad_t;
+
+void mic_vad_init(mic_vad_t *vad, int threshold_dbfs, uint32_t hangover_blocks);
+bool mic_vad_process(mic_vad_t *vad, const int32_t *samples, size_t count);
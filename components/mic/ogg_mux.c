@@ -0,0 +1,109 @@
+#include "ogg_mux.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define OGG_FLAG_BOS      0x02
+#define OGG_FLAG_EOS      0x04
+#define OGG_MAX_SEGMENTS  255
+#define OGG_CRC_POLY      0x04c11db7u
+
+// Ogg CRC-32: polynomial 0x04c11db7, MSB first, zero initial value and no final xor.
+static uint32_t s_crc32(uint32_t crc, const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint32_t)data[i] << 24;
+        for (int b = 0; b < 8; b++) {
+            crc = (crc & 0x80000000u) ? (crc << 1) ^ OGG_CRC_POLY : crc << 1;
+        }
+    }
+    return crc;
+}
+
+// Stores a 32-bit little-endian value.
+static void s_put_le32(uint8_t *p, uint32_t value)
+{
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = (value >> 24) & 0xff;
+}
+
+// Allocates the page body buffer. Returns 0 on success.
+int ogg_mux_init(ogg_mux_t *m, uint32_t serial, size_t page_body_bytes, ogg_mux_write_fn write, void *arg)
+{
+    memset(m, 0, sizeof(*m));
+    m->serial = serial;
+    m->write = write;
+    m->arg = arg;
+    m->body_cap = page_body_bytes;
+    m->body = malloc(page_body_bytes);
+    return (m->body != NULL) ? 0 : -1;
+}
+
+// Writes the pending page. An empty page is only written when it carries the end-of-stream flag.
+int ogg_mux_flush(ogg_mux_t *m, bool eos)
+{
+    if (m->segments == 0 && !eos) {
+        return 0;
+    }
+    uint8_t *h = m->header;
+    memcpy(h, "OggS", 4);
+    h[4] = 0;
+    h[5] = ((m->sequence == 0) ? OGG_FLAG_BOS : 0) | (eos ? OGG_FLAG_EOS : 0);
+    s_put_le32(h + 6, (uint32_t)m->granule);
+    s_put_le32(h + 10, (uint32_t)(m->granule >> 32));
+    s_put_le32(h + 14, m->serial);
+    s_put_le32(h + 18, m->sequence);
+    s_put_le32(h + 22, 0);
+    h[26] = (uint8_t)m->segments;
+
+    const size_t header_len = 27 + m->segments;
+    uint32_t crc = s_crc32(0, h, header_len);
+    crc = s_crc32(crc, m->body, m->body_len);
+    s_put_le32(h + 22, crc);
+
+    int ret = m->write(m->arg, h, header_len);
+    if (ret == 0 && m->body_len > 0) {
+        ret = m->write(m->arg, m->body, m->body_len);
+    }
+    m->sequence++;
+    m->pages++;
+    m->segments = 0;
+    m->body_len = 0;
+    return ret;
+}
+
+// Adds one packet ending at granule; end_page closes the page after it.
+int ogg_mux_packet(ogg_mux_t *m, const uint8_t *data, size_t len, uint64_t granule, bool end_page)
+{
+    const size_t segments = len / 255 + 1;
+    if (segments > OGG_MAX_SEGMENTS || len > m->body_cap) {
+        return -1;
+    }
+    if (m->segments + segments > OGG_MAX_SEGMENTS || m->body_len + len > m->body_cap) {
+        int ret = ogg_mux_flush(m, false);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+
+    // Lacing: runs of 255 followed by a final value below 255 mark the packet end.
+    uint8_t *lacing = m->header + 27 + m->segments;
+    for (size_t i = 0; i + 1 < segments; i++) {
+        lacing[i] = 255;
+    }
+    lacing[segments - 1] = (uint8_t)(len % 255);
+    m->segments += segments;
+    memcpy(m->body + m->body_len, data, len);
+    m->body_len += len;
+    m->granule = granule;
+    return end_page ? ogg_mux_flush(m, false) : 0;
+}
+
+// Frees the page buffer.
+void ogg_mux_deinit(ogg_mux_t *m)
+{
+    free(m->body);
+    m->body = NULL;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Minimal Ogg page writer for a single logical stream. Packets are never split across pages.
+// Depends only on the C library so it can be built and tested on a host.
+
+#define OGG_MUX_HEADER_MAX (27 + 255)
+
+// Receives page data; returns 0 on success.
+typedef int (*ogg_mux_write_fn)(void *arg, const uint8_t *data, size_t len);
+
+typedef struct {
+    ogg_mux_write_fn write;
+    void *arg;
+    uint32_t serial;
+    uint32_t sequence;
+    uint8_t header[OGG_MUX_HEADER_MAX];
+    uint8_t *body;
+    size_t body_cap;
+    size_t body_len;
+    size_t segments;
+    uint64_t granule;            // Granule position of the last packet on the pending page
+    uint32_t pages;
+} ogg_mux_t;
+
+int ogg_mux_init(ogg_mux_t *m, uint32_t serial, size_t page_body_bytes, ogg_mux_write_fn write, void *arg);
+int ogg_mux_packet(ogg_mux_t *m, const uint8_t *data, size_t len, uint64_t granule, bool end_page);
+int ogg_mux_flush(ogg_mux_t *m, bool eos);
+void ogg_mux_deinit(ogg_mux_t *m);
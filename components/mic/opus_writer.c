@@ -0,0 +1,226 @@
+#include "opus_writer.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_opus_enc.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+
+#define OPUS_GRANULE_RATE      48000   // Ogg Opus granule positions always count 48 kHz samples
+#define OPUS_PRE_SKIP          312     // Encoder lookahead at 48 kHz, trimmed by the decoder
+#define OPUS_FRAME_MS          20
+#define OPUS_PAGE_BODY_BYTES   4096
+#define OPUS_HEAD_BYTES        19
+#define OPUS_VENDOR            "esp_audio_codec"
+
+static const char *TAG = "opus";
+
+// Stores a 16-bit little-endian value.
+static void s_put_le16(uint8_t *p, uint16_t value)
+{
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+}
+
+// Stores a 32-bit little-endian value.
+static void s_put_le32(uint8_t *p, uint32_t value)
+{
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = (value >> 24) & 0xff;
+}
+
+// Muxer output: appends page data to the file.
+static int s_on_page(void *arg, const uint8_t *data, size_t len)
+{
+    opus_writer_t *w = (opus_writer_t *)arg;
+    w->write_err = rec_file_write(&w->file, data, len);
+    return (w->write_err == ESP_OK) ? 0 : -1;
+}
+
+// Returns the granule position after the given number of input samples.
+static uint64_t s_granule(const opus_writer_t *w, uint64_t samples)
+{
+    return OPUS_PRE_SKIP + samples * (OPUS_GRANULE_RATE / w->sample_rate_hz);
+}
+
+// Maps an esp_audio_codec result onto esp_err_t.
+static esp_err_t s_ret(esp_audio_err_t ret)
+{
+    if (ret == ESP_AUDIO_ERR_OK) {
+        return ESP_OK;
+    }
+    return (ret == ESP_AUDIO_ERR_MEM_LACK) ? ESP_ERR_NO_MEM : ESP_FAIL;
+}
+
+// Writes the OpusHead and OpusTags packets, each on its own page as the mapping requires.
+static esp_err_t s_write_headers(opus_writer_t *w)
+{
+    uint8_t head[OPUS_HEAD_BYTES] = {0};
+    memcpy(head, "OpusHead", 8);
+    head[8] = 1;                                    // Version
+    head[9] = 1;                                    // Mono
+    s_put_le16(head + 10, OPUS_PRE_SKIP);
+    s_put_le32(head + 12, w->sample_rate_hz);
+    if (ogg_mux_packet(&w->ogg, head, sizeof(head), 0, true) != 0) {
+        return (w->write_err != ESP_OK) ? w->write_err : ESP_FAIL;
+    }
+
+    uint8_t tags[8 + 4 + sizeof(OPUS_VENDOR) - 1 + 4];
+    memcpy(tags, "OpusTags", 8);
+    s_put_le32(tags + 8, sizeof(OPUS_VENDOR) - 1);
+    memcpy(tags + 12, OPUS_VENDOR, sizeof(OPUS_VENDOR) - 1);
+    s_put_le32(tags + 12 + sizeof(OPUS_VENDOR) - 1, 0);
+    if (ogg_mux_packet(&w->ogg, tags, sizeof(tags), 0, true) != 0) {
+        return (w->write_err != ESP_OK) ? w->write_err : ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+// Encodes the buffered frame and adds the packet to the current page.
+static esp_err_t s_encode_frame(opus_writer_t *w, uint64_t granule)
+{
+    esp_audio_enc_in_frame_t in = {
+        .buffer = (uint8_t *)w->frame,
+        .len = (uint32_t)(w->frame_samples * sizeof(int16_t)),
+    };
+    esp_audio_enc_out_frame_t out = {
+        .buffer = w->packet,
+        .len = (uint32_t)w->packet_cap,
+    };
+    const int64_t start_us = esp_timer_get_time();
+    esp_audio_err_t ret = esp_opus_enc_process(w->enc, &in, &out);
+    const uint32_t elapsed_us = (uint32_t)(esp_timer_get_time() - start_us);
+    if (ret != ESP_AUDIO_ERR_OK) {
+        ESP_LOGE(TAG, "Encode failed (%d)", (int)ret);
+        return s_ret(ret);
+    }
+    w->encode_us += elapsed_us;
+    if (elapsed_us > w->encode_max_us) {
+        w->encode_max_us = elapsed_us;
+    }
+    w->frames++;
+    w->frame_fill = 0;
+
+    const uint64_t before = rec_file_size(&w->file);
+    if (ogg_mux_packet(&w->ogg, out.buffer, out.encoded_bytes, granule, false) != 0) {
+        return (w->write_err != ESP_OK) ? w->write_err : ESP_FAIL;
+    }
+    w->data_bytes += rec_file_size(&w->file) - before;
+    return ESP_OK;
+}
+
+// Opens an Ogg Opus file. The file grows as pages are written; fsync runs every sync_s of audio.
+esp_err_t opus_writer_open(opus_writer_t *w, const char *path, const opus_writer_config_t *cfg,
+                           size_t block_size, uint32_t sync_s)
+{
+    memset(w, 0, sizeof(*w));
+    w->sample_rate_hz = cfg->sample_rate_hz;
+    w->frame_samples = cfg->sample_rate_hz * OPUS_FRAME_MS / 1000;
+    w->sync_samples = (uint64_t)cfg->sample_rate_hz * sync_s;
+    w->next_sync = w->sync_samples;
+
+    esp_opus_enc_config_t enc_cfg = ESP_OPUS_ENC_CONFIG_DEFAULT();
+    enc_cfg.sample_rate = (int)cfg->sample_rate_hz;
+    enc_cfg.channel = ESP_AUDIO_MONO;
+    enc_cfg.bits_per_sample = ESP_AUDIO_BIT16;
+    enc_cfg.bitrate = (int)cfg->bitrate_bps;
+    enc_cfg.frame_duration = ESP_OPUS_ENC_FRAME_DURATION_20_MS;
+    enc_cfg.application_mode = ESP_OPUS_ENC_APPLICATION_VOIP;
+    enc_cfg.complexity = cfg->complexity;
+    enc_cfg.enable_vbr = true;
+    esp_err_t ret = s_ret(esp_opus_enc_open(&enc_cfg, sizeof(enc_cfg), &w->enc));
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Encoder open failed");
+        return ret;
+    }
+
+    int in_size = 0;
+    int out_size = 0;
+    esp_opus_enc_get_frame_size(w->enc, &in_size, &out_size);
+    w->packet_cap = (size_t)out_size;
+    w->frame = heap_caps_malloc(w->frame_samples * sizeof(int16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    w->packet = heap_caps_malloc(w->packet_cap, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (w->frame == NULL || w->packet == NULL ||
+            ogg_mux_init(&w->ogg, esp_random(), OPUS_PAGE_BODY_BYTES, s_on_page, w) != 0) {
+        ret = ESP_ERR_NO_MEM;
+        goto fail;
+    }
+
+    // Compressed audio is small enough that growing the file is cheaper than preallocating.
+    ret = rec_file_open(&w->file, path, 0, block_size);
+    if (ret != ESP_OK) {
+        goto fail;
+    }
+    ret = s_write_headers(w);
+    if (ret != ESP_OK) {
+        rec_file_close(&w->file);
+        goto fail;
+    }
+    return ESP_OK;
+
+fail:
+    ogg_mux_deinit(&w->ogg);
+    heap_caps_free(w->frame);
+    heap_caps_free(w->packet);
+    esp_opus_enc_close(w->enc);
+    w->enc = NULL;
+    return ret;
+}
+
+// Buffers 16-bit samples and encodes every completed 20 ms frame.
+esp_err_t opus_writer_write(opus_writer_t *w, const int16_t *samples, size_t count)
+{
+    while (count > 0) {
+        size_t n = w->frame_samples - w->frame_fill;
+        if (n > count) {
+            n = count;
+        }
+        memcpy(w->frame + w->frame_fill, samples, n * sizeof(int16_t));
+        w->frame_fill += n;
+        w->samples += n;
+        samples += n;
+        count -= n;
+        if (w->frame_fill < w->frame_samples) {
+            break;
+        }
+        esp_err_t ret = s_encode_frame(w, s_granule(w, w->samples));
+        if (ret != ESP_OK) {
+            return ret;
+        }
+        if (w->sync_samples > 0 && w->samples >= w->next_sync) {
+            // Without preallocation the directory entry holds the only record of the file size.
+            w->next_sync += w->sync_samples;
+            fsync(w->file.fd);
+        }
+    }
+    return ESP_OK;
+}
+
+// Pads and encodes the last frame, ends the stream and closes the file.
+esp_err_t opus_writer_close(opus_writer_t *w)
+{
+    esp_err_t ret = ESP_OK;
+    if (w->frame_fill > 0) {
+        memset(w->frame + w->frame_fill, 0, (w->frame_samples - w->frame_fill) * sizeof(int16_t));
+        ret = s_encode_frame(w, s_granule(w, w->samples));
+    }
+    // The final granule position tells the decoder how much of the padded frame to play.
+    w->ogg.granule = s_granule(w, w->samples);
+    if (ogg_mux_flush(&w->ogg, true) != 0 && ret == ESP_OK) {
+        ret = (w->write_err != ESP_OK) ? w->write_err : ESP_FAIL;
+    }
+    esp_err_t close_ret = rec_file_close(&w->file);
+    ogg_mux_deinit(&w->ogg);
+    heap_caps_free(w->frame);
+    heap_caps_free(w->packet);
+    w->frame = NULL;
+    w->packet = NULL;
+    esp_opus_enc_close(w->enc);
+    w->enc = NULL;
+    return (ret != ESP_OK) ? ret : close_ret;
+}
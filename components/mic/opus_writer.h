@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "ogg_mux.h"
+#include "rec_file.h"
+
+typedef struct {
+    uint32_t sample_rate_hz;     // 8, 12, 16, 24 or 48 kHz
+    uint32_t bitrate_bps;
+    uint8_t complexity;          // 0-10, trades CPU time for quality
+} opus_writer_config_t;
+
+// Ogg Opus recording: 20 ms mono frames, grown in place and synced to the card periodically.
+typedef struct {
+    rec_file_t file;
+    ogg_mux_t ogg;
+    void *enc;
+    int16_t *frame;
+    size_t frame_samples;
+    size_t frame_fill;
+    uint8_t *packet;
+    size_t packet_cap;
+    uint32_t sample_rate_hz;
+    esp_err_t write_err;
+    uint64_t samples;            // Input samples encoded, excluding padding
+    uint32_t frames;
+    uint64_t data_bytes;         // Ogg bytes written after the header pages
+    uint64_t encode_us;
+    uint32_t encode_max_us;
+    uint64_t sync_samples;       // Audio between fsyncs, 0 to disable
+    uint64_t next_sync;
+} opus_writer_t;
+
+esp_err_t opus_writer_open(opus_writer_t *w, const char *path, const opus_writer_config_t *cfg,
+                           size_t block_size, uint32_t sync_s);
+esp_err_t opus_writer_write(opus_writer_t *w, const int16_t *samples, size_t count);
+esp_err_t opus_writer_close(opus_writer_t *w);
@@ -0,0 +1,185 @@
+#include "rec_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_vfs_fat.h"
+
+#define REC_FILE_MIN_PREALLOC   (1024 * 1024)
+#define REC_FILE_FREE_RESERVE   (4 * 1024 * 1024)        // Left free for other files
+#define REC_FILE_MAX_BYTES      (2047ULL * 1024 * 1024)  // off_t is 32-bit in newlib
+
+static const char *TAG = "rec_file";
+
+// Extracts the VFS mount point ("/sdcard") from a full path.
+static void s_mount_base(const char *path, char *out, size_t out_len)
+{
+    const char *end = strchr(path + 1, '/');
+    size_t len = (end != NULL) ? (size_t)(end - path) : strlen(path);
+    if (len >= out_len) {
+        len = out_len - 1;
+    }
+    memcpy(out, path, len);
+    out[len] = '\0';
+}
+
+// Creates the file as one contiguous extent, shrinking the request until it fits.
+static uint64_t s_preallocate(const char *path, uint64_t bytes)
+{
+    char base[16];
+    s_mount_base(path, base, sizeof(base));
+
+    uint64_t total_bytes = 0;
+    uint64_t free_bytes = 0;
+    if (esp_vfs_fat_info(base, &total_bytes, &free_bytes) == ESP_OK) {
+        if (free_bytes < REC_FILE_FREE_RESERVE + REC_FILE_MIN_PREALLOC) {
+            bytes = 0;
+        } else if (bytes > free_bytes - REC_FILE_FREE_RESERVE) {
+            bytes = free_bytes - REC_FILE_FREE_RESERVE;
+        }
+    }
+    if (bytes > REC_FILE_MAX_BYTES) {
+        bytes = REC_FILE_MAX_BYTES;
+    }
+
+    // f_expand() only works on an empty file.
+    unlink(path);
+    while (bytes >= REC_FILE_MIN_PREALLOC) {
+        if (esp_vfs_fat_create_contiguous_file(base, path, bytes, true) == ESP_OK) {
+            return bytes;
+        }
+        unlink(path);
+        bytes /= 2;
+    }
+    return 0;
+}
+
+// Writes the staging buffer at its file offset.
+static esp_err_t s_flush_block(rec_file_t *rf, size_t len)
+{
+    const int64_t start_us = esp_timer_get_time();
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = write(rf->fd, rf->block + done, len - done);
+        if (n <= 0) {
+            ESP_LOGE(TAG, "Write failed at %llu (%d)", (unsigned long long)(rf->pos + done), errno);
+            return ESP_FAIL;
+        }
+        done += (size_t)n;
+    }
+    const uint32_t elapsed_us = (uint32_t)(esp_timer_get_time() - start_us);
+    if (elapsed_us > rf->write_max_us) {
+        rf->write_max_us = elapsed_us;
+    }
+    return ESP_OK;
+}
+
+// Opens a recording file, preallocating prealloc_bytes as a single contiguous extent.
+esp_err_t rec_file_open(rec_file_t *rf, const char *path, uint64_t prealloc_bytes, size_t block_size)
+{
+    memset(rf, 0, sizeof(*rf));
+    rf->fd = -1;
+    rf->block_size = block_size;
+    rf->block = heap_caps_malloc(block_size, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    if (rf->block == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    rf->alloc_bytes = s_preallocate(path, prealloc_bytes);
+    if (rf->alloc_bytes == 0 && prealloc_bytes > 0) {
+        ESP_LOGW(TAG, "No contiguous space for %s, file will grow on demand", path);
+    }
+
+    int flags = O_WRONLY | O_CREAT;
+    if (rf->alloc_bytes == 0) {
+        flags |= O_TRUNC;
+    }
+    rf->fd = open(path, flags, 0666);
+    if (rf->fd < 0) {
+        ESP_LOGE(TAG, "Open failed %s (%d)", path, errno);
+        heap_caps_free(rf->block);
+        rf->block = NULL;
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "%s: %llu KB preallocated, %u KB blocks", path,
+             (unsigned long long)(rf->alloc_bytes / 1024), (unsigned)(block_size / 1024));
+    return ESP_OK;
+}
+
+// Appends data; the card only sees whole, block-aligned writes.
+esp_err_t rec_file_write(rec_file_t *rf, const void *data, size_t len)
+{
+    const uint8_t *src = (const uint8_t *)data;
+    while (len > 0) {
+        size_t n = rf->block_size - rf->block_fill;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(rf->block + rf->block_fill, src, n);
+        rf->block_fill += n;
+        src += n;
+        len -= n;
+        if (rf->block_fill == rf->block_size) {
+            esp_err_t ret = s_flush_block(rf, rf->block_size);
+            if (ret != ESP_OK) {
+                return ret;
+            }
+            rf->pos += rf->block_size;
+            rf->block_fill = 0;
+        }
+    }
+    return ESP_OK;
+}
+
+// Overwrites already written bytes, e.g. a container header. Must not straddle the staging block.
+esp_err_t rec_file_patch(rec_file_t *rf, uint64_t offset, const void *data, size_t len)
+{
+    if (offset >= rf->pos) {
+        if (offset + len > rf->pos + rf->block_fill) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        memcpy(rf->block + (offset - rf->pos), data, len);
+        return ESP_OK;
+    }
+    if (offset + len > rf->pos) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (pwrite(rf->fd, data, len, (off_t)offset) != (ssize_t)len) {
+        ESP_LOGE(TAG, "Patch at %llu failed (%d)", (unsigned long long)offset, errno);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+// Returns the logical file size, including bytes still in the staging block.
+uint64_t rec_file_size(const rec_file_t *rf)
+{
+    return rf->pos + rf->block_fill;
+}
+
+// Writes the tail, returns the unused preallocation to the volume and closes the file.
+esp_err_t rec_file_close(rec_file_t *rf)
+{
+    esp_err_t ret = ESP_OK;
+    const uint64_t size = rec_file_size(rf);
+    if (rf->fd < 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (rf->block_fill > 0) {
+        ret = s_flush_block(rf, rf->block_fill);
+    }
+    if (rf->alloc_bytes > size && ftruncate(rf->fd, (off_t)size) != 0) {
+        ESP_LOGW(TAG, "Truncate to %llu failed (%d)", (unsigned long long)size, errno);
+    }
+    fsync(rf->fd);
+    close(rf->fd);
+    rf->fd = -1;
+    heap_caps_free(rf->block);
+    rf->block = NULL;
+    return ret;
+}
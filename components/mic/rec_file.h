@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// Recording file on a FAT volume: preallocated contiguous extent, block-aligned writes.
+typedef struct {
+    int fd;
+    uint8_t *block;          // DMA-capable staging buffer covering [pos, pos + block_size)
+    size_t block_size;
+    size_t block_fill;
+    uint64_t pos;            // File offset of block[0]; everything before it is on the card
+    uint64_t alloc_bytes;    // Preallocated size, 0 if the file grows cluster by cluster
+    uint32_t write_max_us;   // Slowest single block write
+} rec_file_t;
+
+esp_err_t rec_file_open(rec_file_t *rf, const char *path, uint64_t prealloc_bytes, size_t block_size);
+esp_err_t rec_file_write(rec_file_t *rf, const void *data, size_t len);
+esp_err_t rec_file_patch(rec_file_t *rf, uint64_t offset, const void *data, size_t len);
+uint64_t rec_file_size(const rec_file_t *rf);
+esp_err_t rec_file_close(rec_file_t *rf);
@@ -0,0 +1,88 @@
+#include <stdint.h>
+#include <time.h>
+
+#include "flac_enc.h"
+#include "host_test.h"
+#include "test_signal.h"
+
+// Host benchmark for flac_enc with the recorder's settings: real-time factor (encode time over audio time) and
+// compressed size over PCM size at 16 and 24 bits, for speech, digital silence and a low noise floor. The last two
+// are what a voice recorder spends most of its time on: silence takes the constant subframe path, the noise floor
+// (peak 84 dB under full scale, about the microphone's idle noise) the residual coder at its smallest Rice
+// parameters. Host timings only compare encoder revisions; on the target the same figures come from the "FLAC:"
+// line mic_capture logs at the end of a recording.
+
+#define BENCH_SECONDS 60
+#define BENCH_RATE    48000
+#define FEED_SAMPLES  960
+
+typedef enum {
+    CORPUS_SPEECH,
+    CORPUS_SILENCE,
+    CORPUS_NOISE,
+} corpus_t;
+
+static const char *const s_corpus_names[] = { "speech", "silence", "noise floor" };
+
+// Fills x with the corpus at bps significant bits.
+static void s_fill(corpus_t corpus, int32_t *x, size_t count, unsigned bps)
+{
+    test_rng_t rng = { 0x9e3779b9 };
+    switch (corpus) {
+    case CORPUS_SPEECH:
+        test_signal_speech(x, count, BENCH_RATE, bps, 0, &rng);
+        break;
+    case CORPUS_SILENCE:
+        memset(x, 0, count * sizeof(int32_t));
+        break;
+    case CORPUS_NOISE:
+        for (size_t i = 0; i < count; i++) {
+            x[i] = test_rng_signed(&rng, bps - 14) * (int32_t)(1u << (32 - bps));
+        }
+        break;
+    }
+}
+
+static int s_count(void *arg, const uint8_t *data, size_t len)
+{
+    (void)data;
+    *(size_t *)arg += len;
+    return 0;
+}
+
+// Encodes one corpus at bps bits and prints its real-time factor and size.
+static void s_bench(corpus_t corpus, unsigned bps, int32_t *x, size_t count)
+{
+    s_fill(corpus, x, count, bps);
+    const flac_enc_config_t cfg = { .sample_rate_hz = BENCH_RATE, .bits_per_sample = (uint8_t)bps,
+                                    .block_size = 4096, .max_order = 4, .max_partition_order = 6 };
+    size_t bytes = 0;
+    flac_enc_t enc;
+    TEST_CHECK(flac_enc_init(&enc, &cfg, s_count, &bytes) == 0);
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (size_t i = 0; i < count; i += FEED_SAMPLES) {
+        TEST_CHECK(flac_enc_process(&enc, x + i, FEED_SAMPLES) == 0);
+    }
+    TEST_CHECK(flac_enc_finish(&enc) == 0);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    const double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    const double pcm = (double)count * bps / 8;
+    printf("%u-bit %s, %d s at %d Hz: real-time factor %.4f, %.4f of PCM (%.1f:1)\n", bps, s_corpus_names[corpus],
+           BENCH_SECONDS, BENCH_RATE, secs / BENCH_SECONDS, (double)bytes / pcm, pcm / (double)bytes);
+    flac_enc_deinit(&enc);
+}
+
+int main(void)
+{
+    const size_t count = (size_t)BENCH_SECONDS * BENCH_RATE;
+    int32_t *x = malloc(count * sizeof(int32_t));
+    TEST_CHECK(x != NULL);
+    for (int corpus = CORPUS_SPEECH; corpus <= CORPUS_NOISE; corpus++) {
+        for (unsigned bps = 16; bps <= 24; bps += 8) {
+            s_bench((corpus_t)corpus, bps, x, count);
+        }
+    }
+    free(x);
+    return 0;
+}
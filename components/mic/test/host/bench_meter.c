@@ -0,0 +1,117 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "host_test.h"
+#include "mic_agc.h"
+#include "mic_dsp.h"
+
+// Host microbenchmark: what the level meter adds to the gain stage it is folded into, over 20 ms blocks at 48 kHz
+// as mic_capture runs them. Each stage runs with and without the meter, the once-per-block peak and RMS the
+// capture task publishes included in the metered run. The two alternate TRIALS times and the fastest run of each
+// counts, which keeps the noise of a shared host out of the difference as far as it goes.
+
+#define SAMPLE_RATE_HZ 48000
+#define BLOCK_SAMPLES  960
+#define BLOCKS         2000
+#define TRIALS         9
+#define RING           8            // Output blocks kept; they stay in cache, like the capture chunk after the gain
+
+static int32_t s_src[BLOCKS][BLOCK_SAMPLES];
+static int32_t s_out[RING][BLOCK_SAMPLES];
+
+static double s_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Noise under a syllable-rate envelope with pauses, so the AGC moves its gain and now and then limits.
+static void s_fill(void)
+{
+    uint32_t x = 1;
+    for (int b = 0; b < BLOCKS; b++) {
+        const int32_t level = (b % 25 < 5) ? (1 << 18) : (1 << (22 + (b * 7) % 8));
+        for (int i = 0; i < BLOCK_SAMPLES; i++) {
+            x = x * 1664525u + 1013904223u;
+            s_src[b][i] = (int32_t)(((int64_t)(int32_t)x * level >> 31) * 16);
+        }
+    }
+}
+
+static const mic_agc_config_t s_agc_cfg = {
+    .sample_rate_hz = SAMPLE_RATE_HZ,
+    .target_dbfs = -18,
+    .max_gain_db = 30,
+    .limit_dbfs = -1,
+    .gate_dbfs = -65,
+    .attack_ms = 10,
+    .release_ms = 800,
+};
+
+// Publishes a block level the way the capture task does.
+static void s_publish(const mic_meter_t *meter, volatile uint32_t *sink)
+{
+    *sink += mic_meter_peak(meter) + mic_meter_rms(meter);
+}
+
+// Runs every block through the AGC into the s_out ring, metered or not, and returns ns per sample.
+static double s_run_agc(bool metered, volatile uint32_t *sink)
+{
+    static mic_agc_t agc;
+    mic_agc_init(&agc, &s_agc_cfg);
+    const double t0 = s_now_ns();
+    for (int b = 0; b < BLOCKS; b++) {
+        memcpy(s_out[b % RING], s_src[b], sizeof(s_out[b % RING]));
+        if (metered) {
+            mic_meter_t meter = {0};
+            mic_agc_process(&agc, s_out[b % RING], BLOCK_SAMPLES, &meter);
+            s_publish(&meter, sink);
+        } else {
+            mic_agc_process(&agc, s_out[b % RING], BLOCK_SAMPLES, NULL);
+        }
+    }
+    return (s_now_ns() - t0) / BLOCKS / BLOCK_SAMPLES;
+}
+
+// The same for the fixed gain the capture task applies when the AGC is off.
+static double s_run_gain(bool metered, volatile uint32_t *sink)
+{
+    const double t0 = s_now_ns();
+    for (int b = 0; b < BLOCKS; b++) {
+        memcpy(s_out[b % RING], s_src[b], sizeof(s_out[b % RING]));
+        if (metered) {
+            mic_meter_t meter = {0};
+            mic_dsp_gain_meter_s32(s_out[b % RING], BLOCK_SAMPLES, 4, &meter);
+            s_publish(&meter, sink);
+        } else {
+            mic_dsp_gain_s32(s_out[b % RING], BLOCK_SAMPLES, 4);
+        }
+    }
+    return (s_now_ns() - t0) / BLOCKS / BLOCK_SAMPLES;
+}
+
+// Times a gain stage without and with the meter, the block copy included in both.
+static void s_report(const char *stage, double (*run)(bool metered, volatile uint32_t *sink))
+{
+    volatile uint32_t sink = 0;
+    double plain = 1e30;
+    double metered = 1e30;
+    for (int t = 0; t < TRIALS; t++) {
+        const double p = run(false, &sink);
+        const double m = run(true, &sink);
+        plain = (p < plain) ? p : plain;
+        metered = (m < metered) ? m : metered;
+    }
+    printf("%s: %.3f ns/sample, metered %.3f ns/sample, meter adds %.2f%%\n", stage, plain, metered,
+           100.0 * (metered - plain) / plain);
+}
+
+int main(void)
+{
+    s_fill();
+    s_report("AGC", s_run_agc);
+    s_report("fixed gain x4", s_run_gain);
+    return 0;
+}
@@ -0,0 +1,294 @@
+#include "flac_test_dec.h"
+
+#include <string.h>
+
+// MSB-first bit reader; reading past the end sets overrun and returns zeros.
+typedef struct {
+    const uint8_t *buf;
+    size_t len;
+    size_t bit;
+    bool overrun;
+} s_bitr_t;
+
+// Reads nbits (0-32) as an unsigned value.
+static uint32_t s_get(s_bitr_t *br, unsigned nbits)
+{
+    uint64_t v = 0;
+    for (unsigned i = 0; i < nbits; i++) {
+        if (br->bit >= br->len * 8) {
+            br->overrun = true;
+            return 0;
+        }
+        v = (v << 1) | ((br->buf[br->bit >> 3] >> (7 - (br->bit & 7))) & 1);
+        br->bit++;
+    }
+    return (uint32_t)v;
+}
+
+// Reads nbits (1-32) as a two's complement value.
+static int32_t s_get_signed(s_bitr_t *br, unsigned nbits)
+{
+    const uint32_t v = s_get(br, nbits);
+    if (nbits < 32 && (v & (1u << (nbits - 1)))) {
+        return (int32_t)(v | ~((1u << nbits) - 1));
+    }
+    return (int32_t)v;
+}
+
+// Counts zero bits up to and including the terminating one.
+static uint32_t s_get_unary(s_bitr_t *br)
+{
+    uint32_t q = 0;
+    while (!br->overrun && s_get(br, 1) == 0) {
+        q++;
+    }
+    return q;
+}
+
+static uint8_t s_crc8(const uint8_t *data, size_t len)
+{
+    uint8_t crc = 0;
+    while (len--) {
+        crc ^= *data++;
+        for (int b = 0; b < 8; b++) {
+            crc = (uint8_t)((crc << 1) ^ ((crc & 0x80) ? 0x07 : 0));
+        }
+    }
+    return crc;
+}
+
+static uint16_t s_crc16(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0;
+    while (len--) {
+        crc ^= (uint16_t)(*data++ << 8);
+        for (int b = 0; b < 8; b++) {
+            crc = (uint16_t)((crc << 1) ^ ((crc & 0x8000) ? 0x8005 : 0));
+        }
+    }
+    return crc;
+}
+
+static const uint32_t s_rates[16] = { 0, 88200, 176400, 192000, 8000, 16000, 22050, 24000,
+                                      32000, 44100, 48000, 96000, 0, 0, 0, 0 };
+static const unsigned s_sizes[8] = { 0, 8, 12, 0, 16, 20, 24, 32 };
+
+#define FAIL(msg)              \
+    do {                       \
+        dec->error = (msg);    \
+        return -1;             \
+    } while (0)
+
+void flac_test_dec_init(flac_test_dec_t *dec, uint32_t sample_rate_hz, unsigned bits_per_sample)
+{
+    memset(dec, 0, sizeof(*dec));
+    dec->sample_rate_hz = sample_rate_hz;
+    dec->bits_per_sample = bits_per_sample;
+}
+
+// Decodes the partitioned Rice residual of a fixed subframe into res[0..n-order).
+static int s_residual(flac_test_dec_t *dec, s_bitr_t *br, unsigned n, unsigned order, int32_t *res)
+{
+    const unsigned method = s_get(br, 2);
+    if (method > 1) {
+        FAIL("reserved residual coding method");
+    }
+    const unsigned param_bits = method ? 5 : 4;
+    const uint32_t escape = (1u << param_bits) - 1;
+    const unsigned porder = s_get(br, 4);
+    const unsigned parts = 1u << porder;
+    if ((n & (parts - 1)) != 0 || (n >> porder) < order || ((n >> porder) == order && porder > 0)) {
+        FAIL("partition order does not fit the block");
+    }
+    for (unsigned p = 0; p < parts; p++) {
+        const unsigned count = (n >> porder) - ((p == 0) ? order : 0);
+        const uint32_t k = s_get(br, param_bits);
+        if (k == escape) {
+            const unsigned raw = s_get(br, 5);
+            dec->escape_partitions++;
+            for (unsigned i = 0; i < count; i++) {
+                *res++ = (raw == 0) ? 0 : s_get_signed(br, raw);
+            }
+            continue;
+        }
+        if (method == 1) {
+            dec->rice2_partitions++;
+        }
+        for (unsigned i = 0; i < count && !br->overrun; i++) {
+            const uint32_t q = s_get_unary(br);
+            if (q > (UINT32_MAX >> k)) {
+                FAIL("Rice quotient overflows 32 bits");
+            }
+            const uint32_t u = (q << k) | s_get(br, k);
+            *res++ = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+        }
+    }
+    return br->overrun ? -1 : 0;
+}
+
+int flac_test_dec_frame(flac_test_dec_t *dec, const uint8_t *data, size_t len, int32_t *out)
+{
+    s_bitr_t br = { .buf = data, .len = len };
+    if (s_get(&br, 14) != 0x3ffe) {
+        FAIL("bad sync code");
+    }
+    if (s_get(&br, 1) != 0) {
+        FAIL("reserved header bit set");
+    }
+    if (s_get(&br, 1) != 0) {
+        FAIL("variable block size stream");
+    }
+    const unsigned bs_code = s_get(&br, 4);
+    const unsigned rate_code = s_get(&br, 4);
+    const unsigned channels = s_get(&br, 4);
+    const unsigned size_code = s_get(&br, 3);
+    if (s_get(&br, 1) != 0) {
+        FAIL("reserved header bit set");
+    }
+    if (channels != 0) {
+        FAIL("not a mono frame");
+    }
+    if (s_sizes[size_code] != dec->bits_per_sample) {
+        FAIL("sample size does not match the stream");
+    }
+    if (rate_code >= 12 || (rate_code != 0 && s_rates[rate_code] != dec->sample_rate_hz)) {
+        FAIL("sample rate does not match the stream");
+    }
+
+    // Frame number, UTF-8 style
+    uint32_t number = s_get(&br, 8);
+    unsigned extra = 0;
+    if (number & 0x80) {
+        while (number & (0x40 >> extra)) {
+            extra++;
+        }
+        if (extra == 0 || extra > 5) {
+            FAIL("bad frame number coding");
+        }
+        number &= 0x3f >> extra;
+        for (unsigned i = 0; i < extra; i++) {
+            const uint32_t b = s_get(&br, 8);
+            if ((b & 0xc0) != 0x80) {
+                FAIL("bad frame number continuation");
+            }
+            number = (number << 6) | (b & 0x3f);
+        }
+    }
+    if (number != dec->next_frame) {
+        FAIL("frame number out of sequence");
+    }
+
+    unsigned n;
+    if (bs_code == 0) {
+        FAIL("reserved block size code");
+    } else if (bs_code == 1) {
+        n = 192;
+    } else if (bs_code <= 5) {
+        n = 576u << (bs_code - 2);
+    } else if (bs_code == 6) {
+        n = s_get(&br, 8) + 1;
+    } else if (bs_code == 7) {
+        n = s_get(&br, 16) + 1;
+    } else {
+        n = 256u << (bs_code - 8);
+    }
+    const uint8_t crc8 = s_crc8(data, br.bit / 8);
+    if (br.overrun || s_get(&br, 8) != crc8) {
+        FAIL("header CRC-8 mismatch");
+    }
+
+    // Subframe header
+    const unsigned bps = dec->bits_per_sample;
+    if (s_get(&br, 1) != 0) {
+        FAIL("subframe padding bit set");
+    }
+    const unsigned type = s_get(&br, 6);
+    unsigned wasted = 0;
+    if (s_get(&br, 1)) {
+        wasted = s_get_unary(&br) + 1;
+        if (wasted >= bps) {
+            FAIL("wasted bits exceed the sample size");
+        }
+    }
+    const unsigned sbps = bps - wasted;
+    if (type == 0) {
+        const int32_t v = s_get_signed(&br, sbps);
+        for (unsigned i = 0; i < n; i++) {
+            out[i] = v;
+        }
+        dec->constant++;
+    } else if (type == 1) {
+        for (unsigned i = 0; i < n; i++) {
+            out[i] = s_get_signed(&br, sbps);
+        }
+        dec->verbatim++;
+    } else if (type >= 8 && type <= 8 + FLAC_TEST_DEC_MAX_ORDER) {
+        const unsigned order = type - 8;
+        if (order > n) {
+            FAIL("predictor order exceeds the block");
+        }
+        for (unsigned i = 0; i < order; i++) {
+            out[i] = s_get_signed(&br, sbps);
+        }
+        if (s_residual(dec, &br, n, order, out + order) != 0) {
+            return -1;
+        }
+        // Residuals were decoded in place after the warm-up samples; add the prediction back in order
+        const int64_t lim = (int64_t)1 << (sbps - 1);
+        for (unsigned i = order; i < n; i++) {
+            int64_t pred;
+            switch (order) {
+            case 0:
+                pred = 0;
+                break;
+            case 1:
+                pred = out[i - 1];
+                break;
+            case 2:
+                pred = 2 * (int64_t)out[i - 1] - out[i - 2];
+                break;
+            case 3:
+                pred = 3 * (int64_t)out[i - 1] - 3 * (int64_t)out[i - 2] + out[i - 3];
+                break;
+            default:
+                pred = 4 * (int64_t)out[i - 1] - 6 * (int64_t)out[i - 2] + 4 * (int64_t)out[i - 3] - out[i - 4];
+                break;
+            }
+            const int64_t v = pred + out[i];
+            if (v < -lim || v >= lim) {
+                FAIL("decoded sample outside the sample size");
+            }
+            out[i] = (int32_t)v;
+        }
+        dec->fixed[order]++;
+    } else {
+        FAIL("unsupported subframe type");
+    }
+    for (unsigned i = 0; i < n && wasted > 0; i++) {
+        out[i] = (int32_t)((uint32_t)out[i] << wasted);
+    }
+
+    // Byte padding, then the CRC-16 of everything before it
+    if (br.bit & 7) {
+        if (s_get(&br, 8 - (br.bit & 7)) != 0) {
+            FAIL("non-zero frame padding");
+        }
+    }
+    const uint16_t crc16 = s_crc16(data, br.bit / 8);
+    if (br.overrun || s_get(&br, 16) != crc16) {
+        FAIL("frame CRC-16 mismatch");
+    }
+    if (br.bit != len * 8) {
+        FAIL("trailing bytes after the frame");
+    }
+
+    dec->next_frame++;
+    dec->frames++;
+    if (dec->min_frame_bytes == 0 || len < dec->min_frame_bytes) {
+        dec->min_frame_bytes = (uint32_t)len;
+    }
+    if (len > dec->max_frame_bytes) {
+        dec->max_frame_bytes = (uint32_t)len;
+    }
+    return (int)n;
+}
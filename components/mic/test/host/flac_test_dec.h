@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Reference FLAC frame decoder for the host tests, written from the format specification independently of
+// flac_enc.c. Decodes mono frames with constant, verbatim and fixed subframes (Rice and Rice2 residuals, escape
+// partitions, wasted bits) and checks everything the encoder is supposed to get right: sync, reserved bits,
+// frame numbering, header CRC-8, frame CRC-16 and that the frame ends exactly at the buffer end.
+// LPC subframes and stereo are rejected, since the encoder never produces them.
+
+#define FLAC_TEST_DEC_MAX_ORDER 4
+
+typedef struct {
+    uint32_t sample_rate_hz;     // Expected sample rate, checked against the header code
+    unsigned bits_per_sample;    // Expected sample size
+    uint32_t next_frame;
+    // What the stream contained so far
+    uint32_t frames;
+    uint32_t constant;
+    uint32_t verbatim;
+    uint32_t fixed[FLAC_TEST_DEC_MAX_ORDER + 1];
+    uint32_t rice2_partitions;
+    uint32_t escape_partitions;
+    uint32_t min_frame_bytes;
+    uint32_t max_frame_bytes;
+    const char *error;           // Why the last frame was rejected
+} flac_test_dec_t;
+
+void flac_test_dec_init(flac_test_dec_t *dec, uint32_t sample_rate_hz, unsigned bits_per_sample);
+// Decodes the single frame in data[0..len) into out (room for 65536 samples). Returns the sample count, or -1
+// with dec->error set.
+int flac_test_dec_frame(flac_test_dec_t *dec, const uint8_t *data, size_t len, int32_t *out);
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Host stand-in for the esp_audio_codec Opus encoder, which only ships as a chip library. It checks the frame it
+// is given and emits a packet the tests can trace back to it: a TOC byte, the frame index (little-endian 32-bit),
+// then the start of the PCM, with lengths from 5 up to HOST_OPUS_MAX_PACKET so pages fill at uneven points and
+// some packets need more than one lacing value.
+
+#define HOST_OPUS_TOC        0x08    // SILK narrowband, 20 ms, mono, one frame
+#define HOST_OPUS_MAX_PACKET 600
+
+typedef int esp_audio_err_t;
+
+#define ESP_AUDIO_ERR_OK                0
+#define ESP_AUDIO_ERR_FAIL              -1
+#define ESP_AUDIO_ERR_MEM_LACK          -2
+#define ESP_AUDIO_ERR_INVALID_PARAMETER -4
+
+#define ESP_AUDIO_MONO  1
+#define ESP_AUDIO_BIT16 16
+
+typedef enum {
+    ESP_OPUS_ENC_FRAME_DURATION_20_MS = 3,
+} esp_opus_enc_frame_duration_t;
+
+typedef enum {
+    ESP_OPUS_ENC_APPLICATION_VOIP = 0,
+} esp_opus_enc_application_t;
+
+typedef struct {
+    int sample_rate;
+    int channel;
+    int bits_per_sample;
+    int bitrate;
+    esp_opus_enc_frame_duration_t frame_duration;
+    esp_opus_enc_application_t application_mode;
+    int complexity;
+    bool enable_fec;
+    bool enable_dtx;
+    bool enable_vbr;
+} esp_opus_enc_config_t;
+
+#define ESP_OPUS_ENC_CONFIG_DEFAULT() {                     \
+    .sample_rate = 48000,                                   \
+    .channel = ESP_AUDIO_MONO,                              \
+    .bits_per_sample = ESP_AUDIO_BIT16,                     \
+    .bitrate = 90000,                                       \
+    .frame_duration = ESP_OPUS_ENC_FRAME_DURATION_20_MS,    \
+    .application_mode = ESP_OPUS_ENC_APPLICATION_VOIP,      \
+}
+
+typedef struct {
+    uint8_t *buffer;
+    uint32_t len;
+} esp_audio_enc_in_frame_t;
+
+typedef struct {
+    uint8_t *buffer;
+    uint32_t len;
+    uint32_t encoded_bytes;
+    uint64_t pts;
+} esp_audio_enc_out_frame_t;
+
+typedef struct {
+    uint32_t frame_bytes;
+    uint32_t index;
+} host_opus_enc_t;
+
+// Returns the length of the packet for frame index, always at least the TOC and index bytes.
+static inline uint32_t host_opus_packet_len(uint32_t index)
+{
+    return 5 + (index * 97u) % (HOST_OPUS_MAX_PACKET - 4);
+}
+
+static inline esp_audio_err_t esp_opus_enc_open(void *cfg, uint32_t cfg_sz, void **enc_hd)
+{
+    const esp_opus_enc_config_t *c = (const esp_opus_enc_config_t *)cfg;
+    if (cfg_sz != sizeof(*c) || c->channel != ESP_AUDIO_MONO || c->bits_per_sample != ESP_AUDIO_BIT16 ||
+            c->frame_duration != ESP_OPUS_ENC_FRAME_DURATION_20_MS) {
+        return ESP_AUDIO_ERR_INVALID_PARAMETER;
+    }
+    host_opus_enc_t *enc = calloc(1, sizeof(*enc));
+    if (enc == NULL) {
+        return ESP_AUDIO_ERR_MEM_LACK;
+    }
+    enc->frame_bytes = (uint32_t)c->sample_rate / 50 * sizeof(int16_t);
+    *enc_hd = enc;
+    return ESP_AUDIO_ERR_OK;
+}
+
+static inline esp_audio_err_t esp_opus_enc_get_frame_size(void *enc_hd, int *in_size, int *out_size)
+{
+    const host_opus_enc_t *enc = (const host_opus_enc_t *)enc_hd;
+    *in_size = (int)enc->frame_bytes;
+    *out_size = HOST_OPUS_MAX_PACKET;
+    return ESP_AUDIO_ERR_OK;
+}
+
+static inline esp_audio_err_t esp_opus_enc_process(void *enc_hd, esp_audio_enc_in_frame_t *in_frame,
+                                                   esp_audio_enc_out_frame_t *out_frame)
+{
+    host_opus_enc_t *enc = (host_opus_enc_t *)enc_hd;
+    const uint32_t len = host_opus_packet_len(enc->index);
+    if (in_frame->len != enc->frame_bytes || out_frame->len < len) {
+        return ESP_AUDIO_ERR_INVALID_PARAMETER;
+    }
+    uint8_t *p = out_frame->buffer;
+    p[0] = HOST_OPUS_TOC;
+    p[1] = enc->index & 0xff;
+    p[2] = (enc->index >> 8) & 0xff;
+    p[3] = (enc->index >> 16) & 0xff;
+    p[4] = (enc->index >> 24) & 0xff;
+    const uint32_t pcm = (len - 5 < in_frame->len) ? len - 5 : in_frame->len;
+    memcpy(p + 5, in_frame->buffer, pcm);
+    memset(p + 5 + pcm, 0, len - 5 - pcm);
+    out_frame->encoded_bytes = len;
+    enc->index++;
+    return ESP_AUDIO_ERR_OK;
+}
+
+static inline void esp_opus_enc_close(void *enc_hd)
+{
+    free(enc_hd);
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+
+// Host stand-in for esp_random(): a fixed value, so the Ogg stream serial is reproducible.
+
+#define HOST_RANDOM_VALUE 0x5eed0123u
+
+static inline uint32_t esp_random(void)
+{
+    return HOST_RANDOM_VALUE;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "esp_err.h"
+
+// Host stand-in for the FAT VFS helpers rec_file uses. The "volume" reports HOST_VFS_FREE_BYTES free, and a
+// contiguous file is a file extended to its full size, as f_expand() leaves it.
+
+#define HOST_VFS_FREE_BYTES (64ULL * 1024 * 1024)
+
+static inline esp_err_t esp_vfs_fat_info(const char *base_path, uint64_t *out_total_bytes, uint64_t *out_free_bytes)
+{
+    (void)base_path;
+    *out_total_bytes = HOST_VFS_FREE_BYTES;
+    *out_free_bytes = HOST_VFS_FREE_BYTES;
+    return ESP_OK;
+}
+
+static inline esp_err_t esp_vfs_fat_create_contiguous_file(const char *base_path, const char *full_path,
+                                                           uint64_t size, bool alloc_now)
+{
+    (void)base_path;
+    (void)alloc_now;
+    const int fd = open(full_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        return ESP_FAIL;
+    }
+    const int ret = ftruncate(fd, (off_t)size);
+    close(fd);
+    return (ret == 0) ? ESP_OK : ESP_FAIL;
+}
@@ -0,0 +1,3 @@
+#pragma once
+
+// Host build: no target, so the portable C paths are compiled.
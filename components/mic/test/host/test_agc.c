@@ -0,0 +1,170 @@
+#include <math.h>
+#include <stdint.h>
+
+#include "host_test.h"
+#include "mic_agc.h"
+
+// mic_agc with the capture path's settings at 16 and 48 kHz, fed a quiet tone that steps up 34 dB, full-scale
+// bursts (a square wave, a sine and a single-sample click) and the quiet tone again. Checks that no output
+// sample passes the -1 dBFS ceiling, that the applied Q16 gain only ever ramps (constant steps within a
+// sub-block, landing on each ramp target to within the step rounding), and that the level settles on the target.
+// With the default 10 ms attack the envelope does most of that on its own, so the script also runs with a
+// slow attack, where the look-ahead limiter has to hold the bursts at the ceiling.
+
+#define TARGET_DBFS   (-18)      // Kconfig defaults and mic_capture.c
+#define MAX_GAIN_DB   30
+#define LIMIT_DBFS    (-1)
+#define GATE_DBFS     (-65)
+#define ATTACK_MS     10
+#define SLOW_ATTACK_MS 500
+#define RELEASE_MS    800
+#define TONE_HZ       440.0
+
+typedef enum {
+    SEG_QUIET,                   // -40 dBFS tone
+    SEG_LOUD,                    // -6 dBFS tone, the step
+    SEG_SQUARE,                  // Full-scale square wave
+    SEG_SINE,                    // Full-scale sine
+    SEG_CLICK,                   // Silence with one full-scale sample
+} seg_kind_t;
+
+typedef struct {
+    seg_kind_t kind;
+    double seconds;
+} seg_t;
+
+static const seg_t s_script[] = {
+    { SEG_QUIET, 2.0 }, { SEG_LOUD, 2.0 }, { SEG_SQUARE, 0.05 }, { SEG_LOUD, 1.0 }, { SEG_SINE, 0.2 },
+    { SEG_CLICK, 0.1 }, { SEG_QUIET, 8.0 },
+};
+
+static int32_t s_sample(seg_kind_t kind, double t, size_t i_in_seg)
+{
+    const double full = 2147483647.0;
+    const double s = sin(2.0 * M_PI * TONE_HZ * t);
+    switch (kind) {
+    case SEG_QUIET:
+        return (int32_t)lrint(full * 0.01 * s);
+    case SEG_LOUD:
+        return (int32_t)lrint(full * 0.5012 * s);
+    case SEG_SQUARE:
+        return (s >= 0.0) ? INT32_MAX : INT32_MIN;
+    case SEG_SINE:
+        return (int32_t)lrint(full * s);
+    case SEG_CLICK:
+        return (i_in_seg == 37) ? INT32_MIN : 0;
+    }
+    return 0;
+}
+
+static double s_dbfs(uint32_t peak)
+{
+    return 20.0 * log10((double)peak / 2147483648.0);
+}
+
+// Runs the script one sample at a time, reading the gain applied to each sample before it goes in.
+static void s_run(uint32_t rate, uint32_t attack_ms)
+{
+    const mic_agc_config_t cfg = {
+        .sample_rate_hz = rate,
+        .target_dbfs = TARGET_DBFS,
+        .max_gain_db = MAX_GAIN_DB,
+        .limit_dbfs = LIMIT_DBFS,
+        .gate_dbfs = GATE_DBFS,
+        .attack_ms = attack_ms,
+        .release_ms = RELEASE_MS,
+    };
+    static mic_agc_t agc;
+    static mic_agc_t agc_block;
+    mic_agc_init(&agc, &cfg);
+    mic_agc_init(&agc_block, &cfg);
+    const uint32_t ceiling = (uint32_t)(2147483647.0 * pow(10.0, LIMIT_DBFS / 20.0));
+
+    uint64_t n = 0;
+    uint32_t prev_gain = agc.gain;
+    int64_t step = 0;
+    int64_t max_delta = 0;
+    uint32_t max_gain = 0;
+    uint32_t out_peak = 0;
+    uint32_t settled_peak[sizeof(s_script) / sizeof(s_script[0])] = {0};
+    int32_t block[MIC_AGC_SUBBLOCK * 3];
+    size_t block_fill = 0;
+    int32_t block_expect[MIC_AGC_SUBBLOCK * 3];
+
+    for (size_t seg = 0; seg < sizeof(s_script) / sizeof(s_script[0]); seg++) {
+        const size_t len = (size_t)(s_script[seg].seconds * rate);
+        for (size_t i = 0; i < len; i++, n++) {
+            const int32_t in = s_sample(s_script[seg].kind, (double)n / rate, i);
+            const uint32_t gain = agc.gain;
+            int32_t v = in;
+            mic_agc_process(&agc, &v, 1, NULL);
+
+            // The same samples in blocks of 96 must come out identical
+            block[block_fill] = in;
+            block_expect[block_fill] = v;
+            if (++block_fill == sizeof(block) / sizeof(block[0])) {
+                mic_agc_process(&agc_block, block, block_fill, NULL);
+                TEST_CHECK(memcmp(block, block_expect, sizeof(block)) == 0);
+                block_fill = 0;
+            }
+
+            // The ceiling, give or take the floor of a negative product
+            const uint32_t mag = (v < 0) ? (uint32_t)(-(int64_t)v) : (uint32_t)v;
+            TEST_CHECK(mag <= ceiling + 1);
+            if (mag > out_peak) {
+                out_peak = mag;
+            }
+            // The last 0.5 s of each segment shows where the level settled
+            if (i + rate / 2 >= len && mag > settled_peak[seg]) {
+                settled_peak[seg] = mag;
+            }
+
+            // Within a sub-block the gain moves by one fixed step per sample; at a boundary it lands on the
+            // target, which the truncated step can miss by less than one step's rounding per sample
+            if (n > 0) {
+                const int64_t delta = (int64_t)gain - prev_gain;
+                if (n % MIC_AGC_SUBBLOCK == 0) {
+                    TEST_CHECK(llabs(delta - step) < MIC_AGC_SUBBLOCK);
+                } else if (n % MIC_AGC_SUBBLOCK != 1) {
+                    TEST_CHECK(delta == step);
+                }
+                if (n % MIC_AGC_SUBBLOCK != 0) {
+                    step = delta;
+                }
+                if (llabs(delta) > max_delta) {
+                    max_delta = llabs(delta);
+                }
+            }
+            if (gain > max_gain) {
+                max_gain = gain;
+            }
+            prev_gain = gain;
+        }
+    }
+
+    // No single-sample jump: the largest change per sample is a ramp's share of the gain range
+    TEST_CHECK(max_delta <= (int64_t)max_gain / MIC_AGC_SUBBLOCK + MIC_AGC_SUBBLOCK);
+    if (attack_ms == SLOW_ATTACK_MS) {
+        // The limiter held the bursts at the ceiling
+        TEST_CHECK(agc.limited_blocks > 0);
+        TEST_CHECK(s_dbfs(out_peak) > LIMIT_DBFS - 0.5);
+    }
+    // The tone ends up near the target before the step, after it, and once the release has run after the bursts
+    TEST_CHECK(fabs(s_dbfs(settled_peak[0]) - TARGET_DBFS) < 1.5);
+    TEST_CHECK(fabs(s_dbfs(settled_peak[1]) - TARGET_DBFS) < 1.5);
+    TEST_CHECK(fabs(s_dbfs(settled_peak[6]) - TARGET_DBFS) < 1.5);
+    printf("%lu Hz, %lu ms attack: peak %.2f dBFS, settled %.1f / %.1f / %.1f dBFS, largest gain change %lld/sample "
+           "(Q16), %lu limited sub-blocks\n", (unsigned long)rate, (unsigned long)attack_ms, s_dbfs(out_peak),
+           s_dbfs(settled_peak[0]), s_dbfs(settled_peak[1]), s_dbfs(settled_peak[6]), (long long)max_delta,
+           (unsigned long)agc.limited_blocks);
+}
+
+int main(void)
+{
+    s_run(16000, ATTACK_MS);
+    s_run(48000, ATTACK_MS);
+    s_run(16000, SLOW_ATTACK_MS);
+    s_run(48000, SLOW_ATTACK_MS);
+    printf("agc: ok\n");
+    return 0;
+}
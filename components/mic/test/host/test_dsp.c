@@ -0,0 +1,222 @@
+#include <math.h>
+#include <stdint.h>
+
+#include "host_test.h"
+#include "mic_agc.h"
+#include "mic_dsp.h"
+
+// Gain kernels against the int64 multiply-and-clip the capture path used before mic_dsp, over the INT32 limits,
+// the clip thresholds of each gain and random samples. The metering gain stages, fixed gain and AGC, must write
+// the same samples as the plain ones and meter every one of them: peak and energy exactly those of the output.
+
+#define RANDOM_SAMPLES 200000
+
+// The original per-sample gain: widen, multiply, clip.
+static int32_t s_ref_gain(int32_t sample, int32_t gain)
+{
+    const int64_t v = (int64_t)sample * gain;
+    if (v > INT32_MAX) {
+        return INT32_MAX;
+    }
+    if (v < INT32_MIN) {
+        return INT32_MIN;
+    }
+    return (int32_t)v;
+}
+
+static uint32_t s_rand_state = 0x12345678;
+
+static uint32_t s_rand(void)
+{
+    s_rand_state ^= s_rand_state << 13;
+    s_rand_state ^= s_rand_state >> 17;
+    s_rand_state ^= s_rand_state << 5;
+    return s_rand_state;
+}
+
+// Meters a block the long way: the largest magnitude and the sum of squares of the top 16 bits.
+static void s_ref_meter(const int32_t *samples, size_t count, int64_t *peak, uint64_t *energy)
+{
+    *peak = 0;
+    *energy = 0;
+    for (size_t i = 0; i < count; i++) {
+        const int64_t mag = llabs((int64_t)samples[i]);
+        *peak = (mag > *peak) ? mag : *peak;
+        *energy += (uint64_t)(((int64_t)samples[i] >> 16) * ((int64_t)samples[i] >> 16));
+    }
+}
+
+// Checks a meter against s_ref_meter() of what the gain stage wrote.
+static void s_check_meter(const mic_meter_t *meter, const int32_t *out, size_t count)
+{
+    int64_t peak;
+    uint64_t energy;
+    s_ref_meter(out, count, &peak, &energy);
+    const int64_t got = (meter->max > -(int64_t)meter->min) ? meter->max : -(int64_t)meter->min;
+    TEST_CHECK(got == peak);
+    TEST_CHECK(meter->energy == energy);
+    TEST_CHECK(meter->count == count);
+}
+
+// Checks both gain entry points, and the metering one, on samples[0..count) against the reference.
+static void s_check_gain(const int32_t *samples, size_t count, int32_t gain)
+{
+    int32_t *a = malloc(count * sizeof(int32_t));
+    int32_t *b = malloc(count * sizeof(int32_t));
+    int32_t *c = malloc(count * sizeof(int32_t));
+    TEST_CHECK(a != NULL && b != NULL && c != NULL);
+    memcpy(a, samples, count * sizeof(int32_t));
+    memcpy(b, samples, count * sizeof(int32_t));
+    memcpy(c, samples, count * sizeof(int32_t));
+    mic_dsp_gain_s32_ansi(a, count, gain);
+    mic_dsp_gain_s32(b, count, gain);
+    mic_meter_t meter = {0};
+    mic_dsp_gain_meter_s32(c, count, gain, &meter);
+    for (size_t i = 0; i < count; i++) {
+        const int32_t want = s_ref_gain(samples[i], gain);
+        if (a[i] != want || b[i] != want || c[i] != want) {
+            fprintf(stderr, "gain %d, sample %d: want %d, ansi %d, dispatch %d, metered %d\n", (int)gain,
+                    (int)samples[i], (int)want, (int)a[i], (int)b[i], (int)c[i]);
+            exit(1);
+        }
+    }
+    // a holds the reference output now
+    s_check_meter(&meter, a, count);
+    free(a);
+    free(b);
+    free(c);
+}
+
+// One full-scale sample anywhere in a block of quiet noise must read as a clip, whichever sign it has: the
+// display shows CLIP after a full-scale sample. A -6 dBFS tone reads 16384 peak and 11585 RMS, -9 dBFS.
+static void s_check_meter_clip(void)
+{
+    int32_t block[960];
+    for (size_t at = 0; at < 960; at++) {
+        for (int sign = 0; sign < 2; sign++) {
+            for (size_t i = 0; i < 960; i++) {
+                block[i] = (int32_t)s_rand() >> 12;
+            }
+            block[at] = sign ? INT32_MIN / 4 : INT32_MAX / 4 + 1;
+            mic_meter_t meter = {0};
+            mic_dsp_gain_meter_s32(block, 960, 4, &meter);
+            TEST_CHECK(mic_meter_peak(&meter) == MIC_METER_FULL_SCALE);
+            meter = (mic_meter_t){0};
+            block[at] = sign ? INT32_MIN : INT32_MAX;
+            mic_dsp_gain_meter_s32(block, 960, 1, &meter);
+            TEST_CHECK(mic_meter_peak(&meter) == MIC_METER_FULL_SCALE);
+        }
+    }
+
+    for (size_t i = 0; i < 960; i++) {
+        block[i] = (int32_t)lrint(1073741824.0 * sin(2 * M_PI * 1000.0 * i / 48000));
+    }
+    mic_meter_t meter = {0};
+    mic_dsp_gain_meter_s32(block, 960, 1, &meter);
+    TEST_CHECK(mic_meter_peak(&meter) == 16384);
+    TEST_CHECK(abs((int)mic_meter_rms(&meter) - 11585) <= 1);
+
+    memset(block, 0, sizeof(block));
+    meter = (mic_meter_t){0};
+    mic_dsp_gain_meter_s32(block, 960, 4, &meter);
+    TEST_CHECK(mic_meter_peak(&meter) == 0 && mic_meter_rms(&meter) == 0);
+}
+
+// The AGC writes the same samples with the meter as without, and the meter holds exactly their level. Blocks of
+// noise at changing levels, loud enough now and then for the limiter.
+static void s_check_agc_meter(void)
+{
+    static const mic_agc_config_t cfg = {
+        .sample_rate_hz = 16000,
+        .target_dbfs = -18,
+        .max_gain_db = 30,
+        .limit_dbfs = -1,
+        .gate_dbfs = -65,
+        .attack_ms = 10,
+        .release_ms = 800,
+    };
+    mic_agc_t plain;
+    mic_agc_t metered;
+    mic_agc_init(&plain, &cfg);
+    mic_agc_init(&metered, &cfg);
+    int32_t a[512];
+    int32_t b[512];
+    for (int blk = 0; blk < 400; blk++) {
+        const int shift = 2 + (blk * 5) % 20;
+        for (size_t i = 0; i < 512; i++) {
+            a[i] = (int32_t)s_rand() >> shift;
+        }
+        memcpy(b, a, sizeof(b));
+        mic_meter_t meter = {0};
+        mic_agc_process(&plain, a, 512, NULL);
+        mic_agc_process(&metered, b, 512, &meter);
+        TEST_CHECK(memcmp(a, b, sizeof(a)) == 0);
+        s_check_meter(&meter, b, 512);
+    }
+}
+
+int main(void)
+{
+    static const int32_t gains[] = { 0, 1, 2, 3, 4, 5, 7, 8, 16, 100, 1000, 65536, 1 << 30, INT32_MAX };
+    int32_t edges[64];
+    int32_t *random = malloc(RANDOM_SAMPLES * sizeof(int32_t));
+    TEST_CHECK(random != NULL);
+    for (size_t i = 0; i < RANDOM_SAMPLES; i++) {
+        // Every magnitude range, not only full-scale values
+        random[i] = (int32_t)s_rand() >> (s_rand() & 31);
+    }
+
+    for (size_t g = 0; g < sizeof(gains) / sizeof(gains[0]); g++) {
+        const int32_t gain = gains[g];
+        size_t n = 0;
+        const int32_t fixed[] = { INT32_MIN, INT32_MIN + 1, -2, -1, 0, 1, 2, INT32_MAX - 1, INT32_MAX };
+        for (size_t i = 0; i < sizeof(fixed) / sizeof(fixed[0]); i++) {
+            edges[n++] = fixed[i];
+        }
+        if (gain > 0) {
+            // The last sample that does not clip and its neighbours, on both sides
+            const int32_t hi = INT32_MAX / gain;
+            const int32_t lo = INT32_MIN / gain;
+            for (int d = -2; d <= 2; d++) {
+                edges[n++] = (int32_t)((int64_t)hi + d <= INT32_MAX ? (int64_t)hi + d : INT32_MAX);
+                edges[n++] = (int32_t)((int64_t)lo + d >= INT32_MIN ? (int64_t)lo + d : INT32_MIN);
+            }
+        }
+        // Odd lengths exercise any vector tail
+        for (size_t len = 1; len <= n; len++) {
+            s_check_gain(edges, len, gain);
+        }
+        s_check_gain(random, RANDOM_SAMPLES, gain);
+        s_check_gain(random + 1, RANDOM_SAMPLES - 3, gain);
+    }
+
+    // Dot product: exact below saturation, saturated like the PIE accumulator readout above it
+    int16_t a[512];
+    int16_t b[512];
+    for (size_t i = 0; i < 512; i++) {
+        a[i] = (int16_t)s_rand();
+        b[i] = (int16_t)s_rand();
+    }
+    int64_t ref = 0;
+    for (size_t i = 0; i < 512; i++) {
+        ref += (int32_t)a[i] * b[i];
+    }
+    TEST_CHECK(mic_dsp_dot_s16(a, b, 512) == (ref > INT32_MAX ? INT32_MAX : ref < INT32_MIN ? INT32_MIN : ref));
+    for (size_t i = 0; i < 512; i++) {
+        a[i] = INT16_MIN;
+        b[i] = INT16_MIN;
+    }
+    TEST_CHECK(mic_dsp_dot_s16(a, b, 512) == INT32_MAX);
+    TEST_CHECK(mic_dsp_dot_s16_ansi(a, b, 1) == (1 << 30));
+    for (size_t i = 0; i < 512; i++) {
+        b[i] = INT16_MAX;
+    }
+    TEST_CHECK(mic_dsp_dot_s16(a, b, 512) == INT32_MIN);
+
+    s_check_meter_clip();
+    s_check_agc_meter();
+
+    free(random);
+    printf("mic_dsp gain, meter and dot product: ok\n");
+    return 0;
+}
@@ -0,0 +1,282 @@
+#include <stdint.h>
+
+#include "flac_enc.h"
+#include "flac_test_dec.h"
+#include "host_test.h"
+#include "test_signal.h"
+
+#if HAVE_LIBFLAC
+#include <FLAC/stream_decoder.h>
+#endif
+
+// Round trip of flac_enc through the reference decoder in flac_test_dec.c, and through libFLAC as well when
+// the build found it: every frame must decode, with valid CRCs, back to the exact input. Each case also checks
+// that the frame kinds it is meant to exercise (fixed orders, constant, verbatim, Rice2) actually occurred.
+
+#define MAX_SAMPLES (20 * 48000)
+#define CHUNK       333    // Feed size, deliberately not a divisor of any block size
+
+typedef struct {
+    flac_test_dec_t dec;
+    int32_t *decoded;
+    size_t decoded_count;
+    uint8_t *stream;       // Frames as written, for the libFLAC pass
+    size_t stream_len;
+} s_sink_t;
+
+// Encoder output callback: decodes each frame as it is produced and keeps its bytes.
+static int s_write(void *arg, const uint8_t *data, size_t len)
+{
+    s_sink_t *sink = arg;
+    int n = flac_test_dec_frame(&sink->dec, data, len, sink->decoded + sink->decoded_count);
+    if (n < 0) {
+        fprintf(stderr, "frame %u rejected: %s\n", (unsigned)sink->dec.next_frame, sink->dec.error);
+        return -1;
+    }
+    sink->decoded_count += (size_t)n;
+    sink->stream = realloc(sink->stream, sink->stream_len + len);
+    TEST_CHECK(sink->stream != NULL);
+    memcpy(sink->stream + sink->stream_len, data, len);
+    sink->stream_len += len;
+    return 0;
+}
+
+#if HAVE_LIBFLAC
+typedef struct {
+    const int32_t *want;
+    size_t count;
+    size_t pos;
+    bool mismatch;
+    bool error;
+} s_libflac_t;
+
+static FLAC__StreamDecoderWriteStatus s_libflac_write(const FLAC__StreamDecoder *d, const FLAC__Frame *frame,
+                                                      const FLAC__int32 *const buffer[], void *arg)
+{
+    (void)d;
+    s_libflac_t *c = arg;
+    for (unsigned i = 0; i < frame->header.blocksize; i++, c->pos++) {
+        if (c->pos >= c->count || buffer[0][i] != c->want[c->pos]) {
+            c->mismatch = true;
+            return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+        }
+    }
+    return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+}
+
+static void s_libflac_error(const FLAC__StreamDecoder *d, FLAC__StreamDecoderErrorStatus status, void *arg)
+{
+    (void)d;
+    fprintf(stderr, "libFLAC: %s\n", FLAC__StreamDecoderErrorStatusString[status]);
+    ((s_libflac_t *)arg)->error = true;
+}
+
+// Wraps the frames in a minimal .flac file and decodes it with libFLAC.
+static void s_check_libflac(const flac_enc_t *enc, const s_sink_t *sink, const int32_t *want, size_t count)
+{
+    char dir[128];
+    char path[192];
+    host_test_tmpdir(dir, sizeof(dir), "flac_enc");
+    snprintf(path, sizeof(path), "%s/test.flac", dir);
+    uint8_t info[FLAC_ENC_STREAMINFO_BYTES];
+    flac_enc_streaminfo(enc, info);
+    FILE *f = fopen(path, "wb");
+    TEST_CHECK(f != NULL);
+    const uint8_t head[8] = { 'f', 'L', 'a', 'C', 0x80, 0, 0, FLAC_ENC_STREAMINFO_BYTES };
+    TEST_CHECK(fwrite(head, 1, sizeof(head), f) == sizeof(head));
+    TEST_CHECK(fwrite(info, 1, sizeof(info), f) == sizeof(info));
+    TEST_CHECK(fwrite(sink->stream, 1, sink->stream_len, f) == sink->stream_len);
+    TEST_CHECK(fclose(f) == 0);
+
+    s_libflac_t c = { .want = want, .count = count };
+    FLAC__StreamDecoder *d = FLAC__stream_decoder_new();
+    TEST_CHECK(d != NULL);
+    TEST_CHECK(FLAC__stream_decoder_init_file(d, path, s_libflac_write, NULL, s_libflac_error, &c) ==
+               FLAC__STREAM_DECODER_INIT_STATUS_OK);
+    TEST_CHECK(FLAC__stream_decoder_process_until_end_of_stream(d));
+    FLAC__stream_decoder_finish(d);
+    FLAC__stream_decoder_delete(d);
+    TEST_CHECK(!c.mismatch && !c.error && c.pos == count);
+    remove(path);
+    remove(dir);
+}
+#endif
+
+// Keeps the last frame written.
+static int s_keep(void *arg, const uint8_t *data, size_t len)
+{
+    s_sink_t *sink = arg;
+    sink->stream = realloc(sink->stream, len);
+    TEST_CHECK(sink->stream != NULL);
+    memcpy(sink->stream, data, len);
+    sink->stream_len = len;
+    return 0;
+}
+
+// The reference decoder must reject a frame with any single bit flipped, or the round trips prove nothing.
+static void s_check_corruption(const int32_t *samples)
+{
+    const flac_enc_config_t cfg = { .sample_rate_hz = 48000, .bits_per_sample = 16, .block_size = 256,
+                                    .max_order = 4, .max_partition_order = 6 };
+    s_sink_t sink = {0};
+    flac_enc_t enc;
+    TEST_CHECK(flac_enc_init(&enc, &cfg, s_keep, &sink) == 0);
+    TEST_CHECK(flac_enc_process(&enc, samples, 256) == 0);
+    int32_t out[256];
+    flac_test_dec_t dec;
+    flac_test_dec_init(&dec, 48000, 16);
+    TEST_CHECK(flac_test_dec_frame(&dec, sink.stream, sink.stream_len, out) == 256);
+    for (size_t bit = 0; bit < sink.stream_len * 8; bit++) {
+        sink.stream[bit / 8] ^= (uint8_t)(0x80 >> (bit % 8));
+        flac_test_dec_init(&dec, 48000, 16);
+        TEST_CHECK(flac_test_dec_frame(&dec, sink.stream, sink.stream_len, out) < 0);
+        sink.stream[bit / 8] ^= (uint8_t)(0x80 >> (bit % 8));
+    }
+    flac_enc_deinit(&enc);
+    free(sink.stream);
+}
+
+// Big-endian bit field of the STREAMINFO body.
+static uint64_t s_info_bits(const uint8_t *info, unsigned first_bit, unsigned nbits)
+{
+    uint64_t v = 0;
+    for (unsigned b = first_bit; b < first_bit + nbits; b++) {
+        v = (v << 1) | ((info[b / 8] >> (7 - b % 8)) & 1);
+    }
+    return v;
+}
+
+// Encodes samples[0..count) with cfg, checks the round trip and STREAMINFO, and returns the decoder's tallies.
+static flac_test_dec_t s_round_trip(const char *name, const flac_enc_config_t *cfg, const int32_t *samples,
+                                    size_t count)
+{
+    s_sink_t sink = {0};
+    flac_test_dec_init(&sink.dec, cfg->sample_rate_hz, cfg->bits_per_sample);
+    sink.decoded = malloc((count + 65536) * sizeof(int32_t));
+    TEST_CHECK(sink.decoded != NULL);
+
+    flac_enc_t enc;
+    TEST_CHECK(flac_enc_init(&enc, cfg, s_write, &sink) == 0);
+    for (size_t i = 0; i < count; i += CHUNK) {
+        TEST_CHECK(flac_enc_process(&enc, samples + i, (count - i < CHUNK) ? count - i : CHUNK) == 0);
+    }
+    TEST_CHECK(flac_enc_finish(&enc) == 0);
+
+    // Exact samples back, right-justified
+    TEST_CHECK(sink.decoded_count == count);
+    int32_t *want = malloc(count * sizeof(int32_t));
+    TEST_CHECK(want != NULL);
+    for (size_t i = 0; i < count; i++) {
+        want[i] = samples[i] >> (32 - cfg->bits_per_sample);
+        if (sink.decoded[i] != want[i]) {
+            fprintf(stderr, "%s: sample %zu decoded as %d, want %d\n", name, i, (int)sink.decoded[i],
+                    (int)want[i]);
+            exit(1);
+        }
+    }
+
+    // The encoder's own bookkeeping agrees with what was decoded
+    const flac_test_dec_t *d = &sink.dec;
+    for (unsigned o = 0; o <= FLAC_ENC_MAX_ORDER; o++) {
+        TEST_CHECK(enc.order_hist[o] == d->fixed[o]);
+    }
+    TEST_CHECK(enc.order_hist[FLAC_ENC_MAX_ORDER + 1] == d->constant);
+    TEST_CHECK(enc.order_hist[FLAC_ENC_MAX_ORDER + 2] == d->verbatim);
+    uint8_t info[FLAC_ENC_STREAMINFO_BYTES];
+    flac_enc_streaminfo(&enc, info);
+    TEST_CHECK(s_info_bits(info, 0, 16) == cfg->block_size);
+    TEST_CHECK(s_info_bits(info, 16, 16) == cfg->block_size);
+    TEST_CHECK(s_info_bits(info, 32, 24) == d->min_frame_bytes);
+    TEST_CHECK(s_info_bits(info, 56, 24) == d->max_frame_bytes);
+    TEST_CHECK(s_info_bits(info, 80, 20) == cfg->sample_rate_hz);
+    TEST_CHECK(s_info_bits(info, 100, 3) == 0);
+    TEST_CHECK(s_info_bits(info, 103, 5) == cfg->bits_per_sample - 1u);
+    TEST_CHECK(s_info_bits(info, 108, 36) == count);
+
+#if HAVE_LIBFLAC
+    s_check_libflac(&enc, &sink, want, count);
+#endif
+    printf("%s: %u frames (fixed %u/%u/%u/%u/%u, constant %u, verbatim %u, rice2 partitions %u), %.3f of PCM\n",
+           name, (unsigned)d->frames, (unsigned)d->fixed[0], (unsigned)d->fixed[1], (unsigned)d->fixed[2],
+           (unsigned)d->fixed[3], (unsigned)d->fixed[4], (unsigned)d->constant, (unsigned)d->verbatim,
+           (unsigned)d->rice2_partitions, (double)sink.stream_len / ((double)count * cfg->bits_per_sample / 8));
+
+    const flac_test_dec_t tallies = sink.dec;
+    flac_enc_deinit(&enc);
+    free(want);
+    free(sink.decoded);
+    free(sink.stream);
+    return tallies;
+}
+
+int main(void)
+{
+    int32_t *x = malloc(MAX_SAMPLES * sizeof(int32_t));
+    TEST_CHECK(x != NULL);
+    test_rng_t rng = { 0x9e3779b9 };
+    flac_test_dec_t d;
+
+    // Speech at both sample sizes, ending in a 3-sample frame; long enough for multi-byte frame numbers
+    flac_enc_config_t cfg = { .sample_rate_hz = 48000, .bits_per_sample = 16, .block_size = 4096,
+                              .max_order = 4, .max_partition_order = 6 };
+    size_t count = 200 * 4096 + 3;
+    test_signal_speech(x, count, 48000, 16, 0, &rng);
+    s_check_corruption(x + 48000);
+    d = s_round_trip("speech 16-bit", &cfg, x, count);
+    TEST_CHECK(d.frames == 201 && d.fixed[1] + d.fixed[2] + d.fixed[3] + d.fixed[4] > 0);
+
+    cfg.bits_per_sample = 24;
+    cfg.sample_rate_hz = 16000;
+    test_signal_speech(x, count, 16000, 24, 0, &rng);
+    d = s_round_trip("speech 24-bit", &cfg, x, count);
+    TEST_CHECK(d.fixed[1] + d.fixed[2] + d.fixed[3] + d.fixed[4] > 0);
+
+    // Odd block size and sample rate (no header rate code), restricted predictor and partition search
+    flac_enc_config_t odd = { .sample_rate_hz = 11025, .bits_per_sample = 16, .block_size = 1153,
+                              .max_order = 2, .max_partition_order = 0 };
+    d = s_round_trip("speech 16-bit, block 1153, order <= 2", &odd, x, 50 * 1153);
+    TEST_CHECK(d.fixed[3] == 0 && d.fixed[4] == 0);
+    odd.max_order = 0;
+    d = s_round_trip("speech 16-bit, block 1153, order 0", &odd, x, 50 * 1153);
+    TEST_CHECK(d.fixed[1] + d.fixed[2] == 0);
+
+    // Silence, a DC offset and a full-scale constant: every frame constant
+    for (unsigned bps = 16; bps <= 24; bps += 8) {
+        cfg.bits_per_sample = (uint8_t)bps;
+        const int32_t levels[] = { 0, -12345 * 256, INT32_MIN, INT32_MAX & ~0xff };
+        for (size_t i = 0; i < 4 * 4096 + 100; i++) {
+            x[i] = levels[(i / 4096) & 3];
+        }
+        d = s_round_trip(bps == 16 ? "constant 16-bit" : "constant 24-bit", &cfg, x, 4 * 4096 + 100);
+        TEST_CHECK(d.constant == d.frames);
+    }
+
+    // Full-scale white noise and a full-scale Nyquist square: nothing beats verbatim
+    for (unsigned bps = 16; bps <= 24; bps += 8) {
+        cfg.bits_per_sample = (uint8_t)bps;
+        for (size_t i = 0; i < 4 * 4096; i++) {
+            x[i] = (i < 2 * 4096) ? (int32_t)test_rng_next(&rng) : ((i & 1) ? INT32_MIN : INT32_MAX);
+        }
+        d = s_round_trip(bps == 16 ? "full-scale noise 16-bit" : "full-scale noise 24-bit", &cfg, x, 4 * 4096);
+        TEST_CHECK(d.verbatim == d.frames);
+    }
+
+    // 24-bit residuals too large for the 4-bit Rice parameter: a slow full-scale sine under 2^17 noise
+    cfg.bits_per_sample = 24;
+    for (size_t i = 0; i < 8 * 4096; i++) {
+        const double s = sin(2 * M_PI * 50.0 * (double)i / 16000) * ((1 << 23) - (1 << 18));
+        x[i] = ((int32_t)lrint(s) + test_rng_signed(&rng, 18)) * 256;
+    }
+    d = s_round_trip("loud 24-bit (Rice2)", &cfg, x, 8 * 4096);
+    TEST_CHECK(d.rice2_partitions > 0 && d.verbatim < d.frames);
+
+    // Short blocks: the 16-sample minimum, and a final frame shorter than the predictor order
+    cfg.bits_per_sample = 16;
+    cfg.block_size = 16;
+    test_signal_speech(x, 16 * 300 + 2, 16000, 16, 12000, &rng);
+    s_round_trip("speech 16-bit, block 16", &cfg, x, 16 * 300 + 2);
+
+    free(x);
+    printf("flac_enc round trip: ok%s\n", HAVE_LIBFLAC ? " (reference decoder and libFLAC)" : " (reference decoder)");
+    return 0;
+}
@@ -0,0 +1,348 @@
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "esp_opus_enc.h"
+#include "esp_random.h"
+#include "host_test.h"
+#include "ogg_mux.h"
+#include "opus_writer.h"
+
+// ogg_mux on its own and under opus_writer, with the encoder stubbed (esp_audio_codec only ships for the chip).
+// The file is parsed back page by page: capture pattern, flags, sequence numbers and CRCs computed here with a
+// table, lacing, OpusHead and OpusTags, and the granule position of every page against the samples it ends on.
+
+#define RATE_HZ          16000
+#define FRAME_SAMPLES    (RATE_HZ / 50)
+#define GRANULE_SCALE    (48000 / RATE_HZ)
+#define PRE_SKIP         312     // Same as opus_writer.c
+#define PAGE_BODY_BYTES  4096    // Same as opus_writer.c
+#define FIXTURE_SAMPLES  (2 * RATE_HZ + 4321)       // Ends partway through a frame
+#define WRITE_SAMPLES    777     // Not a multiple of the frame
+#define BLOCK_BYTES      4096
+#define MAX_PAGES        256
+#define MAX_PACKETS      1024
+
+typedef struct {
+    size_t offset;
+    uint8_t flags;
+    uint64_t granule;
+    uint32_t serial;
+    uint32_t sequence;
+    size_t body_len;
+    size_t first_packet;
+    size_t packets;
+} page_t;
+
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+    size_t page;
+} packet_t;
+
+typedef struct {
+    page_t pages[MAX_PAGES];
+    packet_t packets[MAX_PACKETS];
+    size_t page_count;
+    size_t packet_count;
+} stream_t;
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+} mem_sink_t;
+
+static uint32_t s_crc_table[256];
+static stream_t s_stream;
+
+static uint32_t s_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t s_le16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+// Table-driven Ogg CRC, a different implementation from the bitwise one in ogg_mux.c.
+static void s_crc_init(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t r = i << 24;
+        for (int b = 0; b < 8; b++) {
+            r = (r & 0x80000000u) ? (r << 1) ^ 0x04c11db7u : r << 1;
+        }
+        s_crc_table[i] = r;
+    }
+}
+
+static uint32_t s_crc(uint32_t crc, const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        crc = (crc << 8) ^ s_crc_table[((crc >> 24) ^ data[i]) & 0xff];
+    }
+    return crc;
+}
+
+// Splits a stream into pages and packets, checking what every page must hold regardless of the codec.
+static void s_parse(const uint8_t *data, size_t len, stream_t *st)
+{
+    memset(st, 0, sizeof(*st));
+    size_t pos = 0;
+    while (pos < len) {
+        TEST_CHECK(st->page_count < MAX_PAGES);
+        TEST_CHECK(len - pos >= 27);
+        const uint8_t *h = data + pos;
+        TEST_CHECK(memcmp(h, "OggS", 4) == 0);
+        TEST_CHECK(h[4] == 0);
+        const size_t segments = h[26];
+        TEST_CHECK(len - pos >= 27 + segments);
+        size_t body_len = 0;
+        for (size_t i = 0; i < segments; i++) {
+            body_len += h[27 + i];
+        }
+        const size_t page_len = 27 + segments + body_len;
+        TEST_CHECK(len - pos >= page_len);
+
+        uint8_t header[27 + 255];
+        memcpy(header, h, 27 + segments);
+        memset(header + 22, 0, 4);
+        const uint32_t crc = s_crc(s_crc(0, header, 27 + segments), h + 27 + segments, body_len);
+        TEST_CHECK(crc == s_le32(h + 22));
+
+        page_t *pg = &st->pages[st->page_count];
+        pg->offset = pos;
+        pg->flags = h[5];
+        pg->granule = s_le32(h + 6) | ((uint64_t)s_le32(h + 10) << 32);
+        pg->serial = s_le32(h + 14);
+        pg->sequence = s_le32(h + 18);
+        pg->body_len = body_len;
+        pg->first_packet = st->packet_count;
+        TEST_CHECK(pg->sequence == st->page_count);
+        TEST_CHECK((pg->flags & ~0x07) == 0);
+        // ogg_mux never splits a packet, so nothing continues onto the next page
+        TEST_CHECK((pg->flags & 0x01) == 0);
+        TEST_CHECK(segments == 0 || h[27 + segments - 1] < 255);
+
+        const uint8_t *body = h + 27 + segments;
+        size_t packet_len = 0;
+        for (size_t i = 0; i < segments; i++) {
+            packet_len += h[27 + i];
+            if (h[27 + i] < 255) {
+                TEST_CHECK(st->packet_count < MAX_PACKETS);
+                st->packets[st->packet_count++] = (packet_t) {
+                    .data = body, .len = packet_len, .page = st->page_count
+                };
+                body += packet_len;
+                packet_len = 0;
+            }
+        }
+        pg->packets = st->packet_count - pg->first_packet;
+        st->page_count++;
+        pos += page_len;
+    }
+    TEST_CHECK(st->page_count > 0);
+    // Beginning of stream on the first page only, end of stream on the last only
+    for (size_t i = 0; i < st->page_count; i++) {
+        TEST_CHECK(((st->pages[i].flags & 0x02) != 0) == (i == 0));
+        TEST_CHECK(((st->pages[i].flags & 0x04) != 0) == (i + 1 == st->page_count));
+        TEST_CHECK(st->pages[i].serial == st->pages[0].serial);
+    }
+}
+
+static int s_mem_write(void *arg, const uint8_t *data, size_t len)
+{
+    mem_sink_t *sink = (mem_sink_t *)arg;
+    if (sink->len + len > sink->cap) {
+        sink->cap = (sink->len + len) * 2;
+        sink->data = realloc(sink->data, sink->cap);
+        TEST_CHECK(sink->data != NULL);
+    }
+    memcpy(sink->data + sink->len, data, len);
+    sink->len += len;
+    return 0;
+}
+
+// The CRC here is the Ogg one: CRC-32/CKSUM without its final inversion.
+static void s_test_crc(void)
+{
+    s_crc_init();
+    TEST_CHECK(s_crc(0, (const uint8_t *)"123456789", 9) == (0x765e7680u ^ 0xffffffffu));
+}
+
+// Lacing at the 255-byte edges, a page closed by the 255-segment limit, oversized packets refused, and the
+// empty end-of-stream page.
+static void s_test_mux(void)
+{
+    static uint8_t packet[255 * 2 + 1];
+    for (size_t i = 0; i < sizeof(packet); i++) {
+        packet[i] = (uint8_t)(i * 7 + 3);
+    }
+    const size_t lengths[] = { 0, 1, 254, 255, 256, 510, 511 };
+    const size_t n_lengths = sizeof(lengths) / sizeof(lengths[0]);
+
+    mem_sink_t sink = {0};
+    ogg_mux_t m;
+    TEST_CHECK(ogg_mux_init(&m, 0x1234, 2048, s_mem_write, &sink) == 0);
+    for (size_t i = 0; i < n_lengths; i++) {
+        TEST_CHECK(ogg_mux_packet(&m, packet, lengths[i], 100 + i, false) == 0);
+    }
+    TEST_CHECK(ogg_mux_flush(&m, false) == 0);
+    // 300 one-segment packets: the page closes at 255 segments
+    for (size_t i = 0; i < 300; i++) {
+        TEST_CHECK(ogg_mux_packet(&m, packet, 5, 1000 + i, false) == 0);
+    }
+    // The second flush has nothing pending and writes nothing
+    TEST_CHECK(ogg_mux_flush(&m, false) == 0);
+    TEST_CHECK(ogg_mux_flush(&m, false) == 0);
+    // Longer than the page body
+    static uint8_t big[255 * 255];
+    TEST_CHECK(ogg_mux_packet(&m, big, 2049, 5000, false) != 0);
+    ogg_mux_deinit(&m);
+    // More than 255 lacing values, then exactly 255
+    TEST_CHECK(ogg_mux_init(&m, 0x1234, sizeof(big), s_mem_write, &sink) == 0);
+    m.sequence = 3;
+    TEST_CHECK(ogg_mux_packet(&m, big, sizeof(big), 5000, false) != 0);
+    TEST_CHECK(ogg_mux_packet(&m, big, sizeof(big) - 1, 5000, false) == 0);
+    m.granule = 6000;
+    TEST_CHECK(ogg_mux_flush(&m, false) == 0);
+    // An empty page still goes out when it carries the end of stream
+    TEST_CHECK(ogg_mux_flush(&m, true) == 0);
+    ogg_mux_deinit(&m);
+
+    stream_t *st = &s_stream;
+    s_parse(sink.data, sink.len, st);
+    TEST_CHECK(st->page_count == 5);
+    TEST_CHECK(st->pages[0].packets == n_lengths && st->pages[0].granule == 100 + n_lengths - 1);
+    const uint8_t lacing[] = { 0, 1, 254, 255, 0, 255, 1, 255, 255, 0, 255, 255, 1 };
+    TEST_CHECK(sink.data[26] == sizeof(lacing) && memcmp(sink.data + 27, lacing, sizeof(lacing)) == 0);
+    for (size_t i = 0; i < n_lengths; i++) {
+        TEST_CHECK(st->packets[i].len == lengths[i] && memcmp(st->packets[i].data, packet, lengths[i]) == 0);
+    }
+    TEST_CHECK(st->pages[1].packets == 255 && st->pages[1].granule == 1000 + 254);
+    TEST_CHECK(st->pages[2].packets == 45 && st->pages[2].granule == 1000 + 299);
+    TEST_CHECK(st->pages[3].packets == 1 && st->packets[n_lengths + 300].len == sizeof(big) - 1);
+    TEST_CHECK(st->pages[3].granule == 6000);
+    TEST_CHECK(st->pages[4].packets == 0 && st->pages[4].body_len == 0 && st->pages[4].granule == 6000);
+    free(sink.data);
+}
+
+// Reads a whole file.
+static uint8_t *s_read_file(const char *path, size_t *len)
+{
+    struct stat st;
+    TEST_CHECK(stat(path, &st) == 0);
+    uint8_t *data = malloc((size_t)st.st_size);
+    TEST_CHECK(data != NULL);
+    const int fd = open(path, O_RDONLY);
+    TEST_CHECK(fd >= 0);
+    TEST_CHECK(read(fd, data, (size_t)st.st_size) == st.st_size);
+    close(fd);
+    *len = (size_t)st.st_size;
+    return data;
+}
+
+// A PCM fixture through opus_writer, in blocks that do not line up with the frames, then the file parsed back.
+static void s_test_opus_file(const char *path)
+{
+    static int16_t pcm[FIXTURE_SAMPLES];
+    for (size_t i = 0; i < FIXTURE_SAMPLES; i++) {
+        pcm[i] = (int16_t)lrint(12000.0 * sin(2.0 * M_PI * 440.0 * (double)i / RATE_HZ) + (double)(i % 97));
+    }
+    const opus_writer_config_t cfg = {
+        .sample_rate_hz = RATE_HZ,
+        .bitrate_bps = 24000,
+        .complexity = 5,
+    };
+    opus_writer_t w;
+    TEST_CHECK(opus_writer_open(&w, path, &cfg, BLOCK_BYTES, 1) == ESP_OK);
+    for (size_t done = 0; done < FIXTURE_SAMPLES;) {
+        const size_t n = (FIXTURE_SAMPLES - done < WRITE_SAMPLES) ? FIXTURE_SAMPLES - done : WRITE_SAMPLES;
+        TEST_CHECK(opus_writer_write(&w, pcm + done, n) == ESP_OK);
+        done += n;
+    }
+    const size_t frames = (FIXTURE_SAMPLES + FRAME_SAMPLES - 1) / FRAME_SAMPLES;
+    TEST_CHECK(w.samples == FIXTURE_SAMPLES);
+    const uint64_t data_bytes_before_close = w.data_bytes;
+    TEST_CHECK(opus_writer_close(&w) == ESP_OK);
+    TEST_CHECK(w.frames == frames);
+
+    size_t len = 0;
+    uint8_t *data = s_read_file(path, &len);
+    stream_t *st = &s_stream;
+    s_parse(data, len, st);
+    TEST_CHECK(st->pages[0].serial == HOST_RANDOM_VALUE);
+
+    // OpusHead alone on the first page, OpusTags alone on the second, both at granule 0
+    TEST_CHECK(st->packet_count == 2 + frames);
+    TEST_CHECK(st->pages[0].packets == 1 && st->pages[0].granule == 0);
+    TEST_CHECK(st->pages[1].packets == 1 && st->pages[1].granule == 0);
+    const packet_t *head = &st->packets[0];
+    TEST_CHECK(head->len == 19 && memcmp(head->data, "OpusHead", 8) == 0);
+    TEST_CHECK(head->data[8] == 1);                         // Version
+    TEST_CHECK(head->data[9] == 1);                         // Channels
+    TEST_CHECK(s_le16(head->data + 10) == PRE_SKIP);
+    TEST_CHECK(s_le32(head->data + 12) == RATE_HZ);         // Input rate
+    TEST_CHECK(s_le16(head->data + 16) == 0);               // Output gain
+    TEST_CHECK(head->data[18] == 0);                        // Mapping family
+    const packet_t *tags = &st->packets[1];
+    TEST_CHECK(tags->len >= 16 && memcmp(tags->data, "OpusTags", 8) == 0);
+    const uint32_t vendor_len = s_le32(tags->data + 8);
+    TEST_CHECK(tags->len == 8 + 4 + vendor_len + 4);
+    TEST_CHECK(memcmp(tags->data + 12, "esp_audio_codec", vendor_len) == 0);
+    TEST_CHECK(s_le32(tags->data + 12 + vendor_len) == 0);  // No user comments
+    const size_t header_bytes = st->pages[2].offset;
+
+    // Audio packets in order, each carrying its frame
+    for (size_t k = 0; k < frames; k++) {
+        const packet_t *p = &st->packets[2 + k];
+        TEST_CHECK(p->page >= 2);
+        TEST_CHECK(p->len == host_opus_packet_len((uint32_t)k));
+        TEST_CHECK(p->data[0] == HOST_OPUS_TOC && s_le32(p->data + 1) == k);
+        const size_t pcm_bytes = p->len - 5;
+        for (size_t i = 0; i < pcm_bytes / 2; i++) {
+            const size_t n = k * FRAME_SAMPLES + i;
+            const int16_t expect = (n < FIXTURE_SAMPLES) ? pcm[n] : 0;
+            TEST_CHECK((int16_t)s_le16(p->data + 5 + 2 * i) == expect);
+        }
+    }
+
+    // Each page's granule position is the 48 kHz end of its last frame; the last page ends on the real length
+    for (size_t i = 2; i < st->page_count; i++) {
+        const page_t *pg = &st->pages[i];
+        TEST_CHECK(pg->body_len <= PAGE_BODY_BYTES);
+        if (i + 1 == st->page_count) {
+            TEST_CHECK(pg->granule == PRE_SKIP + (uint64_t)FIXTURE_SAMPLES * GRANULE_SCALE);
+        } else {
+            TEST_CHECK(pg->packets > 0);
+            const size_t last = pg->first_packet + pg->packets - 1 - 2;
+            TEST_CHECK(pg->granule == PRE_SKIP + (uint64_t)(last + 1) * FRAME_SAMPLES * GRANULE_SCALE);
+        }
+        TEST_CHECK(pg->granule >= st->pages[i - 1].granule);
+    }
+    // Several pages, so the page boundaries above were exercised
+    TEST_CHECK(st->page_count >= 6);
+    // data_bytes counts the audio pages written while recording, not the header pages or the one close adds
+    TEST_CHECK(data_bytes_before_close == st->pages[st->page_count - 1].offset - header_bytes);
+    free(data);
+}
+
+int main(void)
+{
+    s_test_crc();
+    s_test_mux();
+
+    char dir[128];
+    char path[256];
+    host_test_tmpdir(dir, sizeof(dir), "ogg_opus");
+    snprintf(path, sizeof(path), "%s/mic_0001.opus", dir);
+    s_test_opus_file(path);
+    unlink(path);
+    rmdir(dir);
+    printf("ogg_mux / opus_writer: ok\n");
+    return 0;
+}
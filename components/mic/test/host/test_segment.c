@@ -0,0 +1,245 @@
+#include <stdint.h>
+#include <unistd.h>
+
+#include "host_test.h"
+#include "mic_segment.h"
+#include "wav_writer.h"
+
+// Splits a recording into WAV segments at a tiny limit, the same way mic_capture's writer drives mic_segment,
+// then reads the files back: the segments must add up to every frame written, each erec chunk must carry the
+// session frame its file starts at, and the audio must continue sample for sample across the cut.
+// Every other next segment is "opened" late, as when the card is slow, so those segments run long.
+// VAD gaps in the first, second and a later segment, one exactly on a cut and one at the very end, must each land
+// in the cue chunk of the segment they fall in, relative to its start.
+
+#define MAX_SEGMENTS 16
+#define MAX_GAPS     5
+
+typedef struct {
+    const char *dir;
+    wav_format_t fmt;
+    size_t frame_bytes;
+    uint32_t session_id;
+    mic_segment_t seg;
+    wav_writer_t slots[2];
+    int cur;
+    bool next_open;
+    char first_path[128];
+    wav_cue_t gaps[MAX_GAPS];
+    size_t gap_count;
+    size_t gaps_seen;            // Gaps the capture task has published so far
+} s_rec_t;
+
+static uint32_t s_get_le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void s_open(s_rec_t *r, int slot, uint32_t segment)
+{
+    char path[160];
+    mic_segment_path(r->first_path, segment, path, sizeof(path));
+    const wav_session_t session = { .id = r->session_id, .segment = segment };
+    TEST_CHECK(wav_writer_open(&r->slots[slot], path, &r->fmt, &session, r->seg.limit_bytes, 512, 0) == ESP_OK);
+}
+
+// s_segment_write() from mic_capture.c, with the segment task's pre-open done inline when ready says so.
+static void s_write(s_rec_t *r, const uint8_t *data, size_t len, bool ready)
+{
+    if (ready && !r->next_open) {
+        s_open(r, r->cur ^ 1, r->seg.segment + 1);
+        r->next_open = true;
+    }
+    while (len > 0) {
+        const size_t n = mic_segment_room(&r->seg, len, r->next_open);
+        if (n > 0) {
+            TEST_CHECK(wav_writer_write(&r->slots[r->cur], data, n) == ESP_OK);
+            data += n;
+            len -= n;
+        }
+        if (mic_segment_wrote(&r->seg, n, r->next_open)) {
+            // s_segment_rotate()
+            size_t first = 0;
+            const size_t cues = mic_segment_cues(&r->seg, r->gaps, r->gaps_seen, false, &first);
+            if (cues > 0) {
+                wav_writer_set_cues(&r->slots[r->cur], r->gaps + first, cues, "gap");
+            }
+            mic_segment_rotate(&r->seg);
+            TEST_CHECK(wav_writer_close(&r->slots[r->cur]) == ESP_OK);
+            r->cur ^= 1;
+            r->slots[r->cur].session.start_frame = r->seg.start_frame;
+            r->next_open = false;
+        }
+    }
+}
+
+// Writes total_frames of a frame counter in chunks of varying size, then checks the segment files.
+static void s_record(const char *dir, const char *name, uint32_t rate, unsigned bytes_per_sample,
+                     uint64_t limit_bytes, uint64_t total_frames)
+{
+    s_rec_t r = {
+        .fmt = { .sample_rate_hz = rate, .bits_per_sample = (uint16_t)(bytes_per_sample * 8), .channels = 1 },
+        .frame_bytes = bytes_per_sample,
+        .session_id = 0x5e5510a0u + bytes_per_sample,
+    };
+    snprintf(r.first_path, sizeof(r.first_path), "%s/%s", dir, name);
+    mic_segment_init(&r.seg, limit_bytes, bytes_per_sample);
+    s_open(&r, 0, 0);
+    // The first segment always ends exactly at the limit
+    const uint64_t limit_frames = limit_bytes / bytes_per_sample;
+    const uint64_t gap_at[MAX_GAPS] = { 50, limit_frames, limit_frames + 100, 2 * limit_frames + 7, total_frames };
+    for (size_t i = 0; i < MAX_GAPS; i++) {
+        r.gaps[i] = (wav_cue_t) { .position = (uint32_t)gap_at[i], .length = 1000 + (uint32_t)i };
+    }
+    r.gap_count = MAX_GAPS;
+
+    uint8_t chunk[3000 * 4];
+    uint64_t frame = 0;
+    unsigned step = 0;
+    while (frame < total_frames) {
+        size_t frames = 700 + (step * 389) % 2300;
+        if (frames > total_frames - frame) {
+            frames = (size_t)(total_frames - frame);
+        }
+        for (size_t i = 0; i < frames; i++) {
+            const uint32_t v = (uint32_t)(frame + i);
+            for (unsigned b = 0; b < bytes_per_sample; b++) {
+                chunk[i * bytes_per_sample + b] = (uint8_t)(v >> (8 * b));
+            }
+        }
+        // For every other segment the next one only gets opened once this one is already full
+        const bool ready = (r.seg.segment % 2 == 0) || r.seg.bytes >= r.seg.limit_bytes;
+        // A gap is published before the audio after it goes out
+        while (r.gaps_seen < r.gap_count && gap_at[r.gaps_seen] < frame + frames) {
+            r.gaps_seen++;
+        }
+        s_write(&r, chunk, frames * bytes_per_sample, ready);
+        frame += frames;
+        step++;
+    }
+    // s_segment_set_cues(true) at the end of the recording
+    size_t first = 0;
+    const size_t last_cues = mic_segment_cues(&r.seg, r.gaps, r.gap_count, true, &first);
+    if (last_cues > 0) {
+        wav_writer_set_cues(&r.slots[r.cur], r.gaps + first, last_cues, "gap");
+    }
+    TEST_CHECK(wav_writer_close(&r.slots[r.cur]) == ESP_OK);
+    if (r.next_open) {
+        char path[160];
+        TEST_CHECK(wav_writer_close(&r.slots[r.cur ^ 1]) == ESP_OK);
+        mic_segment_path(r.first_path, r.seg.segment + 1, path, sizeof(path));
+        TEST_CHECK(unlink(path) == 0);
+    }
+
+    // Read the segments back in order
+    const uint32_t segments = r.seg.segment + 1;
+    TEST_CHECK(segments >= 3 && segments <= MAX_SEGMENTS);
+    uint64_t expect_start = 0;
+    size_t gaps_found = 0;
+    for (uint32_t s = 0; s < segments; s++) {
+        char path[160];
+        mic_segment_path(r.first_path, s, path, sizeof(path));
+        FILE *f = fopen(path, "rb");
+        TEST_CHECK(f != NULL);
+        uint8_t h[WAV_HEADER_BYTES];
+        TEST_CHECK(fread(h, 1, sizeof(h), f) == sizeof(h));
+        size_t off = 12;
+        const uint8_t *erec = NULL;
+        while (off + 8 <= sizeof(h) && erec == NULL) {
+            if (memcmp(h + off, "erec", 4) == 0) {
+                erec = h + off + 8;
+            }
+            off += 8 + s_get_le32(h + off + 4);
+        }
+        TEST_CHECK(erec != NULL);
+        TEST_CHECK(s_get_le32(erec + 4) == 0);                          // Closed
+        TEST_CHECK(s_get_le32(erec + 8) == r.session_id);
+        TEST_CHECK(s_get_le32(erec + 12) == s);
+        const uint64_t start = s_get_le32(erec + 16) | ((uint64_t)s_get_le32(erec + 20) << 32);
+        TEST_CHECK(start == expect_start);
+        TEST_CHECK(memcmp(h + 504, "data", 4) == 0);
+        const uint32_t data_bytes = s_get_le32(h + 508);
+        TEST_CHECK(data_bytes % bytes_per_sample == 0);
+        // Only a late rotation lets a segment pass the limit, and the last one may be short
+        TEST_CHECK(s == segments - 1 || data_bytes >= limit_bytes);
+
+        uint8_t *data = malloc(data_bytes);
+        TEST_CHECK(data != NULL);
+        TEST_CHECK(fread(data, 1, data_bytes, f) == data_bytes);
+        if (data_bytes & 1) {
+            TEST_CHECK(fgetc(f) == 0);
+        }
+
+        // The gaps from start up to the cut, or to the end and past it for the last segment
+        const uint64_t end = start + data_bytes / bytes_per_sample;
+        size_t expect_cues = 0;
+        for (size_t i = 0; i < MAX_GAPS; i++) {
+            if (gap_at[i] >= start && (gap_at[i] < end || (s == segments - 1))) {
+                expect_cues++;
+            }
+        }
+        uint8_t cue[12];
+        if (expect_cues == 0) {
+            TEST_CHECK(fread(cue, 1, sizeof(cue), f) == 0);
+        } else {
+            TEST_CHECK(fread(cue, 1, sizeof(cue), f) == sizeof(cue) && memcmp(cue, "cue ", 4) == 0);
+            TEST_CHECK(s_get_le32(cue + 8) == expect_cues);
+            for (size_t i = 0; i < expect_cues; i++) {
+                uint8_t point[24];
+                TEST_CHECK(fread(point, 1, sizeof(point), f) == sizeof(point));
+                const uint64_t at = gap_at[gaps_found + i];
+                TEST_CHECK(at >= start && at <= end);
+                TEST_CHECK(s_get_le32(point + 4) == at - start);
+                TEST_CHECK(s_get_le32(point + 20) == at - start);
+            }
+            gaps_found += expect_cues;
+        }
+        fclose(f);
+        const uint32_t mask = (bytes_per_sample == 4) ? UINT32_MAX : (1u << (8 * bytes_per_sample)) - 1;
+        for (uint32_t i = 0; i < data_bytes / bytes_per_sample; i++) {
+            uint32_t v = 0;
+            for (unsigned b = 0; b < bytes_per_sample; b++) {
+                v |= (uint32_t)data[i * bytes_per_sample + b] << (8 * b);
+            }
+            TEST_CHECK(v == (uint32_t)((start + i) & mask));
+        }
+        free(data);
+        expect_start += data_bytes / bytes_per_sample;
+        unlink(path);
+    }
+    TEST_CHECK(expect_start == total_frames);
+    TEST_CHECK(gaps_found == MAX_GAPS);
+    TEST_CHECK(r.seg.late > 0);
+    printf("%s: %llu frames in %u segments, %u late rotations\n", name, (unsigned long long)total_frames,
+           (unsigned)segments, (unsigned)r.seg.late);
+}
+
+int main(void)
+{
+    // Limit arithmetic: whichever of the two limits comes first, whole frames, 0 disabling either
+    TEST_CHECK(mic_segment_limit(0, 0, 16000, 2) == MIC_SEGMENT_UNLIMITED);
+    TEST_CHECK(mic_segment_limit(60, 0, 16000, 2) == 60ull * 60 * 16000 * 2);
+    TEST_CHECK(mic_segment_limit(0, 2048, 16000, 2) == 2048ull * 1024 * 1024);
+    TEST_CHECK(mic_segment_limit(0, 1, 16000, 3) == (1024 * 1024 / 3) * 3);
+    TEST_CHECK(mic_segment_limit(1440, 2048, 48000, 4) == 2048ull * 1024 * 1024);
+    TEST_CHECK(mic_segment_limit(1, 2048, 48000, 4) == 60ull * 48000 * 4);
+    TEST_CHECK(mic_segment_limit(1440, 4000, 48000, 4) % 4 == 0);
+
+    char path[64];
+    mic_segment_path("/sdcard/rec/mic_0001.wav", 0, path, sizeof(path));
+    TEST_CHECK(strcmp(path, "/sdcard/rec/mic_0001.wav") == 0);
+    mic_segment_path("/sdcard/rec/mic_0001.wav", 1, path, sizeof(path));
+    TEST_CHECK(strcmp(path, "/sdcard/rec/mic_0001_002.wav") == 0);
+    mic_segment_path("/sdcard/rec.d/mic_0001", 11, path, sizeof(path));
+    TEST_CHECK(strcmp(path, "/sdcard/rec.d/mic_0001_012") == 0);
+
+    char dir[128];
+    host_test_tmpdir(dir, sizeof(dir), "segment");
+    // A 1 MiB size limit at 16-bit, and a one-minute duration limit at 8 kHz in 3-byte frames
+    s_record(dir, "mic_0001.wav", 16000, 2, mic_segment_limit(0, 1, 16000, 2), 1900000);
+    s_record(dir, "mic_0002.wav", 8000, 3, mic_segment_limit(1, 0, 8000, 3), 8000 * 60 * 4 + 1234);
+    s_record(dir, "mic_0003.wav", 8000, 4, mic_segment_limit(1, 1, 8000, 4), 8000 * 60 * 3);
+    TEST_CHECK(rmdir(dir) == 0);
+    printf("segment stitch: ok\n");
+    return 0;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Deterministic test signals in the capture path's format: left-justified 32-bit samples holding bits_per_sample
+// significant bits.
+
+typedef struct {
+    uint32_t state;
+} test_rng_t;
+
+static inline uint32_t test_rng_next(test_rng_t *rng)
+{
+    rng->state ^= rng->state << 13;
+    rng->state ^= rng->state >> 17;
+    rng->state ^= rng->state << 5;
+    return rng->state;
+}
+
+// Uniform value in [-2^(bits-1), 2^(bits-1)).
+static inline int32_t test_rng_signed(test_rng_t *rng, unsigned bits)
+{
+    return (int32_t)test_rng_next(rng) >> (32 - bits);
+}
+
+// Voiced speech stand-in: a gliding 100-220 Hz fundamental with falling harmonics, 4 Hz syllable envelope,
+// short pauses, and a noise floor 60 dB under full scale.
+static inline void test_signal_speech(int32_t *out, size_t count, uint32_t rate, unsigned bps, size_t offset,
+                                      test_rng_t *rng)
+{
+    const double full = (double)((1 << (bps - 1)) - 1);
+    for (size_t i = 0; i < count; i++) {
+        const double t = (double)(offset + i) / rate;
+        const double f0 = 160.0 + 60.0 * sin(2 * M_PI * 0.3 * t);
+        const double phase = 2 * M_PI * (160.0 * t - 60.0 / (2 * M_PI * 0.3) * cos(2 * M_PI * 0.3 * t));
+        const double env = fmax(0.0, sin(2 * M_PI * 4.0 * t)) * (fmod(t, 3.0) < 2.5 ? 1.0 : 0.0);
+        double v = 0.0;
+        for (int h = 1; h <= 6 && h * f0 < rate / 2; h++) {
+            v += sin(h * phase) / h;
+        }
+        v = 0.4 * full * env * v / 2.45 + test_rng_signed(rng, bps - 10);
+        out[i] = (int32_t)lrint(v) * (int32_t)(1u << (32 - bps));
+    }
+}
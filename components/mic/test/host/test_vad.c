@@ -0,0 +1,231 @@
+#include <stdint.h>
+
+#include "host_test.h"
+#include "mic_vad.h"
+#include "test_signal.h"
+
+// Replays a WAV file through mic_vad with the capture path's gating (32 ms blocks, hangover, pre-roll) and
+// reports the fraction of audio kept.
+//   test_vad [file.wav]
+// Without an argument a fixture is generated first: a quiet room with five utterances and a lone fricative at
+// known positions, so the run can also check that every speech block survives and that little else does.
+// Any recording copied off the card can be replayed the same way to tune the MIC_VAD_* options.
+
+#define CHUNK_MS          32    // MIC_CHUNK_MS
+#define THRESHOLD_DBFS    (-55) // Kconfig defaults
+#define HANGOVER_MS       600
+#define PREROLL_MS        300
+
+#define FIXTURE_RATE      16000
+#define FIXTURE_SECONDS   30
+
+typedef struct {
+    double start_s;
+    double end_s;
+} s_span_t;
+
+// Speech in the fixture; the fricative is the short one.
+static const s_span_t s_speech[] = {
+    { 2.0, 4.0 }, { 7.0, 9.5 }, { 12.0, 13.0 }, { 15.0, 15.3 }, { 17.0, 19.0 }, { 22.0, 23.5 },
+};
+#define FRICATIVE_SPAN 3
+
+static void s_put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static void s_put_le32(uint8_t *p, uint32_t v)
+{
+    s_put_le16(p, v & 0xffff);
+    s_put_le16(p + 2, v >> 16);
+}
+
+static uint32_t s_get_le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Writes the fixture as 16-bit mono PCM: a -65 dBFS noise floor, voiced utterances peaking around -12 dBFS
+// with 4 Hz syllables, and a -45 dBFS white-noise fricative.
+static void s_write_fixture(const char *path)
+{
+    const size_t count = (size_t)FIXTURE_RATE * FIXTURE_SECONDS;
+    int16_t *pcm = malloc(count * sizeof(int16_t));
+    TEST_CHECK(pcm != NULL);
+    test_rng_t rng = { 0x5eed1234 };
+    for (size_t i = 0; i < count; i++) {
+        const double t = (double)i / FIXTURE_RATE;
+        double v = test_rng_signed(&rng, 6);
+        for (size_t s = 0; s < sizeof(s_speech) / sizeof(s_speech[0]); s++) {
+            if (t < s_speech[s].start_s || t >= s_speech[s].end_s) {
+                continue;
+            }
+            const double u = t - s_speech[s].start_s;
+            if (s == FRICATIVE_SPAN) {
+                v += test_rng_signed(&rng, 11);
+            } else {
+                const double env = 0.15 + 0.85 * fabs(sin(2 * M_PI * 2.0 * u));
+                const double f0 = 120.0 + 40.0 * (s & 1);
+                for (int h = 1; h <= 6; h++) {
+                    v += 8000.0 * env * sin(2 * M_PI * h * f0 * u) / h;
+                }
+            }
+        }
+        pcm[i] = (int16_t)lrint(fmax(-32768.0, fmin(32767.0, v)));
+    }
+
+    uint8_t h[44];
+    memcpy(h, "RIFF", 4);
+    s_put_le32(h + 4, (uint32_t)(36 + count * 2));
+    memcpy(h + 8, "WAVEfmt ", 8);
+    s_put_le32(h + 16, 16);
+    s_put_le16(h + 20, 1);
+    s_put_le16(h + 22, 1);
+    s_put_le32(h + 24, FIXTURE_RATE);
+    s_put_le32(h + 28, FIXTURE_RATE * 2);
+    s_put_le16(h + 32, 2);
+    s_put_le16(h + 34, 16);
+    memcpy(h + 36, "data", 4);
+    s_put_le32(h + 40, (uint32_t)(count * 2));
+    FILE *f = fopen(path, "wb");
+    TEST_CHECK(f != NULL);
+    TEST_CHECK(fwrite(h, 1, sizeof(h), f) == sizeof(h));
+    TEST_CHECK(fwrite(pcm, sizeof(int16_t), count, f) == count);
+    TEST_CHECK(fclose(f) == 0);
+    free(pcm);
+}
+
+// Loads the first channel of a 16/24/32-bit PCM WAV as left-justified 32-bit samples. Walks the chunk list, so
+// the recorder's own files (JUNK/ds64, erec and cue chunks) load too.
+static int32_t *s_load_wav(const char *path, size_t *count, uint32_t *rate)
+{
+    FILE *f = fopen(path, "rb");
+    TEST_CHECK(f != NULL);
+    uint8_t h[12];
+    TEST_CHECK(fread(h, 1, 12, f) == 12);
+    TEST_CHECK((memcmp(h, "RIFF", 4) == 0 || memcmp(h, "RF64", 4) == 0) && memcmp(h + 8, "WAVE", 4) == 0);
+    unsigned channels = 0;
+    unsigned bits = 0;
+    uint32_t data_bytes = 0;
+    for (;;) {
+        uint8_t c[8];
+        TEST_CHECK(fread(c, 1, 8, f) == 8);
+        const uint32_t size = s_get_le32(c + 4);
+        if (memcmp(c, "fmt ", 4) == 0) {
+            uint8_t fmt[16];
+            TEST_CHECK(size >= 16 && fread(fmt, 1, 16, f) == 16);
+            channels = fmt[2] | (fmt[3] << 8);
+            *rate = s_get_le32(fmt + 4);
+            bits = fmt[14] | (fmt[15] << 8);
+            TEST_CHECK(fseek(f, (long)(size - 16 + (size & 1)), SEEK_CUR) == 0);
+        } else if (memcmp(c, "data", 4) == 0) {
+            data_bytes = size;
+            break;
+        } else {
+            TEST_CHECK(fseek(f, (long)size + (size & 1), SEEK_CUR) == 0);
+        }
+    }
+    TEST_CHECK(channels > 0 && (bits == 16 || bits == 24 || bits == 32));
+    const size_t frame = channels * bits / 8;
+    uint8_t *raw = malloc(data_bytes);
+    TEST_CHECK(raw != NULL);
+    // A size of 0xffffffff (RF64) or one past the end means "the rest of the file"
+    const size_t got = fread(raw, 1, data_bytes, f);
+    fclose(f);
+    *count = got / frame;
+    int32_t *x = malloc(*count * sizeof(int32_t));
+    TEST_CHECK(x != NULL);
+    for (size_t i = 0; i < *count; i++) {
+        const uint8_t *p = raw + i * frame;
+        uint32_t v = 0;
+        for (unsigned b = 0; b < bits / 8; b++) {
+            v |= (uint32_t)p[b] << (32 - bits + 8 * b);
+        }
+        x[i] = (int32_t)v;
+    }
+    free(raw);
+    return x;
+}
+
+// Whether block b of the fixture overlaps speech.
+static bool s_block_is_speech(size_t b, size_t block)
+{
+    const double start = (double)(b * block) / FIXTURE_RATE;
+    const double end = (double)((b + 1) * block) / FIXTURE_RATE;
+    for (size_t s = 0; s < sizeof(s_speech) / sizeof(s_speech[0]); s++) {
+        if (start < s_speech[s].end_s && end > s_speech[s].start_s) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    char dir[128] = "";
+    char path[192];
+    const bool fixture = (argc < 2);
+    if (fixture) {
+        host_test_tmpdir(dir, sizeof(dir), "vad");
+        snprintf(path, sizeof(path), "%s/fixture.wav", dir);
+        s_write_fixture(path);
+    } else {
+        snprintf(path, sizeof(path), "%s", argv[1]);
+    }
+    size_t count = 0;
+    uint32_t rate = 0;
+    int32_t *x = s_load_wav(path, &count, &rate);
+    TEST_CHECK(rate > 0 && count > 0);
+
+    // The same block length and option rounding as mic_capture
+    const size_t block = rate * CHUNK_MS / 1000;
+    const size_t blocks = count / block;
+    const uint32_t hangover = (HANGOVER_MS + CHUNK_MS - 1) / CHUNK_MS;
+    const size_t preroll = (PREROLL_MS + CHUNK_MS - 1) / CHUNK_MS;
+    bool *kept = calloc(blocks + 1, sizeof(bool));
+    TEST_CHECK(kept != NULL);
+    mic_vad_t vad;
+    mic_vad_init(&vad, THRESHOLD_DBFS, hangover);
+    size_t gap = 0;
+    for (size_t b = 0; b < blocks; b++) {
+        if (!mic_vad_process(&vad, x + b * block, block)) {
+            gap++;
+            continue;
+        }
+        // Leaving a gap flushes the pre-roll: the last few skipped blocks are written after all
+        for (size_t p = 1; p <= preroll && p <= gap; p++) {
+            kept[b - p] = true;
+        }
+        gap = 0;
+        kept[b] = true;
+    }
+
+    size_t kept_blocks = 0;
+    size_t speech_blocks = 0;
+    size_t speech_kept = 0;
+    for (size_t b = 0; b < blocks; b++) {
+        kept_blocks += kept[b];
+        if (fixture && s_block_is_speech(b, block)) {
+            speech_blocks++;
+            speech_kept += kept[b];
+        }
+    }
+    printf("%s: %zu blocks of %u ms, kept %zu (%.1f%%), %lu onsets\n", fixture ? "fixture" : path, blocks,
+           CHUNK_MS, kept_blocks, 100.0 * kept_blocks / blocks, (unsigned long)vad.onsets);
+
+    if (fixture) {
+        printf("speech blocks kept: %zu of %zu\n", speech_kept, speech_blocks);
+        // Every speech block survives, and beyond them at most hangover plus pre-roll per utterance
+        const size_t spans = sizeof(s_speech) / sizeof(s_speech[0]);
+        TEST_CHECK(speech_kept == speech_blocks);
+        TEST_CHECK(kept_blocks <= speech_blocks + spans * (hangover + preroll));
+        TEST_CHECK(vad.onsets >= 1 && vad.onsets <= spans);
+        remove(path);
+        remove(dir);
+    }
+    free(kept);
+    free(x);
+    return 0;
+}
@@ -0,0 +1,242 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "host_test.h"
+#include "wav_writer.h"
+
+// Boot-time recovery of WAV files left open by a power loss, including headers too corrupt to repair, and the
+// RF64 header a file takes past 4 GiB, built and recovered with the sizes faked.
+
+#define BLOCK_BYTES 4096
+#define AUDIO_BYTES 4096
+#define DS64        12      // ds64 (or its JUNK placeholder) is the first chunk
+#define GIB         (1024ULL * 1024 * 1024)
+
+static uint32_t s_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t s_le64(const uint8_t *p)
+{
+    return (uint64_t)s_le32(p) | ((uint64_t)s_le32(p + 4) << 32);
+}
+
+static void s_put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+}
+
+static void s_put_le64(uint8_t *p, uint64_t v)
+{
+    s_put_le32(p, (uint32_t)v);
+    s_put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+static void s_read_header(const char *path, uint8_t *h)
+{
+    const int fd = open(path, O_RDONLY);
+    TEST_CHECK(fd >= 0);
+    TEST_CHECK(read(fd, h, WAV_HEADER_BYTES) == WAV_HEADER_BYTES);
+    close(fd);
+}
+
+static void s_write_header(const char *path, const uint8_t *h)
+{
+    const int fd = open(path, O_WRONLY);
+    TEST_CHECK(fd >= 0);
+    TEST_CHECK(pwrite(fd, h, WAV_HEADER_BYTES, 0) == WAV_HEADER_BYTES);
+    close(fd);
+}
+
+static off_t s_file_size(const char *path)
+{
+    struct stat st;
+    TEST_CHECK(stat(path, &st) == 0);
+    return st.st_size;
+}
+
+// Records one second past the first checkpoint, then "loses power": the file is never closed.
+static void s_write_interrupted(const char *path)
+{
+    const wav_format_t fmt = {
+        .sample_rate_hz = 16000,
+        .bits_per_sample = 16,
+        .channels = 1,
+    };
+    static uint8_t audio[1000];
+    for (size_t i = 0; i < sizeof(audio); i++) {
+        audio[i] = (uint8_t)i;
+    }
+    wav_writer_t w;
+    TEST_CHECK(wav_writer_open(&w, path, &fmt, NULL, 60 * 32000, BLOCK_BYTES, 1) == ESP_OK);
+    for (int i = 0; i < 50; i++) {
+        TEST_CHECK(wav_writer_write(&w, audio, sizeof(audio)) == ESP_OK);
+    }
+    close(w.file.fd);
+    free(w.file.block);
+}
+
+// Offset of the recorder state word in the erec chunk.
+static size_t s_rec_state(const uint8_t *h)
+{
+    for (size_t off = 12; off + 16 <= WAV_HEADER_BYTES; off += 2) {
+        if (memcmp(h + off, "erec", 4) == 0) {
+            return off + 12;
+        }
+    }
+    TEST_CHECK(false);
+    return 0;
+}
+
+// Writes AUDIO_BYTES of 16-bit mono audio, then closes as if data_bytes had been written: the header is built
+// for that size while the file holds only the real audio.
+static void s_write_faked(const char *path, uint64_t data_bytes)
+{
+    const wav_format_t fmt = {
+        .sample_rate_hz = 16000,
+        .bits_per_sample = 16,
+        .channels = 1,
+    };
+    static uint8_t audio[AUDIO_BYTES];
+    wav_writer_t w;
+    TEST_CHECK(wav_writer_open(&w, path, &fmt, NULL, AUDIO_BYTES, BLOCK_BYTES, 0) == ESP_OK);
+    TEST_CHECK(wav_writer_write(&w, audio, sizeof(audio)) == ESP_OK);
+    w.data_bytes = data_bytes;
+    TEST_CHECK(wav_writer_close(&w) == ESP_OK);
+    TEST_CHECK(s_file_size(path) == WAV_HEADER_BYTES + AUDIO_BYTES);
+}
+
+// Checks an RF64 header: 32-bit sizes at 0xffffffff, the real ones in ds64.
+static void s_check_rf64(const uint8_t *h, uint64_t data_bytes)
+{
+    TEST_CHECK(memcmp(h, "RF64", 4) == 0 && s_le32(h + 4) == 0xffffffffu && memcmp(h + 8, "WAVE", 4) == 0);
+    TEST_CHECK(memcmp(h + DS64, "ds64", 4) == 0 && s_le32(h + DS64 + 4) == 28);
+    TEST_CHECK(s_le64(h + DS64 + 8) == WAV_HEADER_BYTES - 8 + data_bytes);
+    TEST_CHECK(s_le64(h + DS64 + 16) == data_bytes);
+    TEST_CHECK(s_le64(h + DS64 + 24) == data_bytes / 2);
+    TEST_CHECK(s_le32(h + DS64 + 32) == 0);                  // Empty table
+    TEST_CHECK(memcmp(h + WAV_HEADER_BYTES - 8, "data", 4) == 0);
+    TEST_CHECK(s_le32(h + WAV_HEADER_BYTES - 4) == 0xffffffffu);
+}
+
+// The header turns RF64 exactly when the RIFF size no longer fits in 32 bits, and recovery reads and patches
+// ds64: a size past 2 GiB is kept as checkpointed, a smaller one is trimmed to the file.
+static void s_test_rf64(const char *dir, const char *path)
+{
+    uint8_t h[WAV_HEADER_BYTES];
+
+    // Largest even data size that still fits a 32-bit RIFF size
+    const uint64_t riff_max_data = 0xffffffffULL - (WAV_HEADER_BYTES - 8) - 1;
+    s_write_faked(path, riff_max_data);
+    s_read_header(path, h);
+    TEST_CHECK(memcmp(h, "RIFF", 4) == 0 && s_le32(h + 4) == 0xfffffffeu);
+    TEST_CHECK(memcmp(h + DS64, "JUNK", 4) == 0 && s_le32(h + DS64 + 4) == 28);
+    TEST_CHECK(s_le32(h + WAV_HEADER_BYTES - 4) == (uint32_t)riff_max_data);
+
+    s_write_faked(path, riff_max_data + 2);
+    s_read_header(path, h);
+    s_check_rf64(h, riff_max_data + 2);
+
+    // Recorded past 5 GiB, then power lost: the state goes back to open, as at a checkpoint
+    const uint64_t big = 5 * GIB + AUDIO_BYTES;
+    s_write_faked(path, big);
+    s_read_header(path, h);
+    s_check_rf64(h, big);
+    const size_t state = s_rec_state(h);
+    TEST_CHECK(s_le32(h + state) == 0);
+    s_put_le32(h + state, 1);
+    s_write_header(path, h);
+    TEST_CHECK(wav_writer_recover_dir(dir) == 1);
+    s_read_header(path, h);
+    s_check_rf64(h, big);
+    TEST_CHECK(s_le32(h + s_rec_state(h)) == 0);
+    TEST_CHECK(s_file_size(path) == WAV_HEADER_BYTES + AUDIO_BYTES);
+    TEST_CHECK(wav_writer_recover_dir(dir) == 0);
+
+    // A ds64 size the file does not reach is cut down to the audio actually there
+    s_put_le32(h + s_rec_state(h), 1);
+    s_put_le64(h + DS64 + 16, GIB);
+    s_write_header(path, h);
+    TEST_CHECK(wav_writer_recover_dir(dir) == 1);
+    s_read_header(path, h);
+    s_check_rf64(h, AUDIO_BYTES);
+    TEST_CHECK(s_file_size(path) == WAV_HEADER_BYTES + AUDIO_BYTES);
+}
+
+int main(void)
+{
+    char dir[128];
+    char path[256];
+    uint8_t h[WAV_HEADER_BYTES];
+    host_test_tmpdir(dir, sizeof(dir), "wav_recover");
+    snprintf(path, sizeof(path), "%s/mic_0001.wav", dir);
+
+    // An intact open file is trimmed to its last checkpoint and closed
+    s_write_interrupted(path);
+    TEST_CHECK(s_file_size(path) > WAV_HEADER_BYTES + 50000);
+    TEST_CHECK(wav_writer_recover_dir(dir) == 1);
+    s_read_header(path, h);
+    TEST_CHECK(memcmp(h, "RIFF", 4) == 0);
+    const uint32_t data_bytes = s_le32(h + WAV_HEADER_BYTES - 4);
+    // The checkpoint counts the audio that had reached the card in whole blocks
+    TEST_CHECK(data_bytes > 0 && data_bytes <= 50000 && (WAV_HEADER_BYTES + data_bytes) % BLOCK_BYTES == 0);
+    TEST_CHECK(s_le32(h + 4) == WAV_HEADER_BYTES - 8 + data_bytes);
+    TEST_CHECK(s_file_size(path) == WAV_HEADER_BYTES + (off_t)data_bytes);
+    TEST_CHECK(wav_writer_recover_dir(dir) == 0);
+
+    // Chunk sizes that would wrap the walk back onto itself or behind it, an odd size, and one running off the
+    // sector: recovery must give up on the file instead of looping
+    const uint32_t bad_sizes[] = { 0xfffffff8u, 0xfffffff4u, 0xffffffffu, 0x7fffffffu, 501 };
+    for (size_t i = 0; i < sizeof(bad_sizes) / sizeof(bad_sizes[0]); i++) {
+        s_write_interrupted(path);
+        s_read_header(path, h);
+        s_put_le32(h + 16, bad_sizes[i]);
+        s_write_header(path, h);
+        alarm(5);
+        TEST_CHECK(wav_writer_recover_dir(dir) == 0);
+        alarm(0);
+    }
+
+    // A chunk with an odd size is followed by a pad byte: "odd " (1 byte + pad), fmt, erec, then data at the
+    // end of the sector, as another writer could have laid it out
+    memset(h, 0, sizeof(h));
+    memcpy(h, "RIFF", 4);
+    memcpy(h + 8, "WAVE", 4);
+    memcpy(h + 12, "odd ", 4);
+    s_put_le32(h + 16, 1);
+    memcpy(h + 22, "fmt ", 4);
+    s_put_le32(h + 26, 16);
+    h[30] = 1;                                   // PCM
+    h[32] = 1;                                   // Mono
+    s_put_le32(h + 34, 16000);
+    s_put_le32(h + 38, 32000);
+    h[42] = 2;                                   // Block align
+    h[44] = 16;
+    memcpy(h + 46, "erec", 4);
+    s_put_le32(h + 50, WAV_HEADER_BYTES - 8 - 54);
+    s_put_le32(h + 54, 2);                       // Version
+    s_put_le32(h + 58, 1);                       // Open
+    memcpy(h + WAV_HEADER_BYTES - 8, "data", 4);
+    s_put_le32(h + WAV_HEADER_BYTES - 4, 2000);
+    const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    TEST_CHECK(fd >= 0);
+    TEST_CHECK(write(fd, h, sizeof(h)) == sizeof(h));
+    static const uint8_t audio[3000];
+    TEST_CHECK(write(fd, audio, sizeof(audio)) == sizeof(audio));
+    close(fd);
+    TEST_CHECK(wav_writer_recover_dir(dir) == 1);
+    TEST_CHECK(s_file_size(path) == WAV_HEADER_BYTES + 2000);
+
+    unlink(path);
+    s_test_rf64(dir, path);
+    unlink(path);
+    rmdir(dir);
+    printf("wav_writer recovery: ok\n");
+    return 0;
+}
@@ -0,0 +1,23 @@
+#include <stdio.h>
+#include "unity.h"
+#include "unity_test_runner.h"
+#include "unity_test_utils_memory.h"
+
+/* setUp runs before every test */
+void setUp(void)
+{
+    unity_utils_record_free_mem();
+}
+
+/* tearDown runs after every test */
+void tearDown(void)
+{
+    unity_utils_evaluate_leaks();
+}
+
+void app_main(void)
+{
+    printf("mic DSP kernels: PIE against scalar\n");
+    unity_utils_setup_heap_record(80);
+    unity_run_menu();
+}
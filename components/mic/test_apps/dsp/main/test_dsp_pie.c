@@ -0,0 +1,155 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_cpu.h"
+#include "esp_heap_caps.h"
+#include "unity.h"
+
+#include "mic_dsp.h"
+
+// The PIE kernels in mic_dsp_aes3.S can only be checked on the chip: each dispatching entry point is run on
+// 16-byte aligned buffers, where it takes the vector path, and compared with the portable kernel it replaces.
+
+#define BUF_SAMPLES   1024
+// One 20 ms block at 48 kHz, the size mic_capture processes
+#define BENCH_SAMPLES 960
+#define BENCH_ROUNDS  200
+
+static uint32_t s_rand_state = 0x2545f491;
+
+static uint32_t s_rand(void)
+{
+    s_rand_state ^= s_rand_state << 13;
+    s_rand_state ^= s_rand_state >> 17;
+    s_rand_state ^= s_rand_state << 5;
+    return s_rand_state;
+}
+
+// Random samples over every magnitude, with the INT32 limits and the clip thresholds of gain mixed in.
+static void s_fill(int32_t *samples, size_t count, int32_t gain)
+{
+    const int32_t hi = INT32_MAX / gain;
+    const int32_t lo = INT32_MIN / gain;
+    const int32_t edges[] = { INT32_MIN, INT32_MIN + 1, -1, 0, 1, INT32_MAX - 1, INT32_MAX,
+                              hi - 1, hi, hi + 1, lo - 1, lo, lo + 1 };
+    for (size_t i = 0; i < count; i++) {
+        samples[i] = (int32_t)s_rand() >> (s_rand() & 31);
+    }
+    for (size_t i = 0; i < sizeof(edges) / sizeof(edges[0]) && i < count; i++) {
+        samples[(i * 37) % count] = edges[i];
+    }
+}
+
+TEST_CASE("PIE gain matches the scalar kernel for power-of-two gains", "[dsp]")
+{
+    int32_t *vec = heap_caps_aligned_alloc(16, BUF_SAMPLES * sizeof(int32_t), MALLOC_CAP_DEFAULT);
+    int32_t *ref = heap_caps_aligned_alloc(16, BUF_SAMPLES * sizeof(int32_t), MALLOC_CAP_DEFAULT);
+    TEST_ASSERT_NOT_NULL(vec);
+    TEST_ASSERT_NOT_NULL(ref);
+    // Lengths that leave no tail and each possible scalar tail
+    const size_t lengths[] = { 4, 5, 6, 7, 960, 961, 963, BUF_SAMPLES };
+    for (int shift = 1; shift <= 30; shift++) {
+        const int32_t gain = (int32_t)1 << shift;
+        for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+            const size_t count = lengths[l];
+            s_fill(ref, count, gain);
+            memcpy(vec, ref, count * sizeof(int32_t));
+            mic_dsp_gain_s32(vec, count, gain);
+            mic_dsp_gain_s32_ansi(ref, count, gain);
+            TEST_ASSERT_EQUAL_INT32_ARRAY(ref, vec, count);
+
+            // The metering variant takes the same vector path and must meter every sample of the same output
+            s_fill(ref, count, gain);
+            memcpy(vec, ref, count * sizeof(int32_t));
+            mic_meter_t meter_vec = {0};
+            mic_meter_t meter_ref = {0};
+            mic_dsp_gain_meter_s32(vec, count, gain, &meter_vec);
+            mic_dsp_gain_s32_ansi(ref, count, gain);
+            mic_meter_add_block(&meter_ref, ref, count);
+            TEST_ASSERT_EQUAL_INT32_ARRAY(ref, vec, count);
+            TEST_ASSERT_EQUAL_INT32(meter_ref.max, meter_vec.max);
+            TEST_ASSERT_EQUAL_INT32(meter_ref.min, meter_vec.min);
+            TEST_ASSERT_TRUE(meter_ref.energy == meter_vec.energy);
+            TEST_ASSERT_EQUAL_UINT32(meter_ref.count, meter_vec.count);
+        }
+    }
+    heap_caps_free(vec);
+    heap_caps_free(ref);
+}
+
+TEST_CASE("PIE dot product matches the scalar kernel, saturation included", "[dsp]")
+{
+    int16_t *a = heap_caps_aligned_alloc(16, BUF_SAMPLES * sizeof(int16_t), MALLOC_CAP_DEFAULT);
+    int16_t *b = heap_caps_aligned_alloc(16, BUF_SAMPLES * sizeof(int16_t), MALLOC_CAP_DEFAULT);
+    TEST_ASSERT_NOT_NULL(a);
+    TEST_ASSERT_NOT_NULL(b);
+    for (size_t count = 8; count <= BUF_SAMPLES; count += 8) {
+        for (size_t i = 0; i < count; i++) {
+            // Small values stay exact, full-scale ones drive the accumulator past 32 bits
+            const int shift = (count & 16) ? 0 : 8;
+            a[i] = (int16_t)((int16_t)s_rand() >> shift);
+            b[i] = (int16_t)((int16_t)s_rand() >> shift);
+        }
+        TEST_ASSERT_EQUAL_INT32(mic_dsp_dot_s16_ansi(a, b, count), mic_dsp_dot_s16(a, b, count));
+    }
+    for (size_t i = 0; i < BUF_SAMPLES; i++) {
+        a[i] = INT16_MIN;
+        b[i] = INT16_MIN;
+    }
+    TEST_ASSERT_EQUAL_INT32(INT32_MAX, mic_dsp_dot_s16(a, b, BUF_SAMPLES));
+    for (size_t i = 0; i < BUF_SAMPLES; i++) {
+        b[i] = INT16_MAX;
+    }
+    TEST_ASSERT_EQUAL_INT32(INT32_MIN, mic_dsp_dot_s16(a, b, BUF_SAMPLES));
+    heap_caps_free(a);
+    heap_caps_free(b);
+}
+
+static volatile uint32_t s_sink;
+
+// mic_dsp_gain_meter_s32() in the shape s_cycles_per_sample() times, the level read as the capture task does.
+static void s_gain_metered(int32_t *samples, size_t count, int32_t gain)
+{
+    mic_meter_t meter = {0};
+    mic_dsp_gain_meter_s32(samples, count, gain, &meter);
+    s_sink += mic_meter_peak(&meter) + mic_meter_rms(&meter);
+}
+
+// Average CPU cycles per sample of fn over BENCH_ROUNDS blocks, the source copied back in before each round.
+static uint32_t s_cycles_per_sample(void (*fn)(int32_t *, size_t, int32_t), int32_t *buf, const int32_t *src,
+                                    int32_t gain)
+{
+    uint32_t total = 0;
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        memcpy(buf, src, BENCH_SAMPLES * sizeof(int32_t));
+        const uint32_t start = esp_cpu_get_cycle_count();
+        fn(buf, BENCH_SAMPLES, gain);
+        total += esp_cpu_get_cycle_count() - start;
+    }
+    return (total * 100) / ((uint32_t)BENCH_ROUNDS * BENCH_SAMPLES);
+}
+
+TEST_CASE("Gain cycles per sample, PIE, PIE metered and scalar", "[dsp]")
+{
+    int32_t *buf = heap_caps_aligned_alloc(16, BENCH_SAMPLES * sizeof(int32_t), MALLOC_CAP_INTERNAL);
+    int32_t *src = heap_caps_malloc(BENCH_SAMPLES * sizeof(int32_t), MALLOC_CAP_INTERNAL);
+    TEST_ASSERT_NOT_NULL(buf);
+    TEST_ASSERT_NOT_NULL(src);
+    const int32_t gains[] = { 2, 4, 16 };
+    for (size_t g = 0; g < sizeof(gains) / sizeof(gains[0]); g++) {
+        s_fill(src, BENCH_SAMPLES, gains[g]);
+        const uint32_t pie = s_cycles_per_sample(mic_dsp_gain_s32, buf, src, gains[g]);
+        const uint32_t metered = s_cycles_per_sample(s_gain_metered, buf, src, gains[g]);
+        const uint32_t ansi = s_cycles_per_sample(mic_dsp_gain_s32_ansi, buf, src, gains[g]);
+        printf("gain x%d: PIE %lu.%02lu cycles/sample, metered %lu.%02lu, scalar %lu.%02lu\n", (int)gains[g],
+               (unsigned long)(pie / 100), (unsigned long)(pie % 100),
+               (unsigned long)(metered / 100), (unsigned long)(metered % 100),
+               (unsigned long)(ansi / 100), (unsigned long)(ansi % 100));
+        // The vector path is only worth dispatching to if it beats the loop it replaces
+        TEST_ASSERT_LESS_THAN_UINT32(ansi, pie);
+    }
+    heap_caps_free(buf);
+    heap_caps_free(src);
+}
@@ -0,0 +1,6 @@
+import pytest
+from pytest_embedded_idf.dut import IdfDut
+
+@pytest.mark.esp32s3
+def test_mic_dsp(dut: IdfDut) -> None:
+    dut.run_all_single_board_cases(group=['dsp']) # Run all test cases in the 'dsp' group
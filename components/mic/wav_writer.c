@@ -0,0 +1,370 @@
+#include "wav_writer.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+
+#define WAV_REC_CHUNK_ID       "erec"
+#define WAV_REC_VERSION        2
+#define WAV_REC_STATE_CLOSED   0
+#define WAV_REC_STATE_OPEN     1
+#define WAV_PATH_MAX           300
+#define WAV_FORMAT_PCM         0x0001
+#define WAV_FORMAT_EXTENSIBLE  0xfffe
+#define WAV_CUE_POINT_BYTES    24
+#define WAV_LTXT_BYTES         20
+#define WAV_DS64_BYTES         28      // RIFF size, data size, sample count and an empty table
+#define WAV_SIZE_RF64          0xffffffffu
+
+// KSDATAFORMAT_SUBTYPE_PCM {00000001-0000-0010-8000-00aa00389b71}
+static const uint8_t s_subtype_pcm[16] = {
+    0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00,
+    0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71,
+};
+
+static const char *TAG = "wav";
+
+// Stores a 16-bit little-endian value.
+static void s_put_le16(uint8_t *p, uint16_t value)
+{
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+}
+
+// Stores a 32-bit little-endian value.
+static void s_put_le32(uint8_t *p, uint32_t value)
+{
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = (value >> 24) & 0xff;
+}
+
+// Stores a 64-bit little-endian value.
+static void s_put_le64(uint8_t *p, uint64_t value)
+{
+    s_put_le32(p, (uint32_t)value);
+    s_put_le32(p + 4, (uint32_t)(value >> 32));
+}
+
+// Loads a 16-bit little-endian value.
+static uint16_t s_get_le16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+// Loads a 32-bit little-endian value.
+static uint32_t s_get_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Loads a 64-bit little-endian value.
+static uint64_t s_get_le64(const uint8_t *p)
+{
+    return (uint64_t)s_get_le32(p) | ((uint64_t)s_get_le32(p + 4) << 32);
+}
+
+// Builds the one-sector header: RIFF, ds64 placeholder, fmt, recorder state chunk (padding) and the data chunk
+// header. Past 4 GB the file becomes RF64 and the sizes move into ds64.
+// trailer_bytes covers anything after the audio, including the pad byte of an odd-sized data chunk.
+static void s_build_header(uint8_t *h, const wav_writer_t *w, uint64_t data_bytes, uint32_t trailer_bytes,
+                           bool open)
+{
+    const wav_format_t *fmt = &w->fmt;
+    const uint16_t block_align = fmt->channels * (fmt->bits_per_sample / 8);
+    const uint64_t riff_bytes = WAV_HEADER_BYTES - 8 + data_bytes + trailer_bytes;
+    const bool rf64 = riff_bytes > UINT32_MAX;
+    memset(h, 0, WAV_HEADER_BYTES);
+
+    memcpy(h, rf64 ? "RF64" : "RIFF", 4);
+    s_put_le32(h + 4, rf64 ? WAV_SIZE_RF64 : (uint32_t)riff_bytes);
+    memcpy(h + 8, "WAVE", 4);
+
+    // ds64 must be the first chunk, so it is reserved as JUNK until the file outgrows 32-bit sizes.
+    uint8_t *p = h + 12;
+    memcpy(p, rf64 ? "ds64" : "JUNK", 4);
+    s_put_le32(p + 4, WAV_DS64_BYTES);
+    if (rf64) {
+        s_put_le64(p + 8, riff_bytes);
+        s_put_le64(p + 16, data_bytes);
+        s_put_le64(p + 24, data_bytes / block_align);
+    }
+    p += 8 + WAV_DS64_BYTES;
+
+    // Samples wider than 16 bits need WAVE_FORMAT_EXTENSIBLE to carry the valid bit count.
+    const uint16_t valid_bits = (fmt->valid_bits != 0) ? fmt->valid_bits : fmt->bits_per_sample;
+    const bool extensible = (fmt->bits_per_sample > 16) || (valid_bits != fmt->bits_per_sample);
+    memcpy(p, "fmt ", 4);
+    s_put_le32(p + 4, extensible ? 40 : 16);
+    s_put_le16(p + 8, extensible ? WAV_FORMAT_EXTENSIBLE : WAV_FORMAT_PCM);
+    s_put_le16(p + 10, fmt->channels);
+    s_put_le32(p + 12, fmt->sample_rate_hz);
+    s_put_le32(p + 16, fmt->sample_rate_hz * block_align);
+    s_put_le16(p + 20, block_align);
+    s_put_le16(p + 22, fmt->bits_per_sample);
+    p += 24;
+    if (extensible) {
+        s_put_le16(p, 22);
+        s_put_le16(p + 2, valid_bits);
+        s_put_le32(p + 4, (fmt->channels == 1) ? 0x4 : 0x3);   // Front centre, or front left/right
+        memcpy(p + 8, s_subtype_pcm, sizeof(s_subtype_pcm));
+        p += 24;
+    }
+
+    const uint32_t pad = (uint32_t)((h + WAV_HEADER_BYTES - 8) - (p + 8));
+    memcpy(p, WAV_REC_CHUNK_ID, 4);
+    s_put_le32(p + 4, pad);
+    s_put_le32(p + 8, WAV_REC_VERSION);
+    s_put_le32(p + 12, open ? WAV_REC_STATE_OPEN : WAV_REC_STATE_CLOSED);
+    s_put_le32(p + 16, w->session.id);
+    s_put_le32(p + 20, w->session.segment);
+    s_put_le32(p + 24, (uint32_t)w->session.start_frame);
+    s_put_le32(p + 28, (uint32_t)(w->session.start_frame >> 32));
+    p += 8 + pad;
+
+    memcpy(p, "data", 4);
+    s_put_le32(p + 4, rf64 ? WAV_SIZE_RF64 : (uint32_t)data_bytes);
+}
+
+// Rewrites the header sector with the audio that has reached the card so far.
+static esp_err_t s_checkpoint(wav_writer_t *w)
+{
+    uint8_t header[WAV_HEADER_BYTES];
+    const uint64_t flushed = (w->file.pos > WAV_HEADER_BYTES) ? w->file.pos - WAV_HEADER_BYTES : 0;
+    s_build_header(header, w, flushed, 0, true);
+    esp_err_t ret = rec_file_patch(&w->file, 0, header, sizeof(header));
+    if (ret == ESP_OK && w->file.alloc_bytes == 0) {
+        // Without preallocation the directory entry holds the only record of the file size.
+        fsync(w->file.fd);
+    }
+    return ret;
+}
+
+// Opens a WAV file sized for expected_data_bytes of audio; the sizes are finalized on close.
+esp_err_t wav_writer_open(wav_writer_t *w, const char *path, const wav_format_t *fmt, const wav_session_t *session,
+                          uint64_t expected_data_bytes, size_t block_size, uint32_t checkpoint_s)
+{
+    memset(w, 0, sizeof(*w));
+    w->fmt = *fmt;
+    if (session != NULL) {
+        w->session = *session;
+    }
+    esp_err_t ret = rec_file_open(&w->file, path, WAV_HEADER_BYTES + expected_data_bytes, block_size);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    const uint32_t byte_rate = fmt->sample_rate_hz * fmt->channels * (fmt->bits_per_sample / 8);
+    w->checkpoint_bytes = (uint64_t)byte_rate * checkpoint_s;
+    w->next_checkpoint = w->checkpoint_bytes;
+
+    uint8_t header[WAV_HEADER_BYTES];
+    s_build_header(header, w, 0, 0, true);
+    return rec_file_write(&w->file, header, sizeof(header));
+}
+
+// Appends audio bytes.
+esp_err_t wav_writer_write(wav_writer_t *w, const void *data, size_t len)
+{
+    esp_err_t ret = rec_file_write(&w->file, data, len);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    w->data_bytes += len;
+    if (w->checkpoint_bytes > 0 && w->data_bytes >= w->next_checkpoint) {
+        w->next_checkpoint += w->checkpoint_bytes;
+        return s_checkpoint(w);
+    }
+    return ESP_OK;
+}
+
+// Attaches labelled regions to the recording. The array must stay valid until wav_writer_close().
+void wav_writer_set_cues(wav_writer_t *w, const wav_cue_t *cues, size_t count, const char *label)
+{
+    w->cues = cues;
+    w->cue_count = count;
+    w->cue_label = label;
+}
+
+// Appends the cue chunk and a LIST/adtl chunk with a label and length per cue; returns the bytes written.
+static uint32_t s_write_cues(wav_writer_t *w, esp_err_t *ret)
+{
+    const size_t label_len = strlen(w->cue_label) + 1;
+    const uint32_t labl_size = 4 + (uint32_t)label_len;
+    const uint32_t labl_padded = (labl_size + 1) & ~1u;
+    const uint32_t cue_size = 4 + (uint32_t)w->cue_count * WAV_CUE_POINT_BYTES;
+    const uint32_t list_size = 4 + (uint32_t)w->cue_count * (8 + labl_padded + 8 + WAV_LTXT_BYTES);
+    uint8_t buf[8 + WAV_CUE_POINT_BYTES];
+
+    memcpy(buf, "cue ", 4);
+    s_put_le32(buf + 4, cue_size);
+    s_put_le32(buf + 8, (uint32_t)w->cue_count);
+    *ret = rec_file_write(&w->file, buf, 12);
+    for (size_t i = 0; i < w->cue_count && *ret == ESP_OK; i++) {
+        memset(buf, 0, WAV_CUE_POINT_BYTES);
+        s_put_le32(buf, (uint32_t)i + 1);
+        s_put_le32(buf + 4, w->cues[i].position);
+        memcpy(buf + 8, "data", 4);
+        s_put_le32(buf + 20, w->cues[i].position);
+        *ret = rec_file_write(&w->file, buf, WAV_CUE_POINT_BYTES);
+    }
+
+    memcpy(buf, "LIST", 4);
+    s_put_le32(buf + 4, list_size);
+    memcpy(buf + 8, "adtl", 4);
+    if (*ret == ESP_OK) {
+        *ret = rec_file_write(&w->file, buf, 12);
+    }
+    for (size_t i = 0; i < w->cue_count && *ret == ESP_OK; i++) {
+        const uint8_t zero = 0;
+        memcpy(buf, "labl", 4);
+        s_put_le32(buf + 4, labl_size);
+        s_put_le32(buf + 8, (uint32_t)i + 1);
+        *ret = rec_file_write(&w->file, buf, 12);
+        if (*ret == ESP_OK) {
+            *ret = rec_file_write(&w->file, w->cue_label, label_len);
+        }
+        if (*ret == ESP_OK && labl_padded != labl_size) {
+            *ret = rec_file_write(&w->file, &zero, 1);
+        }
+
+        // ltxt carries the region length, e.g. how much audio a gap stands for.
+        memset(buf, 0, 8 + WAV_LTXT_BYTES);
+        memcpy(buf, "ltxt", 4);
+        s_put_le32(buf + 4, WAV_LTXT_BYTES);
+        s_put_le32(buf + 8, (uint32_t)i + 1);
+        s_put_le32(buf + 12, w->cues[i].length);
+        memcpy(buf + 16, "rgn ", 4);
+        if (*ret == ESP_OK) {
+            *ret = rec_file_write(&w->file, buf, 8 + WAV_LTXT_BYTES);
+        }
+    }
+    return 8 + cue_size + 8 + list_size;
+}
+
+// Writes the final RIFF/data sizes and closes the file.
+esp_err_t wav_writer_close(wav_writer_t *w)
+{
+    esp_err_t ret = ESP_OK;
+    uint32_t trailer_bytes = 0;
+    if (w->data_bytes & 1) {
+        // RIFF chunks are word aligned; odd-sized packed 24-bit audio needs a pad byte.
+        const uint8_t pad = 0;
+        ret = rec_file_write(&w->file, &pad, 1);
+        trailer_bytes = 1;
+    }
+    if (ret == ESP_OK && w->cue_count > 0) {
+        trailer_bytes += s_write_cues(w, &ret);
+    }
+    uint8_t header[WAV_HEADER_BYTES];
+    s_build_header(header, w, w->data_bytes, trailer_bytes, false);
+    esp_err_t patch_ret = rec_file_patch(&w->file, 0, header, sizeof(header));
+    if (ret == ESP_OK) {
+        ret = patch_ret;
+    }
+    esp_err_t close_ret = rec_file_close(&w->file);
+    return (ret != ESP_OK) ? ret : close_ret;
+}
+
+// Finds a chunk in the header sector whose first min_body bytes are in the sector too; returns its offset or -1.
+// The header may be corrupt or half written, so every chunk size is checked before stepping over it.
+static int s_find_chunk(const uint8_t *h, const char *id, size_t min_body)
+{
+    size_t off = 12;
+    while (off + 8 <= WAV_HEADER_BYTES) {
+        if (memcmp(h + off, id, 4) == 0) {
+            return (off + 8 + min_body <= WAV_HEADER_BYTES) ? (int)off : -1;
+        }
+        // Chunk bodies are padded to an even size
+        const uint64_t size = s_get_le32(h + off + 4) + (uint64_t)(s_get_le32(h + off + 4) & 1);
+        if (size > WAV_HEADER_BYTES - off - 8) {
+            break;
+        }
+        off += 8 + (size_t)size;
+    }
+    return -1;
+}
+
+// Repairs a file left open by a power loss: trims the unused preallocation and closes the header.
+static bool s_recover_file(const char *path)
+{
+    uint8_t h[WAV_HEADER_BYTES];
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        return false;
+    }
+    bool repaired = false;
+    struct stat st;
+    if (read(fd, h, sizeof(h)) != sizeof(h) || fstat(fd, &st) != 0 ||
+            (memcmp(h, "RIFF", 4) != 0 && memcmp(h, "RF64", 4) != 0) || memcmp(h + 8, "WAVE", 4) != 0) {
+        goto done;
+    }
+    const int rec = s_find_chunk(h, WAV_REC_CHUNK_ID, 8);
+    const int fmt = s_find_chunk(h, "fmt ", 14);
+    const int data = s_find_chunk(h, "data", 0);
+    const int ds64 = s_find_chunk(h, "ds64", 24);
+    if (rec < 0 || fmt < 0 || data < 0 || s_get_le32(h + rec + 12) != WAV_REC_STATE_OPEN) {
+        goto done;
+    }
+
+    const uint32_t data_start = (uint32_t)data + 8;
+    uint64_t data_bytes = (ds64 >= 0) ? s_get_le64(h + ds64 + 16) : s_get_le32(h + data + 4);
+    // st_size and ftruncate() take a 32-bit off_t, so a file past 2 GB keeps its checkpointed size and tail.
+    const bool trim = (data_start + data_bytes <= INT32_MAX) && (st.st_size >= 0);
+    if (trim && data_start + data_bytes > (uint64_t)st.st_size) {
+        data_bytes = (st.st_size > data_start) ? (uint64_t)(st.st_size - data_start) : 0;
+    }
+    if (ds64 >= 0) {
+        const uint16_t block_align = s_get_le16(h + fmt + 20);
+        s_put_le64(h + ds64 + 8, data_start - 8 + data_bytes);
+        s_put_le64(h + ds64 + 16, data_bytes);
+        s_put_le64(h + ds64 + 24, (block_align > 0) ? data_bytes / block_align : 0);
+    } else {
+        s_put_le32(h + 4, data_start - 8 + (uint32_t)data_bytes);
+        s_put_le32(h + data + 4, (uint32_t)data_bytes);
+    }
+    s_put_le32(h + rec + 12, WAV_REC_STATE_CLOSED);
+    if ((trim && ftruncate(fd, (off_t)(data_start + data_bytes)) != 0) ||
+            pwrite(fd, h, sizeof(h), 0) != sizeof(h)) {
+        ESP_LOGW(TAG, "Repair of %s failed (%d)", path, errno);
+        goto done;
+    }
+    fsync(fd);
+    repaired = true;
+    ESP_LOGW(TAG, "Recovered %s: %llu audio bytes", path, (unsigned long long)data_bytes);
+done:
+    close(fd);
+    return repaired;
+}
+
+// Boot-time scan: repairs every recording in dir that was never closed. Returns the number repaired.
+int wav_writer_recover_dir(const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        return 0;
+    }
+    int repaired = 0;
+    char path[WAV_PATH_MAX];
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        const char *dot = strrchr(entry->d_name, '.');
+        if (dot == NULL || strcasecmp(dot, ".wav") != 0) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        if (s_recover_file(path)) {
+            repaired++;
+        }
+    }
+    closedir(d);
+    return repaired;
+}
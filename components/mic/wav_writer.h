@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "rec_file.h"
+
+// The header fills exactly one sector so the audio that follows is sector aligned.
+#define WAV_HEADER_BYTES 512
+
+typedef struct {
+    uint32_t sample_rate_hz;
+    uint16_t bits_per_sample;    // Container size: 16, 24 or 32
+    uint16_t valid_bits;         // Significant bits, 0 for all of them
+    uint16_t channels;
+} wav_format_t;
+
+// A marked region of the audio, in sample frames from the start of the data chunk.
+typedef struct {
+    uint32_t position;
+    uint32_t length;
+} wav_cue_t;
+
+// Where a file sits in a recording that was split into segments.
+typedef struct {
+    uint32_t id;                 // Shared by every segment of one recording session
+    uint32_t segment;            // 0 for the first file
+    uint64_t start_frame;        // Frames of the session that precede this file
+} wav_session_t;
+
+typedef struct {
+    rec_file_t file;
+    wav_format_t fmt;
+    wav_session_t session;       // Stored in the recorder state chunk; may be updated until close
+    uint64_t data_bytes;
+    uint64_t checkpoint_bytes;   // Audio between header checkpoints, 0 to disable
+    uint64_t next_checkpoint;
+    const wav_cue_t *cues;       // Written as cue/labl/ltxt chunks after the audio on close
+    size_t cue_count;
+    const char *cue_label;
+} wav_writer_t;
+
+esp_err_t wav_writer_open(wav_writer_t *w, const char *path, const wav_format_t *fmt, const wav_session_t *session,
+                          uint64_t expected_data_bytes, size_t block_size, uint32_t checkpoint_s);
+esp_err_t wav_writer_write(wav_writer_t *w, const void *data, size_t len);
+void wav_writer_set_cues(wav_writer_t *w, const wav_cue_t *cues, size_t count, const char *label);
+esp_err_t wav_writer_close(wav_writer_t *w);
+int wav_writer_recover_dir(const char *dir);
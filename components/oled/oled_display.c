@@ -0,0 +1,322 @@
+#include "oled_display.h"
+
+#include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "oled_glyphs.h"
+#include "oled_ssd1306.h"
+
+#define DISPLAY_SLOTS 4             // Latest post, the one being drawn, and one per poster writing at the same time
+#define DISPLAY_SLOT_NONE -1
+#define DISPLAY_TASK_STACK 3072
+#define DISPLAY_TASK_PRIO 2         // Below the capture and USB tasks; the panel can wait
+#define DISPLAY_TEXT_COLS (OLED_GFX_WIDTH / 6)
+
+// Recording screen: status icon left of the clock, status line on the bottom page
+#define DISPLAY_ICON_X 0
+#define DISPLAY_ICON_Y 8
+#define DISPLAY_CLOCK_X 12
+#define DISPLAY_STATUS_Y 24
+
+// Level meter in place of the status line while a meter source is set: RMS bar with a peak-hold marker, CLIP flag
+#define DISPLAY_METER_MS 50                 // Meter refresh period
+#define DISPLAY_METER_W 100
+#define DISPLAY_CLIP_X 104
+#define DISPLAY_LEVEL_FULL_SCALE 32767      // Meter units; a peak at full scale means the input clipped
+#define DISPLAY_METER_FLOOR_DB_X10 (-600)   // Left end of the bar, -60 dBFS
+#define DISPLAY_PEAK_HOLD_MS 1500
+#define DISPLAY_PEAK_FALL_DB_X10 15         // Per refresh once the hold has expired, 30 dB/s
+#define DISPLAY_CLIP_HOLD_MS 2000
+
+static const char *TAG = "oled_display";
+
+typedef enum {
+    DISPLAY_MSG_TEXT,
+    DISPLAY_MSG_RECORDING,
+} display_msg_kind_t;
+
+typedef struct {
+    display_msg_kind_t kind;
+    uint32_t seconds;           // DISPLAY_MSG_RECORDING
+    bool paused;
+    char text[OLED_DISPLAY_TEXT_MAX];   // DISPLAY_MSG_TEXT
+} display_msg_t;
+
+static display_msg_t s_slots[DISPLAY_SLOTS];
+static atomic_uint s_free = (1u << DISPLAY_SLOTS) - 1;     // Bit n set while slot n is unused
+static atomic_int s_latest = DISPLAY_SLOT_NONE;            // Slot holding the newest undrawn message
+static TaskHandle_t s_task;
+static atomic_uint s_posted;
+static atomic_uint s_replaced;
+static atomic_uint s_dropped;
+static atomic_uint s_post_max_us;
+static atomic_uint s_drawn;
+static atomic_uint s_render_max_us;
+static oled_gfx_t s_gfx;                                    // Owned by the display task
+static _Atomic(oled_display_meter_fn_t) s_meter;
+// Display task state for the meter
+static bool s_recording_screen;
+static int s_hold_db_x10 = DISPLAY_METER_FLOOR_DB_X10;
+static int64_t s_hold_until_us;
+static int64_t s_clip_until_us;
+
+// Takes an unused slot, DISPLAY_SLOT_NONE if all are in use.
+static int s_claim_slot(void)
+{
+    unsigned int free_mask = atomic_load(&s_free);
+    while (free_mask != 0) {
+        const int slot = __builtin_ctz(free_mask);
+        if (atomic_compare_exchange_weak(&s_free, &free_mask, free_mask & ~(1u << slot))) {
+            return slot;
+        }
+    }
+    return DISPLAY_SLOT_NONE;
+}
+
+// Returns a slot to the unused set.
+static void s_release_slot(int slot)
+{
+    atomic_fetch_or(&s_free, 1u << slot);
+}
+
+// Raises *max to value if it is larger.
+static void s_update_max(atomic_uint *max, unsigned int value)
+{
+    unsigned int current = atomic_load(max);
+    while (value > current && !atomic_compare_exchange_weak(max, &current, value)) {
+    }
+}
+
+// Draws text (with newlines) in the small font, one line per page, wrapping long lines.
+static void s_draw_text(const char *text)
+{
+    const char *p = text;
+    for (int page = 0; page < OLED_GFX_PAGES; page++) {
+        char line[DISPLAY_TEXT_COLS + 1];
+        size_t len = 0;
+        while (*p != '\0' && *p != '\n' && len < DISPLAY_TEXT_COLS) {
+            line[len++] = *p++;
+        }
+        if (*p == '\n') {
+            p++;
+        }
+        line[len] = '\0';
+        oled_gfx_text(&s_gfx, &oled_font_small, 0, page * 8, OLED_GFX_WIDTH, line);
+    }
+}
+
+// Converts a meter level to tenths of a dBFS, clamped to the bottom of the bar.
+static int s_level_db_x10(uint16_t level)
+{
+    if (level == 0) {
+        return DISPLAY_METER_FLOOR_DB_X10;
+    }
+    const int db_x10 = (int)lroundf(200.0f * log10f((float)level / DISPLAY_LEVEL_FULL_SCALE));
+    return (db_x10 < DISPLAY_METER_FLOOR_DB_X10) ? DISPLAY_METER_FLOOR_DB_X10 : db_x10;
+}
+
+// Samples the meter source and redraws the level bar, its peak-hold marker and the CLIP flag. The caller loads the
+// source once and passes it, so oled_display_set_meter(NULL) in between cannot leave a NULL to call.
+static void s_draw_meter(oled_display_meter_fn_t read)
+{
+    uint16_t peak = 0;
+    uint16_t rms = 0;
+    read(&peak, &rms);
+    const int64_t now_us = esp_timer_get_time();
+
+    const int peak_db_x10 = s_level_db_x10(peak);
+    if (peak_db_x10 >= s_hold_db_x10) {
+        s_hold_db_x10 = peak_db_x10;
+        s_hold_until_us = now_us + DISPLAY_PEAK_HOLD_MS * 1000LL;
+    } else if (now_us >= s_hold_until_us) {
+        s_hold_db_x10 -= DISPLAY_PEAK_FALL_DB_X10;
+        if (s_hold_db_x10 < peak_db_x10) {
+            s_hold_db_x10 = peak_db_x10;
+        }
+    }
+    if (peak >= DISPLAY_LEVEL_FULL_SCALE) {
+        s_clip_until_us = now_us + DISPLAY_CLIP_HOLD_MS * 1000LL;
+    }
+
+    oled_gfx_bar(&s_gfx, 0, DISPLAY_STATUS_Y, DISPLAY_METER_W, 8, s_level_db_x10(rms) - DISPLAY_METER_FLOOR_DB_X10,
+                 s_hold_db_x10 - DISPLAY_METER_FLOOR_DB_X10, -DISPLAY_METER_FLOOR_DB_X10);
+    oled_gfx_fill(&s_gfx, DISPLAY_METER_W, DISPLAY_STATUS_Y, DISPLAY_CLIP_X - DISPLAY_METER_W, 8, false);
+    oled_gfx_text(&s_gfx, &oled_font_small, DISPLAY_CLIP_X, DISPLAY_STATUS_Y, OLED_GFX_WIDTH - DISPLAY_CLIP_X,
+                  (now_us < s_clip_until_us) ? "CLIP" : "");
+}
+
+// Draws the recording screen: record or pause icon, elapsed time in the clock digits, and the level meter, or the
+// status line when there is no meter source.
+static void s_draw_recording(uint32_t seconds, bool paused)
+{
+    char clock[16];
+    snprintf(clock, sizeof(clock), "%02lu:%02lu:%02lu", (unsigned long)(seconds / 3600),
+             (unsigned long)((seconds % 3600) / 60), (unsigned long)(seconds % 60));
+    const oled_icon_t *icon = paused ? &oled_icon_pause : &oled_icon_record;
+    const int icon_bottom = DISPLAY_ICON_Y + icon->pages * 8;
+    const int icon_right = DISPLAY_ICON_X + icon->width;
+    // Blank around the icon rather than under it, so an unchanged icon leaves nothing to flush
+    oled_gfx_fill(&s_gfx, DISPLAY_ICON_X, 0, DISPLAY_CLOCK_X - DISPLAY_ICON_X, DISPLAY_ICON_Y, false);
+    oled_gfx_fill(&s_gfx, icon_right, DISPLAY_ICON_Y, DISPLAY_CLOCK_X - icon_right, icon_bottom - DISPLAY_ICON_Y, false);
+    oled_gfx_fill(&s_gfx, DISPLAY_ICON_X, icon_bottom, DISPLAY_CLOCK_X - DISPLAY_ICON_X, DISPLAY_STATUS_Y - icon_bottom,
+                  false);
+    oled_gfx_icon(&s_gfx, icon, DISPLAY_ICON_X, DISPLAY_ICON_Y);
+    oled_gfx_text(&s_gfx, &oled_font_large, DISPLAY_CLOCK_X, 0, OLED_GFX_WIDTH - DISPLAY_CLOCK_X, clock);
+    if (!s_recording_screen) {
+        s_hold_db_x10 = DISPLAY_METER_FLOOR_DB_X10;
+        s_clip_until_us = 0;
+    }
+    const oled_display_meter_fn_t read = atomic_load(&s_meter);
+    if (read == NULL) {
+        oled_gfx_text(&s_gfx, &oled_font_small, 0, DISPLAY_STATUS_Y, OLED_GFX_WIDTH, paused ? "Paused" : "Recording");
+        return;
+    }
+    s_draw_meter(read);
+}
+
+// Owns the OLED: initializes it off the boot path, then draws the latest posted message.
+static void s_display_task(void *arg)
+{
+    (void)arg;
+    display_msg_t msg;
+    const bool ready = (oled_ssd1306_init() == ESP_OK);
+    if (!ready) {
+        ESP_LOGE(TAG, "OLED init failed, posts are discarded");
+    }
+    // Panel RAM is undefined at power-up
+    oled_gfx_init(&s_gfx);
+    if (ready) {
+        oled_ssd1306_flush(&s_gfx);
+    }
+
+    while (true) {
+        // Checked before waiting, so a post made before the task started is drawn too
+        const int slot = atomic_exchange(&s_latest, DISPLAY_SLOT_NONE);
+        if (slot == DISPLAY_SLOT_NONE) {
+            // The recording screen refreshes its meter between posts
+            const bool metering = ready && s_recording_screen && atomic_load(&s_meter) != NULL;
+            if (ulTaskNotifyTake(pdTRUE, metering ? pdMS_TO_TICKS(DISPLAY_METER_MS) : portMAX_DELAY) == 0 &&
+                    metering) {
+                // The source may have been cleared while waiting
+                const oled_display_meter_fn_t read = atomic_load(&s_meter);
+                if (read != NULL) {
+                    const int64_t start_us = esp_timer_get_time();
+                    s_draw_meter(read);
+                    s_update_max(&s_render_max_us, (unsigned int)(esp_timer_get_time() - start_us));
+                    oled_ssd1306_flush(&s_gfx);
+                }
+            }
+            continue;
+        }
+        memcpy(&msg, &s_slots[slot], sizeof(msg));
+        s_release_slot(slot);
+        if (!ready) {
+            continue;
+        }
+
+        const int64_t start_us = esp_timer_get_time();
+        if (msg.kind == DISPLAY_MSG_RECORDING) {
+            s_draw_recording(msg.seconds, msg.paused);
+        } else {
+            s_draw_text(msg.text);
+        }
+        s_recording_screen = (msg.kind == DISPLAY_MSG_RECORDING);
+        s_update_max(&s_render_max_us, (unsigned int)(esp_timer_get_time() - start_us));
+        oled_ssd1306_flush(&s_gfx);
+        atomic_fetch_add(&s_drawn, 1);
+    }
+}
+
+// Starts the display service task.
+esp_err_t oled_display_start(void)
+{
+    if (s_task != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (xTaskCreate(s_display_task, "oled_display", DISPLAY_TASK_STACK, NULL, DISPLAY_TASK_PRIO, &s_task) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+// Takes a slot for a new message, NULL if every slot is in use.
+static display_msg_t *s_post_begin(int *slot)
+{
+    atomic_fetch_add(&s_posted, 1);
+    *slot = s_claim_slot();
+    if (*slot == DISPLAY_SLOT_NONE) {
+        atomic_fetch_add(&s_dropped, 1);
+        return NULL;
+    }
+    return &s_slots[*slot];
+}
+
+// Publishes a filled slot as the latest message, freeing the one it replaces, and wakes the display task.
+static void s_post_end(int slot, int64_t start_us)
+{
+    const int previous = atomic_exchange(&s_latest, slot);
+    if (previous != DISPLAY_SLOT_NONE) {
+        s_release_slot(previous);
+        atomic_fetch_add(&s_replaced, 1);
+    }
+    if (s_task != NULL) {
+        xTaskNotifyGive(s_task);
+    }
+    s_update_max(&s_post_max_us, (unsigned int)(esp_timer_get_time() - start_us));
+}
+
+// Posts text (with newlines) to show; never waits for the panel or the I2C bus.
+void oled_display_post(const char *text)
+{
+    const int64_t start_us = esp_timer_get_time();
+    int slot;
+    display_msg_t *msg = s_post_begin(&slot);
+    if (msg == NULL) {
+        return;
+    }
+    msg->kind = DISPLAY_MSG_TEXT;
+    snprintf(msg->text, sizeof(msg->text), "%s", text);
+    s_post_end(slot, start_us);
+}
+
+// Posts the recording screen for the given elapsed time; never waits for the panel or the I2C bus.
+void oled_display_post_recording(uint32_t seconds, bool paused)
+{
+    const int64_t start_us = esp_timer_get_time();
+    int slot;
+    display_msg_t *msg = s_post_begin(&slot);
+    if (msg == NULL) {
+        return;
+    }
+    msg->kind = DISPLAY_MSG_RECORDING;
+    msg->seconds = seconds;
+    msg->paused = paused;
+    s_post_end(slot, start_us);
+}
+
+// Sets the level source the recording screen samples every DISPLAY_METER_MS, from the display task.
+void oled_display_set_meter(oled_display_meter_fn_t read)
+{
+    atomic_store(&s_meter, read);
+    if (s_task != NULL) {
+        xTaskNotifyGive(s_task);
+    }
+}
+
+// Returns the mailbox counters since boot.
+void oled_display_get_stats(oled_display_stats_t *stats)
+{
+    stats->posted = atomic_load(&s_posted);
+    stats->drawn = atomic_load(&s_drawn);
+    stats->replaced = atomic_load(&s_replaced);
+    stats->dropped = atomic_load(&s_dropped);
+    stats->post_max_us = atomic_load(&s_post_max_us);
+    stats->render_max_us = atomic_load(&s_render_max_us);
+}
@@ -0,0 +1,33 @@
+#ifndef OLED_DISPLAY_H
+#define OLED_DISPLAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// Display service: one task owns the OLED and the I2C bus. Other tasks post what to show and return at once;
+// a post that arrives before the previous one was drawn replaces it, so only the latest one reaches the panel.
+
+#define OLED_DISPLAY_TEXT_MAX 64
+
+typedef struct {
+    uint32_t posted;        // Messages posted
+    uint32_t drawn;         // Messages the service drew
+    uint32_t replaced;      // Messages replaced by a newer post before they were drawn
+    uint32_t dropped;       // Posts refused because every mailbox slot was in use
+    uint32_t post_max_us;   // Longest post call
+    uint32_t render_max_us; // Longest frame render, flush not included
+} oled_display_stats_t;
+
+// Level source for the recording screen: the largest peak since the previous call and the current RMS, in
+// 1/32768 of full scale. Called from the display task, so it must not block.
+typedef void (*oled_display_meter_fn_t)(uint16_t *peak, uint16_t *rms);
+
+esp_err_t oled_display_start(void);
+void oled_display_post(const char *text);
+void oled_display_post_recording(uint32_t seconds, bool paused);
+void oled_display_set_meter(oled_display_meter_fn_t read);
+void oled_display_get_stats(oled_display_stats_t *stats);
+
+#endif  // OLED_DISPLAY_H
@@ -0,0 +1,186 @@
+#include "oled_gfx.h"
+
+#include <string.h>
+
+// Writes the bits of mask in one panel byte, widening the dirty range of its page if the byte changes.
+static inline void s_put(oled_gfx_t *gfx, int page, int x, uint8_t bits, uint8_t mask)
+{
+    uint8_t *byte = &gfx->fb[page][x];
+    const uint8_t value = (uint8_t)((*byte & ~mask) | (bits & mask));
+    if (value == *byte) {
+        return;
+    }
+    *byte = value;
+    if (gfx->dirty_lo[page] >= gfx->dirty_hi[page]) {
+        gfx->dirty_lo[page] = (uint8_t)x;
+        gfx->dirty_hi[page] = (uint8_t)(x + 1);
+    } else if (x < gfx->dirty_lo[page]) {
+        gfx->dirty_lo[page] = (uint8_t)x;
+    } else if (x >= gfx->dirty_hi[page]) {
+        gfx->dirty_hi[page] = (uint8_t)(x + 1);
+    }
+}
+
+// Writes rows [y, y + h) of column x, h <= 32; bit i of rows is the pixel at y + i.
+static void s_column(oled_gfx_t *gfx, int x, int y, int h, uint32_t rows)
+{
+    if (y < 0) {
+        rows = (-y < 32) ? rows >> -y : 0;
+        h += y;
+        y = 0;
+    }
+    if (x < 0 || x >= OLED_GFX_WIDTH || h <= 0 || y >= OLED_GFX_HEIGHT) {
+        return;
+    }
+    uint64_t mask = ((h >= 32) ? 0xFFFFFFFFull : ((1ull << h) - 1)) << y;
+    uint64_t bits = ((uint64_t)rows << y) & mask;
+    for (int page = y / 8; page < OLED_GFX_PAGES && page <= (y + h - 1) / 8; page++) {
+        s_put(gfx, page, x, (uint8_t)(bits >> (page * 8)), (uint8_t)(mask >> (page * 8)));
+    }
+}
+
+// Clears the canvas and marks it all dirty, for a panel whose contents are unknown.
+void oled_gfx_init(oled_gfx_t *gfx)
+{
+    memset(gfx->fb, 0, sizeof(gfx->fb));
+    oled_gfx_mark_all_dirty(gfx);
+}
+
+// Marks every column of every page as changed, e.g. after a write the panel did not acknowledge.
+void oled_gfx_mark_all_dirty(oled_gfx_t *gfx)
+{
+    memset(gfx->dirty_lo, 0, sizeof(gfx->dirty_lo));
+    memset(gfx->dirty_hi, OLED_GFX_WIDTH, sizeof(gfx->dirty_hi));
+}
+
+// Copies a page-major bitmap to (x, y). Page-aligned rows are byte copies; otherwise each source byte is
+// shifted across two panel pages.
+void oled_gfx_blit(oled_gfx_t *gfx, const uint8_t *bitmap, int width, int pages, int x, int y)
+{
+    if (y < 0 || y >= OLED_GFX_HEIGHT) {
+        return;
+    }
+    const int shift = y % 8;
+    for (int p = 0; p < pages; p++) {
+        const int page = y / 8 + p;
+        if (page >= OLED_GFX_PAGES) {
+            break;
+        }
+        const uint8_t *src = &bitmap[p * width];
+        for (int c = 0; c < width; c++) {
+            const int col = x + c;
+            if (col < 0 || col >= OLED_GFX_WIDTH) {
+                continue;
+            }
+            if (shift == 0) {
+                s_put(gfx, page, col, src[c], 0xFF);
+                continue;
+            }
+            s_put(gfx, page, col, (uint8_t)(src[c] << shift), (uint8_t)(0xFF << shift));
+            if (page + 1 < OLED_GFX_PAGES) {
+                s_put(gfx, page + 1, col, (uint8_t)(src[c] >> (8 - shift)), (uint8_t)(0xFF >> (8 - shift)));
+            }
+        }
+    }
+}
+
+// Sets or clears a rectangle.
+void oled_gfx_fill(oled_gfx_t *gfx, int x, int y, int w, int h, bool on)
+{
+    for (int c = 0; c < w; c++) {
+        for (int row = y; row < y + h; row += 32) {
+            const int rows = (y + h - row < 32) ? y + h - row : 32;
+            s_column(gfx, x + c, row, rows, on ? 0xFFFFFFFFu : 0);
+        }
+    }
+}
+
+// Draws text in a box w columns wide and one cell high, blanking the rest of the box so a shorter string
+// replaces a longer one; w = 0 draws the text only. Characters missing from the atlas draw as '?', or blank
+// when the atlas has no '?'. Returns the column after the last character.
+int oled_gfx_text(oled_gfx_t *gfx, const oled_font_t *font, int x, int y, int w, const char *text)
+{
+    const int cell_bytes = font->width * font->pages;
+    const int end = x + w;
+    for (const char *p = text; *p != '\0' && x < OLED_GFX_WIDTH; p++) {
+        if (w > 0 && x + font->width > end) {
+            break;
+        }
+        uint8_t c = (uint8_t)*p;
+        if (c < font->first || c > font->last) {
+            c = '?';
+        }
+        if (c < font->first || c > font->last) {
+            oled_gfx_fill(gfx, x, y, font->width, font->pages * 8, false);
+        } else {
+            oled_gfx_blit(gfx, &font->bitmap[(c - font->first) * cell_bytes], font->width, font->pages, x, y);
+        }
+        x += font->width;
+    }
+    if (x < end) {
+        oled_gfx_fill(gfx, x, y, end - x, font->pages * 8, false);
+    }
+    return x;
+}
+
+// Draws an icon with its top left corner at (x, y).
+void oled_gfx_icon(oled_gfx_t *gfx, const oled_icon_t *icon, int x, int y)
+{
+    oled_gfx_blit(gfx, icon->bitmap, icon->width, icon->pages, x, y);
+}
+
+// Draws a level meter: solid up to value, a one-column peak marker, and a dotted baseline for the rest.
+// value and peak run from 0 to max; a peak below 0 is not drawn.
+void oled_gfx_bar(oled_gfx_t *gfx, int x, int y, int w, int h, int value, int peak, int max)
+{
+    if (w <= 0 || h <= 0 || h > 32 || max <= 0) {
+        return;
+    }
+    const int filled = (int)((int64_t)value * w / max);
+    const int peak_col = (peak < 0) ? -1 : (int)((int64_t)peak * (w - 1) / max);
+    const uint32_t solid = (h >= 32) ? 0xFFFFFFFFu : ((1u << h) - 1);
+    const uint32_t baseline = 1u << (h - 1);
+    for (int c = 0; c < w; c++) {
+        uint32_t rows = (c < filled || c == peak_col) ? solid : 0;
+        if (rows == 0 && c % 2 == 0) {
+            rows = baseline;
+        }
+        s_column(gfx, x + c, y, h, rows);
+    }
+}
+
+// Draws a progress bar: a one-pixel frame filled in proportion to done / total.
+void oled_gfx_progress(oled_gfx_t *gfx, int x, int y, int w, int h, uint32_t done, uint32_t total)
+{
+    if (w < 3 || h < 3 || h > 32) {
+        return;
+    }
+    const int inner = w - 2;
+    const int filled = (total == 0) ? 0 : (int)((uint64_t)(done < total ? done : total) * inner / total);
+    const uint32_t frame = (h >= 32) ? 0xFFFFFFFFu : ((1u << h) - 1);
+    const uint32_t edges = 1u | (1u << (h - 1));
+    for (int c = 0; c < w; c++) {
+        const bool side = (c == 0 || c == w - 1);
+        s_column(gfx, x + c, y, h, (side || c - 1 < filled) ? frame : edges);
+    }
+}
+
+// Writes the canvas as a binary PBM image, lit pixels black. Returns 0 on success, -1 on a write error.
+int oled_gfx_write_pbm(const oled_gfx_t *gfx, FILE *f)
+{
+    if (fprintf(f, "P4\n%d %d\n", OLED_GFX_WIDTH, OLED_GFX_HEIGHT) < 0) {
+        return -1;
+    }
+    for (int y = 0; y < OLED_GFX_HEIGHT; y++) {
+        uint8_t row[OLED_GFX_WIDTH / 8] = {0};
+        for (int x = 0; x < OLED_GFX_WIDTH; x++) {
+            if (gfx->fb[y / 8][x] & (1u << (y % 8))) {
+                row[x / 8] |= (uint8_t)(0x80 >> (x % 8));
+            }
+        }
+        if (fwrite(row, 1, sizeof(row), f) != sizeof(row)) {
+            return -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,47 @@
+#ifndef OLED_GFX_H
+#define OLED_GFX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Drawing on a copy of the 128x32 panel RAM. Every write compares the new byte with the old one and widens the
+// dirty column range of its page only when it changed, so redrawing a widget with the same content leaves
+// nothing to flush. Widgets compute each byte of their own area once, background included, and never clear
+// first. Pure C, so it also builds on a host.
+
+#define OLED_GFX_WIDTH 128
+#define OLED_GFX_HEIGHT 32
+#define OLED_GFX_PAGES (OLED_GFX_HEIGHT / 8)
+
+typedef struct {
+    uint8_t width;              // Cell width, spacing included
+    uint8_t pages;              // Cell height in pages
+    uint8_t first;              // First and last character in the atlas
+    uint8_t last;
+    const uint8_t *bitmap;      // Cells one after another, each page-major columns
+} oled_font_t;
+
+typedef struct {
+    uint8_t width;
+    uint8_t pages;
+    const uint8_t *bitmap;
+} oled_icon_t;
+
+typedef struct {
+    uint8_t fb[OLED_GFX_PAGES][OLED_GFX_WIDTH];
+    uint8_t dirty_lo[OLED_GFX_PAGES];   // Columns [lo, hi) of each page changed since the last flush
+    uint8_t dirty_hi[OLED_GFX_PAGES];
+} oled_gfx_t;
+
+void oled_gfx_init(oled_gfx_t *gfx);
+void oled_gfx_mark_all_dirty(oled_gfx_t *gfx);
+void oled_gfx_blit(oled_gfx_t *gfx, const uint8_t *bitmap, int width, int pages, int x, int y);
+void oled_gfx_fill(oled_gfx_t *gfx, int x, int y, int w, int h, bool on);
+int oled_gfx_text(oled_gfx_t *gfx, const oled_font_t *font, int x, int y, int w, const char *text);
+void oled_gfx_icon(oled_gfx_t *gfx, const oled_icon_t *icon, int x, int y);
+void oled_gfx_bar(oled_gfx_t *gfx, int x, int y, int w, int h, int value, int peak, int max);
+void oled_gfx_progress(oled_gfx_t *gfx, int x, int y, int w, int h, uint32_t done, uint32_t total);
+int oled_gfx_write_pbm(const oled_gfx_t *gfx, FILE *f);
+
+#endif  // OLED_GFX_H
@@ -1,243 +1,176 @@
 #include "oled_ssd1306.h"
 
+#include <stdbool.h>
 #include <string.h>
 
-#include "driver/i2c.h"
+#include "driver/i2c_master.h"
+#include "esp_attr.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 
 #define OLED_I2C_PORT I2C_NUM_0
 #define OLED_I2C_ADDR 0x3C
 #define OLED_SDA_GPIO 41
 #define OLED_SCL_GPIO 42
 #define OLED_I2C_FREQ_HZ 400000
+#define OLED_I2C_TIMEOUT_MS 100
 
-#define OLED_WIDTH 128
-#define OLED_HEIGHT 32
-#define OLED_PAGES (OLED_HEIGHT / 8)
+// Control bytes: 0x80 is followed by one command byte and another control byte, 0x40 by data up to the stop
+#define OLED_CTRL_CMD_STREAM 0x00
+#define OLED_CTRL_CMD_SINGLE 0x80
+#define OLED_CTRL_DATA 0x40
+#define OLED_TX_HEADER 7        // Page and column address as three single commands, then the data control byte
 
 static const char *TAG = "oled";
 
-static const uint8_t s_font5x7[] = {
-    0x00,0x00,0x00,0x00,0x00, // 0x20 ' '
-    0x00,0x00,0x5f,0x00,0x00, // 0x21 '!'
-    0x00,0x07,0x00,0x07,0x00, // 0x22 '"'
-    0x14,0x7f,0x14,0x7f,0x14, // 0x23 '#'
-    0x24,0x2a,0x7f,0x2a,0x12, // 0x24 '$'
-    0x23,0x13,0x08,0x64,0x62, // 0x25 '%'
-    0x36,0x49,0x55,0x22,0x50, // 0x26 '&'
-    0x00,0x05,0x03,0x00,0x00, // 0x27 '''
-    0x00,0x1c,0x22,0x41,0x00, // 0x28 '('
-    0x00,0x41,0x22,0x1c,0x00, // 0x29 ')'
-    0x14,0x08,0x3e,0x08,0x14, // 0x2a '*'
-    0x08,0x08,0x3e,0x08,0x08, // 0x2b '+'
-    0x00,0x50,0x30,0x00,0x00, // 0x2c ','
-    0x08,0x08,0x08,0x08,0x08, // 0x2d '-'
-    0x00,0x60,0x60,0x00,0x00, // 0x2e '.'
-    0x20,0x10,0x08,0x04,0x02, // 0x2f '/'
-    0x3e,0x51,0x49,0x45,0x3e, // 0x30 '0'
-    0x00,0x42,0x7f,0x40,0x00, // 0x31 '1'
-    0x42,0x61,0x51,0x49,0x46, // 0x32 '2'
-    0x21,0x41,0x45,0x4b,0x31, // 0x33 '3'
-    0x18,0x14,0x12,0x7f,0x10, // 0x34 '4'
-    0x27,0x45,0x45,0x45,0x39, // 0x35 '5'
-    0x3c,0x4a,0x49,0x49,0x30, // 0x36 '6'
-    0x01,0x71,0x09,0x05,0x03, // 0x37 '7'
-    0x36,0x49,0x49,0x49,0x36, // 0x38 '8'
-    0x06,0x49,0x49,0x29,0x1e, // 0x39 '9'
-    0x00,0x36,0x36,0x00,0x00, // 0x3a ':'
-    0x00,0x56,0x36,0x00,0x00, // 0x3b ';'
-    0x08,0x14,0x22,0x41,0x00, // 0x3c '<'
-    0x14,0x14,0x14,0x14,0x14, // 0x3d '='
-    0x00,0x41,0x22,0x14,0x08, // 0x3e '>'
-    0x02,0x01,0x51,0x09,0x06, // 0x3f '?'
-    0x32,0x49,0x79,0x41,0x3e, // 0x40 '@'
-    0x7e,0x11,0x11,0x11,0x7e, // 0x41 'A'
-    0x7f,0x49,0x49,0x49,0x36, // 0x42 'B'
-    0x3e,0x41,0x41,0x41,0x22, // 0x43 'C'
-    0x7f,0x41,0x41,0x22,0x1c, // 0x44 'D'
-    0x7f,0x49,0x49,0x49,0x41, // 0x45 'E'
-    0x7f,0x09,0x09,0x09,0x01, // 0x46 'F'
-    0x3e,0x41,0x49,0x49,0x7a, // 0x47 'G'
-    0x7f,0x08,0x08,0x08,0x7f, // 0x48 'H'
-    0x00,0x41,0x7f,0x41,0x00, // 0x49 'I'
-    0x20,0x40,0x41,0x3f,0x01, // 0x4a 'J'
-    0x7f,0x08,0x14,0x22,0x41, // 0x4b 'K'
-    0x7f,0x40,0x40,0x40,0x40, // 0x4c 'L'
-    0x7f,0x02,0x0c,0x02,0x7f, // 0x4d 'M'
-    0x7f,0x04,0x08,0x10,0x7f, // 0x4e 'N'
-    0x3e,0x41,0x41,0x41,0x3e, // 0x4f 'O'
-    0x7f,0x09,0x09,0x09,0x06, // 0x50 'P'
-    0x3e,0x41,0x51,0x21,0x5e, // 0x51 'Q'
-    0x7f,0x09,0x19,0x29,0x46, // 0x52 'R'
-    0x46,0x49,0x49,0x49,0x31, // 0x53 'S'
-    0x01,0x01,0x7f,0x01,0x01, // 0x54 'T'
-    0x3f,0x40,0x40,0x40,0x3f, // 0x55 'U'
-    0x1f,0x20,0x40,0x20,0x1f, // 0x56 'V'
-    0x3f,0x40,0x38,0x40,0x3f, // 0x57 'W'
-    0x63,0x14,0x08,0x14,0x63, // 0x58 'X'
-    0x07,0x08,0x70,0x08,0x07, // 0x59 'Y'
-    0x61,0x51,0x49,0x45,0x43, // 0x5a 'Z'
-    0x00,0x7f,0x41,0x41,0x00, // 0x5b '['
-    0x02,0x04,0x08,0x10,0x20, // 0x5c '\'
-    0x00,0x41,0x41,0x7f,0x00, // 0x5d ']'
-    0x04,0x02,0x01,0x02,0x04, // 0x5e '^'
-    0x40,0x40,0x40,0x40,0x40, // 0x5f '_'
-    0x00,0x01,0x02,0x04,0x00, // 0x60 '`'
-    0x20,0x54,0x54,0x54,0x78, // 0x61 'a'
-    0x7f,0x48,0x44,0x44,0x38, // 0x62 'b'
-    0x38,0x44,0x44,0x44,0x20, // 0x63 'c'
-    0x38,0x44,0x44,0x48,0x7f, // 0x64 'd'
-    0x38,0x54,0x54,0x54,0x18, // 0x65 'e'
-    0x08,0x7e,0x09,0x01,0x02, // 0x66 'f'
-    0x0c,0x52,0x52,0x52,0x3e, // 0x67 'g'
-    0x7f,0x08,0x04,0x04,0x78, // 0x68 'h'
-    0x00,0x44,0x7d,0x40,0x00, // 0x69 'i'
-    0x20,0x40,0x44,0x3d,0x00, // 0x6a 'j'
-    0x7f,0x10,0x28,0x44,0x00, // 0x6b 'k'
-    0x00,0x41,0x7f,0x40,0x00, // 0x6c 'l'
-    0x7c,0x04,0x18,0x04,0x78, // 0x6d 'm'
-    0x7c,0x08,0x04,0x04,0x78, // 0x6e 'n'
-    0x38,0x44,0x44,0x44,0x38, // 0x6f 'o'
-    0x7c,0x14,0x14,0x14,0x08, // 0x70 'p'
-    0x08,0x14,0x14,0x18,0x7c, // 0x71 'q'
-    0x7c,0x08,0x04,0x04,0x08, // 0x72 'r'
-    0x48,0x54,0x54,0x54,0x20, // 0x73 's'
-    0x04,0x3f,0x44,0x40,0x20, // 0x74 't'
-    0x3c,0x40,0x40,0x20,0x7c, // 0x75 'u'
-    0x1c,0x20,0x40,0x20,0x1c, // 0x76 'v'
-    0x3c,0x40,0x30,0x40,0x3c, // 0x77 'w'
-    0x44,0x28,0x10,0x28,0x44, // 0x78 'x'
-    0x0c,0x50,0x50,0x50,0x3c, // 0x79 'y'
-    0x44,0x64,0x54,0x4c,0x44, // 0x7a 'z'
-    0x00,0x08,0x36,0x41,0x00, // 0x7b '{'
-    0x00,0x00,0x7f,0x00,0x00, // 0x7c '|'
-    0x00,0x41,0x36,0x08,0x00, // 0x7d '}'
-    0x10,0x08,0x08,0x10,0x08, // 0x7e '~'
-    0x00,0x06,0x09,0x09,0x06  // 0x7f DEL
+static i2c_master_bus_handle_t s_bus;
+static i2c_master_dev_handle_t s_dev;
+static SemaphoreHandle_t s_lock;
+static volatile bool s_bus_error;               // Set from the ISR when a queued write is not acknowledged
+// One transfer per page; the driver reads them in the background, so they stay untouched until the bus is idle
+static uint8_t s_tx[OLED_GFX_PAGES][OLED_TX_HEADER + OLED_GFX_WIDTH];
+static oled_ssd1306_stats_t s_stats;
+
+static const uint8_t s_init_cmds[] = {
+    OLED_CTRL_CMD_STREAM,
+    0xAE,       // display off
+    0xD5, 0x80, // set display clock
+    0xA8, 0x1F, // multiplex, 0x1F for 32 rows
+    0xD3, 0x00, // display offset
+    0x40,       // start line
+    0x8D, 0x14, // charge pump
+    0x20, 0x02, // memory mode: page addressing, so a write never leaves its page
+    0xA1,       // segment remap
+    0xC8,       // COM scan dec
+    0xDA, 0x02, // COM pins
+    0x81, 0x8F, // contrast
+    0xA4,       // display follow RAM
+    0xA6,       // normal display
+    0xAF,       // display on
 };
 
-// Sends a control byte and payload over I2C to the OLED.
-static esp_err_t s_i2c_write(uint8_t control, const uint8_t *data, size_t len)
+// I2C ISR callback: notes a write the panel did not acknowledge, so the next flush repaints everything.
+static bool IRAM_ATTR s_on_trans_done(i2c_master_dev_handle_t dev, const i2c_master_event_data_t *evt, void *arg)
 {
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    i2c_master_start(cmd);
-    i2c_master_write_byte(cmd, (OLED_I2C_ADDR << 1) | I2C_MASTER_WRITE, true);
-    i2c_master_write_byte(cmd, control, true);
-    if (len > 0) {
-        i2c_master_write(cmd, (uint8_t *)data, len, true);
+    (void)dev;
+    (void)arg;
+    if (evt->event == I2C_EVENT_NACK) {
+        s_bus_error = true;
     }
-    i2c_master_stop(cmd);
-    esp_err_t ret = i2c_master_cmd_begin(OLED_I2C_PORT, cmd, pdMS_TO_TICKS(100));
-    i2c_cmd_link_delete(cmd);
-    return ret;
-}
-
-// Writes a single SSD1306 command byte.
-static esp_err_t s_write_cmd(uint8_t cmd)
-{
-    return s_i2c_write(0x00, &cmd, 1);
-}
-
-// Writes a block of display data bytes.
-static esp_err_t s_write_data(const uint8_t *data, size_t len)
-{
-    return s_i2c_write(0x40, data, len);
+    return false;
 }
 
-// Clears the display to all zeros.
-static esp_err_t ssd1306_clear(void)
+// Queues one write on the bus. The buffer must stay untouched until the bus is idle again.
+static esp_err_t s_transmit(const uint8_t *buf, size_t len)
 {
-    uint8_t clear[OLED_WIDTH];
-    memset(clear, 0x00, sizeof(clear));
-    for (int page = 0; page < OLED_PAGES; page++) {
-        s_write_cmd(0xB0 | page);
-        s_write_cmd(0x00);
-        s_write_cmd(0x10);
-        s_write_data(clear, sizeof(clear));
+    esp_err_t ret = i2c_master_transmit(s_dev, buf, len, OLED_I2C_TIMEOUT_MS);
+    if (ret == ESP_OK) {
+        s_stats.transactions++;
+        s_stats.bytes += len + 1; // address byte
+    } else {
+        s_stats.errors++;
     }
-    return ESP_OK;
+    return ret;
 }
 
 // Initializes I2C and SSD1306 display settings.
 esp_err_t oled_ssd1306_init(void)
 {
-    i2c_config_t cfg = {
-        .mode = I2C_MODE_MASTER,
+    i2c_master_bus_config_t bus_cfg = {
+        .i2c_port = OLED_I2C_PORT,
         .sda_io_num = OLED_SDA_GPIO,
         .scl_io_num = OLED_SCL_GPIO,
-        .sda_pullup_en = GPIO_PULLUP_ENABLE,
-        .scl_pullup_en = GPIO_PULLUP_ENABLE,
-        .master.clk_speed = OLED_I2C_FREQ_HZ,
-        .clk_flags = 0,
+        .clk_source = I2C_CLK_SRC_DEFAULT,
+        .glitch_ignore_cnt = 7,
+        .trans_queue_depth = OLED_GFX_PAGES,
+        .flags.enable_internal_pullup = true,
+    };
+    ESP_ERROR_CHECK(i2c_new_master_bus(&bus_cfg, &s_bus));
+
+    i2c_device_config_t dev_cfg = {
+        .dev_addr_length = I2C_ADDR_BIT_LEN_7,
+        .device_address = OLED_I2C_ADDR,
+        .scl_speed_hz = OLED_I2C_FREQ_HZ,
     };
-    ESP_ERROR_CHECK(i2c_param_config(OLED_I2C_PORT, &cfg));
-    ESP_ERROR_CHECK(i2c_driver_install(OLED_I2C_PORT, cfg.mode, 0, 0, 0));
-
-    s_write_cmd(0xAE); // display off
-    s_write_cmd(0xD5); // set display clock
-    s_write_cmd(0x80);
-    s_write_cmd(0xA8); // multiplex
-    s_write_cmd(0x1F); // 0x1F for 32 rows
-    s_write_cmd(0xD3); // display offset
-    s_write_cmd(0x00);
-    s_write_cmd(0x40); // start line
-    s_write_cmd(0x8D); // charge pump
-    s_write_cmd(0x14);
-    s_write_cmd(0x20); // memory mode
-    s_write_cmd(0x00); // horizontal addressing
-    s_write_cmd(0xA1); // segment remap
-    s_write_cmd(0xC8); // COM scan dec
-    s_write_cmd(0xDA); // COM pins
-    s_write_cmd(0x02);
-    s_write_cmd(0x81); // contrast
-    s_write_cmd(0x8F);
-    s_write_cmd(0xA4); // display follow RAM
-    s_write_cmd(0xA6); // normal display
-    s_write_cmd(0xAF); // display on
+    ESP_ERROR_CHECK(i2c_master_bus_add_device(s_bus, &dev_cfg, &s_dev));
+
+    // With a done callback registered, i2c_master_transmit() queues the write and returns
+    i2c_master_event_callbacks_t cbs = {
+        .on_trans_done = s_on_trans_done,
+    };
+    ESP_ERROR_CHECK(i2c_master_register_event_callbacks(s_dev, &cbs, NULL));
+
+    s_lock = xSemaphoreCreateMutex();
+    if (s_lock == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t ret = s_transmit(s_init_cmds, sizeof(s_init_cmds));
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "SSD1306 not responding (%s)", esp_err_to_name(ret));
+        return ret;
+    }
 
+    // The queued commands complete before the first flush reuses the bus
     ESP_LOGI(TAG, "SSD1306 initialized");
-    return ssd1306_clear();
+    return ESP_OK;
 }
 
-// Renders text (with newlines) onto the display.
-esp_err_t oled_ssd1306_display_text(const char *text)
+// Sends the dirty column range of each canvas page in one write per page and clears it; does not wait for
+// the bus. Columns that could not be queued stay dirty for the next flush.
+esp_err_t oled_ssd1306_flush(oled_gfx_t *gfx)
 {
-    uint8_t buffer[OLED_WIDTH * OLED_PAGES];
-    memset(buffer, 0x00, sizeof(buffer));
-
-    int x = 0;
-    int page = 0;
-    for (const char *p = text; *p != '\0' && page < OLED_PAGES; p++) {
-        char c = *p;
-        if (c == '\n') {
-            x = 0;
-            page++;
+    if (s_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    // The previous flush may still be reading s_tx
+    esp_err_t ret = i2c_master_bus_wait_all_done(s_bus, OLED_I2C_TIMEOUT_MS);
+    if (ret != ESP_OK) {
+        xSemaphoreGive(s_lock);
+        return ret;
+    }
+    if (s_bus_error) {
+        s_bus_error = false;
+        s_stats.errors++;
+        oled_gfx_mark_all_dirty(gfx);
+    }
+
+    for (int page = 0; page < OLED_GFX_PAGES; page++) {
+        const uint8_t lo = gfx->dirty_lo[page];
+        const uint8_t hi = gfx->dirty_hi[page];
+        if (lo >= hi) {
             continue;
         }
-        if (c < 0x20 || c > 0x7f) {
-            c = '?';
-        }
-        if (x + 6 > OLED_WIDTH) {
-            x = 0;
-            page++;
-            if (page >= OLED_PAGES) {
-                break;
-            }
+        uint8_t *tx = s_tx[page];
+        tx[0] = OLED_CTRL_CMD_SINGLE;
+        tx[1] = 0xB0 | page;            // page start
+        tx[2] = OLED_CTRL_CMD_SINGLE;
+        tx[3] = 0x00 | (lo & 0x0F);     // column start, low nibble
+        tx[4] = OLED_CTRL_CMD_SINGLE;
+        tx[5] = 0x10 | (lo >> 4);       // column start, high nibble
+        tx[6] = OLED_CTRL_DATA;
+        memcpy(&tx[OLED_TX_HEADER], &gfx->fb[page][lo], hi - lo);
+        ret = s_transmit(tx, OLED_TX_HEADER + (hi - lo));
+        if (ret != ESP_OK) {
+            break;
         }
-        int index = (c - 0x20) * 5;
-        int base = page * OLED_WIDTH + x;
-        for (int col = 0; col < 5; col++) {
-            buffer[base + col] = s_font5x7[index + col];
-        }
-        x += 6;
+        gfx->dirty_lo[page] = 0;
+        gfx->dirty_hi[page] = 0;
     }
+    xSemaphoreGive(s_lock);
+    return ret;
+}
 
-    for (int p = 0; p < OLED_PAGES; p++) {
-        s_write_cmd(0xB0 | p);
-        s_write_cmd(0x00);
-        s_write_cmd(0x10);
-        s_write_data(&buffer[p * OLED_WIDTH], OLED_WIDTH);
+// Returns the I2C traffic sent to the display since init.
+void oled_ssd1306_get_stats(oled_ssd1306_stats_t *stats)
+{
+    if (s_lock == NULL) {
+        memset(stats, 0, sizeof(*stats));
+        return;
     }
-    return ESP_OK;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    *stats = s_stats;
+    xSemaphoreGive(s_lock);
 }
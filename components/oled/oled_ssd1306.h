@@ -1,9 +1,19 @@
 #ifndef OLED_SSD1306_H
 #define OLED_SSD1306_H
 
+#include <stdint.h>
+
 #include "esp_err.h"
+#include "oled_gfx.h"
+
+typedef struct {
+    uint32_t transactions;  // I2C writes queued
+    uint64_t bytes;         // Bytes put on the bus, address bytes included
+    uint32_t errors;        // Writes refused by the driver or not acknowledged by the panel
+} oled_ssd1306_stats_t;
 
 esp_err_t oled_ssd1306_init(void);
-esp_err_t oled_ssd1306_display_text(const char *text);
+esp_err_t oled_ssd1306_flush(oled_gfx_t *gfx);
+void oled_ssd1306_get_stats(oled_ssd1306_stats_t *stats);
 
 #endif  // OLED_SSD1306_H
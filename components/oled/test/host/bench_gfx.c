@@ -0,0 +1,64 @@
+#include <stdint.h>
+#include <time.h>
+
+#include "host_test.h"
+#include "oled_glyphs.h"
+#include "oled_gfx.h"
+
+// Host microbenchmark: render time per frame of the recording screen, in the clock-only case the display redraws
+// once per second and the meter case it redraws every 50 ms, plus a full screen of small text. Host numbers only
+// rank the cases; the target figure is render_max_us in oled_display_get_stats().
+
+#define FRAMES 200000
+
+static double s_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// One recording frame as oled_display draws it; the meter moves every frame, the clock every 20.
+static void s_frame(oled_gfx_t *gfx, uint32_t frame, bool meter)
+{
+    char clock[16];
+    const uint32_t seconds = meter ? frame / 20 : frame;
+    snprintf(clock, sizeof(clock), "%02lu:%02lu:%02lu", (unsigned long)(seconds / 3600),
+             (unsigned long)((seconds % 3600) / 60), (unsigned long)(seconds % 60));
+    oled_gfx_icon(gfx, &oled_icon_record, 0, 8);
+    oled_gfx_text(gfx, &oled_font_large, 12, 0, OLED_GFX_WIDTH - 12, clock);
+    if (meter) {
+        oled_gfx_bar(gfx, 0, 24, 100, 8, (int)(frame * 37 % 600), (int)(frame * 13 % 600), 600);
+        oled_gfx_text(gfx, &oled_font_small, 104, 24, OLED_GFX_WIDTH - 104, (frame % 64 < 8) ? "CLIP" : "");
+    } else {
+        oled_gfx_text(gfx, &oled_font_small, 0, 24, OLED_GFX_WIDTH, "Recording");
+    }
+}
+
+int main(void)
+{
+    static oled_gfx_t gfx;
+    static const char *modes[] = { "clock", "clock + meter" };
+    for (int m = 0; m < 2; m++) {
+        oled_gfx_init(&gfx);
+        volatile uint8_t sink = 0;
+        const double t0 = s_now_ns();
+        for (uint32_t f = 0; f < FRAMES; f++) {
+            s_frame(&gfx, f, m == 1);
+            sink += gfx.dirty_hi[f % OLED_GFX_PAGES];
+            oled_gfx_mark_all_dirty(&gfx);
+        }
+        printf("[bench] recording screen, %s: %.0f ns per frame\n", modes[m], (s_now_ns() - t0) / FRAMES);
+        (void)sink;
+    }
+
+    oled_gfx_init(&gfx);
+    const double t0 = s_now_ns();
+    for (uint32_t f = 0; f < FRAMES; f++) {
+        for (int page = 0; page < OLED_GFX_PAGES; page++) {
+            oled_gfx_text(&gfx, &oled_font_small, 0, page * 8, OLED_GFX_WIDTH, (f & 1) ? "Formatting card..." : "Ready");
+        }
+    }
+    printf("[bench] text screen, 4 lines: %.0f ns per frame\n", (s_now_ns() - t0) / FRAMES);
+    return 0;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+// Host stand-in for esp_attr: code placement attributes have no meaning on the host.
+
+#define IRAM_ATTR
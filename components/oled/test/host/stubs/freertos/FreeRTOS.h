@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+
+// Host stand-in for the FreeRTOS types the oled driver uses. The tests are single threaded.
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+
+#define pdTRUE          1
+#define pdFALSE         0
+#define portMAX_DELAY   ((TickType_t)0xFFFFFFFF)
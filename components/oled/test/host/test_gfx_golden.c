@@ -0,0 +1,126 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "host_test.h"
+#include "oled_glyphs.h"
+#include "oled_gfx.h"
+
+// oled_gfx scenes rendered to PBM and compared byte for byte with the reference images in golden/. A scene that
+// differs is written next to the test binary as <name>.actual.pbm. After a deliberate change to the glyphs or a
+// widget, look at the new images and rerun with --update to replace the references.
+
+typedef struct {
+    const char *name;
+    void (*draw)(oled_gfx_t *gfx);
+} scene_t;
+
+// Three lines in the small font: plain text, a character missing from the atlas, a line cut at its box.
+static void s_scene_text(oled_gfx_t *gfx)
+{
+    oled_gfx_text(gfx, &oled_font_small, 0, 0, OLED_GFX_WIDTH, "Ready 48kHz 24-bit");
+    oled_gfx_text(gfx, &oled_font_small, 0, 8, OLED_GFX_WIDTH, "Bad \x01 char");
+    oled_gfx_text(gfx, &oled_font_small, 0, 16, 60, "Cut at sixty columns");
+    oled_gfx_text(gfx, &oled_font_small, 0, 24, OLED_GFX_WIDTH, "~!@#$%^&*()_+{}|");
+}
+
+// The recording screen with the level meter: icon, clock digits, bar with peak marker, CLIP flag.
+static void s_scene_recording(oled_gfx_t *gfx)
+{
+    oled_gfx_icon(gfx, &oled_icon_record, 0, 8);
+    oled_gfx_text(gfx, &oled_font_large, 12, 0, OLED_GFX_WIDTH - 12, "01:23:45");
+    oled_gfx_bar(gfx, 0, 24, 100, 8, 420, 510, 600);
+    oled_gfx_text(gfx, &oled_font_small, 104, 24, OLED_GFX_WIDTH - 104, "CLIP");
+}
+
+// Blits that straddle pages: medium text and an icon at unaligned rows, a progress bar across two pages.
+static void s_scene_unaligned(oled_gfx_t *gfx)
+{
+    oled_gfx_text(gfx, &oled_font_medium, 2, 5, 0, "Sync");
+    oled_gfx_icon(gfx, &oled_icon_pause, 60, 3);
+    oled_gfx_progress(gfx, 70, 18, 50, 10, 1, 3);
+    oled_gfx_fill(gfx, 0, 22, 50, 2, true);
+}
+
+// A shorter string over a longer one in the same box leaves no trace of the longer one; so does a lower level.
+static void s_scene_overdraw(oled_gfx_t *gfx)
+{
+    oled_gfx_text(gfx, &oled_font_small, 0, 0, OLED_GFX_WIDTH, "Formatting card...");
+    oled_gfx_text(gfx, &oled_font_small, 0, 0, OLED_GFX_WIDTH, "Done");
+    oled_gfx_bar(gfx, 0, 8, 128, 8, 600, 600, 600);
+    oled_gfx_bar(gfx, 0, 8, 128, 8, 150, 300, 600);
+    oled_gfx_progress(gfx, 0, 16, 128, 16, 3, 3);
+    oled_gfx_progress(gfx, 0, 16, 128, 16, 0, 3);
+}
+
+static const scene_t s_scenes[] = {
+    { "text", s_scene_text },
+    { "recording", s_scene_recording },
+    { "unaligned", s_scene_unaligned },
+    { "overdraw", s_scene_overdraw },
+};
+
+// Renders a scene on a blank canvas into a PBM image in memory; returns its size.
+static size_t s_render(const scene_t *scene, char *pbm, size_t size)
+{
+    static oled_gfx_t gfx;
+    oled_gfx_init(&gfx);
+    scene->draw(&gfx);
+    FILE *f = fmemopen(pbm, size, "wb");
+    TEST_CHECK(f != NULL);
+    TEST_CHECK(oled_gfx_write_pbm(&gfx, f) == 0);
+    const long len = ftell(f);
+    TEST_CHECK(fclose(f) == 0 && len > 0);
+    return (size_t)len;
+}
+
+// Reads a whole file; returns its size, or -1 if it cannot be read.
+static long s_read_file(const char *path, char *buf, size_t size)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return -1;
+    }
+    const size_t len = fread(buf, 1, size, f);
+    fclose(f);
+    return (long)len;
+}
+
+static void s_write_file(const char *path, const char *buf, size_t len)
+{
+    FILE *f = fopen(path, "wb");
+    TEST_CHECK(f != NULL);
+    TEST_CHECK(fwrite(buf, 1, len, f) == len);
+    TEST_CHECK(fclose(f) == 0);
+}
+
+int main(int argc, char **argv)
+{
+    const bool update = (argc > 1 && strcmp(argv[1], "--update") == 0);
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(s_scenes) / sizeof(s_scenes[0]); i++) {
+        char actual[1024];
+        char golden[1024];
+        char path[512];
+        const size_t len = s_render(&s_scenes[i], actual, sizeof(actual));
+        snprintf(path, sizeof(path), "%s/%s.pbm", GOLDEN_DIR, s_scenes[i].name);
+        if (update) {
+            s_write_file(path, actual, len);
+            printf("updated %s\n", path);
+            continue;
+        }
+        const long golden_len = s_read_file(path, golden, sizeof(golden));
+        if (golden_len == (long)len && memcmp(actual, golden, len) == 0) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s.actual.pbm", s_scenes[i].name);
+        s_write_file(path, actual, len);
+        fprintf(stderr, "%s: differs from %s/%s.pbm, rendered to %s\n", s_scenes[i].name, GOLDEN_DIR,
+                s_scenes[i].name, path);
+        failed++;
+    }
+    if (failed) {
+        return 1;
+    }
+    printf("gfx golden: all scenes match\n");
+    return 0;
+}
@@ -0,0 +1,259 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "driver/i2c_master.h"
+#include "host_test.h"
+#include "oled_glyphs.h"
+#include "oled_ssd1306.h"
+
+// oled_ssd1306 on a fake I2C bus that counts every write and decodes it the way the SSD1306 would, into a copy
+// of the panel RAM. Checks the panel always ends up showing the framebuffer, and counts what a ticking recording
+// clock puts on the bus against the driver before the framebuffer, which rewrote every page each second.
+
+#define CLOCK_SECONDS 120
+
+// The driver before the framebuffer, per frame: for each page three single-command writes (address, control
+// byte, command) and one write of the whole page (address, control byte, 128 data bytes)
+#define LEGACY_FRAME_WRITES (OLED_GFX_PAGES * 4)
+#define LEGACY_FRAME_BYTES  (OLED_GFX_PAGES * (3 * 3 + 2 + OLED_GFX_WIDTH))
+
+// A full page now: address, three control/command pairs, data control byte, 128 data bytes
+#define FULL_PAGE_BYTES (1 + 7 + OLED_GFX_WIDTH)
+
+static struct {
+    uint8_t ram[OLED_GFX_PAGES][OLED_GFX_WIDTH];
+    int page;
+    int col;
+    bool page_mode;
+    uint32_t writes;
+    uint64_t bytes;
+    int refuse_after;           // Writes accepted before the next one is refused, -1 for none
+    bool nack_next;             // The next write is not acknowledged
+    i2c_master_callback_t on_done;
+} s_bus = { .refuse_after = -1 };
+
+static oled_gfx_t s_gfx;
+
+// Applies one SSD1306 command; returns how many argument bytes follow it.
+static int s_command(uint8_t cmd, const uint8_t *args, size_t avail)
+{
+    if (cmd >= 0xB0 && cmd <= 0xB7) {
+        s_bus.page = cmd & 0x07;
+    } else if (cmd <= 0x0F) {
+        s_bus.col = (s_bus.col & 0xF0) | cmd;
+    } else if (cmd >= 0x10 && cmd <= 0x1F) {
+        s_bus.col = (s_bus.col & 0x0F) | ((cmd & 0x0F) << 4);
+    } else if (cmd == 0x20 || cmd == 0x81 || cmd == 0x8D || cmd == 0xA8 || cmd == 0xD3 || cmd == 0xD5 ||
+               cmd == 0xD9 || cmd == 0xDA || cmd == 0xDB) {
+        TEST_CHECK(avail >= 1);
+        if (cmd == 0x20) {
+            s_bus.page_mode = (args[0] == 0x02);
+        }
+        return 1;
+    }
+    return 0;
+}
+
+// Decodes one write as the panel would: control bytes, commands, then data into RAM at the page and column.
+static void s_decode(const uint8_t *buf, size_t len)
+{
+    size_t i = 0;
+    while (i < len) {
+        const uint8_t ctrl = buf[i++];
+        if (ctrl == 0x40) {
+            TEST_CHECK(s_bus.page_mode);
+            for (; i < len; i++) {
+                s_bus.ram[s_bus.page][s_bus.col] = buf[i];
+                s_bus.col = (s_bus.col + 1) % OLED_GFX_WIDTH;
+            }
+        } else if (ctrl == 0x00) {
+            while (i < len) {
+                const uint8_t cmd = buf[i++];
+                i += s_command(cmd, &buf[i], len - i);
+            }
+        } else {
+            TEST_CHECK(ctrl == 0x80 && i < len);
+            const uint8_t cmd = buf[i++];
+            TEST_CHECK(s_command(cmd, NULL, 0) == 0);
+        }
+    }
+}
+
+esp_err_t i2c_new_master_bus(const i2c_master_bus_config_t *config, i2c_master_bus_handle_t *ret_bus)
+{
+    TEST_CHECK(config->trans_queue_depth >= OLED_GFX_PAGES);
+    *ret_bus = (i2c_master_bus_handle_t)&s_bus;
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_bus_add_device(i2c_master_bus_handle_t bus, const i2c_device_config_t *config,
+                                    i2c_master_dev_handle_t *ret_dev)
+{
+    (void)config;
+    *ret_dev = (i2c_master_dev_handle_t)bus;
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_register_event_callbacks(i2c_master_dev_handle_t dev, const i2c_master_event_callbacks_t *cbs,
+                                              void *user_data)
+{
+    (void)dev;
+    (void)user_data;
+    s_bus.on_done = cbs->on_trans_done;
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_transmit(i2c_master_dev_handle_t dev, const uint8_t *buf, size_t len, int timeout_ms)
+{
+    (void)timeout_ms;
+    if (s_bus.refuse_after == 0) {
+        s_bus.refuse_after = -1;
+        return ESP_ERR_TIMEOUT;
+    }
+    if (s_bus.refuse_after > 0) {
+        s_bus.refuse_after--;
+    }
+    s_bus.writes++;
+    s_bus.bytes += len + 1;
+    i2c_master_event_data_t evt = { .event = I2C_EVENT_DONE };
+    if (s_bus.nack_next) {
+        s_bus.nack_next = false;
+        evt.event = I2C_EVENT_NACK;
+    } else {
+        s_decode(buf, len);
+    }
+    if (s_bus.on_done != NULL) {
+        s_bus.on_done(dev, &evt, NULL);
+    }
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_bus_wait_all_done(i2c_master_bus_handle_t bus, int timeout_ms)
+{
+    (void)bus;
+    (void)timeout_ms;
+    return ESP_OK;
+}
+
+// Flushes and returns the writes and bytes it put on the bus; the panel must then show the framebuffer.
+static void s_flush(uint32_t *writes, uint64_t *bytes)
+{
+    const uint32_t w0 = s_bus.writes;
+    const uint64_t b0 = s_bus.bytes;
+    TEST_CHECK(oled_ssd1306_flush(&s_gfx) == ESP_OK);
+    TEST_CHECK(memcmp(s_bus.ram, s_gfx.fb, sizeof(s_bus.ram)) == 0);
+    for (int page = 0; page < OLED_GFX_PAGES; page++) {
+        TEST_CHECK(s_gfx.dirty_lo[page] >= s_gfx.dirty_hi[page]);
+    }
+    *writes = s_bus.writes - w0;
+    *bytes = s_bus.bytes - b0;
+}
+
+// Draws the recording screen as oled_display does without a meter: icon, clock in the large digits, status line.
+static void s_draw_recording(uint32_t seconds)
+{
+    char clock[16];
+    snprintf(clock, sizeof(clock), "%02lu:%02lu:%02lu", (unsigned long)(seconds / 3600),
+             (unsigned long)((seconds % 3600) / 60), (unsigned long)(seconds % 60));
+    oled_gfx_icon(&s_gfx, &oled_icon_record, 0, 8);
+    oled_gfx_text(&s_gfx, &oled_font_large, 12, 0, OLED_GFX_WIDTH - 12, clock);
+    oled_gfx_text(&s_gfx, &oled_font_small, 0, 24, OLED_GFX_WIDTH, "Recording");
+}
+
+// Init sends the whole setup in one write and selects page addressing; the first flush paints every page.
+static void s_test_init(void)
+{
+    memset(s_bus.ram, 0xA5, sizeof(s_bus.ram));     // Panel RAM is undefined at power-up
+    TEST_CHECK(oled_ssd1306_init() == ESP_OK);
+    TEST_CHECK(s_bus.writes == 1 && s_bus.page_mode);
+
+    oled_gfx_init(&s_gfx);
+    uint32_t writes;
+    uint64_t bytes;
+    s_flush(&writes, &bytes);
+    TEST_CHECK(writes == OLED_GFX_PAGES && bytes == OLED_GFX_PAGES * FULL_PAGE_BYTES);
+    s_flush(&writes, &bytes);
+    TEST_CHECK(writes == 0 && bytes == 0);
+}
+
+// A ticking clock only sends the digits that changed, never more than the legacy frame.
+static void s_test_clock(void)
+{
+    uint32_t writes;
+    uint64_t bytes;
+    s_draw_recording(0);
+    s_flush(&writes, &bytes);
+
+    // The same screen again leaves nothing to send
+    s_draw_recording(0);
+    s_flush(&writes, &bytes);
+    TEST_CHECK(writes == 0 && bytes == 0);
+
+    uint64_t total_writes = 0;
+    uint64_t total_bytes = 0;
+    uint64_t max_bytes = 0;
+    for (uint32_t s = 1; s <= CLOCK_SECONDS; s++) {
+        s_draw_recording(s);
+        s_flush(&writes, &bytes);
+        TEST_CHECK(writes >= 1 && writes <= OLED_GFX_PAGES);
+        total_writes += writes;
+        total_bytes += bytes;
+        if (bytes > max_bytes) {
+            max_bytes = bytes;
+        }
+    }
+    TEST_CHECK(max_bytes < LEGACY_FRAME_BYTES);
+    TEST_CHECK(total_bytes * 2 < (uint64_t)CLOCK_SECONDS * LEGACY_FRAME_BYTES);
+    printf("[bus] recording clock, %u s: before %u B in %u writes per second, after %.1f B in %.1f writes "
+           "(max %llu B)\n", CLOCK_SECONDS, LEGACY_FRAME_BYTES, LEGACY_FRAME_WRITES,
+           (double)total_bytes / CLOCK_SECONDS, (double)total_writes / CLOCK_SECONDS, (unsigned long long)max_bytes);
+
+    oled_ssd1306_stats_t stats;
+    oled_ssd1306_get_stats(&stats);
+    TEST_CHECK(stats.transactions == s_bus.writes && stats.bytes == s_bus.bytes && stats.errors == 0);
+}
+
+// A write the panel did not acknowledge makes the next flush repaint everything.
+static void s_test_nack(void)
+{
+    uint32_t writes;
+    uint64_t bytes;
+    oled_gfx_fill(&s_gfx, 120, 24, 1, 1, true);
+    s_bus.nack_next = true;
+    TEST_CHECK(oled_ssd1306_flush(&s_gfx) == ESP_OK);
+    TEST_CHECK(memcmp(s_bus.ram, s_gfx.fb, sizeof(s_bus.ram)) != 0);
+
+    s_flush(&writes, &bytes);
+    TEST_CHECK(writes == OLED_GFX_PAGES && bytes == OLED_GFX_PAGES * FULL_PAGE_BYTES);
+    oled_ssd1306_stats_t stats;
+    oled_ssd1306_get_stats(&stats);
+    TEST_CHECK(stats.errors == 1);
+}
+
+// A write the driver refuses stops the flush; the pages not sent stay dirty and go out with the next flush.
+static void s_test_refused(void)
+{
+    oled_gfx_mark_all_dirty(&s_gfx);
+    s_bus.refuse_after = 2;
+    TEST_CHECK(oled_ssd1306_flush(&s_gfx) != ESP_OK);
+    TEST_CHECK(s_gfx.dirty_lo[0] >= s_gfx.dirty_hi[0] && s_gfx.dirty_lo[1] >= s_gfx.dirty_hi[1]);
+    TEST_CHECK(s_gfx.dirty_lo[2] < s_gfx.dirty_hi[2] && s_gfx.dirty_lo[3] < s_gfx.dirty_hi[3]);
+
+    uint32_t writes;
+    uint64_t bytes;
+    s_flush(&writes, &bytes);
+    TEST_CHECK(writes == 2 && bytes == 2 * FULL_PAGE_BYTES);
+    oled_ssd1306_stats_t stats;
+    oled_ssd1306_get_stats(&stats);
+    TEST_CHECK(stats.errors == 2);
+}
+
+int main(void)
+{
+    s_test_init();
+    s_test_clock();
+    s_test_nack();
+    s_test_refused();
+    printf("ssd1306 bus: all checks passed\n");
+    return 0;
+}
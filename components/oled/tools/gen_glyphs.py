@@ -0,0 +1,245 @@
+#!/usr/bin/env python
+# Generates the OLED glyph atlases and icons (oled_glyphs.c/.h) at build time.
+#
+# Glyphs are stored the way the SSD1306 takes them: one byte per column and page, LSB at the top, the pages of a
+# glyph one after another. Each cell already includes its spacing column and blank rows, so drawing a string
+# overwrites the previous one without clearing first. Larger sizes are the 5x7 font scaled up.
+
+import argparse
+import os
+
+# 5x7 font, ASCII 0x20-0x7f, five column bytes per glyph
+FONT_5X7 = [
+    (0x00, 0x00, 0x00, 0x00, 0x00),  # 0x20
+    (0x00, 0x00, 0x5f, 0x00, 0x00),  # 0x21
+    (0x00, 0x07, 0x00, 0x07, 0x00),  # 0x22
+    (0x14, 0x7f, 0x14, 0x7f, 0x14),  # 0x23
+    (0x24, 0x2a, 0x7f, 0x2a, 0x12),  # 0x24
+    (0x23, 0x13, 0x08, 0x64, 0x62),  # 0x25
+    (0x36, 0x49, 0x55, 0x22, 0x50),  # 0x26
+    (0x00, 0x05, 0x03, 0x00, 0x00),  # 0x27
+    (0x00, 0x1c, 0x22, 0x41, 0x00),  # 0x28
+    (0x00, 0x41, 0x22, 0x1c, 0x00),  # 0x29
+    (0x14, 0x08, 0x3e, 0x08, 0x14),  # 0x2a
+    (0x08, 0x08, 0x3e, 0x08, 0x08),  # 0x2b
+    (0x00, 0x50, 0x30, 0x00, 0x00),  # 0x2c
+    (0x08, 0x08, 0x08, 0x08, 0x08),  # 0x2d
+    (0x00, 0x60, 0x60, 0x00, 0x00),  # 0x2e
+    (0x20, 0x10, 0x08, 0x04, 0x02),  # 0x2f
+    (0x3e, 0x51, 0x49, 0x45, 0x3e),  # 0x30
+    (0x00, 0x42, 0x7f, 0x40, 0x00),  # 0x31
+    (0x42, 0x61, 0x51, 0x49, 0x46),  # 0x32
+    (0x21, 0x41, 0x45, 0x4b, 0x31),  # 0x33
+    (0x18, 0x14, 0x12, 0x7f, 0x10),  # 0x34
+    (0x27, 0x45, 0x45, 0x45, 0x39),  # 0x35
+    (0x3c, 0x4a, 0x49, 0x49, 0x30),  # 0x36
+    (0x01, 0x71, 0x09, 0x05, 0x03),  # 0x37
+    (0x36, 0x49, 0x49, 0x49, 0x36),  # 0x38
+    (0x06, 0x49, 0x49, 0x29, 0x1e),  # 0x39
+    (0x00, 0x36, 0x36, 0x00, 0x00),  # 0x3a
+    (0x00, 0x56, 0x36, 0x00, 0x00),  # 0x3b
+    (0x08, 0x14, 0x22, 0x41, 0x00),  # 0x3c
+    (0x14, 0x14, 0x14, 0x14, 0x14),  # 0x3d
+    (0x00, 0x41, 0x22, 0x14, 0x08),  # 0x3e
+    (0x02, 0x01, 0x51, 0x09, 0x06),  # 0x3f
+    (0x32, 0x49, 0x79, 0x41, 0x3e),  # 0x40
+    (0x7e, 0x11, 0x11, 0x11, 0x7e),  # 0x41
+    (0x7f, 0x49, 0x49, 0x49, 0x36),  # 0x42
+    (0x3e, 0x41, 0x41, 0x41, 0x22),  # 0x43
+    (0x7f, 0x41, 0x41, 0x22, 0x1c),  # 0x44
+    (0x7f, 0x49, 0x49, 0x49, 0x41),  # 0x45
+    (0x7f, 0x09, 0x09, 0x09, 0x01),  # 0x46
+    (0x3e, 0x41, 0x49, 0x49, 0x7a),  # 0x47
+    (0x7f, 0x08, 0x08, 0x08, 0x7f),  # 0x48
+    (0x00, 0x41, 0x7f, 0x41, 0x00),  # 0x49
+    (0x20, 0x40, 0x41, 0x3f, 0x01),  # 0x4a
+    (0x7f, 0x08, 0x14, 0x22, 0x41),  # 0x4b
+    (0x7f, 0x40, 0x40, 0x40, 0x40),  # 0x4c
+    (0x7f, 0x02, 0x0c, 0x02, 0x7f),  # 0x4d
+    (0x7f, 0x04, 0x08, 0x10, 0x7f),  # 0x4e
+    (0x3e, 0x41, 0x41, 0x41, 0x3e),  # 0x4f
+    (0x7f, 0x09, 0x09, 0x09, 0x06),  # 0x50
+    (0x3e, 0x41, 0x51, 0x21, 0x5e),  # 0x51
+    (0x7f, 0x09, 0x19, 0x29, 0x46),  # 0x52
+    (0x46, 0x49, 0x49, 0x49, 0x31),  # 0x53
+    (0x01, 0x01, 0x7f, 0x01, 0x01),  # 0x54
+    (0x3f, 0x40, 0x40, 0x40, 0x3f),  # 0x55
+    (0x1f, 0x20, 0x40, 0x20, 0x1f),  # 0x56
+    (0x3f, 0x40, 0x38, 0x40, 0x3f),  # 0x57
+    (0x63, 0x14, 0x08, 0x14, 0x63),  # 0x58
+    (0x07, 0x08, 0x70, 0x08, 0x07),  # 0x59
+    (0x61, 0x51, 0x49, 0x45, 0x43),  # 0x5a
+    (0x00, 0x7f, 0x41, 0x41, 0x00),  # 0x5b
+    (0x02, 0x04, 0x08, 0x10, 0x20),  # 0x5c
+    (0x00, 0x41, 0x41, 0x7f, 0x00),  # 0x5d
+    (0x04, 0x02, 0x01, 0x02, 0x04),  # 0x5e
+    (0x40, 0x40, 0x40, 0x40, 0x40),  # 0x5f
+    (0x00, 0x01, 0x02, 0x04, 0x00),  # 0x60
+    (0x20, 0x54, 0x54, 0x54, 0x78),  # 0x61
+    (0x7f, 0x48, 0x44, 0x44, 0x38),  # 0x62
+    (0x38, 0x44, 0x44, 0x44, 0x20),  # 0x63
+    (0x38, 0x44, 0x44, 0x48, 0x7f),  # 0x64
+    (0x38, 0x54, 0x54, 0x54, 0x18),  # 0x65
+    (0x08, 0x7e, 0x09, 0x01, 0x02),  # 0x66
+    (0x0c, 0x52, 0x52, 0x52, 0x3e),  # 0x67
+    (0x7f, 0x08, 0x04, 0x04, 0x78),  # 0x68
+    (0x00, 0x44, 0x7d, 0x40, 0x00),  # 0x69
+    (0x20, 0x40, 0x44, 0x3d, 0x00),  # 0x6a
+    (0x7f, 0x10, 0x28, 0x44, 0x00),  # 0x6b
+    (0x00, 0x41, 0x7f, 0x40, 0x00),  # 0x6c
+    (0x7c, 0x04, 0x18, 0x04, 0x78),  # 0x6d
+    (0x7c, 0x08, 0x04, 0x04, 0x78),  # 0x6e
+    (0x38, 0x44, 0x44, 0x44, 0x38),  # 0x6f
+    (0x7c, 0x14, 0x14, 0x14, 0x08),  # 0x70
+    (0x08, 0x14, 0x14, 0x18, 0x7c),  # 0x71
+    (0x7c, 0x08, 0x04, 0x04, 0x08),  # 0x72
+    (0x48, 0x54, 0x54, 0x54, 0x20),  # 0x73
+    (0x04, 0x3f, 0x44, 0x40, 0x20),  # 0x74
+    (0x3c, 0x40, 0x40, 0x20, 0x7c),  # 0x75
+    (0x1c, 0x20, 0x40, 0x20, 0x1c),  # 0x76
+    (0x3c, 0x40, 0x30, 0x40, 0x3c),  # 0x77
+    (0x44, 0x28, 0x10, 0x28, 0x44),  # 0x78
+    (0x0c, 0x50, 0x50, 0x50, 0x3c),  # 0x79
+    (0x44, 0x64, 0x54, 0x4c, 0x44),  # 0x7a
+    (0x00, 0x08, 0x36, 0x41, 0x00),  # 0x7b
+    (0x00, 0x00, 0x7f, 0x00, 0x00),  # 0x7c
+    (0x00, 0x41, 0x36, 0x08, 0x00),  # 0x7d
+    (0x10, 0x08, 0x08, 0x10, 0x08),  # 0x7e
+    (0x00, 0x06, 0x09, 0x09, 0x06),  # 0x7f
+]
+
+# Fonts: name, comment, horizontal and vertical scale, first and last character
+FONTS = [
+    ('small', '5x7 text, ASCII 0x20-0x7f', 1, 1, 0x20, 0x7f),
+    ('medium', '10x14 text, ASCII 0x20-0x7f', 2, 2, 0x20, 0x7f),
+    ('large', '10x21 clock digits, "0"-":"', 2, 3, 0x30, 0x3a),
+]
+
+# Icons as ASCII art, "#" lit
+ICONS = [
+    ('record', [
+        '..####..',
+        '.######.',
+        '########',
+        '########',
+        '########',
+        '########',
+        '.######.',
+        '..####..',
+    ]),
+    ('pause', [
+        '.##..##.',
+        '.##..##.',
+        '.##..##.',
+        '.##..##.',
+        '.##..##.',
+        '.##..##.',
+        '.##..##.',
+        '.##..##.',
+    ]),
+]
+
+
+def pack(pixels, width, height):
+    """Packs rows of 0/1 pixels into page-major column bytes."""
+    pages = (height + 7) // 8
+    out = []
+    for page in range(pages):
+        for x in range(width):
+            byte = 0
+            for bit in range(8):
+                y = page * 8 + bit
+                if y < height and pixels[y][x]:
+                    byte |= 1 << bit
+            out.append(byte)
+    return out, pages
+
+
+def glyph_pixels(code, sx, sy):
+    """Scales one 5x7 glyph, spacing column and blank bottom row included, to (6 * sx) x (8 * sy)."""
+    columns = list(FONT_5X7[code - 0x20]) + [0]
+    width = len(columns) * sx
+    height = 8 * sy
+    return [[(columns[x // sx] >> (y // sy)) & 1 for x in range(width)] for y in range(height)], width, height
+
+
+def c_bytes(data, indent='    ', per_line=16):
+    lines = []
+    for i in range(0, len(data), per_line):
+        lines.append(indent + ','.join('0x%02x' % b for b in data[i:i + per_line]) + ',')
+    return '\n'.join(lines)
+
+
+def generate():
+    header = [
+        '// Generated by tools/gen_glyphs.py, do not edit.',
+        '#ifndef OLED_GLYPHS_H',
+        '#define OLED_GLYPHS_H',
+        '',
+        '#include "oled_gfx.h"',
+        '',
+    ]
+    source = [
+        '// Generated by tools/gen_glyphs.py, do not edit.',
+        '#include "oled_glyphs.h"',
+        '',
+    ]
+    for name, comment, sx, sy, first, last in FONTS:
+        data = []
+        for code in range(first, last + 1):
+            pixels, width, height = glyph_pixels(code, sx, sy)
+            packed, pages = pack(pixels, width, height)
+            data.extend(packed)
+        header.append('extern const oled_font_t oled_font_%s;  // %s' % (name, comment))
+        source.append('static const uint8_t s_font_%s[] = {' % name)
+        source.append(c_bytes(data))
+        source.append('};')
+        source.append('')
+        source.append('const oled_font_t oled_font_%s = {' % name)
+        source.append('    .width = %d,' % width)
+        source.append('    .pages = %d,' % pages)
+        source.append("    .first = 0x%02x," % first)
+        source.append("    .last = 0x%02x," % last)
+        source.append('    .bitmap = s_font_%s,' % name)
+        source.append('};')
+        source.append('')
+    for name, art in ICONS:
+        width = len(art[0])
+        height = len(art)
+        packed, pages = pack([[c == '#' for c in row] for row in art], width, height)
+        header.append('extern const oled_icon_t oled_icon_%s;  // %dx%d' % (name, width, height))
+        source.append('static const uint8_t s_icon_%s[] = {' % name)
+        source.append(c_bytes(packed))
+        source.append('};')
+        source.append('')
+        source.append('const oled_icon_t oled_icon_%s = {' % name)
+        source.append('    .width = %d,' % width)
+        source.append('    .pages = %d,' % pages)
+        source.append('    .bitmap = s_icon_%s,' % name)
+        source.append('};')
+        source.append('')
+    header += ['', '#endif  // OLED_GLYPHS_H', '']
+    return '\n'.join(header), '\n'.join(source)
+
+
+def write_if_changed(path, text):
+    if os.path.exists(path):
+        with open(path) as f:
+            if f.read() == text:
+                return
+    with open(path, 'w') as f:
+        f.write(text)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--out-dir', required=True, help='Directory for oled_glyphs.c and oled_glyphs.h')
+    args = parser.parse_args()
+    header, source = generate()
+    os.makedirs(args.out_dir, exist_ok=True)
+    write_if_changed(os.path.join(args.out_dir, 'oled_glyphs.h'), header)
+    write_if_changed(os.path.join(args.out_dir, 'oled_glyphs.c'), source)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,299 @@
+#include "rec_mtp.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "esp_log.h"
+
+static const char *TAG = "rec_mtp";
+
+// Picks the MTP object format from the file extension.
+static uint16_t s_format(const char *name)
+{
+    const char *dot = strrchr(name, '.');
+    if (dot == NULL) {
+        return REC_MTP_FORMAT_UNDEFINED;
+    }
+    if (strcasecmp(dot, ".wav") == 0) {
+        return REC_MTP_FORMAT_WAV;
+    }
+    if (strcasecmp(dot, ".flac") == 0) {
+        return REC_MTP_FORMAT_FLAC;
+    }
+    if (strcasecmp(dot, ".opus") == 0 || strcasecmp(dot, ".ogg") == 0) {
+        return REC_MTP_FORMAT_OGG;
+    }
+    if (strcasecmp(dot, ".raw") == 0 || strcasecmp(dot, ".pcm") == 0) {
+        return REC_MTP_FORMAT_AUDIO;
+    }
+    return REC_MTP_FORMAT_UNDEFINED;
+}
+
+// Builds the FatFs path of a file on the card.
+static void s_path(const rec_mtp_t *mtp, const char *dir, const char *name, char *out, size_t out_size)
+{
+    if (dir[0] != '\0') {
+        snprintf(out, out_size, "%u:/%s/%s", mtp->pdrv, dir, name);
+    } else {
+        snprintf(out, out_size, "%u:/%s", mtp->pdrv, name);
+    }
+}
+
+// Appends a file to the object table; the caller holds the lock. Returns its index, -1 if it cannot be listed.
+static int s_append(rec_mtp_t *mtp, const char *dir, const char *name, int64_t mtime)
+{
+    char path[REC_MTP_PATH_MAX];
+    FILINFO info;
+    s_path(mtp, dir, name, path, sizeof(path));
+    // ObjectInfo carries a 32-bit size
+    if (f_stat(path, &info) != FR_OK || (uint64_t)info.fsize > 0xFFFFFFFFull) {
+        return -1;
+    }
+    if (mtp->count == mtp->cap) {
+        size_t cap = mtp->cap ? mtp->cap * 2 : 64;
+        rec_mtp_object_t *objects = realloc(mtp->objects, cap * sizeof(*objects));
+        if (objects == NULL) {
+            return -1;
+        }
+        mtp->objects = objects;
+        mtp->cap = cap;
+    }
+    rec_mtp_object_t *obj = &mtp->objects[mtp->count];
+    snprintf(obj->dir, sizeof(obj->dir), "%s", dir);
+    snprintf(obj->name, sizeof(obj->name), "%s", name);
+    obj->size = (uint64_t)info.fsize;
+    obj->mtime = mtime;
+    obj->format = s_format(name);
+    return (int)mtp->count++;
+}
+
+// Appends every segment of a finished recording; the caller holds the lock. Returns the segments listed.
+static uint32_t s_append_recording(rec_mtp_t *mtp, const rec_catalog_entry_t *entry, uint32_t *first)
+{
+    const uint16_t segments = entry->segments ? entry->segments : 1;
+    uint32_t listed = 0;
+    for (uint16_t i = 0; i < segments; i++) {
+        char name[REC_CATALOG_SEGMENT_MAX];
+        rec_catalog_segment_name(entry, i, name, sizeof(name));
+        const int index = s_append(mtp, entry->dir, name, entry->start_time);
+        if (index < 0) {
+            continue;
+        }
+        if (listed++ == 0 && first != NULL) {
+            *first = (uint32_t)index;
+        }
+    }
+    return listed;
+}
+
+typedef struct {
+    rec_mtp_t *mtp;
+    size_t skip;                 // Oldest recordings left out to stay within REC_MTP_MAX_OBJECTS
+    uint32_t skipped;            // Segments that could not be listed
+} build_ctx_t;
+
+// Catalog visitor: lists every segment of a finished recording.
+static bool s_visit(const rec_catalog_entry_t *entry, void *arg)
+{
+    build_ctx_t *ctx = (build_ctx_t *)arg;
+
+    if (ctx->skip > 0) {
+        ctx->skip--;
+        return true;
+    }
+    if (entry->state != REC_CATALOG_DONE && entry->state != REC_CATALOG_INTERRUPTED) {
+        return true;
+    }
+    const uint16_t segments = entry->segments ? entry->segments : 1;
+    ctx->skipped += segments - s_append_recording(ctx->mtp, entry, NULL);
+    return ctx->mtp->count < REC_MTP_MAX_OBJECTS;
+}
+
+// Prepares an empty object table for the card mounted as FatFs drive pdrv.
+int rec_mtp_init(rec_mtp_t *mtp, uint8_t pdrv)
+{
+    memset(mtp, 0, sizeof(*mtp));
+    mtp->pdrv = pdrv;
+
+    // The FATFS object lives as long as the card is mounted; it answers the capacity without a FAT scan
+    DIR dir;
+    char root[8];
+    snprintf(root, sizeof(root), "%u:/", pdrv);
+    if (f_opendir(&dir, root) != FR_OK) {
+        return -1;
+    }
+    mtp->fs = dir.obj.fs;
+    f_closedir(&dir);
+
+    mtp->lock = xSemaphoreCreateMutex();
+    mtp->fil = malloc(sizeof(FIL));
+    if (mtp->lock == NULL || mtp->fil == NULL) {
+        rec_mtp_deinit(mtp);
+        return -1;
+    }
+    return 0;
+}
+
+// Frees the object table.
+void rec_mtp_deinit(rec_mtp_t *mtp)
+{
+    if (mtp->open) {
+        f_close(mtp->fil);
+    }
+    if (mtp->lock != NULL) {
+        vSemaphoreDelete(mtp->lock);
+    }
+    free(mtp->fil);
+    free(mtp->objects);
+    memset(mtp, 0, sizeof(*mtp));
+}
+
+// Lists the finished recordings of the catalog, newest REC_MTP_MAX_OBJECTS. Call once, before the host connects.
+int rec_mtp_build(rec_mtp_t *mtp, const rec_catalog_t *cat)
+{
+    build_ctx_t ctx = {
+        .mtp = mtp,
+    };
+    const size_t count = rec_catalog_count(cat);
+    ctx.skip = (count > REC_MTP_MAX_OBJECTS) ? count - REC_MTP_MAX_OBJECTS : 0;
+
+    xSemaphoreTake(mtp->lock, portMAX_DELAY);
+    rec_catalog_list(cat, s_visit, &ctx);
+    xSemaphoreGive(mtp->lock);
+
+    if (ctx.skipped > 0) {
+        ESP_LOGW(TAG, "%u file(s) left out of the MTP listing", (unsigned)ctx.skipped);
+    }
+    ESP_LOGI(TAG, "%u objects listed", (unsigned)mtp->count);
+    return 0;
+}
+
+// Lists one more file, e.g. one that is not a recording. index receives its object index.
+int rec_mtp_add_file(rec_mtp_t *mtp, const char *dir, const char *name, int64_t mtime, uint32_t *index)
+{
+    xSemaphoreTake(mtp->lock, portMAX_DELAY);
+    const int ret = s_append(mtp, dir, name, mtime);
+    xSemaphoreGive(mtp->lock);
+    if (ret < 0) {
+        return -1;
+    }
+    if (index != NULL) {
+        *index = (uint32_t)ret;
+    }
+    return 0;
+}
+
+// Lists the segments of a recording that just finished. first and count receive the new object indices.
+int rec_mtp_add_recording(rec_mtp_t *mtp, const rec_catalog_entry_t *entry, uint32_t *first, uint32_t *count)
+{
+    xSemaphoreTake(mtp->lock, portMAX_DELAY);
+    const uint32_t listed = s_append_recording(mtp, entry, first);
+    xSemaphoreGive(mtp->lock);
+    *count = listed;
+    return (listed > 0) ? 0 : -1;
+}
+
+// MTP backend: number of objects.
+static uint32_t s_count(void *arg)
+{
+    rec_mtp_t *mtp = (rec_mtp_t *)arg;
+    xSemaphoreTake(mtp->lock, portMAX_DELAY);
+    const uint32_t count = (uint32_t)mtp->count;
+    xSemaphoreGive(mtp->lock);
+    return count;
+}
+
+// MTP backend: describes one object.
+static esp_err_t s_get(uint32_t index, tinyusb_mtp_object_t *object, void *arg)
+{
+    rec_mtp_t *mtp = (rec_mtp_t *)arg;
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+
+    xSemaphoreTake(mtp->lock, portMAX_DELAY);
+    if (index < mtp->count) {
+        const rec_mtp_object_t *obj = &mtp->objects[index];
+        snprintf(object->name, sizeof(object->name), "%s", obj->name);
+        object->size = obj->size;
+        object->format = obj->format;
+        object->mtime = (obj->mtime >= REC_CATALOG_CLOCK_VALID) ? obj->mtime : 0;
+        ret = ESP_OK;
+    }
+    xSemaphoreGive(mtp->lock);
+    return ret;
+}
+
+// MTP backend: opens one object for reading.
+static esp_err_t s_open(uint32_t index, void *arg)
+{
+    rec_mtp_t *mtp = (rec_mtp_t *)arg;
+    char path[REC_MTP_PATH_MAX];
+
+    xSemaphoreTake(mtp->lock, portMAX_DELAY);
+    const bool found = index < mtp->count;
+    if (found) {
+        s_path(mtp, mtp->objects[index].dir, mtp->objects[index].name, path, sizeof(path));
+    }
+    xSemaphoreGive(mtp->lock);
+
+    if (!found || mtp->open) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (f_open(mtp->fil, path, FA_READ) != FR_OK) {
+        ESP_LOGW(TAG, "Cannot open %s", path);
+        return ESP_FAIL;
+    }
+    mtp->open = true;
+    return ESP_OK;
+}
+
+// MTP backend: reads from the open object. Offsets are sector aligned, so FatFs reads whole sectors
+// straight into dest without its sector buffer.
+static esp_err_t s_read(uint64_t offset, void *dest, size_t size, size_t *read_size, void *arg)
+{
+    rec_mtp_t *mtp = (rec_mtp_t *)arg;
+    UINT got = 0;
+
+    if (!mtp->open || f_lseek(mtp->fil, (FSIZE_t)offset) != FR_OK || f_read(mtp->fil, dest, size, &got) != FR_OK) {
+        return ESP_FAIL;
+    }
+    *read_size = got;
+    return ESP_OK;
+}
+
+// MTP backend: closes the open object.
+static void s_close(void *arg)
+{
+    rec_mtp_t *mtp = (rec_mtp_t *)arg;
+    if (mtp->open) {
+        f_close(mtp->fil);
+        mtp->open = false;
+    }
+}
+
+// MTP backend: card size and free space, from the FSInfo count FatFs keeps.
+static esp_err_t s_capacity(uint64_t *total_bytes, uint64_t *free_bytes, void *arg)
+{
+    rec_mtp_t *mtp = (rec_mtp_t *)arg;
+    const FATFS *fs = mtp->fs;
+#if FF_MAX_SS != FF_MIN_SS
+    const uint64_t cluster_bytes = (uint64_t)fs->csize * fs->ssize;
+#else
+    const uint64_t cluster_bytes = (uint64_t)fs->csize * FF_MAX_SS;
+#endif
+    *total_bytes = (uint64_t)(fs->n_fatent - 2) * cluster_bytes;
+    *free_bytes = (fs->free_clst <= fs->n_fatent - 2) ? (uint64_t)fs->free_clst * cluster_bytes : 0;
+    return ESP_OK;
+}
+
+// Fills the backend part of an MTP responder configuration.
+void rec_mtp_config(rec_mtp_t *mtp, tinyusb_mtp_config_t *config)
+{
+    config->ops.count = s_count;
+    config->ops.get = s_get;
+    config->ops.open = s_open;
+    config->ops.read = s_read;
+    config->ops.close = s_close;
+    config->ops.capacity = s_capacity;
+    config->arg = mtp;
+}
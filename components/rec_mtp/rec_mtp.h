@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "ff.h"
+#include "rec_catalog.h"
+#include "tinyusb_mtp.h"
+
+// MTP storage backend over the recording catalog: every segment of a finished recording is one object, read
+// from the card with FatFs while the card stays mounted for the recorder. Objects are only ever appended, so an
+// object's index, and with it the handle the host sees, stays valid for as long as the device is connected.
+
+#define REC_MTP_MAX_OBJECTS      1024       // Newest recordings listed at boot
+#define REC_MTP_PATH_MAX         (REC_CATALOG_DIR_MAX + REC_CATALOG_SEGMENT_MAX + 8)
+
+// MTP object format codes
+#define REC_MTP_FORMAT_UNDEFINED 0x3000
+#define REC_MTP_FORMAT_WAV       0x3008
+#define REC_MTP_FORMAT_AUDIO     0xB900     // Undefined audio, raw PCM
+#define REC_MTP_FORMAT_OGG       0xB902
+#define REC_MTP_FORMAT_FLAC      0xB906
+
+typedef struct {
+    char dir[REC_CATALOG_DIR_MAX];   // Directory under the card root, empty for the root itself
+    char name[REC_CATALOG_SEGMENT_MAX];
+    uint64_t size;
+    int64_t mtime;
+    uint16_t format;
+} rec_mtp_object_t;
+
+typedef struct {
+    uint8_t pdrv;                // FatFs drive of the card
+    FATFS *fs;
+    SemaphoreHandle_t lock;      // Guards the object table against the TinyUSB task
+    rec_mtp_object_t *objects;
+    size_t count;
+    size_t cap;
+    FIL *fil;                    // Object open for the host
+    bool open;
+} rec_mtp_t;
+
+int rec_mtp_init(rec_mtp_t *mtp, uint8_t pdrv);
+void rec_mtp_deinit(rec_mtp_t *mtp);
+int rec_mtp_build(rec_mtp_t *mtp, const rec_catalog_t *cat);
+int rec_mtp_add_file(rec_mtp_t *mtp, const char *dir, const char *name, int64_t mtime, uint32_t *index);
+int rec_mtp_add_recording(rec_mtp_t *mtp, const rec_catalog_entry_t *entry, uint32_t *first, uint32_t *count);
+void rec_mtp_config(rec_mtp_t *mtp, tinyusb_mtp_config_t *config);
@@ -0,0 +1,473 @@
+#include "rec_view.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define VIEW_DIR_ENTRY_BYTES   32
+#define VIEW_DIR_PER_SECTOR    (REC_VIEW_SECTOR_SIZE / VIEW_DIR_ENTRY_BYTES)
+#define VIEW_FAT_PER_SECTOR    (REC_VIEW_SECTOR_SIZE / 4)
+#define VIEW_LFN_CHARS         13
+#define VIEW_FAT_EOC           0x0FFFFFFFu
+#define VIEW_FAT_MEDIA         0x0FFFFFF8u
+#define VIEW_MAX_CLUSTERS      0x0FFFFFF5u
+#define VIEW_FSINFO_SECTOR     1
+#define VIEW_BACKUP_SECTOR     6
+#define VIEW_ATTR_READ_ONLY    0x01
+#define VIEW_ATTR_VOLUME_ID    0x08
+#define VIEW_ATTR_ARCHIVE      0x20
+#define VIEW_ATTR_LFN          0x0F
+#define VIEW_LABEL             "RECORDINGS "
+#define VIEW_FAT_DATE_EPOCH    ((1 << 5) | 1)   // 1980-01-01, for recordings made before the clock was set
+
+// Stores a 16-bit little-endian value.
+static void s_put_le16(uint8_t *p, uint16_t value)
+{
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+}
+
+// Stores a 32-bit little-endian value.
+static void s_put_le32(uint8_t *p, uint32_t value)
+{
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = (value >> 24) & 0xff;
+}
+
+// Number of long name entries a name needs.
+static uint32_t s_lfn_entries(const char *name)
+{
+    return (uint32_t)(strlen(name) + VIEW_LFN_CHARS - 1) / VIEW_LFN_CHARS;
+}
+
+// Builds the 8.3 name of the file at position pos: R0000123 plus the first three letters of the extension.
+static void s_short_name(const rec_view_file_t *file, size_t pos, uint8_t out[11])
+{
+    char base[16];
+    snprintf(base, sizeof(base), "R%07u", (unsigned)(pos % 10000000u));
+    memset(out, ' ', 11);
+    memcpy(out, base, 8);
+    const char *dot = strrchr(file->name, '.');
+    for (int i = 0; dot != NULL && i < 3 && dot[1 + i] != '\0'; i++) {
+        char c = dot[1 + i];
+        out[8 + i] = (c >= 'a' && c <= 'z') ? (uint8_t)(c - 'a' + 'A') : (uint8_t)c;
+    }
+}
+
+// Checksum of an 8.3 name, stored in each of its long name entries.
+static uint8_t s_short_sum(const uint8_t name[11])
+{
+    uint8_t sum = 0;
+    for (int i = 0; i < 11; i++) {
+        sum = (uint8_t)(((sum & 1) << 7) + (sum >> 1) + name[i]);
+    }
+    return sum;
+}
+
+// Converts a Unix time to FAT date and time; unset clocks give the FAT epoch.
+static void s_fat_time(int64_t mtime, uint16_t *date, uint16_t *time_out)
+{
+    struct tm tm;
+    time_t t = (time_t)mtime;
+    if (mtime < REC_CATALOG_CLOCK_VALID || localtime_r(&t, &tm) == NULL || tm.tm_year < 80) {
+        *date = VIEW_FAT_DATE_EPOCH;
+        *time_out = 0;
+        return;
+    }
+    *date = (uint16_t)(((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday);
+    *time_out = (uint16_t)((tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2));
+}
+
+// Sets up an empty view over sector_count sectors; rec_view_layout() places the FATs before files are added.
+int rec_view_init(rec_view_t *view, uint32_t sector_count, rec_view_card_read_t card_read, void *arg)
+{
+    memset(view, 0, sizeof(*view));
+    view->card_read = card_read;
+    view->card_arg = arg;
+    view->sector_count = sector_count;
+    view->volume_id = sector_count;
+    return (card_read != NULL && sector_count > REC_VIEW_RESERVED) ? 0 : -1;
+}
+
+// Picks the cluster size and places the FATs. Clusters are at most the card's, so that a view cluster never
+// straddles two card clusters, and small enough to keep the volume FAT32. Empties the view.
+int rec_view_layout(rec_view_t *view, uint32_t card_cluster_sectors)
+{
+    const uint32_t sector_count = view->sector_count;
+    uint32_t cluster = REC_VIEW_MAX_CLUSTER;
+
+    rec_view_clear(view);
+    view->cluster_count = 0;
+    while (cluster > 1 && (card_cluster_sectors % cluster) != 0) {
+        cluster /= 2;
+    }
+    for (; cluster >= 1; cluster /= 2) {
+        // Sized for every sector being data; the few clusters the FATs take leave some entries unused.
+        const uint64_t entries = (uint64_t)(sector_count - REC_VIEW_RESERVED) / cluster + 2;
+        view->fat_sectors = (uint32_t)((entries * 4 + REC_VIEW_SECTOR_SIZE - 1) / REC_VIEW_SECTOR_SIZE);
+        view->data_start = REC_VIEW_RESERVED + 2 * view->fat_sectors;
+        if (view->data_start >= sector_count) {
+            return -1;
+        }
+        view->cluster_sectors = cluster;
+        view->cluster_count = (sector_count - view->data_start) / cluster;
+        if (view->cluster_count >= REC_VIEW_MIN_CLUSTERS) {
+            break;
+        }
+    }
+    if (view->cluster_count < REC_VIEW_MIN_CLUSTERS || view->cluster_count > VIEW_MAX_CLUSTERS) {
+        view->cluster_count = 0;
+        return -1;
+    }
+    return 0;
+}
+
+// Frees the file and extent tables.
+void rec_view_deinit(rec_view_t *view)
+{
+    free(view->files);
+    free(view->extents);
+    view->files = NULL;
+    view->extents = NULL;
+    view->file_cap = 0;
+    view->extent_cap = 0;
+    rec_view_clear(view);
+}
+
+// Empties the view before a rebuild; reads fail until rec_view_finish().
+void rec_view_clear(rec_view_t *view)
+{
+    view->ready = false;
+    view->file_count = 0;
+    view->extent_count = 0;
+    view->root_clusters = 0;
+    view->root_entries = 0;
+}
+
+// Appends a file; its extents follow with rec_view_add_extent().
+int rec_view_add_file(rec_view_t *view, const char *name, uint32_t size, int64_t mtime)
+{
+    if (view->file_count >= REC_VIEW_MAX_FILES || strlen(name) >= REC_VIEW_NAME_MAX || name[0] == '\0') {
+        return -1;
+    }
+    if (view->file_count == view->file_cap) {
+        size_t cap = view->file_cap ? view->file_cap * 2 : 64;
+        rec_view_file_t *files = realloc(view->files, cap * sizeof(*files));
+        if (files == NULL) {
+            return -1;
+        }
+        view->files = files;
+        view->file_cap = cap;
+    }
+    rec_view_file_t *file = &view->files[view->file_count++];
+    memset(file, 0, sizeof(*file));
+    strcpy(file->name, name);
+    file->size = size;
+    file->first_extent = (uint32_t)view->extent_count;
+    s_fat_time(mtime, &file->date, &file->time);
+    view->ready = false;
+    return 0;
+}
+
+// Maps the next count sectors of the file added last to card sectors from lba on.
+int rec_view_add_extent(rec_view_t *view, uint32_t lba, uint32_t count)
+{
+    if (view->file_count == 0 || count == 0) {
+        return -1;
+    }
+    rec_view_file_t *file = &view->files[view->file_count - 1];
+    if (file->extents > 0) {
+        rec_view_extent_t *last = &view->extents[view->extent_count - 1];
+        if (last->lba + last->count == lba) {
+            last->count += count;
+            file->mapped_sectors += count;
+            return 0;
+        }
+    }
+    if (view->extent_count == view->extent_cap) {
+        size_t cap = view->extent_cap ? view->extent_cap * 2 : 256;
+        rec_view_extent_t *extents = realloc(view->extents, cap * sizeof(*extents));
+        if (extents == NULL) {
+            return -1;
+        }
+        view->extents = extents;
+        view->extent_cap = cap;
+    }
+    view->extents[view->extent_count++] = (rec_view_extent_t){
+        .file_sector = file->mapped_sectors,
+        .lba = lba,
+        .count = count,
+    };
+    file->extents++;
+    file->mapped_sectors += count;
+    return 0;
+}
+
+// Removes the file added last with its extents, e.g. after its clusters could not be walked.
+void rec_view_drop_file(rec_view_t *view)
+{
+    if (view->file_count == 0) {
+        return;
+    }
+    view->file_count--;
+    view->extent_count = view->files[view->file_count].first_extent;
+}
+
+// Places the root directory and the files in the cluster space. Returns -1 if they do not fit.
+int rec_view_finish(rec_view_t *view)
+{
+    if (view->cluster_count == 0) {
+        return -1;
+    }
+    const uint32_t cluster_bytes = view->cluster_sectors * REC_VIEW_SECTOR_SIZE;
+    uint32_t entries = 1;   // Volume label
+    for (size_t i = 0; i < view->file_count; i++) {
+        view->files[i].dir_entry = entries;
+        entries += s_lfn_entries(view->files[i].name) + 1;
+    }
+    view->root_entries = entries;
+    view->root_clusters = (entries * VIEW_DIR_ENTRY_BYTES + cluster_bytes - 1) / cluster_bytes;
+
+    uint64_t next = 2 + (uint64_t)view->root_clusters;
+    for (size_t i = 0; i < view->file_count; i++) {
+        rec_view_file_t *file = &view->files[i];
+        file->clusters = (uint32_t)(((uint64_t)file->size + cluster_bytes - 1) / cluster_bytes);
+        file->first_cluster = (uint32_t)next;
+        next += file->clusters;
+    }
+    if (next > (uint64_t)view->cluster_count + 2) {
+        return -1;
+    }
+    view->volume_id++;      // Tells hosts that cache by volume serial that the contents changed
+    view->ready = true;
+    return 0;
+}
+
+// Finds the file holding cluster, or NULL for a free cluster. Files are in cluster order.
+static const rec_view_file_t *s_file_at_cluster(const rec_view_t *view, uint32_t cluster)
+{
+    size_t lo = 0;
+    size_t hi = view->file_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (view->files[mid].first_cluster <= cluster) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return NULL;
+    }
+    const rec_view_file_t *file = &view->files[lo - 1];
+    return (cluster - file->first_cluster < file->clusters) ? file : NULL;
+}
+
+// Finds the file whose directory entries include entry.
+static size_t s_file_at_entry(const rec_view_t *view, uint32_t entry)
+{
+    size_t lo = 0;
+    size_t hi = view->file_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (view->files[mid].dir_entry <= entry) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo - 1;
+}
+
+// Finds the extent holding a file sector, or NULL past the mapped part.
+static const rec_view_extent_t *s_extent_at(const rec_view_t *view, const rec_view_file_t *file, uint32_t sector)
+{
+    if (sector >= file->mapped_sectors) {
+        return NULL;
+    }
+    size_t lo = file->first_extent;
+    size_t hi = file->first_extent + file->extents;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (view->extents[mid].file_sector <= sector) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return &view->extents[lo - 1];
+}
+
+// Produces the boot sector.
+static void s_boot_sector(const rec_view_t *view, uint8_t *out)
+{
+    memcpy(out, "\xEB\x58\x90" "MSWIN4.1", 11);
+    s_put_le16(out + 11, REC_VIEW_SECTOR_SIZE);
+    out[13] = (uint8_t)view->cluster_sectors;
+    s_put_le16(out + 14, REC_VIEW_RESERVED);
+    out[16] = 2;                                    // FATs
+    out[21] = 0xF8;                                 // Fixed disk
+    s_put_le16(out + 24, 63);                       // Sectors per track and heads, nominal
+    s_put_le16(out + 26, 255);
+    s_put_le32(out + 32, view->sector_count);
+    s_put_le32(out + 36, view->fat_sectors);
+    s_put_le32(out + 44, 2);                        // Root directory cluster
+    s_put_le16(out + 48, VIEW_FSINFO_SECTOR);
+    s_put_le16(out + 50, VIEW_BACKUP_SECTOR);
+    out[64] = 0x80;                                 // Drive number
+    out[66] = 0x29;                                 // Extended boot signature
+    s_put_le32(out + 67, view->volume_id);
+    memcpy(out + 71, VIEW_LABEL, 11);
+    memcpy(out + 82, "FAT32   ", 8);
+    out[510] = 0x55;
+    out[511] = 0xAA;
+}
+
+// Produces the FSInfo sector; the free count is left unknown, the volume is never written.
+static void s_fsinfo_sector(uint8_t *out)
+{
+    s_put_le32(out, 0x41615252);
+    s_put_le32(out + 484, 0x61417272);
+    s_put_le32(out + 488, 0xFFFFFFFF);
+    s_put_le32(out + 492, 0xFFFFFFFF);
+    s_put_le32(out + 508, 0xAA550000);
+}
+
+// Produces one sector of the FAT: the root directory and each file are single cluster chains.
+static void s_fat_sector(const rec_view_t *view, uint32_t index, uint8_t *out)
+{
+    const uint32_t root_end = 2 + view->root_clusters;
+    uint32_t cluster = index * VIEW_FAT_PER_SECTOR;
+    const rec_view_file_t *file = NULL;
+
+    for (int i = 0; i < VIEW_FAT_PER_SECTOR; i++, cluster++) {
+        uint32_t value = 0;
+        if (cluster == 0) {
+            value = VIEW_FAT_MEDIA;
+        } else if (cluster == 1) {
+            value = VIEW_FAT_EOC;
+        } else if (cluster < root_end) {
+            value = (cluster + 1 == root_end) ? VIEW_FAT_EOC : cluster + 1;
+        } else if (cluster < view->cluster_count + 2) {
+            if (file == NULL || cluster - file->first_cluster >= file->clusters) {
+                file = s_file_at_cluster(view, cluster);
+            }
+            if (file != NULL) {
+                value = (cluster + 1 == file->first_cluster + file->clusters) ? VIEW_FAT_EOC : cluster + 1;
+            }
+        }
+        s_put_le32(out + i * 4, value);
+    }
+}
+
+// Produces one long name entry, order counted from 1 at the start of the name.
+static void s_lfn_entry(const char *name, uint32_t order, bool last, uint8_t sum, uint8_t *out)
+{
+    static const uint8_t offsets[VIEW_LFN_CHARS] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+    const size_t len = strlen(name);
+
+    out[0] = (uint8_t)(order | (last ? 0x40 : 0));
+    out[11] = VIEW_ATTR_LFN;
+    out[13] = sum;
+    for (int i = 0; i < VIEW_LFN_CHARS; i++) {
+        const size_t at = (order - 1) * VIEW_LFN_CHARS + i;
+        uint16_t c = 0xFFFF;
+        if (at < len) {
+            c = (uint8_t)name[at];
+        } else if (at == len) {
+            c = 0;
+        }
+        s_put_le16(out + offsets[i], c);
+    }
+}
+
+// Produces one sector of the root directory: the volume label, then each file's long name and 8.3 entries.
+static void s_dir_sector(const rec_view_t *view, uint32_t index, uint8_t *out)
+{
+    uint32_t entry = index * VIEW_DIR_PER_SECTOR;
+
+    for (int i = 0; i < VIEW_DIR_PER_SECTOR && entry < view->root_entries; i++, entry++) {
+        uint8_t *e = out + i * VIEW_DIR_ENTRY_BYTES;
+        if (entry == 0) {
+            memcpy(e, VIEW_LABEL, 11);
+            e[11] = VIEW_ATTR_VOLUME_ID;
+            continue;
+        }
+        const size_t pos = s_file_at_entry(view, entry);
+        const rec_view_file_t *file = &view->files[pos];
+        const uint32_t lfn = s_lfn_entries(file->name);
+        const uint32_t k = entry - file->dir_entry;
+        uint8_t short_name[11];
+        s_short_name(file, pos, short_name);
+
+        if (k < lfn) {
+            // Long name entries come last part first
+            s_lfn_entry(file->name, lfn - k, k == 0, s_short_sum(short_name), e);
+            continue;
+        }
+        memcpy(e, short_name, 11);
+        e[11] = VIEW_ATTR_READ_ONLY | VIEW_ATTR_ARCHIVE;
+        s_put_le16(e + 14, file->time);
+        s_put_le16(e + 16, file->date);
+        s_put_le16(e + 18, file->date);
+        const uint32_t first = file->clusters ? file->first_cluster : 0;   // Empty files own no cluster
+        s_put_le16(e + 20, (uint16_t)(first >> 16));
+        s_put_le16(e + 22, file->time);
+        s_put_le16(e + 24, file->date);
+        s_put_le16(e + 26, (uint16_t)first);
+        s_put_le32(e + 28, file->size);
+    }
+}
+
+// Reads count sectors of the view. File data comes from the card in runs as long as the extents allow,
+// everything else is produced in place. Returns -1 if the view is not ready or the card read fails.
+int rec_view_read(rec_view_t *view, uint32_t lba, uint32_t count, void *dest)
+{
+    uint8_t *out = (uint8_t *)dest;
+
+    if (!view->ready || lba >= view->sector_count || count > view->sector_count - lba) {
+        return -1;
+    }
+    while (count > 0) {
+        uint32_t n = 1;
+        memset(out, 0, REC_VIEW_SECTOR_SIZE);
+
+        if (lba < REC_VIEW_RESERVED) {
+            if (lba == 0 || lba == VIEW_BACKUP_SECTOR) {
+                s_boot_sector(view, out);
+            } else if (lba == VIEW_FSINFO_SECTOR || lba == VIEW_BACKUP_SECTOR + VIEW_FSINFO_SECTOR) {
+                s_fsinfo_sector(out);
+            }
+        } else if (lba < view->data_start) {
+            s_fat_sector(view, (lba - REC_VIEW_RESERVED) % view->fat_sectors, out);
+        } else {
+            const uint32_t rel = lba - view->data_start;
+            const uint32_t cluster = 2 + rel / view->cluster_sectors;
+            if (cluster < 2 + view->root_clusters) {
+                s_dir_sector(view, rel, out);
+            } else {
+                const rec_view_file_t *file = s_file_at_cluster(view, cluster);
+                if (file != NULL) {
+                    const uint32_t sector = rel - (file->first_cluster - 2) * view->cluster_sectors;
+                    const rec_view_extent_t *ext = s_extent_at(view, file, sector);
+                    if (ext != NULL) {
+                        const uint32_t in_ext = ext->count - (sector - ext->file_sector);
+                        const uint32_t in_file = file->clusters * view->cluster_sectors - sector;
+                        n = count < in_ext ? count : in_ext;
+                        n = n < in_file ? n : in_file;
+                        if (view->card_read(ext->lba + (sector - ext->file_sector), n, out, view->card_arg) != 0) {
+                            return -1;
+                        }
+                    }
+                }
+            }
+        }
+        out += (size_t)n * REC_VIEW_SECTOR_SIZE;
+        lba += n;
+        count -= n;
+    }
+    return 0;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "rec_catalog.h"
+
+// Read-only FAT32 view of the finished recordings, produced sector by sector for a virtual USB drive.
+// Only the boot sector, the FATs and the root directory are synthesized; each file's clusters map straight to
+// the card sectors that hold its data, so nothing is copied and the application keeps the card mounted
+// read-write. The view is a snapshot: rebuild it whenever the files may have moved, while nobody reads it.
+// rec_view.c is plain C and can be tested on a host; rec_view_scan.c fills the view from the catalog with FatFs.
+
+#define REC_VIEW_SECTOR_SIZE     512
+#define REC_VIEW_RESERVED        32         // Boot sector, FSInfo, backups at 6 and 7
+#define REC_VIEW_MAX_CLUSTER     64         // Sectors per cluster, at most 32 KB
+#define REC_VIEW_MIN_CLUSTERS    65536      // FAT32 needs at least 65525 clusters
+#define REC_VIEW_MAX_FILES       1024       // Newest recordings kept in the view
+#define REC_VIEW_NAME_MAX        REC_CATALOG_SEGMENT_MAX
+
+// Reads count whole card sectors; returns 0 on success, -1 on error.
+typedef int (*rec_view_card_read_t)(uint32_t lba, uint32_t count, void *dest, void *arg);
+
+typedef struct {
+    uint32_t file_sector;        // First sector of the run within the file
+    uint32_t lba;                // Card sector holding it
+    uint32_t count;
+} rec_view_extent_t;
+
+typedef struct {
+    char name[REC_VIEW_NAME_MAX];
+    uint32_t size;
+    uint16_t date;               // FAT date and time of the recording start
+    uint16_t time;
+    uint32_t first_cluster;      // Assigned by rec_view_finish()
+    uint32_t clusters;
+    uint32_t dir_entry;          // First directory entry, long name entries included
+    uint32_t first_extent;
+    uint32_t extents;
+    uint32_t mapped_sectors;     // File sectors covered by its extents
+} rec_view_file_t;
+
+typedef struct {
+    uint32_t sector_count;       // Size of the volume, the card's size
+    uint32_t cluster_sectors;
+    uint32_t fat_sectors;        // Per FAT
+    uint32_t data_start;         // Sector of cluster 2
+    uint32_t cluster_count;      // 0 until rec_view_layout() succeeds
+    uint32_t root_clusters;      // Root directory from cluster 2 on
+    uint32_t root_entries;       // Volume label and files
+    uint32_t volume_id;
+    bool ready;                  // rec_view_finish() succeeded, sectors can be read
+    rec_view_file_t *files;
+    size_t file_count;
+    size_t file_cap;
+    rec_view_extent_t *extents;
+    size_t extent_count;
+    size_t extent_cap;
+    rec_view_card_read_t card_read;
+    void *card_arg;
+} rec_view_t;
+
+int rec_view_init(rec_view_t *view, uint32_t sector_count, rec_view_card_read_t card_read, void *arg);
+int rec_view_layout(rec_view_t *view, uint32_t card_cluster_sectors);
+void rec_view_deinit(rec_view_t *view);
+void rec_view_clear(rec_view_t *view);
+int rec_view_add_file(rec_view_t *view, const char *name, uint32_t size, int64_t mtime);
+int rec_view_add_extent(rec_view_t *view, uint32_t lba, uint32_t count);
+void rec_view_drop_file(rec_view_t *view);
+int rec_view_finish(rec_view_t *view);
+int rec_view_read(rec_view_t *view, uint32_t lba, uint32_t count, void *dest);
+int rec_view_build(rec_view_t *view, const rec_catalog_t *cat, uint8_t pdrv);
@@ -0,0 +1,130 @@
+#include "rec_view.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ff.h"
+#include "esp_log.h"
+
+static const char *TAG = "rec_view";
+
+#define VIEW_PATH_MAX          (REC_CATALOG_DIR_MAX + REC_VIEW_NAME_MAX + 8)
+#define VIEW_FILE_LIMIT        0xFFFFFFFFull    // FAT32 file size limit
+
+typedef struct {
+    rec_view_t *view;
+    uint8_t pdrv;
+    FIL *fil;
+    size_t skip;                 // Oldest recordings left out to stay within REC_VIEW_MAX_FILES
+    uint32_t skipped;            // Segments that could not be mapped
+} scan_ctx_t;
+
+// Adds one file to the view with the card sectors of each of its clusters. FatFs follows the chain
+// incrementally on forward seeks, so the walk reads each FAT sector once.
+static int s_add_file(scan_ctx_t *ctx, const char *dir, const char *name, int64_t mtime)
+{
+    char path[VIEW_PATH_MAX];
+    if (dir[0] != '\0') {
+        snprintf(path, sizeof(path), "%u:/%s/%s", ctx->pdrv, dir, name);
+    } else {
+        snprintf(path, sizeof(path), "%u:/%s", ctx->pdrv, name);
+    }
+    if (f_open(ctx->fil, path, FA_READ) != FR_OK) {
+        return -1;
+    }
+    const FSIZE_t size = f_size(ctx->fil);
+    const FATFS *fs = ctx->fil->obj.fs;
+#if FF_MAX_SS != FF_MIN_SS
+    const bool sector_ok = (fs->ssize == REC_VIEW_SECTOR_SIZE);
+#else
+    const bool sector_ok = (FF_MAX_SS == REC_VIEW_SECTOR_SIZE);
+#endif
+    if (size > VIEW_FILE_LIMIT || !sector_ok || rec_view_add_file(ctx->view, name, (uint32_t)size, mtime) != 0) {
+        f_close(ctx->fil);
+        return -1;
+    }
+
+    const FSIZE_t cluster_bytes = (FSIZE_t)fs->csize * REC_VIEW_SECTOR_SIZE;
+    for (FSIZE_t pos = 0; pos < size; pos += cluster_bytes) {
+        // Seeking to the byte after pos leaves the file on the cluster holding pos
+        if (f_lseek(ctx->fil, pos + 1) != FR_OK || ctx->fil->clust < 2
+                || rec_view_add_extent(ctx->view, (uint32_t)(fs->database + (LBA_t)(ctx->fil->clust - 2) * fs->csize),
+                                       fs->csize) != 0) {
+            rec_view_drop_file(ctx->view);
+            f_close(ctx->fil);
+            return -1;
+        }
+    }
+    f_close(ctx->fil);
+    return 0;
+}
+
+// Catalog visitor: adds every segment of a finished recording.
+static bool s_visit(const rec_catalog_entry_t *entry, void *arg)
+{
+    scan_ctx_t *ctx = (scan_ctx_t *)arg;
+
+    if (ctx->skip > 0) {
+        ctx->skip--;
+        return true;
+    }
+    if (entry->state != REC_CATALOG_DONE && entry->state != REC_CATALOG_INTERRUPTED) {
+        return true;
+    }
+    const uint16_t segments = entry->segments ? entry->segments : 1;
+    for (uint16_t i = 0; i < segments; i++) {
+        char name[REC_VIEW_NAME_MAX];
+        rec_catalog_segment_name(entry, i, name, sizeof(name));
+        if (s_add_file(ctx, entry->dir, name, entry->start_time) != 0) {
+            ctx->skipped++;
+        }
+    }
+    return ctx->view->file_count < REC_VIEW_MAX_FILES;
+}
+
+// Rebuilds the view from the catalog: every finished recording, newest REC_VIEW_MAX_FILES, flattened into the
+// root directory. pdrv is the FatFs drive of the card. Call only while the view is hidden from the host.
+int rec_view_build(rec_view_t *view, const rec_catalog_t *cat, uint8_t pdrv)
+{
+    scan_ctx_t ctx = {
+        .view = view,
+        .pdrv = pdrv,
+        .fil = malloc(sizeof(FIL)),
+    };
+    if (ctx.fil == NULL) {
+        return -1;
+    }
+    // The host may have reformatted the card with another cluster size while it had it
+    DIR dir;
+    char root[8];
+    snprintf(root, sizeof(root), "%u:/", pdrv);
+    if (f_opendir(&dir, root) != FR_OK) {
+        free(ctx.fil);
+        return -1;
+    }
+    const uint32_t card_cluster_sectors = dir.obj.fs->csize;
+    f_closedir(&dir);
+    if (rec_view_layout(view, card_cluster_sectors) != 0) {
+        ESP_LOGE(TAG, "Card of %"PRIu32" sectors is too small for a FAT32 view", view->sector_count);
+        free(ctx.fil);
+        return -1;
+    }
+
+    const size_t count = rec_catalog_count(cat);
+    ctx.skip = (count > REC_VIEW_MAX_FILES) ? count - REC_VIEW_MAX_FILES : 0;
+
+    rec_catalog_list(cat, s_visit, &ctx);
+    free(ctx.fil);
+
+    if (ctx.skipped > 0) {
+        ESP_LOGW(TAG, "%u file(s) left out of the view", (unsigned)ctx.skipped);
+    }
+    if (rec_view_finish(view) != 0) {
+        ESP_LOGE(TAG, "%u files do not fit the view", (unsigned)view->file_count);
+        rec_view_clear(view);
+        return -1;
+    }
+    ESP_LOGI(TAG, "View of %u files in %u extents", (unsigned)view->file_count, (unsigned)view->extent_count);
+    return 0;
+}
@@ -0,0 +1,540 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "host_test.h"
+#include "rec_view.h"
+
+// rec_view over a fake card whose sectors carry their own LBA, read back the way a host mounts the drive: the
+// boot sector and FSInfo with their backups, both FATs, the root directory chain with its long names, and every
+// file through its cluster chain. File sectors must come from the card sectors the extents map them to, in runs
+// no longer than the extents, and read as zeros past the mapped part.
+
+#define SECTOR       REC_VIEW_SECTOR_SIZE
+#define FAT_EOC      0x0FFFFFFFu
+#define MAX_FILES    80
+#define MAX_EXTENTS  64
+#define CARD_DATA    8192                // Card sector of the first cluster handed out
+
+typedef struct {
+    uint32_t sector_count;
+    uint32_t calls;
+    uint32_t fail_lba;                   // A read covering this sector fails; UINT32_MAX for none
+} fake_card_t;
+
+typedef struct {
+    char name[REC_VIEW_NAME_MAX];
+    uint32_t size;
+    int64_t mtime;
+    uint32_t extents;
+    uint32_t file_sector[MAX_EXTENTS];   // As added, one card cluster each, before rec_view merges them
+    uint32_t lba[MAX_EXTENTS];
+    uint32_t count[MAX_EXTENTS];
+} expect_file_t;
+
+typedef struct {
+    expect_file_t files[MAX_FILES];
+    size_t file_count;
+    uint32_t next_card_cluster;
+} expect_t;
+
+static fake_card_t s_card;
+static expect_t s_expect;
+
+static uint32_t s_le16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t s_le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// The byte at offset i of card sector lba: the LBA itself up front, a pattern that depends on both after it.
+static uint8_t s_card_byte(uint32_t lba, size_t i)
+{
+    if (i < 4) {
+        return (uint8_t)(lba >> (8 * i));
+    }
+    return (uint8_t)((lba * 2654435761u + i * 40503u) >> 11);
+}
+
+static int s_card_read(uint32_t lba, uint32_t count, void *dest, void *arg)
+{
+    fake_card_t *card = arg;
+    TEST_CHECK(card == &s_card);
+    TEST_CHECK(count > 0 && lba < card->sector_count && count <= card->sector_count - lba);
+    card->calls++;
+    if (card->fail_lba >= lba && card->fail_lba - lba < count) {
+        return -1;
+    }
+    uint8_t *out = dest;
+    for (uint32_t s = 0; s < count; s++) {
+        for (size_t i = 0; i < SECTOR; i++) {
+            *out++ = s_card_byte(lba + s, i);
+        }
+    }
+    return 0;
+}
+
+// Reads view sectors, which must succeed.
+static void s_read(rec_view_t *view, uint32_t lba, uint32_t count, uint8_t *dest)
+{
+    TEST_CHECK(rec_view_read(view, lba, count, dest) == 0);
+}
+
+// Adds a file to the view and the expected list, its data in card clusters the way rec_view_scan.c maps them.
+// Every third card cluster is skipped so the file is fragmented; mapped caps the clusters that get an extent.
+static void s_add(rec_view_t *view, const char *name, uint32_t size, int64_t mtime, uint32_t card_cluster,
+                  uint32_t mapped)
+{
+    TEST_CHECK(s_expect.file_count < MAX_FILES);
+    expect_file_t *f = &s_expect.files[s_expect.file_count++];
+    memset(f, 0, sizeof(*f));
+    snprintf(f->name, sizeof(f->name), "%s", name);
+    f->size = size;
+    f->mtime = mtime;
+    TEST_CHECK(rec_view_add_file(view, name, size, mtime) == 0);
+
+    const uint64_t cluster_bytes = (uint64_t)card_cluster * SECTOR;
+    uint32_t clusters = (uint32_t)((size + cluster_bytes - 1) / cluster_bytes);
+    clusters = clusters < mapped ? clusters : mapped;
+    for (uint32_t c = 0; c < clusters; c++) {
+        if (s_expect.next_card_cluster % 3 == 2) {
+            s_expect.next_card_cluster++;
+        }
+        TEST_CHECK(f->extents < MAX_EXTENTS);
+        f->file_sector[f->extents] = c * card_cluster;
+        f->lba[f->extents] = CARD_DATA + s_expect.next_card_cluster++ * card_cluster;
+        f->count[f->extents] = card_cluster;
+        TEST_CHECK(rec_view_add_extent(view, f->lba[f->extents], card_cluster) == 0);
+        f->extents++;
+    }
+}
+
+// Card sector that file sector s of f comes from, or UINT32_MAX where the view must produce zeros.
+static uint32_t s_expect_lba(const expect_file_t *f, uint32_t s)
+{
+    for (uint32_t e = 0; e < f->extents; e++) {
+        if (s >= f->file_sector[e] && s - f->file_sector[e] < f->count[e]) {
+            return f->lba[e] + (s - f->file_sector[e]);
+        }
+    }
+    return UINT32_MAX;
+}
+
+// Card reads a whole-file read takes: one per run of card-contiguous extents within the file's clusters.
+static uint32_t s_expect_runs(const expect_file_t *f, uint32_t file_sectors)
+{
+    uint32_t runs = 0;
+    for (uint32_t e = 0; e < f->extents && f->file_sector[e] < file_sectors; e++) {
+        if (e == 0 || f->lba[e - 1] + f->count[e - 1] != f->lba[e]) {
+            runs++;
+        }
+    }
+    return runs;
+}
+
+// Checks one sector read from file sector s of f.
+static void s_check_file_sector(const expect_file_t *f, uint32_t s, const uint8_t *data)
+{
+    const uint32_t lba = s_expect_lba(f, s);
+    for (size_t i = 0; i < SECTOR; i++) {
+        TEST_CHECK(data[i] == (lba == UINT32_MAX ? 0 : s_card_byte(lba, i)));
+    }
+}
+
+// The FAT checksum of an 8.3 name, computed here rather than taken from rec_view.c.
+static uint8_t s_sum(const uint8_t *name)
+{
+    uint8_t sum = 0;
+    for (int i = 0; i < 11; i++) {
+        sum = (uint8_t)((sum >> 1) | (sum << 7));
+        sum = (uint8_t)(sum + name[i]);
+    }
+    return sum;
+}
+
+// FAT date and time for mtime as the view should store it.
+static void s_expect_time(int64_t mtime, uint32_t *date, uint32_t *time_out)
+{
+    if (mtime < REC_CATALOG_CLOCK_VALID) {
+        *date = (1 << 5) | 1;
+        *time_out = 0;
+        return;
+    }
+    struct tm tm;
+    const time_t t = (time_t)mtime;
+    TEST_CHECK(localtime_r(&t, &tm) != NULL);
+    *date = ((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday;
+    *time_out = (tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2);
+}
+
+// The boot sector, its backup and the FSInfo sectors; returns the FAT read back from the volume.
+static uint32_t *s_check_volume(rec_view_t *view, uint32_t card_cluster)
+{
+    uint8_t boot[SECTOR];
+    uint8_t sector[SECTOR];
+    s_read(view, 0, 1, boot);
+    TEST_CHECK(memcmp(boot, "\xEB\x58\x90" "MSWIN4.1", 11) == 0);
+    TEST_CHECK(s_le16(boot + 11) == SECTOR);
+    const uint32_t cs = boot[13];
+    TEST_CHECK(cs != 0 && (cs & (cs - 1)) == 0 && cs <= REC_VIEW_MAX_CLUSTER && card_cluster % cs == 0);
+    const uint32_t reserved = s_le16(boot + 14);
+    TEST_CHECK(reserved == REC_VIEW_RESERVED && boot[16] == 2 && boot[21] == 0xF8);
+    TEST_CHECK(s_le16(boot + 17) == 0 && s_le16(boot + 19) == 0 && s_le16(boot + 22) == 0);   // FAT32 only
+    TEST_CHECK(s_le32(boot + 32) == view->sector_count);
+    const uint32_t fat_sectors = s_le32(boot + 36);
+    TEST_CHECK(s_le32(boot + 44) == 2 && s_le16(boot + 48) == 1 && s_le16(boot + 50) == 6);
+    TEST_CHECK(boot[66] == 0x29 && s_le32(boot + 67) == view->volume_id);
+    TEST_CHECK(memcmp(boot + 71, "RECORDINGS ", 11) == 0 && memcmp(boot + 82, "FAT32   ", 8) == 0);
+    TEST_CHECK(boot[510] == 0x55 && boot[511] == 0xAA);
+
+    // The cluster count a host derives makes the volume FAT32, and the FAT has an entry for each cluster
+    const uint32_t data_start = reserved + 2 * fat_sectors;
+    const uint32_t clusters = (view->sector_count - data_start) / cs;
+    TEST_CHECK(clusters >= 65525 && clusters < 0x0FFFFFF5u);
+    TEST_CHECK((uint64_t)fat_sectors * SECTOR / 4 >= (uint64_t)clusters + 2);
+
+    s_read(view, 6, 1, sector);
+    TEST_CHECK(memcmp(sector, boot, SECTOR) == 0);
+    for (uint32_t lba = 1; lba < 8; lba += 6) {
+        s_read(view, lba, 1, sector);
+        TEST_CHECK(s_le32(sector) == 0x41615252 && s_le32(sector + 484) == 0x61417272);
+        TEST_CHECK(s_le32(sector + 488) == 0xFFFFFFFF && s_le32(sector + 492) == 0xFFFFFFFF);
+        TEST_CHECK(s_le32(sector + 508) == 0xAA550000);
+    }
+
+    // Both FATs, read in one go, must match
+    uint8_t *fats = malloc((size_t)2 * fat_sectors * SECTOR);
+    uint32_t *fat = malloc((size_t)fat_sectors * SECTOR);
+    TEST_CHECK(fats != NULL && fat != NULL);
+    s_read(view, reserved, 2 * fat_sectors, fats);
+    TEST_CHECK(memcmp(fats, fats + (size_t)fat_sectors * SECTOR, (size_t)fat_sectors * SECTOR) == 0);
+    for (size_t i = 0; i < (size_t)fat_sectors * SECTOR / 4; i++) {
+        fat[i] = s_le32(fats + i * 4);
+    }
+    free(fats);
+    TEST_CHECK(fat[0] == 0x0FFFFFF8u && fat[1] == FAT_EOC);
+    return fat;
+}
+
+// Follows a chain from first, marking its clusters used; returns its length. A chain must end in EOC, stay in
+// the volume and not run into a cluster another chain owns.
+static uint32_t s_chain(const uint32_t *fat, uint8_t *used, uint32_t clusters, uint32_t first, uint32_t *out,
+                        uint32_t out_max)
+{
+    uint32_t n = 0;
+    for (uint32_t c = first;; c = fat[c]) {
+        TEST_CHECK(c >= 2 && c < clusters + 2);
+        TEST_CHECK(!used[c]);
+        used[c] = 1;
+        if (out != NULL) {
+            TEST_CHECK(n < out_max);
+            out[n] = c;
+        }
+        n++;
+        if (fat[c] == FAT_EOC) {
+            return n;
+        }
+    }
+}
+
+typedef struct {
+    char name[REC_VIEW_NAME_MAX + 13];
+    uint8_t short_name[11];
+    uint8_t attr;
+    uint32_t first_cluster;
+    uint32_t size;
+    uint32_t date;
+    uint32_t time;
+} dir_file_t;
+
+// Parses the root directory like a host: long name entries last part first with the checksum of the 8.3 entry
+// that follows them. Returns the number of files.
+static size_t s_parse_dir(const uint8_t *dir, size_t entries, dir_file_t *files, size_t max)
+{
+    static const uint8_t offsets[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+    size_t count = 0;
+
+    TEST_CHECK(memcmp(dir, "RECORDINGS ", 11) == 0 && dir[11] == 0x08);
+    size_t e = 1;
+    for (; e < entries && dir[e * 32] != 0; e++) {
+        const uint8_t *d = dir + e * 32;
+        TEST_CHECK(count < max);
+        dir_file_t *f = &files[count];
+        memset(f, 0, sizeof(*f));
+
+        // The first long name entry has the 0x40 flag and the highest order, the rest count down to 1
+        TEST_CHECK(d[11] == 0x0F && (d[0] & 0x40) != 0);
+        const uint32_t parts = d[0] & 0x3F;
+        TEST_CHECK(parts >= 1 && parts <= 2 && e + parts < entries);
+        const uint8_t *sfn = d + parts * 32;
+        const uint8_t sum = s_sum(sfn);
+        for (uint32_t k = 0; k < parts; k++) {
+            const uint8_t *l = d + k * 32;
+            bool ended = false;
+            const uint32_t order = parts - k;
+            TEST_CHECK((l[0] & 0x3F) == order && l[11] == 0x0F && l[12] == 0 && l[13] == sum);
+            TEST_CHECK(s_le16(l + 26) == 0);
+            for (int i = 0; i < 13; i++) {
+                const uint32_t c = s_le16(l + offsets[i]);
+                const size_t at = (order - 1) * 13 + i;
+                if (c == 0xFFFF) {
+                    // Padding only after the terminator, which only the last part carries
+                    TEST_CHECK(k == 0 && ended);
+                    continue;
+                }
+                if (c == 0) {
+                    TEST_CHECK(k == 0 && !ended);
+                    ended = true;
+                    continue;
+                }
+                TEST_CHECK(!ended && c < 0x80);
+                f->name[at] = (char)c;
+            }
+        }
+        e += parts;
+        memcpy(f->short_name, sfn, 11);
+        f->attr = sfn[11];
+        f->first_cluster = (s_le16(sfn + 20) << 16) | s_le16(sfn + 26);
+        f->size = s_le32(sfn + 28);
+        f->date = s_le16(sfn + 24);
+        f->time = s_le16(sfn + 22);
+        TEST_CHECK(s_le16(sfn + 16) == f->date && s_le16(sfn + 18) == f->date && s_le16(sfn + 14) == f->time);
+        count++;
+    }
+    // Nothing after the end marker
+    for (; e < entries; e++) {
+        for (int i = 0; i < 32; i++) {
+            TEST_CHECK(dir[e * 32 + i] == 0);
+        }
+    }
+    return count;
+}
+
+// Mounts the view like a host and checks everything it reads against the expected files.
+static void s_check_view(rec_view_t *view, uint32_t card_cluster)
+{
+    uint32_t *fat = s_check_volume(view, card_cluster);
+    const uint32_t cs = view->cluster_sectors;
+    const uint32_t cluster_bytes = cs * SECTOR;
+    const uint32_t clusters = view->cluster_count;
+    uint8_t *used = calloc((size_t)clusters + 2, 1);
+    TEST_CHECK(used != NULL);
+
+    // The root directory chain, read cluster by cluster
+    uint32_t root[16];
+    const uint32_t root_len = s_chain(fat, used, clusters, 2, root, 16);
+    uint8_t *dir = malloc((size_t)root_len * cluster_bytes);
+    TEST_CHECK(dir != NULL);
+    for (uint32_t i = 0; i < root_len; i++) {
+        s_read(view, view->data_start + (root[i] - 2) * cs, cs, dir + (size_t)i * cluster_bytes);
+    }
+    size_t entries = 1;
+    for (size_t i = 0; i < s_expect.file_count; i++) {
+        entries += (strlen(s_expect.files[i].name) + 12) / 13 + 1;
+    }
+    TEST_CHECK((size_t)root_len * cluster_bytes / 32 >= entries);
+    TEST_CHECK(((size_t)root_len - 1) * cluster_bytes / 32 < entries);
+
+    static dir_file_t found[MAX_FILES];
+    const size_t count = s_parse_dir(dir, (size_t)root_len * cluster_bytes / 32, found, MAX_FILES);
+    TEST_CHECK(count == s_expect.file_count);
+    free(dir);
+
+    uint8_t *data = NULL;
+    uint32_t total_clusters = root_len;
+    for (size_t i = 0; i < count; i++) {
+        const expect_file_t *f = &s_expect.files[i];
+        const dir_file_t *d = &found[i];
+        TEST_CHECK(strcmp(d->name, f->name) == 0);
+        TEST_CHECK(d->attr == 0x21 && d->size == f->size);
+        char base[9];
+        snprintf(base, sizeof(base), "R%07u", (unsigned)i);
+        TEST_CHECK(memcmp(d->short_name, base, 8) == 0);
+        const char *dot = strrchr(f->name, '.');
+        TEST_CHECK(dot != NULL && d->short_name[8] == (dot[1] & ~0x20) && d->short_name[9] == (dot[2] & ~0x20));
+        uint32_t date;
+        uint32_t time_value;
+        s_expect_time(f->mtime, &date, &time_value);
+        TEST_CHECK(d->date == date && d->time == time_value);
+
+        // The chain holds exactly the file's bytes; an empty file owns none
+        const uint32_t want = (uint32_t)(((uint64_t)f->size + cluster_bytes - 1) / cluster_bytes);
+        if (want == 0) {
+            TEST_CHECK(d->first_cluster == 0);
+            continue;
+        }
+        uint32_t *chain = malloc(want * sizeof(uint32_t));
+        TEST_CHECK(chain != NULL);
+        TEST_CHECK(s_chain(fat, used, clusters, d->first_cluster, chain, want) == want);
+        total_clusters += want;
+
+        // Cluster by cluster, sector by sector
+        uint8_t sector[SECTOR];
+        for (uint32_t c = 0; c < want; c++) {
+            for (uint32_t s = 0; s < cs; s++) {
+                s_read(view, view->data_start + (chain[c] - 2) * cs + s, 1, sector);
+                s_check_file_sector(f, c * cs + s, sector);
+            }
+        }
+
+        // The whole file in one read takes one card read per contiguous run of its extents
+        const uint32_t file_sectors = want * cs;
+        for (uint32_t c = 1; c < want; c++) {
+            TEST_CHECK(chain[c] == chain[c - 1] + 1);
+        }
+        data = realloc(data, (size_t)file_sectors * SECTOR);
+        TEST_CHECK(data != NULL);
+        const uint32_t calls = s_card.calls;
+        s_read(view, view->data_start + (chain[0] - 2) * cs, file_sectors, data);
+        TEST_CHECK(s_card.calls - calls == s_expect_runs(f, file_sectors));
+        for (uint32_t s = 0; s < file_sectors; s++) {
+            s_check_file_sector(f, s, data + (size_t)s * SECTOR);
+        }
+        free(chain);
+    }
+
+    // One read across every file's clusters and a free one after them: no run may carry on past the end of a
+    // file into the next one, e.g. when a card cluster maps more sectors than the file's last view cluster holds
+    const uint32_t span = total_clusters - root_len + 1;
+    data = realloc(data, (size_t)span * cluster_bytes);
+    TEST_CHECK(data != NULL);
+    s_read(view, view->data_start + root_len * cs, span * cs, data);
+    uint32_t cluster = 2 + root_len;
+    for (size_t i = 0; i < count; i++) {
+        const uint32_t n = (uint32_t)(((uint64_t)found[i].size + cluster_bytes - 1) / cluster_bytes);
+        TEST_CHECK(n == 0 || found[i].first_cluster == cluster);
+        for (uint32_t s = 0; s < n * cs; s++) {
+            s_check_file_sector(&s_expect.files[i], s, data + ((size_t)(cluster - 2 - root_len) * cs + s) * SECTOR);
+        }
+        cluster += n;
+    }
+    for (size_t i = (size_t)(span - 1) * cluster_bytes; i < (size_t)span * cluster_bytes; i++) {
+        TEST_CHECK(data[i] == 0);
+    }
+
+    // Every other cluster is free
+    uint32_t free_clusters = 0;
+    for (uint32_t c = 2; c < clusters + 2; c++) {
+        TEST_CHECK(used[c] || fat[c] == 0);
+        free_clusters += !used[c];
+    }
+    TEST_CHECK(free_clusters == clusters - total_clusters);
+    // The FAT entries past the last cluster are zero as well
+    for (size_t c = (size_t)clusters + 2; c < (size_t)view->fat_sectors * SECTOR / 4; c++) {
+        TEST_CHECK(fat[c] == 0);
+    }
+
+    // Free clusters read as zeros, from the card not at all
+    uint8_t sector[SECTOR];
+    const uint32_t calls = s_card.calls;
+    s_read(view, view->sector_count - 1, 1, sector);
+    for (size_t i = 0; i < SECTOR; i++) {
+        TEST_CHECK(sector[i] == 0);
+    }
+    TEST_CHECK(s_card.calls == calls);
+
+    free(data);
+    free(used);
+    free(fat);
+}
+
+// A card of sector_count sectors with card_cluster sectors per cluster, filled with the recordings a day of use
+// leaves: an empty file, a one-byte file, fragmented multi-cluster files, one whose tail is not mapped, and enough
+// short segments to take the root directory past one cluster when clusters are small.
+static void s_test_card(uint32_t sector_count, uint32_t card_cluster, uint32_t want_cluster)
+{
+    static rec_view_t view;
+    memset(&s_expect, 0, sizeof(s_expect));
+    s_card = (fake_card_t){ .sector_count = sector_count, .fail_lba = UINT32_MAX };
+    TEST_CHECK(rec_view_init(&view, sector_count, s_card_read, &s_card) == 0);
+    TEST_CHECK(rec_view_layout(&view, card_cluster) == 0);
+    TEST_CHECK(view.cluster_sectors == want_cluster);
+
+    const uint32_t cb = card_cluster * SECTOR;
+    s_add(&view, "mic_0001.wav", 0, 0, card_cluster, UINT32_MAX);
+    s_add(&view, "mic_0002.flac", 1, 1700000000, card_cluster, UINT32_MAX);
+    s_add(&view, "mic_0003.opus", 5 * cb + 17, 1712345679, card_cluster, UINT32_MAX);
+    s_add(&view, "mic_0004_001.wav", 3 * cb, 1760000001, card_cluster, UINT32_MAX);
+    // A file that grew after its chain was walked: the sectors past the mapped part read as zeros
+    s_add(&view, "mic_0004_002.wav", 4 * cb - 100, 1760000301, card_cluster, 2);
+    // The longest name the catalog makes, two long name entries
+    s_add(&view, "mic_1234567890_123.flac", cb + 1, 1760000601, card_cluster, UINT32_MAX);
+    for (int i = 0; i < 60; i++) {
+        char name[REC_VIEW_NAME_MAX];
+        snprintf(name, sizeof(name), "mic_%04d.%s", 5 + i, (i % 3 == 0) ? "wav" : (i % 3 == 1) ? "flac" : "opus");
+        s_add(&view, name, (uint32_t)(i * 1000 + 513), 1760003600 + i * 61, card_cluster, UINT32_MAX);
+    }
+    TEST_CHECK(rec_view_finish(&view) == 0);
+    for (size_t i = 0; i < s_expect.file_count; i++) {
+        // Extents of consecutive card clusters were merged
+        TEST_CHECK(view.files[i].extents == s_expect_runs(&s_expect.files[i], UINT32_MAX));
+    }
+    s_check_view(&view, card_cluster);
+    printf("%lu sectors, %lu-sector card clusters: %lu-sector view clusters, %lu clusters, root in %lu, "
+           "%lu card reads\n", (unsigned long)sector_count, (unsigned long)card_cluster,
+           (unsigned long)view.cluster_sectors, (unsigned long)view.cluster_count, (unsigned long)view.root_clusters,
+           (unsigned long)s_card.calls);
+
+    // A failed card read fails the view read; reads outside the volume or before finish fail outright
+    uint8_t buf[4 * SECTOR];
+    const rec_view_file_t *file = &view.files[2];
+    const uint32_t file_lba = view.data_start + (file->first_cluster - 2) * view.cluster_sectors;
+    s_card.fail_lba = s_expect.files[2].lba[0] + 1;
+    TEST_CHECK(rec_view_read(&view, file_lba, 4, buf) == -1);
+    s_card.fail_lba = UINT32_MAX;
+    TEST_CHECK(rec_view_read(&view, file_lba, 4, buf) == 0);
+    TEST_CHECK(rec_view_read(&view, sector_count, 1, buf) == -1);
+    TEST_CHECK(rec_view_read(&view, sector_count - 1, 2, buf) == -1);
+    rec_view_drop_file(&view);
+    TEST_CHECK(rec_view_read(&view, 0, 1, buf) == 0);
+    rec_view_clear(&view);
+    TEST_CHECK(rec_view_read(&view, 0, 1, buf) == -1);
+
+    // An empty view after a rebuild: the label alone in one root cluster, nothing else allocated
+    memset(&s_expect, 0, sizeof(s_expect));
+    TEST_CHECK(rec_view_finish(&view) == 0);
+    TEST_CHECK(view.root_clusters == 1);
+    s_check_view(&view, card_cluster);
+    rec_view_deinit(&view);
+}
+
+// Layouts that cannot be FAT32, and arguments rec_view refuses.
+static void s_test_limits(void)
+{
+    static rec_view_t view;
+    uint8_t buf[SECTOR];
+    TEST_CHECK(rec_view_init(&view, 1 << 20, NULL, NULL) == -1);
+    TEST_CHECK(rec_view_init(&view, 1 << 16, s_card_read, &s_card) == 0);
+    TEST_CHECK(rec_view_layout(&view, 64) == -1);
+    TEST_CHECK(rec_view_finish(&view) == -1);
+    TEST_CHECK(rec_view_read(&view, 0, 1, buf) == -1);
+
+    // A name too long for the catalog, and an extent with no file to take it
+    TEST_CHECK(rec_view_init(&view, 1 << 21, s_card_read, &s_card) == 0);
+    TEST_CHECK(rec_view_layout(&view, 8) == 0);
+    TEST_CHECK(rec_view_add_extent(&view, CARD_DATA, 8) == -1);
+    TEST_CHECK(rec_view_add_file(&view, "mic_12345678901234_123.wav", 1, 0) == -1);
+    TEST_CHECK(rec_view_add_file(&view, "", 1, 0) == -1);
+    // Files that do not fit the volume
+    TEST_CHECK(rec_view_add_file(&view, "mic_0001.wav", UINT32_MAX, 0) == 0);
+    TEST_CHECK(rec_view_add_file(&view, "mic_0002.wav", UINT32_MAX, 0) == 0);
+    TEST_CHECK(rec_view_finish(&view) == -1);
+    rec_view_deinit(&view);
+}
+
+int main(void)
+{
+    // 4 GB card with 32 KB clusters, 1 GB with 4 KB clusters and a root past one cluster, 4 GB with 64 KB clusters
+    // that the view halves, and a card small enough that the view must use smaller clusters than the card
+    s_test_card(8388608, 64, 64);
+    s_test_card(2097152, 8, 8);
+    s_test_card(8388608, 128, 64);
+    s_test_card(600000, 64, 8);
+    s_test_limits();
+    printf("rec_view: ok\n");
+    return 0;
+}
@@ -10,16 +10,29 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
+#include <sys/stat.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "button.h"
 #include "mic_capture.h"
+#include "rec_catalog.h"
+#include "rec_catalog_bench.h"
+#include "rec_view.h"
+#include "rec_mtp.h"
+#include "flac_writer.h"
+#include "wav_writer.h"
 #include "oled_ssd1306.h"
+#include "oled_display.h"
 #include "tinyusb.h"
 #include "tinyusb_default_config.h"
 #include "tinyusb_msc.h"
+#include "tinyusb_mtp.h"
 #include "sdmmc_cmd.h"
+#include "diskio_sdmmc.h"
 #include "driver/sdmmc_host.h"
 #include "sd_test_io.h"
 #if SOC_SDMMC_IO_POWER_EXTERNAL
@@ -31,6 +44,28 @@
 static const char *TAG = "example";
 
 #define MOUNT_POINT "/sdcard"
+#if CONFIG_EXAMPLE_RECORD_FLAC
+#define MIC_CONTAINER REC_CATALOG_FLAC
+#elif CONFIG_EXAMPLE_RECORD_OPUS
+#define MIC_CONTAINER REC_CATALOG_OPUS
+#else
+#define MIC_CONTAINER REC_CATALOG_WAV
+#endif
+#if CONFIG_EXAMPLE_USB_KEEP_ENUMERATED
+#define USB_SWITCH_MODE "USB kept"
+#else
+#define USB_SWITCH_MODE "USB reinstalled"
+#endif
+#if CONFIG_EXAMPLE_USB_MTP
+#define USB_CLASS_NAME "MTP"
+#else
+#define USB_CLASS_NAME "MSC"
+#endif
+#define BENCH_FILE_NAME    "USBBENCH.BIN"
+#define BENCH_BLOCK_SIZE   (64 * 1024)
+#define VIEW_TASK_STACK    4096
+#define VIEW_TASK_PRIO     3        // Below the recorder's writer and segment tasks
+
 #define EXAMPLE_IS_UHS1    (CONFIG_EXAMPLE_SDMMC_SPEED_UHS_I_SDR50 || CONFIG_EXAMPLE_SDMMC_SPEED_UHS_I_DDR50)
 
 #ifdef CONFIG_EXAMPLE_DEBUG_PIN_CONNECTIONS
@@ -59,11 +94,22 @@ pin_configuration_t config = {
 #endif //CONFIG_EXAMPLE_DEBUG_PIN_CONNECTIONS
 
 /* TinyUSB descriptors */
+#if CONFIG_EXAMPLE_USB_MTP
+#define TUSB_DESC_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + TUD_MTP_DESC_LEN)
+#define MTP_EVT_SIZE         64
+#define MTP_EVT_INTERVAL     1
+#define MTP_STR_INDEX        4
+#else
 #define EPNUM_MSC            1
 #define TUSB_DESC_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + TUD_MSC_DESC_LEN)
+#endif
 
 enum {
+#if CONFIG_EXAMPLE_USB_MTP
+    ITF_NUM_MTP = 0,
+#else
     ITF_NUM_MSC = 0,
+#endif
     ITF_NUM_TOTAL
 };
 
@@ -73,6 +119,10 @@ enum {
 
     EDPT_MSC_OUT  = 0x01,
     EDPT_MSC_IN   = 0x81,
+
+    EDPT_MTP_OUT  = 0x02,
+    EDPT_MTP_IN   = 0x82,
+    EDPT_MTP_EVT  = 0x83,
 };
 
 static tusb_desc_device_t descriptor_config = {
@@ -92,9 +142,13 @@ static tusb_desc_device_t descriptor_config = {
     .bNumConfigurations = 0x01
 };
 
-static uint8_t const msc_fs_configuration_desc[] = {
+static uint8_t const usb_fs_configuration_desc[] = {
     TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, TUSB_DESC_TOTAL_LEN, TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 100),
+#if CONFIG_EXAMPLE_USB_MTP
+    TUD_MTP_DESCRIPTOR(ITF_NUM_MTP, MTP_STR_INDEX, EDPT_MTP_EVT, MTP_EVT_SIZE, MTP_EVT_INTERVAL, EDPT_MTP_OUT, EDPT_MTP_IN, 64),
+#else
     TUD_MSC_DESCRIPTOR(ITF_NUM_MSC, 0, EDPT_MSC_OUT, EDPT_MSC_IN, 64),
+#endif
 };
 
 #if (TUD_OPT_HIGH_SPEED)
@@ -110,9 +164,13 @@ static const tusb_desc_device_qualifier_t device_qualifier = {
     .bReserved = 0
 };
 
-static uint8_t const msc_hs_configuration_desc[] = {
+static uint8_t const usb_hs_configuration_desc[] = {
     TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, TUSB_DESC_TOTAL_LEN, TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 100),
+#if CONFIG_EXAMPLE_USB_MTP
+    TUD_MTP_DESCRIPTOR(ITF_NUM_MTP, MTP_STR_INDEX, EDPT_MTP_EVT, MTP_EVT_SIZE, MTP_EVT_INTERVAL, EDPT_MTP_OUT, EDPT_MTP_IN, 512),
+#else
     TUD_MSC_DESCRIPTOR(ITF_NUM_MSC, 0, EDPT_MSC_OUT, EDPT_MSC_IN, 512),
+#endif
 };
 #endif
 
@@ -121,11 +179,25 @@ static char const *string_desc_arr[] = {
     "TinyUSB",
     "TinyUSB Device",
     "123456",
+#if CONFIG_EXAMPLE_USB_MTP
+    "MTP",
+#endif
 };
 
 static tinyusb_msc_storage_handle_t s_storage_hdl;
 static tinyusb_config_t s_tusb_cfg;
 static bool s_usb_active;
+static rec_catalog_t s_catalog;
+#if CONFIG_EXAMPLE_USB_RECORDINGS_VIEW
+static tinyusb_msc_storage_handle_t s_view_hdl;
+static rec_view_t s_view;
+static sdmmc_card_t *s_view_card;
+static SemaphoreHandle_t s_view_done;
+#endif
+#if CONFIG_EXAMPLE_USB_MTP
+static rec_mtp_t s_mtp;
+static bool s_mtp_ready;
+#endif
 
 // Writes a test string to a file on the SD card.
 static esp_err_t s_example_write_file(const char *path, char *data)
@@ -264,7 +336,190 @@ static esp_err_t s_switch_mount(tinyusb_msc_mount_point_t mount_point)
     return tinyusb_msc_set_storage_mount_point(s_storage_hdl, mount_point);
 }
 
-// Starts the TinyUSB MSC driver if not already running.
+// Logs how long handing the card between the host and the recorder took.
+static void s_log_switch_time(const char *to, int64_t start_us)
+{
+    ESP_LOGI(TAG, "Switch to %s took %lu us (" USB_SWITCH_MODE ")", to,
+             (unsigned long)(esp_timer_get_time() - start_us));
+}
+
+// Logs how well the MSC read-ahead and write-back cache served the host while exposed over USB.
+static void s_log_msc_stats(void)
+{
+    tinyusb_msc_io_stats_t io;
+    if (tinyusb_msc_get_io_stats(&io) == ESP_OK && (io.read_bytes > 0 || io.write_bytes > 0)) {
+        const uint32_t rd_kbps = tinyusb_rate_kbps(io.read_bytes, io.read_active_us);
+        const uint32_t wr_kbps = tinyusb_rate_kbps(io.write_bytes, io.write_active_us);
+        ESP_LOGI(TAG, "MSC I/O: read %llu KB at %lu KB/s, wrote %llu KB at %lu KB/s, worker busy %llu ms, %lu stalls, queue max %lu, %lu errors",
+                 (unsigned long long)(io.read_bytes / 1024), (unsigned long)rd_kbps,
+                 (unsigned long long)(io.write_bytes / 1024), (unsigned long)wr_kbps,
+                 (unsigned long long)(io.worker_busy_us / 1000), (unsigned long)io.write_stalls,
+                 (unsigned long)io.max_queued, (unsigned long)io.errors);
+    }
+
+    tinyusb_msc_readahead_stats_t ra;
+    if (tinyusb_msc_get_readahead_stats(s_storage_hdl, &ra) == ESP_OK && ra.read_sectors > 0) {
+        ESP_LOGI(TAG, "MSC read-ahead: %llu/%llu sectors hit (%llu waited), %lu prefetches, %lu streams, %lu dropped",
+                 (unsigned long long)ra.hit_sectors, (unsigned long long)ra.read_sectors,
+                 (unsigned long long)ra.wait_sectors, (unsigned long)ra.prefetches, (unsigned long)ra.streams,
+                 (unsigned long)ra.invalidations);
+    }
+
+    tinyusb_msc_cache_stats_t cache;
+    if (tinyusb_msc_get_cache_stats(s_storage_hdl, &cache) != ESP_OK || cache.write_sectors == 0) {
+        return;
+    }
+    const uint32_t per_write = cache.medium_writes ? (uint32_t)(cache.medium_sectors / cache.medium_writes) : 0;
+    ESP_LOGI(TAG, "MSC cache: %llu sectors in %lu card writes (%lu avg, %lu max), %llu rewrite hits, %llu/%llu read hits",
+             (unsigned long long)cache.write_sectors, (unsigned long)cache.medium_writes, (unsigned long)per_write,
+             (unsigned long)cache.longest_write, (unsigned long long)cache.write_hits,
+             (unsigned long long)cache.read_hits, (unsigned long long)cache.read_sectors);
+    ESP_LOGI(TAG, "MSC cache flushes: %lu sync, %lu idle, %lu full, %lu seek, %lu unmount, %lu errors",
+             (unsigned long)cache.flush_sync, (unsigned long)cache.flush_idle, (unsigned long)cache.flush_full,
+             (unsigned long)cache.flush_seek, (unsigned long)cache.flush_unmount, (unsigned long)cache.errors);
+}
+
+#if CONFIG_EXAMPLE_USB_RECORDINGS_VIEW
+// Reads card sectors for the recordings view; the SDMMC host serialises them with the recorder's writes.
+static int s_view_card_read(uint32_t lba, uint32_t count, void *dest, void *arg)
+{
+    return (sdmmc_read_sectors((sdmmc_card_t *)arg, dest, lba, count) == ESP_OK) ? 0 : -1;
+}
+
+// Produces sectors of the recordings view for the host.
+static esp_err_t s_view_read(uint32_t lba, uint32_t count, void *dest, void *arg)
+{
+    return (rec_view_read((rec_view_t *)arg, lba, count, dest) == 0) ? ESP_OK : ESP_FAIL;
+}
+
+// Adds a read-only LUN that shows the finished recordings while the card is recording. Must run before the
+// TinyUSB driver is installed, the host reads the number of LUNs once.
+static void s_view_init(sdmmc_card_t *card)
+{
+    const tinyusb_msc_virtual_config_t view_cfg = {
+        .sector_count = (uint32_t)card->csd.capacity,
+        .sector_size = REC_VIEW_SECTOR_SIZE,
+        .read = s_view_read,
+        .arg = &s_view,
+    };
+    if (card->csd.sector_size != REC_VIEW_SECTOR_SIZE
+            || rec_view_init(&s_view, view_cfg.sector_count, s_view_card_read, card) != 0) {
+        ESP_LOGW(TAG, "Recordings view not supported on this card");
+        return;
+    }
+    s_view_done = xSemaphoreCreateBinary();
+    if (s_view_done == NULL || tinyusb_msc_new_storage_virtual(&view_cfg, &s_view_hdl) != ESP_OK) {
+        ESP_LOGW(TAG, "Recordings view unavailable");
+        s_view_hdl = NULL;
+        return;
+    }
+    s_view_card = card;
+}
+
+// Builds the view from the catalog and shows it to the host. Runs beside the recording, so the recording
+// starts without waiting for the cluster walk.
+static void s_view_task(void *arg)
+{
+    const int64_t start_us = esp_timer_get_time();
+    const BYTE pdrv = ff_diskio_get_pdrv_card(s_view_card);
+
+    if (pdrv != 0xFF && rec_view_build(&s_view, &s_catalog, pdrv) == 0
+            && tinyusb_msc_set_storage_mount_point(s_view_hdl, TINYUSB_MSC_STORAGE_MOUNT_USB) == ESP_OK) {
+        ESP_LOGI(TAG, "Recordings view of %u files published in %lu us", (unsigned)s_view.file_count,
+                 (unsigned long)(esp_timer_get_time() - start_us));
+    }
+    xSemaphoreGive(s_view_done);
+    vTaskDelete(NULL);
+}
+
+// Starts building the view once the recorder owns the card. The catalog must not change until s_view_wait().
+static void s_view_publish(void)
+{
+    if (s_view_hdl == NULL) {
+        return;
+    }
+    if (xTaskCreate(s_view_task, "rec_view", VIEW_TASK_STACK, NULL, VIEW_TASK_PRIO, NULL) != pdPASS) {
+        ESP_LOGW(TAG, "Recordings view task failed to start");
+        xSemaphoreGive(s_view_done);
+    }
+}
+
+// Waits until the view task is done with the catalog.
+static void s_view_wait(void)
+{
+    if (s_view_hdl != NULL) {
+        xSemaphoreTake(s_view_done, portMAX_DELAY);
+    }
+}
+
+// Hides the view before the host gets the card itself back; its sectors would go stale under host writes.
+static void s_view_hide(void)
+{
+    if (s_view_hdl != NULL) {
+        tinyusb_msc_set_storage_mount_point(s_view_hdl, TINYUSB_MSC_STORAGE_MOUNT_APP);
+    }
+}
+#endif
+
+#if CONFIG_EXAMPLE_USB_MTP
+// Logs the object transfers served over MTP, in the same terms as the MSC I/O line.
+static void s_log_mtp_stats(void)
+{
+    tinyusb_mtp_stats_t io;
+    if (tinyusb_mtp_get_stats(&io) != ESP_OK || io.sent_bytes == 0) {
+        return;
+    }
+    const uint32_t kbps = tinyusb_rate_kbps(io.sent_bytes, io.active_us);
+    ESP_LOGI(TAG, "MTP I/O: sent %llu KB at %lu KB/s, %lu objects, %lu partial, card reads %llu ms, %lu waits, %lu errors",
+             (unsigned long long)(io.sent_bytes / 1024), (unsigned long)kbps, (unsigned long)io.objects,
+             (unsigned long)io.partial_objects, (unsigned long long)(io.read_us / 1000), (unsigned long)io.waits,
+             (unsigned long)io.errors);
+}
+
+// Lists the finished recordings and starts the MTP responder. Must run before the TinyUSB driver is installed.
+static void s_mtp_init(sdmmc_card_t *card)
+{
+    const BYTE pdrv = ff_diskio_get_pdrv_card(card);
+    if (pdrv == 0xFF || rec_mtp_init(&s_mtp, pdrv) != 0) {
+        ESP_LOGE(TAG, "MTP storage unavailable");
+        return;
+    }
+    rec_mtp_build(&s_mtp, &s_catalog);
+#if CONFIG_EXAMPLE_USB_BENCH_FILE_MB > 0
+    rec_mtp_add_file(&s_mtp, "", BENCH_FILE_NAME, time(NULL), NULL);
+#endif
+    tinyusb_mtp_config_t mtp_cfg = {
+        .description = "Recordings",
+        .manufacturer = string_desc_arr[1],
+        .model = string_desc_arr[2],
+        .serial = string_desc_arr[3],
+    };
+    rec_mtp_config(&s_mtp, &mtp_cfg);
+    if (tinyusb_mtp_init(&mtp_cfg) != ESP_OK) {
+        ESP_LOGE(TAG, "MTP responder failed to start");
+        rec_mtp_deinit(&s_mtp);
+        return;
+    }
+    s_mtp_ready = true;
+}
+
+// Lists a finished recording and tells the host about each of its files.
+static void s_mtp_publish(const rec_catalog_entry_t *entry)
+{
+    uint32_t first = 0;
+    uint32_t count = 0;
+    if (!s_mtp_ready || rec_mtp_add_recording(&s_mtp, entry, &first, &count) != 0) {
+        return;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (tinyusb_mtp_object_added(first + i) != ESP_OK) {
+            ESP_LOGW(TAG, "ObjectAdded event for %s not sent", entry->name);
+        }
+    }
+}
+#endif
+
+// Starts the TinyUSB driver if not already running.
 static esp_err_t s_usb_start(void)
 {
     if (s_usb_active) {
@@ -273,11 +528,12 @@ static esp_err_t s_usb_start(void)
     esp_err_t ret = tinyusb_driver_install(&s_tusb_cfg);
     if (ret == ESP_OK) {
         s_usb_active = true;
-        ESP_LOGI(TAG, "USB MSC ready");
+        ESP_LOGI(TAG, "USB " USB_CLASS_NAME " ready");
     }
     return ret;
 }
 
+#if !CONFIG_EXAMPLE_USB_KEEP_ENUMERATED
 // Stops the TinyUSB MSC driver if running.
 static void s_usb_stop(void)
 {
@@ -292,6 +548,76 @@ static void s_usb_stop(void)
     s_usb_active = false;
     ESP_LOGI(TAG, "USB MSC stopped");
 }
+#endif
+
+#if CONFIG_EXAMPLE_USB_BENCH_FILE_MB > 0
+// Creates the USB throughput test file, unless one of the right size is already there.
+static void s_bench_file(void)
+{
+    const char *path = MOUNT_POINT "/" BENCH_FILE_NAME;
+    const uint32_t blocks = (uint32_t)CONFIG_EXAMPLE_USB_BENCH_FILE_MB * (1024 * 1024 / BENCH_BLOCK_SIZE);
+    struct stat st;
+    if (stat(path, &st) == 0 && (uint64_t)st.st_size == (uint64_t)blocks * BENCH_BLOCK_SIZE) {
+        return;
+    }
+
+    uint32_t *block = malloc(BENCH_BLOCK_SIZE);
+    FILE *f = fopen(path, "wb");
+    if (block == NULL || f == NULL) {
+        ESP_LOGE(TAG, "Failed to create %s", path);
+        free(block);
+        if (f != NULL) {
+            fclose(f);
+        }
+        return;
+    }
+    ESP_LOGI(TAG, "Creating %s of %d MB", path, CONFIG_EXAMPLE_USB_BENCH_FILE_MB);
+    const int64_t start_us = esp_timer_get_time();
+    bool ok = true;
+    for (uint32_t b = 0; b < blocks && ok; b++) {
+        // Each word holds its own offset, so a copy that drops or repeats a block does not compare equal
+        for (uint32_t i = 0; i < BENCH_BLOCK_SIZE / sizeof(uint32_t); i++) {
+            block[i] = b * BENCH_BLOCK_SIZE + i * sizeof(uint32_t);
+        }
+        ok = fwrite(block, 1, BENCH_BLOCK_SIZE, f) == BENCH_BLOCK_SIZE;
+    }
+    ok = (fclose(f) == 0) && ok;
+    free(block);
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to write %s", path);
+        remove(path);
+        return;
+    }
+    ESP_LOGI(TAG, "Created %s in %llu ms", path, (unsigned long long)((esp_timer_get_time() - start_us) / 1000));
+}
+#endif
+
+#if CONFIG_EXAMPLE_DIR_BENCHMARK
+// Logs file-create latency in a flat directory against the sharded recording layout.
+static void s_dir_benchmark(void)
+{
+    rec_catalog_bench_t points[REC_CATALOG_BENCH_POINTS] = {0};
+    ESP_LOGI(TAG, "Directory benchmark running, this takes a few minutes");
+    if (rec_catalog_bench(MOUNT_POINT, points) != 0) {
+        ESP_LOGE(TAG, "Directory benchmark failed");
+    }
+    for (int i = 0; i < REC_CATALOG_BENCH_POINTS; i++) {
+        ESP_LOGI(TAG, "%5lu files: create %lu us flat, %lu us sharded", (unsigned long)points[i].files,
+                 (unsigned long)points[i].flat_us, (unsigned long)points[i].sharded_us);
+    }
+}
+#endif
+
+#if CONFIG_MIC_LEVEL_METER
+// Display meter source: the gain stage level published by the capture task.
+static void s_meter_read(uint16_t *peak, uint16_t *rms)
+{
+    mic_capture_level_t level;
+    mic_capture_get_level(&level);
+    *peak = level.peak;
+    *rms = level.rms;
+}
+#endif
 
 // Initializes peripherals and handles record/USB switching loop.
 void app_main(void)
@@ -299,10 +625,18 @@ void app_main(void)
     esp_err_t ret;
 
     ESP_LOGI(TAG, "Initializing SD card");
-    if (oled_ssd1306_init() != ESP_OK) {
-        ESP_LOGE(TAG, "OLED init failed");
+    // The display service brings up the OLED on its own task, so a missing panel does not hold up boot
+    if (oled_display_start() != ESP_OK) {
+        ESP_LOGE(TAG, "Display service failed to start");
     }
+#if CONFIG_MIC_LEVEL_METER
+    oled_display_set_meter(s_meter_read);
+#endif
     button_init();
+    // Start capturing right away so the first recording already has pre-roll.
+    if (mic_capture_start() != ESP_OK) {
+        ESP_LOGE(TAG, "Mic capture service failed to start");
+    }
 
     sdmmc_card_t *card = NULL;
     ret = s_storage_init_sdmmc(&card);
@@ -312,7 +646,7 @@ void app_main(void)
     }
 
     tinyusb_msc_storage_config_t storage_cfg = {
-        .mount_point = TINYUSB_MSC_STORAGE_MOUNT_USB,
+        .mount_point = TINYUSB_MSC_STORAGE_MOUNT_APP,
         .fat_fs = {
             .base_path = MOUNT_POINT,
             .config.max_files = 5,
@@ -322,40 +656,123 @@ void app_main(void)
     };
 
     ESP_ERROR_CHECK(tinyusb_msc_new_storage_sdmmc(&storage_cfg, &s_storage_hdl));
+#if CONFIG_EXAMPLE_USB_RECORDINGS_VIEW
+    s_view_init(card);
+#endif
+
+#if CONFIG_EXAMPLE_DIR_BENCHMARK
+    s_dir_benchmark();
+#endif
+    // The catalog hands out the next free name without scanning the card.
+    if (rec_catalog_open(&s_catalog, MOUNT_POINT) != 0) {
+        ESP_LOGW(TAG, "Recording catalog unavailable, names continue from mic_%04lu",
+                 (unsigned long)s_catalog.next_index);
+    }
+    ESP_LOGI(TAG, "%u recordings in the catalog", (unsigned)rec_catalog_count(&s_catalog));
+
+    // Repair recordings cut short by a power loss before the host gets to see them. Only the newest recording
+    // can have been left open, so besides the root (older cards) only its directory is scanned.
+    int recovered = wav_writer_recover_dir(MOUNT_POINT) + flac_writer_recover_dir(MOUNT_POINT);
+    if (s_catalog.cur_dir[0] != '\0') {
+        char shard[EXAMPLE_MAX_CHAR_SIZE];
+        snprintf(shard, sizeof(shard), MOUNT_POINT"/%s", s_catalog.cur_dir);
+        recovered += wav_writer_recover_dir(shard) + flac_writer_recover_dir(shard);
+    }
+    if (recovered > 0) {
+        ESP_LOGW(TAG, "Recovered %d interrupted recording(s)", recovered);
+    }
+
+#if CONFIG_EXAMPLE_USB_BENCH_FILE_MB > 0
+    s_bench_file();
+#endif
 
     s_tusb_cfg = (tinyusb_config_t)TINYUSB_DEFAULT_CONFIG();
     s_tusb_cfg.descriptor.device = &descriptor_config;
-    s_tusb_cfg.descriptor.full_speed_config = msc_fs_configuration_desc;
+    s_tusb_cfg.descriptor.full_speed_config = usb_fs_configuration_desc;
     s_tusb_cfg.descriptor.string = string_desc_arr;
     s_tusb_cfg.descriptor.string_count = sizeof(string_desc_arr) / sizeof(string_desc_arr[0]);
 #if (TUD_OPT_HIGH_SPEED)
-    s_tusb_cfg.descriptor.high_speed_config = msc_hs_configuration_desc;
+    s_tusb_cfg.descriptor.high_speed_config = usb_hs_configuration_desc;
     s_tusb_cfg.descriptor.qualifier = &device_qualifier;
 #endif
 
+#if CONFIG_EXAMPLE_USB_MTP
+    // MTP serves files, so the card stays mounted for the recorder and is never handed to the host
+    s_mtp_init(card);
+    ESP_ERROR_CHECK(s_usb_start());
+    ESP_LOGI(TAG, "Serving recordings over MTP");
+#else
     ESP_ERROR_CHECK(s_usb_start());
     ESP_LOGI(TAG, "Exposing SD card over USB");
     ESP_ERROR_CHECK(s_switch_mount(TINYUSB_MSC_STORAGE_MOUNT_USB));
+#endif
 
-    uint32_t file_index = 1;
     while (true) {
-        while (!button_is_recording()) {
-            vTaskDelay(pdMS_TO_TICKS(50));
-        }
-
-        ESP_LOGI(TAG, "Disabling USB and mounting SD card for recording");
+        button_wait_recording(portMAX_DELAY);
+
+#if CONFIG_EXAMPLE_USB_MTP
+        s_log_mtp_stats();
+#else
+        ESP_LOGI(TAG, "Mounting SD card for recording");
+        int64_t switch_start = esp_timer_get_time();
+#if !CONFIG_EXAMPLE_USB_KEEP_ENUMERATED
         s_usb_stop();
+#endif
         ret = s_switch_mount(TINYUSB_MSC_STORAGE_MOUNT_APP);
+        s_log_switch_time("app", switch_start);
         if (ret != ESP_OK) {
             ESP_LOGE(TAG, "Failed to mount to app (%s)", esp_err_to_name(ret));
             vTaskDelay(pdMS_TO_TICKS(1000));
             continue;
         }
+        s_log_msc_stats();
+        // The host may have changed the card while it was exposed over USB.
+        rec_catalog_reload(&s_catalog);
+#endif
 
+        // Logged as open before any audio is written, so a power loss cannot hand the name out twice.
+        rec_catalog_entry_t entry;
+        if (rec_catalog_begin(&s_catalog, MIC_CONTAINER, CONFIG_MIC_SAMPLE_RATE_HZ, time(NULL), &entry) != 0) {
+            ESP_LOGW(TAG, "Catalog update failed for %s", entry.name);
+        }
         char mic_path[EXAMPLE_MAX_CHAR_SIZE];
-        snprintf(mic_path, sizeof(mic_path), MOUNT_POINT"/mic_%04u.wav", (unsigned)file_index);
+        rec_catalog_path(&s_catalog, &entry, mic_path, sizeof(mic_path));
+#if CONFIG_EXAMPLE_USB_RECORDINGS_VIEW
+        s_view_publish();
+#endif
         int captured_seconds = 0;
         ret = mic_capture_to_file(mic_path, 0, &captured_seconds);
+#if CONFIG_EXAMPLE_USB_RECORDINGS_VIEW
+        s_view_wait();
+#endif
+
+        entry.state = (ret == ESP_OK) ? REC_CATALOG_DONE : REC_CATALOG_FAILED;
+        entry.seconds = (uint32_t)captured_seconds;
+        // Without a file there is nothing to describe, and the entry keeps what rec_catalog_begin() set
+        mic_capture_stats_t stats;
+        if (mic_capture_get_stats(&stats) == ESP_OK) {
+            entry.sample_rate_hz = stats.sample_rate_hz;
+            entry.bytes = stats.output_bytes;
+            entry.segments = (uint16_t)stats.segments;
+        }
+        oled_ssd1306_stats_t oled;
+        oled_display_stats_t display;
+        oled_ssd1306_get_stats(&oled);
+        oled_display_get_stats(&display);
+        ESP_LOGI(TAG, "Display: %lu I2C writes, %llu bytes, %lu errors since boot", (unsigned long)oled.transactions,
+                 (unsigned long long)oled.bytes, (unsigned long)oled.errors);
+        ESP_LOGI(TAG, "Display posts: %lu drawn, %lu replaced, %lu dropped of %lu, slowest post %lu us, slowest render %lu us",
+                 (unsigned long)display.drawn, (unsigned long)display.replaced, (unsigned long)display.dropped,
+                 (unsigned long)display.posted, (unsigned long)display.post_max_us, (unsigned long)display.render_max_us);
+        button_stats_t button;
+        button_get_stats(&button);
+        ESP_LOGI(TAG, "Button: %lu short, %lu long, %lu double, %lu glitches, %lu dropped; event to action max %lu us, "
+                 "app wake max %lu us", (unsigned long)button.shorts, (unsigned long)button.longs,
+                 (unsigned long)button.doubles, (unsigned long)button.glitches, (unsigned long)button.dropped,
+                 (unsigned long)button.action_max_us, (unsigned long)button.wake_max_us);
+        if (rec_catalog_finish(&s_catalog, &entry) != 0) {
+            ESP_LOGW(TAG, "Catalog update failed for %s", entry.name);
+        }
         if (ret != ESP_OK) {
             ESP_LOGE(TAG, "Mic capture failed");
         } else {
@@ -368,11 +785,23 @@ void app_main(void)
             }
             snprintf(line1, sizeof(line1), "Recorded %ds at", captured_seconds);
             button_set_idle_display(line1, filename);
-            file_index++;
         }
 
+#if CONFIG_EXAMPLE_USB_MTP
+        if (ret == ESP_OK) {
+            s_mtp_publish(&entry);
+        }
+#else
         ESP_LOGI(TAG, "Exposing SD card over USB");
+#if CONFIG_EXAMPLE_USB_RECORDINGS_VIEW
+        s_view_hide();
+#endif
+        switch_start = esp_timer_get_time();
         ESP_ERROR_CHECK(s_switch_mount(TINYUSB_MSC_STORAGE_MOUNT_USB));
+#if !CONFIG_EXAMPLE_USB_KEEP_ENUMERATED
         ESP_ERROR_CHECK(s_usb_start());
+#endif
+        s_log_switch_time("USB", switch_start);
+#endif
     }
 }
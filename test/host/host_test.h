@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Minimal checks shared by the host tests under components/*/test/host: report the failing line and exit non-zero
+// so ctest marks the test failed. stubs/ next to this file holds the ESP-IDF stand-ins more than one component
+// needs; each test keeps its own stubs/ for the rest.
+
+#define TEST_CHECK(cond)                                                                    \
+    do {                                                                                    \
+        if (!(cond)) {                                                                      \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);        \
+            exit(1);                                                                        \
+        }                                                                                   \
+    } while (0)
+
+// Creates a scratch directory under $TMPDIR (or /tmp) standing in for the card. path holds at least 64 bytes.
+static inline void host_test_tmpdir(char *path, size_t size, const char *name)
+{
+    const char *base = getenv("TMPDIR");
+    snprintf(path, size, "%s/%s_XXXXXX", (base != NULL) ? base : "/tmp", name);
+    TEST_CHECK(mkdtemp(path) != NULL);
+}
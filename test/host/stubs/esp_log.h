@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdio.h>
+
+// Host stand-in for esp_log: warnings and errors go to stderr, the rest is dropped.
+
+#define ESP_LOGE(tag, fmt, ...) fprintf(stderr, "E %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) fprintf(stderr, "W %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) do { (void)(tag); } while (0)
+#define ESP_LOGD(tag, fmt, ...) do { (void)(tag); } while (0)